@@ -0,0 +1,711 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Times spmn end to end on synthetic mirrors: every case is run as a
+ * fresh process, the way a user runs it, with the page cache either warm
+ * or emptied of the cache directory before every run. Results go to a
+ * JSON lines file, one object per corpus, case and cache state.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "def.h"
+#include "corpus.h"
+
+#define MAX_CASE_ARGS 16
+#define HEAVY_RUNS_DIV 10
+#define MIN_HEAVY_RUNS 3
+#define SERVER_WAIT_MS 10000
+#define CACHE_SUBDIR "/home/.cache/spmn"
+#define HIDDEN_SUFFIX ".off"
+
+struct bench_opts {
+    const char *spmn;
+    const char *gen;
+    const char *out;
+    const char *workdir;
+    size_t runs;
+    bool keep;
+};
+
+struct corpus {
+    size_t tools;
+    size_t patches;
+    char label[ENTRYLEN];
+    char root[PATHBUF];
+    char home[PATHBUF];
+    char cache[PATHBUF];
+    char sites[PATHBUF];
+    char loaddir[PATHBUF];
+};
+
+struct bench_args {
+    char *argv[MAX_CASE_ARGS + 1];
+    char buf[MAX_CASE_ARGS][ENTRYLEN];
+    size_t argc;
+};
+
+struct samples {
+    uint64_t *lat_ns;
+    size_t cnt;
+    size_t failures;
+    long max_rss_kb;
+};
+
+enum case_flags {
+    CASE_IN_LOADDIR = 1 << 0,
+    CASE_NO_INDEX = 1 << 1,
+    CASE_SERVED = 1 << 2,
+    CASE_WARM_ONLY = 1 << 3,
+    CASE_HEAVY = 1 << 4,
+    /* the catalogs and description stores stay, only search indexes go */
+    CASE_NO_SEARCH_INDEX = 1 << 5,
+};
+
+typedef void (*make_args_func)(struct bench_args *args,
+                               const struct corpus *corpus, uint64_t *rng);
+
+struct bench_case {
+    const char *name;
+    make_args_func make_args;
+    unsigned flags;
+};
+
+static void add_arg(struct bench_args *args, const char *fmt, ...) {
+    va_list ap;
+
+    if (args->argc == MAX_CASE_ARGS)
+        return;
+
+    va_start(ap, fmt);
+    vsnprintf(args->buf[args->argc], ENTRYLEN, fmt, ap);
+    va_end(ap);
+
+    args->argv[args->argc] = args->buf[args->argc];
+    args->argv[++args->argc] = NULL;
+}
+
+static void add_tool_arg(struct bench_args *args, const struct corpus *corpus,
+                         size_t tool) {
+    char toolname[ENTRYLEN];
+
+    corpus_tool_name(toolname, sizeof(toolname), tool);
+    add_arg(args, "%s", toolname);
+}
+
+static void args_search(struct bench_args *args, const struct corpus *corpus,
+                        uint64_t *rng) {
+    add_arg(args, "search");
+    add_tool_arg(args, corpus, corpus_rand(rng) % corpus->tools);
+    add_arg(args, "%s", corpus_word(rng));
+    add_arg(args, "%s", corpus_word(rng));
+}
+
+static void args_ranked(struct bench_args *args, const struct corpus *corpus,
+                        uint64_t *rng) {
+    add_arg(args, "search");
+    add_arg(args, "-n");
+    add_arg(args, "10");
+    add_tool_arg(args, corpus, corpus_rand(rng) % corpus->tools);
+    add_arg(args, "%s", corpus_word(rng));
+    add_arg(args, "%s", corpus_word(rng));
+}
+
+static void args_fuzzy(struct bench_args *args, const struct corpus *corpus,
+                       uint64_t *rng) {
+    const char *word = corpus_word(rng);
+
+    add_arg(args, "search");
+    add_arg(args, "-~1");
+    add_tool_arg(args, corpus, corpus_rand(rng) % corpus->tools);
+    /* the word with its second letter dropped */
+    add_arg(args, "%.1s%s", word, word + 2);
+}
+
+static void args_all(struct bench_args *args, const struct corpus *corpus,
+                     uint64_t *rng) {
+    KINDA_USE_ARG(corpus)
+    add_arg(args, "search");
+    add_arg(args, "--all");
+    add_arg(args, "-n");
+    add_arg(args, "5");
+    add_arg(args, "%s", corpus_word(rng));
+}
+
+static void add_patch_args(struct bench_args *args,
+                           const struct corpus *corpus, uint64_t *rng,
+                           bool single_diff) {
+    size_t tool = corpus_rand(rng) % corpus->tools;
+    size_t patch = corpus_rand(rng) % corpus->patches;
+    char patchname[ENTRYLEN];
+
+    /* load would stop at the prompt on a patch with several diffs */
+    if (single_diff && corpus_diff_count(patch) > 1)
+        patch = patch ? patch - 1 : patch + 1;
+
+    corpus_patch_name(patchname, sizeof(patchname), tool, patch);
+    add_tool_arg(args, corpus, tool);
+    add_arg(args, "%s", patchname);
+}
+
+static void args_open(struct bench_args *args, const struct corpus *corpus,
+                      uint64_t *rng) {
+    add_arg(args, "open");
+    add_patch_args(args, corpus, rng, false);
+}
+
+static void args_load(struct bench_args *args, const struct corpus *corpus,
+                      uint64_t *rng) {
+    add_arg(args, "load");
+    add_patch_args(args, corpus, rng, true);
+}
+
+static void args_reindex(struct bench_args *args, const struct corpus *corpus,
+                         uint64_t *rng) {
+    KINDA_USE_2ARG(corpus, rng)
+    add_arg(args, "sync");
+    add_arg(args, "-r");
+}
+
+static const struct bench_case bench_cases[] = {
+    {"search", &args_search, 0},
+    {"search-ranked", &args_ranked, 0},
+    {"search-fuzzy", &args_fuzzy, 0},
+    {"search-all", &args_all, 0},
+    {"search-scan", &args_search, CASE_NO_INDEX},
+    {"search-store", &args_search, CASE_NO_SEARCH_INDEX},
+    {"search-served", &args_search, CASE_SERVED | CASE_WARM_ONLY},
+    {"open", &args_open, 0},
+    {"load", &args_load, CASE_IN_LOADDIR},
+    {"sync-reindex", &args_reindex, CASE_HEAVY},
+};
+
+#define BENCH_CASE_CNT (sizeof(bench_cases) / sizeof(*bench_cases))
+
+static int remove_cb(const char *fpath, const struct stat *sb, int typeflag,
+                     struct FTW *ftwbuf) {
+    KINDA_USE_3ARG(sb, typeflag, ftwbuf)
+    remove(fpath);
+    return OK;
+}
+
+static void remove_tree(const char *path) {
+    nftw(path, remove_cb, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/*
+ * Dropping the cache directory's pages works without root, unlike
+ * drop_caches, but leaves the dentry and inode caches warm.
+ */
+static int evict_cb(const char *fpath, const struct stat *sb, int typeflag,
+                    struct FTW *ftwbuf) {
+    int fd;
+
+    KINDA_USE_2ARG(sb, ftwbuf)
+
+    if (typeflag != FTW_F)
+        return OK;
+
+    if ((fd = open(fpath, O_RDONLY | O_NOATIME)) < 0 &&
+        (fd = open(fpath, O_RDONLY)) < 0)
+        return OK;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return OK;
+}
+
+static void evict_cache(const struct corpus *corpus) {
+    nftw(corpus->cache, evict_cb, 64, FTW_PHYS);
+}
+
+static void empty_dir(const char *path) {
+    remove_tree(path);
+    mkdir(path, 0755);
+}
+
+static void exec_quiet(const char *home, const char *cwd, char *const *argv,
+                       bool keep_stderr) {
+    int nullfd = open(DEVNULL, O_RDWR);
+
+    if (setenv("HOME", home, 1) || (cwd && chdir(cwd)) || nullfd < 0)
+        _exit(ERR_SYS);
+
+    dup2(nullfd, STDIN_FILENO);
+    dup2(nullfd, STDOUT_FILENO);
+    if (!keep_stderr)
+        dup2(nullfd, STDERR_FILENO);
+
+    execvp(argv[0], argv);
+    _exit(ERR_SYS);
+}
+
+static result run_setup(const char *home, char *const *argv) {
+    int status;
+    pid_t pid;
+
+    UNWRAP_NEG(pid = fork())
+
+    if (pid == 0)
+        exec_quiet(home, NULL, argv, true);
+
+    UNWRAP_NEG(waitpid(pid, &status, 0))
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "bench: '%s' failed\n", argv[0]);
+        FAIL()
+    }
+    RET_OK()
+}
+
+static result run_measured(const struct bench_opts *opts,
+                           const struct corpus *corpus,
+                           struct bench_args *args, unsigned flags,
+                           struct samples *samples) {
+    struct timespec start, end;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    args->argv[0] = (char *)opts->spmn;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    UNWRAP_NEG(pid = fork())
+
+    if (pid == 0) {
+        exec_quiet(corpus->home,
+                   flags & CASE_IN_LOADDIR ? corpus->loaddir : NULL,
+                   args->argv, false);
+    }
+
+    UNWRAP_NEG(wait4(pid, &status, 0, &usage))
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!samples)
+        RET_OK()
+
+    samples->lat_ns[samples->cnt++] =
+        (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+        (uint64_t)(end.tv_nsec - start.tv_nsec);
+
+    if (usage.ru_maxrss > samples->max_rss_kb)
+        samples->max_rss_kb = usage.ru_maxrss;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        samples->failures++;
+
+    RET_OK()
+}
+
+/* snprintf for paths: one that does not fit fails with ENAMETOOLONG */
+static result format_path(char *buf, size_t size, const char *fmt, ...) {
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+
+    if (len < 0 || (size_t)len >= size) {
+        errno = ENAMETOOLONG;
+        ERROR(ERR_SYS)
+    }
+
+    RET_OK()
+}
+
+static result start_server(const struct bench_opts *opts,
+                           const struct corpus *corpus, pid_t *server) {
+    char *argv[] = {(char *)opts->spmn, "serve", "-f", NULL};
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    struct timespec pause = {0, 1000000};
+
+    UNWRAP(format_path(addr.sun_path, sizeof(addr.sun_path), "%s/%s",
+                       corpus->cache, SERVE_SOCKET))
+
+    UNWRAP_NEG(*server = fork())
+
+    if (*server == 0)
+        exec_quiet(corpus->home, NULL, argv, true);
+
+    for (int waited = 0; waited < SERVER_WAIT_MS; waited++) {
+        int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (sockfd < 0)
+            break;
+
+        if (IS_OK(connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)))) {
+            close(sockfd);
+            RET_OK()
+        }
+
+        close(sockfd);
+        nanosleep(&pause, NULL);
+    }
+
+    kill(*server, SIGTERM);
+    waitpid(*server, NULL, 0);
+    fprintf(stderr, "bench: spmn serve did not come up\n");
+    FAIL()
+}
+
+static void stop_server(pid_t server) {
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+}
+
+static int cmp_lat(const void *a, const void *b) {
+    uint64_t la = *(const uint64_t *)a, lb = *(const uint64_t *)b;
+
+    return (la > lb) - (la < lb);
+}
+
+/* nearest rank */
+static double percentile_us(const struct samples *samples, size_t pct) {
+    size_t rank = (samples->cnt * pct + 99) / 100;
+
+    return samples->lat_ns[rank ? rank - 1 : 0] / 1000.0;
+}
+
+static void report(FILE *out, const struct corpus *corpus,
+                   const struct bench_case *bcase, const char *cache,
+                   struct samples *samples) {
+    double p50, p99;
+
+    qsort(samples->lat_ns, samples->cnt, sizeof(*samples->lat_ns), cmp_lat);
+    p50 = percentile_us(samples, 50);
+    p99 = percentile_us(samples, 99);
+
+    fprintf(out,
+            "{\"corpus\":\"%s\",\"tools\":%zu,\"patches\":%zu,"
+            "\"case\":\"%s\",\"cache\":\"%s\",\"runs\":%zu,"
+            "\"failures\":%zu,\"p50_us\":%.1f,\"p99_us\":%.1f,"
+            "\"max_rss_kb\":%ld}\n",
+            corpus->label, corpus->tools, corpus->patches, bcase->name, cache,
+            samples->cnt, samples->failures, p50, p99, samples->max_rss_kb);
+
+    printf("%-10s %-14s %-5s %6zu %10.1f %10.1f %10ld%s\n", corpus->label,
+           bcase->name, cache, samples->cnt, p50, p99, samples->max_rss_kb,
+           samples->failures ? "  (failures)" : "");
+}
+
+/* argv[0] is left for the spmn path */
+static void next_args(struct bench_args *args, const struct bench_case *bcase,
+                      const struct corpus *corpus, uint64_t *rng) {
+    memset(args, 0, sizeof(*args));
+    args->argc = 1;
+    bcase->make_args(args, corpus, rng);
+}
+
+static result run_case_state(const struct bench_opts *opts,
+                             const struct corpus *corpus,
+                             const struct bench_case *bcase, bool cold,
+                             FILE *out) {
+    struct samples samples = {0};
+    struct bench_args args = {0};
+    uint64_t rng = CORPUS_SEED;
+    size_t runs = opts->runs;
+    ZIC_RESULT_INIT()
+
+    if (bcase->flags & CASE_HEAVY) {
+        runs /= HEAVY_RUNS_DIV;
+        if (runs < MIN_HEAVY_RUNS)
+            runs = MIN_HEAVY_RUNS;
+    }
+
+    UNWRAP_PTR(samples.lat_ns = calloc(runs, sizeof(*samples.lat_ns)))
+
+    /* one unmeasured run, so warm means warm */
+    next_args(&args, bcase, corpus, &rng);
+    TRY(run_measured(opts, corpus, &args, bcase->flags, NULL),
+        DO_CLEAN_ALL())
+
+    for (size_t r = 0; r < runs; r++) {
+        next_args(&args, bcase, corpus, &rng);
+
+        if (cold)
+            evict_cache(corpus);
+
+        TRY(run_measured(opts, corpus, &args, bcase->flags, &samples),
+            DO_CLEAN_ALL())
+
+        if (bcase->flags & CASE_IN_LOADDIR)
+            empty_dir(corpus->loaddir);
+    }
+
+    report(out, corpus, bcase, cold ? "cold" : "warm", &samples);
+
+    CLEANUP_ALL(free(samples.lat_ns));
+    ZIC_RETURN_RESULT()
+}
+
+/* renames every search index of indexdir to or from its hidden name */
+static result hide_search_indexes(const char *indexdir, bool hide) {
+    const char *suffix = hide ? SEARCH_INDEX_EXT : SEARCH_INDEX_EXT HIDDEN_SUFFIX;
+    size_t suffix_len = strlen(suffix);
+    struct dirent *entry = NULL;
+    DIR *dir = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR(dir = opendir(indexdir))
+
+    while ((entry = readdir(dir))) {
+        char from[PATHBUF], to[PATHBUF];
+        size_t len = strlen(entry->d_name);
+
+        if (len <= suffix_len ||
+            strcmp(entry->d_name + len - suffix_len, suffix))
+            continue;
+
+        TRY(format_path(from, sizeof(from), "%s/%s", indexdir,
+                        entry->d_name), DO_CLEAN_ALL())
+        if (hide) {
+            TRY(format_path(to, sizeof(to), "%s%s", from, HIDDEN_SUFFIX),
+                DO_CLEAN_ALL())
+        } else {
+            memcpy(to, from, sizeof(to));
+            to[strlen(to) - (sizeof(HIDDEN_SUFFIX) - 1)] = ASCNULL;
+        }
+
+        TRY_NEG(rename(from, to), DO_CLEAN_ALL())
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(closedir(dir));
+    ZIC_RETURN_RESULT()
+}
+
+static result run_case(const struct bench_opts *opts,
+                       const struct corpus *corpus,
+                       const struct bench_case *bcase, FILE *out) {
+    char indexdir[PATHBUF], hiddendir[PATHBUF];
+    pid_t server = 0;
+    ZIC_RESULT_INIT()
+
+    UNWRAP(format_path(indexdir, sizeof(indexdir), "%s/%s", corpus->cache,
+                       INDEXDIR))
+    /* index is a link into the current snapshot, it is renamed itself */
+    indexdir[strlen(indexdir) - 1] = ASCNULL;
+    UNWRAP(format_path(hiddendir, sizeof(hiddendir), "%s/index%s",
+                       corpus->cache, HIDDEN_SUFFIX))
+
+    if (bcase->flags & CASE_NO_INDEX)
+        UNWRAP_NEG(rename(indexdir, hiddendir))
+
+    if (bcase->flags & CASE_NO_SEARCH_INDEX)
+        UNWRAP(hide_search_indexes(indexdir, true))
+
+    if (bcase->flags & CASE_SERVED)
+        TRY(start_server(opts, corpus, &server), DO_CLEAN(cl_index))
+
+    TRY(run_case_state(opts, corpus, bcase, false, out), DO_CLEAN_ALL())
+
+    if (!(bcase->flags & CASE_WARM_ONLY))
+        TRY(run_case_state(opts, corpus, bcase, true, out), DO_CLEAN_ALL())
+
+    CLEANUP_ALL(if (server) stop_server(server));
+    CLEANUP(cl_index, if (bcase->flags & CASE_NO_INDEX)
+                          rename(hiddendir, indexdir);
+                      if (bcase->flags & CASE_NO_SEARCH_INDEX)
+                          hide_search_indexes(indexdir, false));
+    ZIC_RETURN_RESULT()
+}
+
+static result make_dir(const char *path) {
+    if (mkdir(path, 0755) && errno != EEXIST)
+        ERROR(ERR_SYS)
+
+    RET_OK()
+}
+
+static result setup_corpus(const struct bench_opts *opts,
+                           struct corpus *corpus) {
+    char tools[ENTRYLEN], patches[ENTRYLEN], path[PATHBUF];
+
+    UNWRAP(format_path(corpus->root, sizeof(corpus->root), "%s/%s",
+                       opts->workdir, corpus->label))
+    UNWRAP(format_path(corpus->home, sizeof(corpus->home), "%s/home",
+                       corpus->root))
+    UNWRAP(format_path(corpus->cache, sizeof(corpus->cache), "%s%s",
+                       corpus->root, CACHE_SUBDIR))
+    UNWRAP(format_path(corpus->sites, sizeof(corpus->sites), "%s/sites/",
+                       corpus->cache))
+    UNWRAP(format_path(corpus->loaddir, sizeof(corpus->loaddir), "%s/load",
+                       corpus->root))
+    snprintf(tools, sizeof(tools), "%zu", corpus->tools);
+    snprintf(patches, sizeof(patches), "%zu", corpus->patches);
+
+    remove_tree(corpus->root);
+    UNWRAP(make_dir(corpus->root))
+    UNWRAP(make_dir(corpus->home))
+    UNWRAP(format_path(path, sizeof(path), "%s/home/.cache", corpus->root))
+    UNWRAP(make_dir(path))
+    UNWRAP(make_dir(corpus->cache))
+    UNWRAP(make_dir(corpus->sites))
+    UNWRAP(make_dir(corpus->loaddir))
+
+    {
+        char *gen[] = {(char *)opts->gen, "-t", tools, "-p", patches,
+                       corpus->sites, NULL};
+        char *init[] = {"git", "-C", corpus->sites, "init", "-q", NULL};
+        char *add[] = {"git", "-C", corpus->sites, "add", "-A", NULL};
+        char *commit[] = {"git", "-C", corpus->sites,
+                          "-c", "user.name=bench",
+                          "-c", "user.email=bench@localhost",
+                          "commit", "-q", "-m", "corpus", NULL};
+        char *index[] = {(char *)opts->spmn, "sync", "-r", NULL};
+
+        UNWRAP(run_setup(corpus->home, gen))
+        UNWRAP(run_setup(corpus->home, init))
+        UNWRAP(run_setup(corpus->home, add))
+        UNWRAP(run_setup(corpus->home, commit))
+        UNWRAP(run_setup(corpus->home, index))
+    }
+    RET_OK()
+}
+
+static result bench_corpus(const struct bench_opts *opts,
+                           struct corpus *corpus, FILE *out) {
+    ZIC_RESULT_INIT()
+
+    printf("generating %s mirror...\n", corpus->label);
+    fflush(stdout);
+    UNWRAP(setup_corpus(opts, corpus))
+
+    for (size_t c = 0; c < BENCH_CASE_CNT; c++) {
+        TRY(run_case(opts, corpus, bench_cases + c, out), DO_CLEAN_ALL())
+        fflush(out);
+    }
+
+    CLEANUP_ALL(if (!opts->keep) remove_tree(corpus->root));
+    ZIC_RETURN_RESULT()
+}
+
+static result parse_corpus(const char *arg, struct corpus *corpus) {
+    char *endp = NULL;
+
+    memset(corpus, 0, sizeof(*corpus));
+
+    corpus->tools = strtoul(arg, &endp, 10);
+    if (endp == arg || *endp != 'x' || corpus->tools == 0)
+        ERROR(ERR_INVARG)
+
+    arg = endp + 1;
+    corpus->patches = strtoul(arg, &endp, 10);
+    if (endp == arg || *endp != ASCNULL || corpus->patches == 0)
+        ERROR(ERR_INVARG)
+
+    snprintf(corpus->label, sizeof(corpus->label), "%zux%zu", corpus->tools,
+             corpus->patches);
+    RET_OK()
+}
+
+static void usage(void) {
+    fputs("usage: bench -b spmn -g gen-mirror [-r runs] [-o results.json] "
+          "[-w workdir] [-k] <tools>x<patches>...\n",
+          stderr);
+}
+
+int main(int argc, char **argv) {
+    struct bench_opts opts = {.out = "bench-results.json",
+                              .workdir = "/tmp",
+                              .runs = 50};
+    struct corpus corpus;
+    FILE *out = NULL;
+    int opt;
+    ZIC_RESULT_INIT()
+
+    while ((opt = getopt(argc, argv, "b:g:r:o:w:k")) != -1) {
+        switch (opt) {
+        case 'b':
+            opts.spmn = optarg;
+            break;
+        case 'g':
+            opts.gen = optarg;
+            break;
+        case 'r':
+            opts.runs = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            opts.out = optarg;
+            break;
+        case 'w':
+            opts.workdir = optarg;
+            break;
+        case 'k':
+            opts.keep = true;
+            break;
+        default:
+            usage();
+            return ERR_INVARG;
+        }
+    }
+
+    if (!opts.spmn || !opts.gen || !opts.runs || optind == argc) {
+        usage();
+        return ERR_INVARG;
+    }
+
+    /* children exec by path from inside the corpus directories */
+    opts.spmn = realpath(opts.spmn, NULL);
+    opts.gen = realpath(opts.gen, NULL);
+    if (!opts.spmn || !opts.gen) {
+        perror("bench");
+        return ERR_SYS;
+    }
+
+    if (!(out = fopen(opts.out, "w"))) {
+        perror(opts.out);
+        return ERR_SYS;
+    }
+
+    printf("%-10s %-14s %-5s %6s %10s %10s %10s\n", "corpus", "case", "cache",
+           "runs", "p50_us", "p99_us", "rss_kb");
+
+    for (int a = optind; a < argc; a++) {
+        if (parse_corpus(argv[a], &corpus)) {
+            usage();
+            ERROR_DO_CLEAN_ALL(ERR_INVARG)
+        }
+
+        if (bench_corpus(&opts, &corpus, out)) {
+            perror("bench");
+            FAIL_DO_CLEAN_ALL()
+        }
+    }
+
+    printf("results written to %s\n", opts.out);
+
+    CLEANUP_ALL(fclose(out));
+    ZIC_RETURN_RESULT()
+}
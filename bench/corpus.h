@@ -0,0 +1,86 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BENCH_CORPUS_DEF
+#define BENCH_CORPUS_DEF
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The synthetic mirror, shared by the generator and the harness so the
+ * harness can name tools, patches and words that exist in it.
+ *
+ * Tools 0..2 are dwm, st and surf with their own sites, the rest live
+ * under tools.suckless.org. Every fifth patch ships two diffs, like the
+ * patches kept for several releases do.
+ */
+#define CORPUS_SITE_TOOLS 3
+#define CORPUS_MULTIDIFF_EVERY 5
+#define CORPUS_SEED 0x5eed5c0ffee1ULL
+
+static const char *const corpus_site_tools[CORPUS_SITE_TOOLS] = {
+    "dwm", "st", "surf"};
+
+static const char *const corpus_words[] = {
+    "bar",      "gap",      "systray",  "tag",      "urgent",  "colors",
+    "font",     "alpha",    "key",      "mouse",    "window",  "scroll",
+    "status",   "pertag",   "border",   "layout",   "focus",   "monitor",
+    "client",   "cursor",   "title",    "fullscreen", "center", "swallow",
+    "rules",    "gaps",     "vanity",   "xresources", "keyboard", "clipboard",
+    "history",  "boxdraw",  "ligatures", "transparency", "opacity", "blur",
+    "launcher", "session",  "restart",  "autostart", "dmenu",  "prompt",
+    "password", "notify",   "fuzzy",    "match",    "highlight", "grid",
+    "tile",     "stack",    "master",   "column",   "deck",    "monocle",
+    "sticky",   "scratchpad", "hide",   "vacant",   "icons",   "preview",
+    "shortcut", "zoom",     "resize",   "move",
+};
+
+#define CORPUS_WORD_CNT (sizeof(corpus_words) / sizeof(*corpus_words))
+
+/* xorshift64*, good enough to make a corpus look irregular */
+static inline uint64_t corpus_rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/* skewed towards the first words, as real descriptions are */
+static inline const char *corpus_word(uint64_t *state) {
+    return corpus_words[corpus_rand(state) %
+                        (corpus_rand(state) % CORPUS_WORD_CNT + 1)];
+}
+
+static inline void corpus_tool_name(char *buf, size_t size, size_t tool) {
+    if (tool < CORPUS_SITE_TOOLS)
+        snprintf(buf, size, "%s", corpus_site_tools[tool]);
+    else
+        snprintf(buf, size, "tool%02zu", tool);
+}
+
+static inline void corpus_patch_name(char *buf, size_t size, size_t tool,
+                                     size_t patch) {
+    snprintf(buf, size, "%s%zu",
+             corpus_words[(tool * 31 + patch * 7) % CORPUS_WORD_CNT], patch);
+}
+
+static inline size_t corpus_diff_count(size_t patch) {
+    return patch % CORPUS_MULTIDIFF_EVERY == CORPUS_MULTIDIFF_EVERY - 1 ? 2
+                                                                        : 1;
+}
+#endif
@@ -0,0 +1,289 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Writes a suckless style mirror of N tools with M patches each:
+ * <site>/patches/<patch>/index.md and one or two .diff files per patch,
+ * sized roughly like the real ones.
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "def.h"
+#include "corpus.h"
+
+#define MIN_DIFF_SIZE 600
+#define DIFF_SIZE_STEPS 6
+#define HUNK_LINES 8
+#define HUNK_GAP 40
+
+static const char *const diff_lines[] = {
+    "\tif (!c || !c->mon)",
+    "\t\treturn;",
+    "\tfor (i = 0; i < LENGTH(tags); i++)",
+    "\tdrawbar(selmon);",
+    "\tarrange(c->mon);",
+    "static void togglebar(const Arg *arg);",
+    "\tXMoveResizeWindow(dpy, c->win, x, y, w, h);",
+    "\tc->isfloating = c->oldstate = trans != None || c->isfixed;",
+};
+
+#define DIFF_LINE_CNT (sizeof(diff_lines) / sizeof(*diff_lines))
+
+static result make_dirs(char *path) {
+    for (char *slash = strchr(path + 1, '/'); slash;
+         slash = strchr(slash + 1, '/')) {
+        *slash = ASCNULL;
+        if (mkdir(path, 0755) && errno != EEXIST) {
+            *slash = '/';
+            ERROR(ERR_SYS)
+        }
+        *slash = '/';
+    }
+
+    if (mkdir(path, 0755) && errno != EEXIST)
+        ERROR(ERR_SYS)
+
+    RET_OK()
+}
+
+/* snprintf for paths: one that does not fit fails with ENAMETOOLONG */
+static result format_path(char *buf, size_t size, const char *fmt, ...) {
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+
+    if (len < 0 || (size_t)len >= size) {
+        errno = ENAMETOOLONG;
+        ERROR(ERR_SYS)
+    }
+
+    RET_OK()
+}
+
+static void write_words(FILE *f, uint64_t *rng, size_t cnt) {
+    for (size_t w = 0; w < cnt; w++) {
+        fprintf(f, "%s%s", w ? " " : "", corpus_word(rng));
+    }
+}
+
+static result write_index_md(const char *patchdir, const char *toolname,
+                             const char *patchname, size_t diffcnt,
+                             uint64_t *rng) {
+    char path[PATHBUF];
+    size_t sentences = 2 + corpus_rand(rng) % 7;
+    FILE *md = NULL;
+
+    UNWRAP(format_path(path, sizeof(path), "%s/index.md", patchdir))
+    UNWRAP_PTR(md = fopen(path, "w"))
+
+    fprintf(md, "%s\n%.*s\n\nDescription\n-----------\n", patchname,
+            (int)strlen(patchname), "========================================");
+
+    for (size_t s = 0; s < sentences; s++) {
+        fprintf(md, "This patch ");
+        write_words(md, rng, 6 + corpus_rand(rng) % 11);
+        fprintf(md, ".\n");
+    }
+
+    fprintf(md, "\nDownload\n--------\n");
+    for (size_t d = 0; d < diffcnt; d++) {
+        fprintf(md, "* [%s-%s-6.%zu.diff](%s-%s-6.%zu.diff)\n", toolname,
+                patchname, 4 - d, toolname, patchname, 4 - d);
+    }
+
+    fprintf(md, "\nAuthors\n-------\n* Bench Author <bench@suckless.org>\n");
+
+    if (fclose(md))
+        ERROR(ERR_SYS)
+
+    RET_OK()
+}
+
+/*
+ * Hunks follow each other down the file, and their headers count the
+ * context, removed and added lines they really have, so patch(1) parses
+ * every diff even though it applies to no real source.
+ */
+static size_t write_hunk(FILE *diff, size_t *old_line, size_t *new_line,
+                         uint64_t *rng) {
+    char kinds[HUNK_LINES];
+    size_t lines[HUNK_LINES];
+    size_t old_cnt = 0, new_cnt = 0, gap = 1 + corpus_rand(rng) % HUNK_GAP;
+    size_t written;
+
+    for (size_t l = 0; l < HUNK_LINES; l++) {
+        kinds[l] = " +-"[corpus_rand(rng) % 3];
+        lines[l] = corpus_rand(rng) % DIFF_LINE_CNT;
+        old_cnt += kinds[l] != '+';
+        new_cnt += kinds[l] != '-';
+    }
+
+    /* a hunk of context alone is no change, patch(1) rejects it */
+    if (old_cnt == HUNK_LINES && new_cnt == HUNK_LINES) {
+        kinds[corpus_rand(rng) % HUNK_LINES] = '+';
+        old_cnt--;
+    }
+
+    *old_line += gap;
+    *new_line += gap;
+
+    /* an empty side names the line before the hunk */
+    written = fprintf(diff, "@@ -%zu,%zu +%zu,%zu @@\n",
+                      old_cnt ? *old_line : *old_line - 1, old_cnt,
+                      new_cnt ? *new_line : *new_line - 1, new_cnt);
+
+    for (size_t l = 0; l < HUNK_LINES; l++) {
+        written += fprintf(diff, "%c%s\n", kinds[l], diff_lines[lines[l]]);
+    }
+
+    *old_line += old_cnt;
+    *new_line += new_cnt;
+    return written;
+}
+
+static result write_diff(const char *patchdir, const char *toolname,
+                         const char *patchname, size_t version,
+                         uint64_t *rng) {
+    char path[PATHBUF];
+    size_t size = MIN_DIFF_SIZE << (corpus_rand(rng) % DIFF_SIZE_STEPS);
+    size_t written = 0, old_line = 0, new_line = 0;
+    FILE *diff = NULL;
+
+    size += corpus_rand(rng) % MIN_DIFF_SIZE;
+
+    UNWRAP(format_path(path, sizeof(path), "%s/%s-%s-6.%zu.diff", patchdir,
+                       toolname, patchname, version))
+    UNWRAP_PTR(diff = fopen(path, "w"))
+
+    written += fprintf(diff, "diff --git a/%s.c b/%s.c\n--- a/%s.c\n"
+                             "+++ b/%s.c\n", toolname, toolname, toolname,
+                       toolname);
+
+    while (written < size) {
+        written += write_hunk(diff, &old_line, &new_line, rng);
+    }
+
+    if (fclose(diff))
+        ERROR(ERR_SYS)
+
+    RET_OK()
+}
+
+static result write_tool(const char *sitesdir, size_t tool, size_t patches,
+                         uint64_t *rng) {
+    char toolname[ENTRYLEN], patchname[ENTRYLEN], patchdir[PATHBUF];
+
+    corpus_tool_name(toolname, sizeof(toolname), tool);
+
+    for (size_t p = 0; p < patches; p++) {
+        size_t diffcnt = corpus_diff_count(p);
+
+        corpus_patch_name(patchname, sizeof(patchname), tool, p);
+
+        if (tool < CORPUS_SITE_TOOLS) {
+            snprintf(patchdir, sizeof(patchdir), "%s/%s%s%s", sitesdir,
+                     toolname, PATCHESDIR, patchname);
+        } else {
+            snprintf(patchdir, sizeof(patchdir), "%s/%s%s%s%s", sitesdir,
+                     TOOLSDIR, toolname, PATCHESP, patchname);
+        }
+
+        UNWRAP(make_dirs(patchdir))
+        UNWRAP(write_index_md(patchdir, toolname, patchname, diffcnt, rng))
+
+        for (size_t d = 0; d < diffcnt; d++) {
+            UNWRAP(write_diff(patchdir, toolname, patchname, 4 - d, rng))
+        }
+    }
+    RET_OK()
+}
+
+static result parse_size(const char *arg, size_t *val) {
+    char *endp = NULL;
+
+    errno = 0;
+    *val = strtoul(arg, &endp, 10);
+    if (errno || endp == arg || *endp != ASCNULL || *val == 0)
+        ERROR(ERR_INVARG)
+
+    RET_OK()
+}
+
+static void usage(void) {
+    fputs("usage: gen-mirror [-t tools] [-p patches] [-s seed] <sitesdir>\n",
+          stderr);
+}
+
+int main(int argc, char **argv) {
+    size_t tools = CORPUS_SITE_TOOLS, patches = 100, seed = 0;
+    char toolsdir[PATHBUF];
+    uint64_t rng;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:p:s:")) != -1) {
+        switch (opt) {
+        case 't':
+            if (parse_size(optarg, &tools)) {
+                usage();
+                return ERR_INVARG;
+            }
+            break;
+        case 'p':
+            if (parse_size(optarg, &patches)) {
+                usage();
+                return ERR_INVARG;
+            }
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return ERR_INVARG;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage();
+        return ERR_INVARG;
+    }
+
+    rng = CORPUS_SEED ^ (seed * 0x9e3779b97f4a7c15ULL);
+
+    /* the real mirror always has it, tool lookups expect it */
+    snprintf(toolsdir, sizeof(toolsdir), "%s/%s", argv[optind], TOOLSDIR);
+    if (make_dirs(toolsdir)) {
+        perror("gen-mirror");
+        return ERR_SYS;
+    }
+
+    for (size_t t = 0; t < tools; t++) {
+        if (write_tool(argv[optind], t, patches, &rng)) {
+            perror("gen-mirror");
+            return ERR_SYS;
+        }
+    }
+    return OK;
+}
@@ -14,8 +14,49 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 */
 
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "utils/growbuf.h"
 #include "zic.h"
 
-result do_apply(const char *diff_file);
+struct diff_score {
+    size_t hunks;
+    size_t fuzzy;
+    size_t failed;
+};
+
+/*
+ * Every file is patched in memory first. Nothing is written before all
+ * hunks of the diff have applied, so a failed apply leaves the tree
+ * as it was.
+ */
+struct apply_target {
+    char *path;
+    struct growbuf text;
+    mode_t mode;
+    bool created;
+    bool removed;
+};
+
+/*
+ * A file not patched here yet is read from base, what the earlier diffs
+ * of a stack made of it, before the current directory.
+ */
+struct apply_targets {
+    struct apply_target *targets;
+    size_t cnt;
+    size_t cap;
+    const struct apply_targets *base;
+};
+
+void free_apply_targets(struct apply_targets *targets);
+
+result do_apply(const char *const *diff_files, size_t diff_cnt, bool dry_run);
+
+result score_diff(const char *diff_file, const struct apply_targets *stack,
+                  struct diff_score *score);
+
+result stack_diff(const char *diff_file, struct apply_targets *stack);
 
 int parse_apply_args(int argc, char **argv, const char *basecacherepo);
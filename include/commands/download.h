@@ -15,12 +15,19 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "zic.h"
 
 struct load_args {
 	bool apply;
+	bool dry_run;
+	bool assume_yes;
 };
 
+result loadp_stack(const char *toolname, const char *const *patchnames,
+                   size_t patch_cnt, const char *basecacherepo,
+                   struct load_args flags);
+
 result loadp(const char *toolname, const char *patchname,
              const char *basecacherepo, struct load_args flags);
 
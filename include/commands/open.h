@@ -14,8 +14,13 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 */
 
 
+#include <stdio.h>
 #include "zic.h"
 
 result openp(void);
 
+FILE *open_pager(void);
+
+void close_pager(FILE *pager);
+
 int parse_open_args(int argc, char **argv, const char *basecacherepo);
@@ -21,7 +21,8 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 
 #include "commands/search.h"
 
-int run_search(char *patchdir, searchsyms *searchsyms);
+int run_search(const char *basecacherepo, const char *toolname,
+               char *patchdir, searchsyms *searchsyms);
 
 int parse_search_args(int argc, char **argv, const char *basecacherepo);
 #endif
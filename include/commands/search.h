@@ -18,34 +18,118 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #define SEARCH_COMMAND_DEF
 
 #include <pthread.h>
+#include <stdio.h>
 #include "def.h"
 #include "stdbool.h"
+#include "utils/catalog.h"
+#include "utils/descstore.h"
+#include "utils/fuzzy.h"
+#include "utils/growbuf.h"
+#include "utils/matcher.h"
+
+#define SEARCH_OUTBUF (64 * 1024)
 
 struct search_flags {
 	bool print_full_patch;
+    size_t jobs;
+    size_t top_k;
+    size_t max_edits;
+    bool all_tools;
+    bool batch;
 };
 
 typedef struct searchargs {
     char **words; 
     size_t wordcount;
+    struct ac_matcher matcher;
+    struct fuzzy_pattern *patterns;
 	struct search_flags s_flags;
 } searchsyms;
 
+/*
+ * Results are numbered per output stream, so shards of a --all search
+ * can be printed concurrently into their own buffers.
+ * A direct output (buf set) bypasses f: results gather in buf and go to
+ * fd, and a description that does not fit is written from its mapping.
+ */
+struct search_output {
+    FILE *f;
+    size_t matchedc;
+    int fd;
+    char *buf;
+    size_t buflen;
+};
+
+struct desc_span {
+    const char *text;
+    size_t len;
+};
+
+/*
+ * With -~ every hit is collected first and printed closest match first.
+ * A scan with -n collects its exact hits too, at distance 0, so the K
+ * printed are the first by name whatever order the workers finish in.
+ * Hits of a scan outlive the mapping of their index.md, so their text is
+ * copied into the shared arena and found by offset once the scan is done.
+ */
+struct fuzzy_hit {
+    size_t distance;
+    const char *name;
+    const char *desc;
+    size_t desclen;
+    uint32_t text_off;
+    bool copied;
+};
+
+struct fuzzy_hits {
+    struct fuzzy_hit *hits;
+    size_t cnt;
+    size_t cap;
+    struct growbuf text;
+};
+
+/*
+ * A scan reads index.md from patchdir, or from the description store
+ * when cat and store are set, every worker decoding into its own cursor.
+ */
 struct threadargs {
-    char *descfname;
     char *patchdir;
-    int descffd;
-    int outfd;
-    int startpoint;
-    int endpoint;
+    const struct patch_catalog *cat;
+    const struct desc_store *store;
+    struct desc_cursor cursor;
+    struct search_output *out;
     result result;
     pthread_mutex_t *mutex;
     searchsyms *searchargs;
+    struct fuzzy_hits *fuzzy_hits;
 };
 
 typedef struct threadargs lookupthread_args;
 
-void *search_entry(void *thread_args);
+void find_description(const char *md, size_t mdlen, struct desc_span *desc);
+
+result open_direct_output(struct search_output *out, int fd);
+
+result close_direct_output(struct search_output *out);
+
+result print_matched_desc(struct search_output *out, const char *entryname,
+                          const char *desc, size_t desclen,
+                          bool print_full_patch_description);
+
+bool fuzzy_match(const searchsyms *sargs, const char *name, size_t namelen,
+                 const char *desc, size_t desclen, size_t *distance);
+
+result add_fuzzy_hit(struct fuzzy_hits *hits, const struct fuzzy_hit *hit);
+
+result print_fuzzy_hits(struct search_output *out, struct fuzzy_hits *hits,
+                        const searchsyms *sargs);
+
+void free_fuzzy_hits(struct fuzzy_hits *hits);
+
+result search_patch_text(lookupthread_args *args, const char *patchname,
+                         const char *md, size_t mdlen);
+
+void search_entry(void *patchname, void *thread_args, size_t worker_id);
 
-result lookup_entries(const lookupthread_args *args);
+void search_store_block(void *block, void *thread_args, size_t worker_id);
 #endif
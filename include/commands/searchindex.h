@@ -0,0 +1,143 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SEARCH_INDEX_DEF
+#define SEARCH_INDEX_DEF
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "commands/search.h"
+#include "commands/sync.h"
+#include "def.h"
+
+#define SIDX_MAGIC "SPMNSIDX"
+#define SIDX_MAGIC_LEN 8
+#define SIDX_VERSION 3
+
+DEFINE_ERROR(ERR_INDEX_STALE, 17)
+
+/*
+ * On-disk layout: header, then sections addressed by the header's
+ * offset table. The checksum covers everything after the header.
+ */
+enum sidx_section {
+    SIDX_DOCS = 0,
+    SIDX_TERMS = 1,
+    SIDX_POSTINGS = 2,
+    SIDX_STRINGS = 3,
+    SIDX_TERM_FREQS = 4,
+    SIDX_TRIGRAMS = 5,
+    SIDX_TRIGRAM_POSTINGS = 6,
+    SIDX_SEC_CNT
+};
+
+struct sidx_section_ref {
+    uint32_t off;
+    uint32_t len;
+};
+
+struct sidx_header {
+    char magic[SIDX_MAGIC_LEN];
+    uint32_t version;
+    uint32_t doc_cnt;
+    uint32_t term_cnt;
+    uint32_t token_cnt;
+    uint64_t checksum;
+    char head[GIT_HEAD_LEN];
+    struct sidx_section_ref sections[SIDX_SEC_CNT];
+};
+
+struct sidx_doc {
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t desc_off;
+    uint32_t desc_len;
+    uint32_t token_cnt;
+};
+
+struct sidx_term {
+    uint32_t str_off;
+    uint32_t str_len;
+    uint32_t post_off;
+    uint32_t post_cnt;
+};
+
+/*
+ * Every three-byte window of a name or description without whitespace in
+ * it, packed as (b0 << 16 | b1 << 8 | b2), sorted by key.
+ */
+struct sidx_trigram {
+    uint32_t key;
+    uint32_t post_off;
+    uint32_t post_cnt;
+};
+
+#define TRIGRAM_LEN 3
+
+/*
+ * Postings carry the term frequency of every document for BM25.
+ * Name tokens are counted NAME_TERM_WEIGHT times, so a keyword found in
+ * the patch name outranks the same keyword in a description.
+ */
+#define NAME_TERM_WEIGHT 3
+#define DESC_TERM_WEIGHT 1
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+struct search_index {
+    void *map;
+    size_t size;
+    const struct sidx_header *hdr;
+    const struct sidx_doc *docs;
+    const struct sidx_term *terms;
+    const uint32_t *postings;
+    const uint32_t *term_freqs;
+    const struct sidx_trigram *trigrams;
+    const uint32_t *trigram_postings;
+    size_t trigram_cnt;
+    const char *strings;
+    bool retained;
+};
+
+result open_search_index(struct search_index *idx, const char *basecacherepo,
+                         const char *toolname);
+
+void close_search_index(struct search_index *idx);
+
+result keep_search_indexes(const char *basecacherepo);
+
+void drop_search_indexes(void);
+
+result search_index_lookup(const struct search_index *idx,
+                           const searchsyms *sargs,
+                           struct search_output *out);
+
+result build_search_index(const char *indexpath, const char *patchdir,
+                          const char *head);
+
+result build_search_indexes(const char *basecacherepo);
+
+result update_search_indexes(const char *basecacherepo, const char *old_head,
+                             const struct mirror_changes *changes);
+
+result collect_changed_patches(struct growbuf *names,
+                               const struct mirror_changes *changes,
+                               const char *basecacherepo,
+                               const char *patchdir);
+
+void free_patchnames(struct growbuf *names);
+#endif
@@ -0,0 +1,66 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SERVE_COMMAND_DEF
+#define SERVE_COMMAND_DEF
+
+#include <stdint.h>
+#include "zic.h"
+#include "def.h"
+
+#define SERVE_MAGIC 0x4e4d5053U
+#define SERVE_MAX_ARGC 64
+#define SERVE_MAX_ARGV (MAXSEARCH_LEN * SERVE_MAX_ARGC)
+#define SERVE_BACKLOG 16
+
+/*
+ * A client connects to <cache>/spmn.sock and sends a request header with
+ * its stdin, stdout, stderr and working directory attached as
+ * SCM_RIGHTS, then argc NUL terminated arguments. The server runs the
+ * command on those descriptors and replies with the command's result.
+ */
+enum served_command {
+    SERVE_SEARCH = 0,
+    SERVE_OPEN = 1,
+    SERVE_LOAD = 2,
+    SERVE_CMD_CNT
+};
+
+enum serve_fd {
+    SERVE_FD_STDIN = 0,
+    SERVE_FD_STDOUT = 1,
+    SERVE_FD_STDERR = 2,
+    SERVE_FD_CWD = 3,
+    SERVE_FD_CNT
+};
+
+struct serve_request {
+    uint32_t magic;
+    uint32_t command;
+    uint32_t argc;
+    uint32_t argv_len;
+};
+
+struct serve_reply {
+    uint32_t magic;
+    int32_t result;
+};
+
+result ask_server(enum served_command cmd, int argc, char **argv,
+                  const char *basecacherepo, result *cmd_result);
+
+int parse_serve_args(int argc, char **argv, const char *basecacherepo);
+#endif
@@ -14,9 +14,56 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 */
 
 
+#ifndef SYNC_COMMAND_DEF
+#define SYNC_COMMAND_DEF
+
+#include <stddef.h>
 #include "zic.h"
+#include "def.h"
+
 #define SYNC_INTERVAL_D 7
+#define SECONDS_PER_DAY (24 * 60 * 60)
+
+/*
+ * A failed autosync is retried after SYNC_RETRY_BASE_S seconds, doubled
+ * with every failure in a row up to SYNC_RETRY_MAX_S.
+ */
+#define SYNC_RETRY_BASE_S (15 * 60)
+#define SYNC_RETRY_MAX_S SECONDS_PER_DAY
+
+#define MIRROR_REMOTE_ENV "SPMN_REMOTE"
+
+#define GIT_STATUS_ADDED 'A'
+#define GIT_STATUS_DELETED 'D'
+
+/*
+ * Paths changed between two mirror heads, as listed by
+ * git diff --name-status -z. Paths point into raw.
+ */
+struct mirror_change {
+    char status;
+    const char *path;
+};
+
+struct mirror_changes {
+    char *raw;
+    size_t raw_len;
+    struct mirror_change *changes;
+    size_t cnt;
+};
+
+result get_mirror_head(const char *basecacherepo, char *head);
+
+result diff_mirror(const char *basecacherepo, const char *old_head,
+                   const char *new_head, struct mirror_changes *changes);
+
+void free_mirror_changes(struct mirror_changes *changes);
+
+result run_sync(const char *basecacherepo, int *gitclone_st);
+
+int sync_repo(const char *basecacherepo);
 
-result run_sync();
+result autosync_repo(const char *basecacherepo);
 
 int parse_sync_args(int argc, char **argv, const char *basecacherepo);
+#endif
@@ -19,6 +19,7 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #define DEF_BASE
 
 #define BASEREPO "/.cache/spmn/sites/"
+#define SITE_DOMAIN ".suckless.org"
 #define PATCHESDIR ".suckless.org/patches/"
 #define PATCHESP "/patches/"
 #define DWM "dwm"
@@ -30,9 +31,22 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #define TOOLSDIR "tools.suckless.org/"
 #define INDEXMD "/index.md"
 #define DESCRIPTION_SECTION "Description"
+#define DESCRIPTION_SEPARATOR "--------------------------------------------------"
+#define GITDIR ".git/"
+#define INDEXDIR "index/"
+#define MIRRORDIR "sites/"
+#define SNAPSHOTSDIR "snapshots/"
+#define CURRENT_SNAPSHOT "current"
+#define READERS_LOCK "readers.lock"
+#define SYNC_LOCK "sync.lock"
+#define SYNC_STATE "sync.state"
+#define SEARCH_INDEX_EXT ".sidx"
+#define PATCH_CATALOG_EXT ".pcat"
+#define DESC_STORE_EXT ".pdsc"
+#define TOOL_REGISTRY "tools.reg"
+#define SERVE_SOCKET "spmn.sock"
 
 #define GREP_BIN "/bin/grep"
-#define DESCFILE "descfile.XXXXXX"
 #define RESULTCACHE "result.XXXXXX"
 #define DEVNULL "/dev/null"
 #define ASCNULL '\0'
@@ -43,14 +57,16 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 
 #define LINEBUF 4096
 #define PATHBUF LINEBUF
-#define OPTTHREAD_COUNT 4
-#define OPTWORK_AMOUNT 80
+#define GIT_HEAD_LEN 40
 #define MIN_WORKAMOUNT 40
 
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
 #define BUG_PREFIX_LEN sizeof(BUG_PREFIX)
 #define ERR_PREFIX_LEN sizeof(ERR_PREFIX)
-#define DESCFILE_LEN sizeof(DESCFILE)
 #define DESCRIPTION_SECTION_LENGTH sizeof(DESCRIPTION_SECTION)
+#define DESCRIPTION_SEPARATOR_LEN (sizeof(DESCRIPTION_SEPARATOR) - 1)
 
 #define AVSEARCH_WORD_LEN 5
 #define MAXSEARCH_LEN 512
@@ -81,6 +97,4 @@ DEFINE_ERROR(ERR_INVARG, 7)
     (void)ARG2;                                                                \
     (void)ARG3;
 
-//#define USE_MULTITHREADED
-
 #endif
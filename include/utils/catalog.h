@@ -0,0 +1,119 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CATALOG_DEF
+#define CATALOG_DEF
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "def.h"
+#include "utils/fileutils.h"
+
+#define PCAT_MAGIC "SPMNPCAT"
+#define PCAT_MAGIC_LEN 8
+#define PCAT_VERSION 1
+
+DEFINE_ERROR(ERR_NO_CATALOG, 20)
+
+/*
+ * Patch catalog of a tool, written by sync next to its search index, so
+ * load, open and apply find a patch, its diffs and its index.md without
+ * reading the mirror's directories. The index.md files themselves are in
+ * the tool's description store, under the same patch numbers.
+ *
+ * Layout: header, the patch columns, the diff columns, strings. Every
+ * column is patch_cnt or diff_cnt words. Patches are sorted by name, as
+ * are the diffs of a patch, which are contiguous.
+ *
+ * Unlike the search index there is no checksum: sync replaces the file
+ * atomically, and a lookup checks every offset it follows, so it only
+ * touches the pages it reads.
+ */
+struct pcat_header {
+    char magic[PCAT_MAGIC_LEN];
+    uint32_t version;
+    uint32_t patch_cnt;
+    uint32_t diff_cnt;
+    uint32_t strings_len;
+};
+
+enum pcat_patch_col {
+    PCAT_PATCH_NAME_OFF,
+    PCAT_PATCH_FIRST_DIFF,
+    PCAT_PATCH_DIFF_CNT,
+    PCAT_PATCH_MD_SIZE,
+    PCAT_PATCH_COLS
+};
+
+enum pcat_diff_col {
+    PCAT_DIFF_NAME_OFF,
+    PCAT_DIFF_SIZE,
+    /* target version taken from the name, a substring of it */
+    PCAT_DIFF_VERSION_OFF,
+    PCAT_DIFF_VERSION_LEN,
+    PCAT_DIFF_COLS
+};
+
+/* md size of a patch without an index.md */
+#define PCAT_NO_MD UINT32_MAX
+
+struct patch_catalog {
+    struct mapped_file map;
+    const struct pcat_header *hdr;
+    const uint32_t *patches[PCAT_PATCH_COLS];
+    const uint32_t *diffs[PCAT_DIFF_COLS];
+    const char *strings;
+};
+
+struct patch_entry {
+    const char *name;
+    uint32_t id;
+    uint32_t first_diff;
+    uint32_t diff_cnt;
+    uint32_t md_size;
+};
+
+struct diff_entry {
+    const char *name;
+    uint32_t size;
+    const char *version;
+    uint32_t version_len;
+};
+
+result open_patch_catalog(struct patch_catalog *cat, const char *basecacherepo,
+                          const char *toolname);
+
+void close_patch_catalog(struct patch_catalog *cat);
+
+result catalog_find_patch(const struct patch_catalog *cat, const char *name,
+                          struct patch_entry *patch);
+
+result catalog_patch(const struct patch_catalog *cat, uint32_t id,
+                     struct patch_entry *patch);
+
+result catalog_diff(const struct patch_catalog *cat, uint32_t diff,
+                    struct diff_entry *entry);
+
+result build_patch_catalog(const char *catpath, const char *storepath,
+                           const char *patchdir);
+
+result build_tool_catalog(const char *basecacherepo, const char *toolname,
+                          const char *patchdir);
+
+bool has_tool_catalog(const char *basecacherepo, const char *toolname);
+
+result build_patch_catalogs(const char *basecacherepo);
+#endif
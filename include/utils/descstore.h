@@ -0,0 +1,133 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DESCSTORE_DEF
+#define DESCSTORE_DEF
+
+#include <stddef.h>
+#include <stdint.h>
+#include "def.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+
+#define PDSC_MAGIC "SPMNPDSC"
+#define PDSC_MAGIC_LEN 8
+#define PDSC_VERSION 1
+
+/*
+ * Descriptions are packed whole into blocks of about PDSC_BLOCK_SIZE
+ * bytes, a larger one gets a block of its own. A block is compressed on
+ * its own, so a lookup decodes the one block its patch is in.
+ */
+#define PDSC_BLOCK_SIZE (16 * 1024)
+#define PDSC_DICT_MAX (4 * 1024)
+
+/*
+ * Description store of a tool, written by sync together with its patch
+ * catalog: the index.md of every patch, in catalog order.
+ *
+ * Layout: header, the patch columns, the block columns, the dictionary,
+ * the compressed blocks. Every block is decoded behind the dictionary,
+ * the lines most repeated across the tool's descriptions, so the
+ * boilerplate every index.md has costs a back reference even in the
+ * first bytes of a block.
+ *
+ * A block is a sequence of LZ77 tokens: a byte with the literal count
+ * in its high nibble and the match length minus PDSC_MIN_MATCH in its
+ * low one, a nibble of 15 being continued by bytes up to and including
+ * the first one below 255. The literals follow, then the match as a
+ * little-endian 16-bit distance back, unless the block ends with the
+ * literals.
+ */
+struct pdsc_header {
+    char magic[PDSC_MAGIC_LEN];
+    uint32_t version;
+    uint32_t patch_cnt;
+    uint32_t block_cnt;
+    uint32_t dict_len;
+    uint32_t data_len;
+};
+
+enum pdsc_patch_col {
+    PDSC_PATCH_BLOCK,
+    /* offset and length of the index.md in the decoded block */
+    PDSC_PATCH_OFF,
+    PDSC_PATCH_LEN,
+    PDSC_PATCH_COLS
+};
+
+enum pdsc_block_col {
+    PDSC_BLOCK_OFF,
+    PDSC_BLOCK_LEN,
+    PDSC_BLOCK_RAW_LEN,
+    /* the patches of a block are contiguous */
+    PDSC_BLOCK_FIRST_PATCH,
+    PDSC_BLOCK_PATCH_CNT,
+    PDSC_BLOCK_COLS
+};
+
+/* block of a patch without an index.md */
+#define PDSC_NO_BLOCK UINT32_MAX
+
+#define PDSC_MIN_MATCH 4
+
+struct desc_store {
+    struct mapped_file map;
+    const struct pdsc_header *hdr;
+    const uint32_t *patches[PDSC_PATCH_COLS];
+    const uint32_t *blocks[PDSC_BLOCK_COLS];
+    const unsigned char *dict;
+    const unsigned char *data;
+};
+
+/*
+ * The last block decoded, behind a copy of the dictionary. Scanning the
+ * patches in order decodes every block once.
+ */
+struct desc_cursor {
+    char *window;
+    size_t cap;
+    uint32_t block;
+};
+
+struct desc_store_builder {
+    struct growbuf raw;
+    struct growbuf offs;
+    struct growbuf lens;
+};
+
+result open_desc_store(struct desc_store *store, const char *basecacherepo,
+                       const char *toolname);
+
+void close_desc_store(struct desc_store *store);
+
+void init_desc_cursor(struct desc_cursor *cur);
+
+void free_desc_cursor(struct desc_cursor *cur);
+
+result desc_store_get(const struct desc_store *store, uint32_t patch,
+                      struct desc_cursor *cur, const char **md, size_t *mdlen);
+
+result desc_store_add_fd(struct desc_store_builder *builder, int fd,
+                         uint32_t *mdlen);
+
+result desc_store_skip(struct desc_store_builder *builder);
+
+result write_desc_store(const struct desc_store_builder *builder,
+                        const char *storepath);
+
+void free_desc_store_builder(struct desc_store_builder *builder);
+#endif
@@ -16,9 +16,21 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 
 #include "def.h"
 #include <stddef.h>
+#include "utils/catalog.h"
 
 #define HTTPS_PREF "https://"
 
+/*
+ * A patch found in its tool's catalog. The catalog stays open while the
+ * entry is in use, its strings point into the mapping.
+ */
+struct patch_location {
+    struct patch_catalog cat;
+    struct patch_entry patch;
+    char tool[ENTRYLEN];
+    char dir[PATHBUF];
+};
+
 int append_patchmd(char **buf, const char *patchdir, char *patch);
 
 int check_entrname_valid(const char *entryname, const int enamelen);
@@ -31,6 +43,11 @@ result build_patch_dir(char **pdir, const char *toolname,
                         const char *patch_name, size_t patchn_len,
                         const char *basecacherepo);
 
+result locate_patch(struct patch_location *loc, const char *toolname,
+                    const char *patch_name, const char *basecacherepo);
+
+void release_patch_location(struct patch_location *loc);
+
 result build_patch_url(char **url, const char *toolname, 
                         const char *patch_name, const char *basecacherepo);
 
@@ -0,0 +1,39 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef FILEUTILS_DEF
+#define FILEUTILS_DEF
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "def.h"
+
+struct mapped_file {
+    char *data;
+    size_t size;
+};
+
+result map_file(struct mapped_file *mfile, const char *path);
+
+void unmap_file(struct mapped_file *mfile);
+
+result write_file_atomic(const char *path, const void *data, size_t len);
+
+result write_file_atomic_mode(const char *path, const void *data, size_t len,
+                              mode_t mode);
+
+result copy_fd(int destfd, int srcfd, size_t *copied);
+#endif
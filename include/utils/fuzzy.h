@@ -0,0 +1,42 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef FUZZY_DEF
+#define FUZZY_DEF
+
+#include <stddef.h>
+#include <stdint.h>
+#include "def.h"
+
+#define FUZZY_ALPHABET 256
+#define FUZZY_MAX_PATTERN 64
+
+/*
+ * Myers' bit-parallel approximate matcher: the edit distance column of a
+ * pattern of up to FUZZY_MAX_PATTERN bytes is kept in two 64-bit vectors,
+ * so a text is scanned in one pass with a handful of word operations per byte.
+ */
+struct fuzzy_pattern {
+    uint64_t peq[FUZZY_ALPHABET];
+    const char *word;
+    size_t len;
+};
+
+void fuzzy_compile(struct fuzzy_pattern *pat, const char *word);
+
+size_t fuzzy_distance(const struct fuzzy_pattern *pat, const char *text,
+                      size_t len);
+#endif
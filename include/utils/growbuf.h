@@ -0,0 +1,43 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GROWBUF_DEF
+#define GROWBUF_DEF
+
+#include <stddef.h>
+#include <stdint.h>
+#include "def.h"
+
+/*
+ * Append-only byte buffer for building on-disk images. Offsets handed
+ * out by growbuf_append are 32-bit, so a buffer never exceeds UINT32_MAX.
+ */
+struct growbuf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+result growbuf_reserve(struct growbuf *buf, size_t extra);
+
+result growbuf_append(struct growbuf *buf, const void *data, size_t len,
+                      uint32_t *off);
+
+result growbuf_append_string(struct growbuf *strings, const char *str,
+                             size_t len, uint32_t *off);
+
+void growbuf_free(struct growbuf *buf);
+#endif
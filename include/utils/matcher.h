@@ -0,0 +1,54 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MATCHER_DEF
+#define MATCHER_DEF
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "def.h"
+
+#define MATCHER_ALPHABET 256
+#define MATCHER_ROOT 0
+
+/*
+ * Aho-Corasick automaton over all search words with a dense transition
+ * table, so a text is scanned once no matter how many words there are.
+ * Matched words are tracked in a bitmask of mask_words 64-bit words.
+ */
+struct ac_matcher {
+    uint32_t (*next)[MATCHER_ALPHABET];
+    uint64_t *outputs;
+    bool *has_output;
+    size_t state_cnt;
+    size_t word_cnt;
+    size_t mask_words;
+};
+
+result matcher_build(struct ac_matcher *matcher, char *const *words,
+                     size_t wordcount);
+
+uint64_t *matcher_alloc_mask(const struct ac_matcher *matcher);
+
+bool matcher_scan(const struct ac_matcher *matcher, const char *text,
+                  size_t len, uint64_t *matched);
+
+bool matcher_all_matched(const struct ac_matcher *matcher,
+                         const uint64_t *matched);
+
+void matcher_free(struct ac_matcher *matcher);
+#endif
@@ -19,6 +19,8 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include <stddef.h>
 #include "def.h"
 
+typedef result (*tool_iter_cb)(const char *toolname, const char *patchdir, void *ctx);
+
 result check_isdir(const struct dirent *dir);
 
 result spappend(char **bufp, const char *base, const char *append);
@@ -41,6 +43,24 @@ result get_tool_path(char **patchdir, const char *basecacherepo, const char *too
 
 result append_toolpath(char **buf, const char *basecacherepo, const char *toolname);
 
+result append_cachedir(char **buf, const char *basecacherepo);
+
+result append_indexdir(char **buf, const char *basecacherepo);
+
+result append_indexpath(char **buf, const char *basecacherepo, const char *toolname);
+
+result append_catalogpath(char **buf, const char *basecacherepo, const char *toolname);
+
+result append_descstorepath(char **buf, const char *basecacherepo, const char *toolname);
+
+result append_registrypath(char **buf, const char *basecacherepo);
+
+result append_socketpath(char **buf, const char *basecacherepo);
+
+result append_syncstatepath(char **buf, const char *basecacherepo);
+
+result iter_tools(const char *basecacherepo, tool_iter_cb iter_cb, void *ctx);
+
 result get_repocache(char **cachedirbuf);
 
 bool check_baserepo_exists(const char *baserepocache);
@@ -0,0 +1,98 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef REGISTRY_DEF
+#define REGISTRY_DEF
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "def.h"
+#include "utils/fileutils.h"
+#include "utils/pathutils.h"
+
+#define TREG_MAGIC "SPMNTREG"
+#define TREG_MAGIC_LEN 8
+#define TREG_VERSION 1
+#define TREG_MAX_DISPLACEMENT (1U << 20)
+
+/*
+ * Tool registry written by sync: every tool name and alias is a key of a
+ * minimal perfect hash (hash and displace), so resolving a tool touches
+ * one mapped file and no directories.
+ *
+ * Layout: header, displacements[key_cnt], keys[key_cnt] in slot order,
+ * tools[tool_cnt], strings. A displacement d >= 0 puts the bucket's keys
+ * at treg_hash(key, d); d < 0 is a single key stored in slot -d - 1.
+ */
+struct treg_header {
+    char magic[TREG_MAGIC_LEN];
+    uint32_t version;
+    uint32_t tool_cnt;
+    uint32_t key_cnt;
+    uint32_t strings_len;
+    uint64_t checksum;
+};
+
+struct treg_key {
+    uint32_t str_off;
+    uint32_t str_len;
+    uint32_t tool;
+};
+
+struct treg_tool {
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t dir_off;
+    uint32_t dir_len;
+    uint32_t patch_cnt;
+};
+
+struct tool_registry {
+    struct mapped_file map;
+    const struct treg_header *hdr;
+    const int32_t *displacements;
+    const struct treg_key *keys;
+    const struct treg_tool *tools;
+    const char *strings;
+    bool retained;
+};
+
+struct tool_entry {
+    const char *name;
+    const char *patchdir;
+    uint32_t patch_cnt;
+};
+
+result open_tool_registry(struct tool_registry *reg, const char *basecacherepo);
+
+void close_tool_registry(struct tool_registry *reg);
+
+result keep_tool_registry(const char *basecacherepo);
+
+void drop_tool_registry(void);
+
+result registry_lookup(const struct tool_registry *reg, const char *name,
+                       struct tool_entry *entry);
+
+result iter_registry_tools(const struct tool_registry *reg,
+                           const char *basecacherepo, tool_iter_cb iter_cb,
+                           void *ctx);
+
+result iter_mirror_tools(const char *basecacherepo, tool_iter_cb iter_cb,
+                         void *ctx);
+
+result build_tool_registry(const char *basecacherepo);
+#endif
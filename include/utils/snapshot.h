@@ -0,0 +1,66 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SNAPSHOT_DEF
+#define SNAPSHOT_DEF
+
+#include <stdbool.h>
+#include "def.h"
+
+DEFINE_ERROR(ERR_SYNC_BUSY, 21)
+
+/*
+ * The mirror and the indexes derived from it live together in a snapshot
+ * directory, snapshots/<id>/{sites,index}, next to the 'current' link to
+ * the published one. 'sites' and 'index' in the cache directory link
+ * through 'current', so the old paths keep working.
+ *
+ * Sync builds the next snapshot aside from hard links to the published
+ * one, under the sync lock, and publishes it by renaming a new 'current'
+ * over the old. Every other process pins the snapshot it started with by
+ * holding a shared lock on its readers lock; a snapshot is deleted once
+ * sync gets that lock exclusively.
+ */
+struct snapshot {
+    char *basecacherepo;
+    int lockfd;
+};
+
+struct snapshot_stage {
+    char dir[PATHBUF];
+    char *basecacherepo;
+    bool published;
+};
+
+result pin_snapshot(struct snapshot *snap, const char *basecacherepo);
+
+void unpin_snapshot(struct snapshot *snap);
+
+result lock_snapshots(int *lockfd, const char *basecacherepo, bool wait);
+
+void unlock_snapshots(int lockfd);
+
+result stage_snapshot(struct snapshot_stage *stage, const char *basecacherepo);
+
+result publish_snapshot(struct snapshot_stage *stage,
+                        const char *basecacherepo);
+
+void drop_snapshot_stage(struct snapshot_stage *stage);
+
+void retire_snapshots(const char *basecacherepo);
+
+int remove_tree(const char *path);
+#endif
@@ -0,0 +1,92 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef STATS_DEF
+#define STATS_DEF
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "def.h"
+
+#define STATS_ARG "--stats"
+#define STATS_ENV "SPMN_STATS"
+
+/*
+ * Phases are timed with the monotonic clock and may nest: output is
+ * also part of the lookup or match it happens in. Phases run by the
+ * workers add up the time of every worker.
+ */
+enum stats_phase {
+    STATS_RESOLVE,
+    STATS_PARSE,
+    STATS_INDEX_OPEN,
+    STATS_INDEX_LOOKUP,
+    STATS_READDIR,
+    STATS_READ,
+    STATS_MATCH,
+    STATS_OUTPUT,
+    STATS_PHASE_CNT
+};
+
+enum stats_counter {
+    STATS_DIRS,
+    STATS_FILES,
+    STATS_BYTES_READ,
+    STATS_BYTES_WRITTEN,
+    STATS_MATCHES,
+    STATS_ALLOCS,
+    STATS_COUNTER_CNT
+};
+
+extern bool stats_enabled;
+
+void stats_init(int *argc, char **argv);
+
+uint64_t stats_clock(void);
+
+void stats_add_time(enum stats_phase phase, uint64_t elapsed);
+
+void stats_add(enum stats_counter counter, uint64_t n);
+
+void stats_add_busy(uint64_t busy);
+
+void stats_report(void);
+
+/*
+ * With stats off every probe is a single branch on stats_enabled.
+ */
+static inline uint64_t
+stats_begin(void) {
+    return stats_enabled ? stats_clock() : 0;
+}
+
+static inline uint64_t
+stats_since(uint64_t start) {
+    return stats_enabled ? stats_clock() - start : 0;
+}
+
+static inline void
+stats_end(enum stats_phase phase, uint64_t start) {
+    if (stats_enabled)
+        stats_add_time(phase, stats_clock() - start);
+}
+
+static inline void
+stats_count(enum stats_counter counter, uint64_t n) {
+    if (stats_enabled)
+        stats_add(counter, n);
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UNIDIFF_DEF
+#define UNIDIFF_DEF
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "def.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+
+DEFINE_ERROR(ERR_PATCH_FAILED, 18)
+DEFINE_ERROR(ERR_BAD_DIFF, 19)
+
+/* like GNU patch, at most two lines of context may be ignored */
+#define MAX_FUZZ 2
+#define DEVNULL_NAME "/dev/null"
+
+/*
+ * A hunk line points into the diff text. Its length includes the
+ * newline unless the diff marks the line as having none.
+ */
+struct diff_line {
+    char op;
+    const char *text;
+    size_t len;
+};
+
+struct diff_hunk {
+    size_t old_start;
+    size_t old_cnt;
+    size_t new_start;
+    size_t new_cnt;
+    size_t first_line;
+    size_t line_cnt;
+    size_t prefix_ctx;
+    size_t suffix_ctx;
+};
+
+/*
+ * One '---'/'+++' section. A name is NULL for /dev/null: the file is
+ * created or removed by the patch.
+ */
+struct diff_file {
+    char *old_name;
+    char *new_name;
+    size_t first_hunk;
+    size_t hunk_cnt;
+};
+
+struct unidiff {
+    struct mapped_file map;
+    struct diff_file *files;
+    size_t file_cnt;
+    size_t file_cap;
+    struct diff_hunk *hunks;
+    size_t hunk_cnt;
+    size_t hunk_cap;
+    struct diff_line *lines;
+    size_t line_cnt;
+    size_t line_cap;
+};
+
+enum hunk_status {
+    HUNK_APPLIED,
+    HUNK_FAILED,
+    HUNK_REVERSED
+};
+
+/*
+ * Where a hunk went, as a line of the patched text, or for a failed
+ * hunk where it was expected.
+ */
+struct hunk_result {
+    enum hunk_status status;
+    size_t line;
+    long offset;
+    size_t fuzz;
+};
+
+result load_unidiff(struct unidiff *diff, const char *path);
+
+result parse_unidiff(struct unidiff *diff, const char *text, size_t len);
+
+void free_unidiff(struct unidiff *diff);
+
+result patch_text(const struct unidiff *diff, const struct diff_file *file,
+                  const char *text, size_t len, struct growbuf *out,
+                  struct hunk_result *results, size_t *failed);
+#endif
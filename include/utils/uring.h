@@ -0,0 +1,75 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef URING_DEF
+#define URING_DEF
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include "def.h"
+
+DEFINE_ERROR(ERR_NO_URING, 22)
+
+#define SCAN_IO_ENV "SPMN_SCAN_IO"
+#define SCAN_IO_POOL "pool"
+
+/*
+ * Files in flight per batch. A round closes a batch, opens the next one
+ * and reads the one opened before: at most three requests per slot.
+ * Most index.md files fit in URING_READ_SIZE and are read with a single
+ * request.
+ */
+#define URING_BATCH 64
+#define URING_ENTRIES (4 * URING_BATCH)
+#define URING_READ_SIZE (8 * 1024)
+
+/*
+ * An io_uring set up with the raw system calls: the submission and
+ * completion rings and the submission entries are mapped from the ring's
+ * file descriptor. sqe_tail counts the entries handed out and not yet
+ * published to the kernel.
+ */
+struct uring {
+    int fd;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned sqe_tail;
+};
+
+/* data is only valid during the call */
+typedef result (*file_read_cb)(size_t file, const char *data, size_t len,
+                               void *ctx);
+
+result uring_init(struct uring *ring, unsigned entries);
+
+void uring_exit(struct uring *ring);
+
+result uring_read_files(int dirfd, const char *const *paths, size_t cnt,
+                        file_read_cb cb, void *ctx);
+#endif
@@ -0,0 +1,78 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WORKPOOL_DEF
+#define WORKPOOL_DEF
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "def.h"
+
+typedef void (*work_fn)(void *item, void *ctx, size_t worker_id);
+
+/*
+ * Every worker owns a deque: it pops its own items from the tail
+ * and, once empty, steals from the head of the other workers' deques.
+ */
+struct work_deque {
+    void **items;
+    size_t head;
+    size_t tail;
+    size_t cap;
+    pthread_mutex_t lock;
+};
+
+struct worker;
+
+/*
+ * Items are either all pushed before workpool_run, or fed while the pool
+ * runs: workpool_start starts every worker on a thread of its own,
+ * workpool_feed wakes them up and workpool_finish waits for the deques to
+ * drain. fed counts the items fed so far, feeding is cleared by
+ * workpool_finish.
+ */
+struct workpool {
+    struct work_deque *deques;
+    size_t worker_cnt;
+    size_t next_push;
+    work_fn fn;
+    void *ctx;
+    struct worker *workers;
+    pthread_t *threads;
+    size_t started;
+    pthread_mutex_t lock;
+    pthread_cond_t fed_cond;
+    size_t fed;
+    bool feeding;
+};
+
+size_t online_cpus(void);
+
+result workpool_init(struct workpool *pool, size_t worker_cnt);
+
+result workpool_push(struct workpool *pool, void *item);
+
+result workpool_run(struct workpool *pool, work_fn fn, void *ctx);
+
+result workpool_start(struct workpool *pool, work_fn fn, void *ctx);
+
+result workpool_feed(struct workpool *pool, void *item);
+
+void workpool_finish(struct workpool *pool);
+
+void workpool_destroy(struct workpool *pool);
+#endif
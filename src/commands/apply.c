@@ -15,60 +15,477 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 
 
 #include "def.h"
-#include "sys/sendfile.h"
-#include "utils/entry-utils.h"
-#include "utils/logutils.h"
-#include "utils/pathutils.h"
-#include <bits/types/__FILE.h>
-#include <dirent.h>
 #include <errno.h>
-#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
+#include "commands/apply.h"
 #include "commands/download.h"
+#include "utils/entry-utils.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+#include "utils/logutils.h"
+#include "utils/unidiff.h"
 
-static const char *const apply_cmd = "patch < "; 
+#define NEW_FILE_MODE 0644
+#define NEW_DIR_MODE 0755
+#define GIT_PREFIX_LEN 2
 
-result do_apply(const char *diff_file) {
-	char *cmd = NULL;
-	UNWRAP (spappend(&cmd, apply_cmd, diff_file));
-	
-	system(cmd);
+/*
+ * Patching writes the files, checking reports every hunk, scoring
+ * only counts them.
+ */
+enum apply_mode {
+    APPLY_PATCH,
+    APPLY_CHECK,
+    APPLY_SCORE,
+};
 
-	free(cmd);
-	RET_OK();
+static const struct option apply_long_options[] = {
+    {"dry-run", no_argument, NULL, 'd'},
+    {NULL, 0, NULL, 0},
+};
+
+void free_apply_targets(struct apply_targets *targets) {
+    for (size_t i = 0; i < targets->cnt; i++) {
+        free(targets->targets[i].path);
+        growbuf_free(&targets->targets[i].text);
+    }
+    free(targets->targets);
+    memset(targets, 0, sizeof(*targets));
 }
 
-static result applyp(const char *toolname, const char *patchname,
-             const char *basecacherepo) {
-	return loadp(toolname, patchname, basecacherepo, (struct load_args){.apply = true});
+static struct apply_target *find_target(const struct apply_targets *targets,
+                                        const char *path) {
+    for (size_t i = 0; i < targets->cnt; i++) {
+        if (IS_OK(strcmp(targets->targets[i].path, path)))
+            return targets->targets + i;
+    }
+    return NULL;
+}
+
+/* the file as the diff sees it: patched by it, by the base, or neither */
+static const struct apply_target *
+find_pending(const struct apply_targets *targets, const char *path) {
+    const struct apply_target *pending = NULL;
+
+    for (; targets && !pending; targets = targets->base) {
+        pending = find_target(targets, path);
+    }
+    return pending;
+}
+
+static result add_target(struct apply_targets *targets, const char *path,
+                         struct apply_target **target) {
+    struct apply_target *added = NULL;
+
+    if (targets->cnt == targets->cap) {
+        size_t newcap = targets->cap ? targets->cap * 2 : ENTRYLEN;
+        struct apply_target *newtargets =
+            realloc(targets->targets, newcap * sizeof(*newtargets));
+
+        UNWRAP_PTR(newtargets)
+        targets->targets = newtargets;
+        targets->cap = newcap;
+    }
+
+    added = targets->targets + targets->cnt;
+    memset(added, 0, sizeof(*added));
+    UNWRAP_PTR(added->path = strdup(path))
+
+    targets->cnt++;
+    *target = added;
+    RET_OK()
+}
+
+/* a diff from the mirror must not reach outside of the current directory */
+static bool safe_path(const char *path) {
+    const char *part = path;
+
+    if (!*path || *path == '/')
+        return false;
+
+    while (part) {
+        if (part[0] == '.' && part[1] == '.' && (!part[2] || part[2] == '/'))
+            return false;
+
+        part = strchr(part, '/');
+        if (part)
+            part++;
+    }
+    return true;
+}
+
+static const char *strip_git_prefix(const char *name) {
+    if ((name[0] == 'a' || name[0] == 'b') && name[1] == '/')
+        return name + GIT_PREFIX_LEN;
+
+    return name;
+}
+
+static const char *strip_dirs(const char *name) {
+    const char *slash = strrchr(name, '/');
+
+    return slash ? slash + 1 : name;
+}
+
+static bool target_exists(struct apply_targets *targets, const char *path) {
+    const struct apply_target *pending = find_pending(targets, path);
+    struct stat st;
+
+    if (pending)
+        return !pending->removed;
+
+    return IS_OK(stat(path, &st)) && S_ISREG(st.st_mode);
+}
+
+/*
+ * Suckless diffs come from git with a/ and b/ prefixes and are meant for
+ * the root of the tool's source tree. The names as they are and, like
+ * GNU patch without -p, the bare file names are tried after that.
+ */
+static const char *resolve_target(const struct diff_file *file,
+                                  struct apply_targets *targets) {
+    const char *names[] = {file->old_name, file->new_name};
+    const char *(*const strips[])(const char *) = {&strip_git_prefix, NULL,
+                                                   &strip_dirs};
+
+    if (!file->old_name) {
+        const char *created = strip_git_prefix(file->new_name);
+        return safe_path(created) ? created : NULL;
+    }
+
+    for (size_t s = 0; s < sizeof(strips) / sizeof(*strips); s++) {
+        for (size_t n = 0; n < sizeof(names) / sizeof(*names); n++) {
+            const char *path = NULL;
+
+            if (!names[n])
+                continue;
+
+            path = strips[s] ? strips[s](names[n]) : names[n];
+            if (safe_path(path) && target_exists(targets, path))
+                return path;
+        }
+    }
+    return NULL;
+}
+
+static void report_hunks(const struct diff_file *file,
+                         const struct hunk_result *results, bool dry_run) {
+    for (size_t h = 0; h < file->hunk_cnt; h++) {
+        const struct hunk_result *res = results + h;
+
+        switch (res->status) {
+        case HUNK_FAILED:
+            printf("Hunk #%zu FAILED at %zu.\n", h + 1, res->line);
+            break;
+        case HUNK_REVERSED:
+            printf("Hunk #%zu FAILED at %zu (reversed or already applied).\n",
+                   h + 1, res->line);
+            break;
+        case HUNK_APPLIED:
+            if (!dry_run && !res->fuzz && !res->offset)
+                break;
+
+            printf("Hunk #%zu succeeded at %zu", h + 1, res->line);
+            if (res->fuzz)
+                printf(" with fuzz %zu", res->fuzz);
+            if (res->offset) {
+                printf(" (offset %ld line%s)", res->offset,
+                       res->offset == 1 || res->offset == -1 ? "" : "s");
+            }
+            puts(".");
+        }
+    }
+}
+
+static void score_hunks(const struct diff_file *file,
+                        const struct hunk_result *results,
+                        struct diff_score *score) {
+    for (size_t h = 0; h < file->hunk_cnt; h++) {
+        if (results[h].status != HUNK_APPLIED)
+            score->failed++;
+        else if (results[h].fuzz)
+            score->fuzzy++;
+    }
+}
+
+/*
+ * The text to patch is what an earlier section of the diff, or an
+ * earlier diff of the stack, made of the file, or the file itself.
+ */
+static result patch_target(const struct unidiff *diff,
+                           const struct diff_file *file,
+                           struct apply_targets *targets, enum apply_mode mode,
+                           struct diff_score *score) {
+    struct apply_target *target = NULL;
+    const struct apply_target *pending = NULL;
+    struct mapped_file map = {0};
+    struct hunk_result *results = NULL;
+    struct growbuf patched = {0};
+    const char *path = resolve_target(file, targets);
+    const char *text = NULL;
+    size_t len = 0, file_failed = 0;
+    struct stat st;
+    ZIC_RESULT_INIT()
+
+    /* keep the report in order with the errors on stderr */
+    fflush(stdout);
+    score->hunks += file->hunk_cnt;
+
+    if (!path) {
+        if (mode != APPLY_SCORE) {
+            PRINT_ERR("Can't find file to patch: '%s'",
+                      file->old_name ? file->old_name : file->new_name);
+        }
+        score->failed += file->hunk_cnt;
+        RET_OK()
+    }
+
+    if (mode != APPLY_SCORE)
+        printf("%s file %s\n", mode == APPLY_CHECK ? "checking" : "patching",
+               path);
+
+    if (!file->old_name && target_exists(targets, path)) {
+        if (mode != APPLY_SCORE) {
+            fflush(stdout);
+            PRINT_ERR("File '%s' to be created already exists", path);
+        }
+        score->failed += file->hunk_cnt;
+        RET_OK()
+    }
+
+    target = find_target(targets, path);
+    pending = target ? target : find_pending(targets->base, path);
+    if (pending && !pending->removed) {
+        text = pending->text.data;
+        len = pending->text.len;
+    } else if (file->old_name) {
+        UNWRAP(map_file(&map, path))
+        text = map.data;
+        len = map.size;
+    }
+
+    TRY_PTR(results = calloc(file->hunk_cnt + 1, sizeof(*results)),
+            DO_CLEAN(cl_map))
+
+    TRY(patch_text(diff, file, text, len, &patched, results, &file_failed),
+        DO_CLEAN_ALL())
+
+    if (mode != APPLY_SCORE)
+        report_hunks(file, results, mode == APPLY_CHECK);
+    score_hunks(file, results, score);
+
+    if (file_failed)
+        RET_OK_DO_CLEAN_ALL()
+
+    if (!target) {
+        TRY(add_target(targets, path, &target), DO_CLEAN_ALL())
+
+        target->created = !file->old_name;
+        target->mode = NEW_FILE_MODE;
+        if (pending) {
+            target->created = pending->created;
+            target->mode = pending->mode;
+        } else if (!target->created && IS_OK(stat(path, &st))) {
+            target->mode = st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+        }
+    }
+
+    growbuf_free(&target->text);
+    target->text = patched;
+    target->removed = !file->new_name && !patched.len;
+    memset(&patched, 0, sizeof(patched));
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(
+        growbuf_free(&patched);
+        free(results));
+    CLEANUP(cl_map, unmap_file(&map));
+    ZIC_RETURN_RESULT()
+}
+
+static result make_parent_dirs(const char *path) {
+    char dir[PATHBUF] = {0};
+
+    snprintf(dir, sizeof(dir), "%s", path);
+
+    for (char *slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = ASCNULL;
+        if (mkdir(dir, NEW_DIR_MODE) && errno != EEXIST)
+            ERROR(ERR_SYS)
+        *slash = '/';
+    }
+    RET_OK()
+}
+
+static result write_targets(const struct apply_targets *targets) {
+    for (size_t i = 0; i < targets->cnt; i++) {
+        const struct apply_target *target = targets->targets + i;
+
+        if (target->removed) {
+            if (!target->created)
+                UNWRAP_NEG(unlink(target->path))
+            continue;
+        }
+
+        if (target->created)
+            UNWRAP(make_parent_dirs(target->path))
+
+        UNWRAP(write_file_atomic_mode(target->path, target->text.data,
+                                      target->text.len, target->mode))
+    }
+    RET_OK()
+}
+
+/*
+ * Patches the targets in memory with one diff of the stack. A diff that
+ * does not apply stops the stack, as the ones after it build on it.
+ */
+static result apply_diff(const char *diff_file, struct apply_targets *targets,
+                         enum apply_mode mode, struct diff_score *score) {
+    struct unidiff diff;
+    ZIC_RESULT_INIT()
+
+    TRY(load_unidiff(&diff, diff_file),
+        if (mode != APPLY_SCORE)
+            CATCH(ERR_BAD_DIFF, PRINT_ERR("'%s' is not a unified diff",
+                                          diff_file)))
+
+    for (size_t f = 0; f < diff.file_cnt; f++) {
+        TRY(patch_target(&diff, diff.files + f, targets, mode, score),
+            DO_CLEAN_ALL())
+    }
+
+    if (score->failed) {
+        if (mode != APPLY_SCORE) {
+            fflush(stdout);
+            PRINT_ERR("%zu out of %zu hunk%s FAILED, no file was changed",
+                      score->failed, diff.hunk_cnt,
+                      diff.hunk_cnt == 1 ? "" : "s");
+        }
+        ERROR_DO_CLEAN(ERR_PATCH_FAILED, DO_CLEAN_ALL())
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free_unidiff(&diff));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Applies the diffs in order on top of each other. Every file they touch
+ * is read once and written once, after the last diff has applied.
+ */
+result do_apply(const char *const *diff_files, size_t diff_cnt, bool dry_run) {
+    struct apply_targets targets = {0};
+    ZIC_RESULT_INIT()
+
+    for (size_t d = 0; d < diff_cnt; d++) {
+        struct diff_score score = {0};
+
+        if (diff_cnt > 1)
+            printf("%s %s\n", dry_run ? "checking" : "applying",
+                   strip_dirs(diff_files[d]));
+
+        TRY(apply_diff(diff_files[d], &targets,
+                       dry_run ? APPLY_CHECK : APPLY_PATCH, &score),
+            DO_CLEAN_ALL())
+    }
+
+    if (!dry_run)
+        TRY(write_targets(&targets), DO_CLEAN_ALL())
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free_apply_targets(&targets));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Counts the hunks of the diff that would apply on top of the stack, or
+ * to the current directory without one, printing nothing. A diff that
+ * does not apply is not an error here. The stack is only read, so the
+ * candidates of a patch can be scored against it in parallel.
+ */
+result score_diff(const char *diff_file, const struct apply_targets *stack,
+                  struct diff_score *score) {
+    struct apply_targets targets = {.base = stack};
+    ZIC_RESULT_INIT()
+
+    memset(score, 0, sizeof(*score));
+
+    ZIC_RESULT = apply_diff(diff_file, &targets, APPLY_SCORE, score);
+    if (ZIC_RESULT == ERR_PATCH_FAILED)
+        ZIC_RESULT = OK;
+
+    free_apply_targets(&targets);
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Applies the diff in memory on top of what the stack made of the files,
+ * printing nothing, so the next patch can be scored against it.
+ */
+result stack_diff(const char *diff_file, struct apply_targets *stack) {
+    struct diff_score score = {0};
+
+    return apply_diff(diff_file, stack, APPLY_SCORE, &score);
 }
 
 int parse_apply_args(int argc, char **argv, const char *basecacherepo) {
-	int option;
-	ZIC_RESULT_INIT()
-
-    if (argc < 4)
-        ERROR(ERR_INVARG);
-
-	while ((option = getopt(argc, argv, ":f")) != -1) {
-		switch (option) {
-		case 'f':
-			UNWRAP_ERR(do_apply(argv[3]), ERR_SYS);
-			RET_OK();
-		case ':':
-			ERROR(ERR_INVARG);
-		case '?':
-			ERROR(ERR_INVARG);
+    struct load_args args = {.apply = true};
+    const char **diff_files = NULL;
+    size_t diff_cnt = 0, startp;
+    int option;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR(diff_files = calloc(argc, sizeof(*diff_files)))
+
+    while ((option = getopt_long(argc, argv, "f:y", apply_long_options,
+                                 NULL)) != -1) {
+        switch (option) {
+        case 'f':
+            diff_files[diff_cnt++] = optarg;
+            break;
+        case 'y':
+            args.assume_yes = true;
+            break;
+        case 'd':
+            args.dry_run = true;
+            break;
+        case '?':
+            ERROR_DO_CLEAN(ERR_INVARG, DO_CLEAN_ALL());
         }
     }
-			
-    TRY(applyp(argv[2], argv[3], basecacherepo), CATCH(ERR_SYS, HANDLE_SYS());
 
-        CATCH(ERR_LOCAL, bug(__FILE__, __LINE__, strerror(errno)); FAIL()))
+    if (diff_cnt) {
+        TRY(do_apply(diff_files, diff_cnt, args.dry_run),
+            CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL());
+            DO_CLEAN_ALL());
+        RET_OK_DO_CLEAN_ALL()
+    }
+
+    startp = optind;
+    if (startp < (size_t)argc && IS_OK(strcmp(argv[startp], "apply")))
+        startp++;
+
+    /* the tool, then one or more patches to stack */
+    if (startp + 2 > (size_t)argc)
+        ERROR_DO_CLEAN(ERR_INVARG, DO_CLEAN_ALL())
+
+    TRY(loadp_stack(argv[startp], (const char *const *)argv + startp + 1,
+                    argc - startp - 1, basecacherepo, args),
+        CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL());
+        CATCH(ERR_LOCAL, bug(__FILE__, __LINE__, strerror(errno));
+              FAIL_DO_CLEAN_ALL());
+        DO_CLEAN_ALL());
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free(diff_files));
     ZIC_RETURN_RESULT()
 }
@@ -15,10 +15,14 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 
 
 #include "def.h"
-#include "sys/sendfile.h"
 #include "utils/entry-utils.h"
+#include "utils/fileutils.h"
 #include "utils/logutils.h"
 #include "utils/pathutils.h"
+#include "utils/catalog.h"
+#include "utils/stats.h"
+#include "utils/unidiff.h"
+#include "utils/workpool.h"
 #include <bits/getopt_core.h>
 #include <dirent.h>
 #include <errno.h>
@@ -37,102 +41,154 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 DEFINE_ERROR(ERR_NO_DIFF_FILE, 15)
 DEFINE_ERROR(ERR_LOAD_CANCELED, 16)
 	
-#define DIFF_FILE_EXT "diff"
+#define DIFF_FILE_EXT ".diff"
+#define DIFF_TABLE_INIT 4
 #define ENTER_NUMBER_PROMPT "Enter a number"
 
-static result diff_f_iter(DIR *ddir, struct dirent **ddirent, char **diff_f) {
-    while ((*ddirent = readdir(ddir))) {
-        char *diff_ext;
-        diff_ext = strrchr((*ddirent)->d_name, '.');
+static bool is_diff_file(const char *name) {
+    const size_t ext_len = sizeof(DIFF_FILE_EXT) - 1;
+    size_t len = strlen(name);
 
-        if (IS_OK(strcmp(diff_ext + 1, DIFF_FILE_EXT))) {
-            if (diff_f)
-                *diff_f = strdup((*ddirent)->d_name);
+    return name[0] != '.' && len > ext_len &&
+           IS_OK(strcmp(name + len - ext_len, DIFF_FILE_EXT));
+}
 
-            RET_OK()
-        }
-    }
+static int cmp_diff_files(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-    FAIL()
+static void free_diff_f_table(char **diff_table, size_t diff_t_len) {
+    for (size_t diff_f_i = 0; diff_f_i < diff_t_len; diff_f_i++) {
+        free(diff_table[diff_f_i]);
+    }
+	free(diff_table);
 }
 
-static result get_diff_files_cnt(const char *patch_p, size_t *fcnt) {
+/* without a catalog the diffs are read from the patch dir, in one pass */
+static result get_diff_file_list(char ***diff_table, size_t *diff_table_len,
+                          const char *patch_p) {
     DIR *pdir = NULL;
     struct dirent *pdirent = NULL;
-    size_t diff_cnt = 0;
+    char **table = NULL;
+    size_t diff_cnt = 0, table_cap = 0;
+    ZIC_RESULT_INIT()
 
     pdir = opendir(patch_p);
     UNWRAP_PTR(pdir)
+    stats_count(STATS_DIRS, 1);
+
+    while ((pdirent = readdir(pdir))) {
+        if (!is_diff_file(pdirent->d_name))
+            continue;
+
+        if (diff_cnt == table_cap) {
+            size_t newcap = table_cap ? table_cap * 2 : DIFF_TABLE_INIT;
+            char **newtable = realloc(table, newcap * sizeof(*newtable));
+
+            TRY_PTR(newtable, DO_CLEAN_ALL())
+            table = newtable;
+            table_cap = newcap;
+        }
 
-    while (IS_OK(diff_f_iter(pdir, &pdirent, NULL))) {
+        TRY_PTR(table[diff_cnt] = strdup(pdirent->d_name), DO_CLEAN_ALL())
         diff_cnt++;
     }
 
-    closedir(pdir);
-    *fcnt = diff_cnt;
-    RET_OK()
-}
+    if (diff_cnt == 0) {
+        ERROR_DO_CLEAN_ALL(ERR_NO_DIFF_FILE)
+    }
 
-static result get_diff_file_list(char ***diff_table, size_t *diff_table_len,
-                          const char *patch_p) {
-    DIR *pdir = NULL;
-    struct dirent *pdirent = NULL;
-    char *diff_f_name;
-    size_t diff_total_cnt = 0;
+    qsort(table, diff_cnt, sizeof(*table), &cmp_diff_files);
+    *diff_table = table;
+    *diff_table_len = diff_cnt;
+    table = NULL;
 
-    UNWRAP(get_diff_files_cnt(patch_p, &diff_total_cnt))
+	ZIC_RESULT = OK;
+    CLEANUP_ALL(
+        if (table)
+            free_diff_f_table(table, diff_cnt);
+        closedir(pdir));
+    ZIC_RETURN_RESULT()
+}
 
-    if (diff_total_cnt == 0) {
+static result get_catalog_diff_list(char ***diff_table, size_t *diff_table_len,
+                                    const struct patch_location *loc) {
+    char **table = NULL;
+    size_t diff_cnt = loc->patch.diff_cnt, d = 0;
+    struct diff_entry diff;
+    ZIC_RESULT_INIT()
+
+    if (diff_cnt == 0) {
         ERROR(ERR_NO_DIFF_FILE)
     }
 
-    *diff_table = calloc(diff_total_cnt, sizeof(**diff_table));
-    UNWRAP_PTR(*diff_table)
+    UNWRAP_PTR(table = calloc(diff_cnt, sizeof(*table)))
 
-    pdir = opendir(patch_p);
-    UNWRAP_PTR(pdir)
+    for (; d < diff_cnt; d++) {
+        TRY(catalog_diff(&loc->cat, loc->patch.first_diff + d, &diff),
+            DO_CLEAN_ALL())
+        TRY_PTR(table[d] = strdup(diff.name), DO_CLEAN_ALL())
+    }
+
+    *diff_table = table;
+    *diff_table_len = diff_cnt;
+    RET_OK()
+
+    CLEANUP_ALL(free_diff_f_table(table, d));
+    ZIC_RETURN_RESULT()
+}
 
-    for (size_t diff_counter = 0;
-         IS_OK(diff_f_iter(pdir, &pdirent, &diff_f_name)); diff_counter++) {
+/*
+ * The patch dir and its diffs come from the catalog of the last sync;
+ * the mirror is only read when there is none.
+ */
+static result list_patch_diffs(const char *toolname, const char *patchname,
+                               const char *basecacherepo, char **ppath,
+                               char ***diff_table, size_t *diff_t_len) {
+    struct patch_location loc;
+    result located;
+    ZIC_RESULT_INIT();
 
-        (*diff_table)[diff_counter] = diff_f_name;
+    located = locate_patch(&loc, toolname, patchname, basecacherepo);
+    if (located == ERR_NO_CATALOG) {
+        UNWRAP(build_patch_dir(ppath, toolname, patchname,
+                               strnlen(patchname, ENTRYLEN), basecacherepo))
+        return get_diff_file_list(diff_table, diff_t_len, *ppath);
     }
-	
-    *diff_table_len = diff_total_cnt;
-    UNWRAP(closedir(pdir))
-    RET_OK()
+    UNWRAP(located)
+
+    TRY_PTR(*ppath = strdup(loc.dir), DO_CLEAN_ALL())
+    ZIC_RESULT = get_catalog_diff_list(diff_table, diff_t_len, &loc);
+
+    CLEANUP_ALL(release_patch_location(&loc));
+    ZIC_RETURN_RESULT()
 }
 
 static result copy_diff_file(const char *diff_f, const char *patch_path) {
-    char *sdiff_path = NULL, *copy_buf = NULL;
-    int dest_diff, source_diff, read_buf_c;
-    struct stat diff_st = {0};
-    size_t ppath_len, tot_buf_len;
+    char *sdiff_path = NULL;
+    int dest_diff, source_diff;
+    size_t ppath_len, tot_buf_len, copied = 0;
     ZIC_RESULT_INIT()
 
     ppath_len = strlen(patch_path);
     tot_buf_len = ppath_len + 1 + strnlen(diff_f, ENTRYLEN) + 1;
-    sdiff_path = calloc(tot_buf_len, sizeof(*sdiff_path));
+    UNWRAP_PTR(sdiff_path = calloc(tot_buf_len, sizeof(*sdiff_path)))
 
     snprintf(sdiff_path, tot_buf_len, "%s/%s", patch_path, diff_f);
 
     source_diff = open(sdiff_path, O_RDONLY);
     TRY_NEG(source_diff, DO_CLEAN(cl_diff_path));
-    dest_diff = open(diff_f, O_CREAT | O_WRONLY, 0640);
+    dest_diff = open(diff_f, O_CREAT | O_TRUNC | O_WRONLY, 0640);
     TRY_NEG(dest_diff, DO_CLEAN(cl_source_fd));
 
-    TRY_NEG(stat(sdiff_path, &diff_st), DO_CLEAN(cl_dest_fd));
-
-    TRY_PTR(copy_buf = calloc(diff_st.st_size, sizeof(*copy_buf)),
-            DO_CLEAN(cl_dest_fd));
+    TRY(copy_fd(dest_diff, source_diff, &copied), DO_CLEAN_ALL());
 
-    read_buf_c = read(source_diff, copy_buf, diff_st.st_size);
-    TRY_NEG(read_buf_c, DO_CLEAN_ALL());
-    TRY_NEG(write(dest_diff, copy_buf, read_buf_c), DO_CLEAN_ALL());
+    stats_count(STATS_FILES, 2);
+    stats_count(STATS_BYTES_READ, copied);
+    stats_count(STATS_BYTES_WRITTEN, copied);
 
 	ZIC_RESULT = OK;
-    CLEANUP_ALL(free(copy_buf));
-    CLEANUP(cl_dest_fd, close(dest_diff));
+    CLEANUP_ALL(close(dest_diff));
     CLEANUP(cl_source_fd, close(source_diff));
     CLEANUP(cl_diff_path, free(sdiff_path));
     ZIC_RETURN_RESULT()
@@ -146,6 +202,7 @@ static result read_prompt_diff_file(size_t *input_val, size_t diff_t_len) {
 
     for (char *prompt_msg = ENTER_NUMBER_PROMPT; true;) {
         printf("\33[A\33[2K\r%s: ", prompt_msg);
+        fflush(stdout);
         UNWRAP_PTR(fgets(read_buf, ENTRYLEN - 1, stdin));
 
 		rval = strtoumax(read_buf, NULL, 10);
@@ -170,8 +227,103 @@ static result read_prompt_diff_file(size_t *input_val, size_t diff_t_len) {
     RET_OK()
 }
 
-static result prompt_diff_file(char **diff_table, char **chosen_diff,
-                        const char *patch_name, size_t diff_f_cnt) {
+struct diff_candidate {
+    char *name;
+    char path[PATHBUF];
+    struct diff_score score;
+    bool broken;
+};
+
+static void score_candidate(void *item, void *ctx, size_t worker_id) {
+    struct diff_candidate *cand = item;
+    const struct apply_targets *stack = ctx;
+
+    (void)worker_id;
+    cand->broken = score_diff(cand->path, stack, &cand->score) != OK;
+}
+
+static size_t clean_hunks(const struct diff_candidate *cand) {
+    return cand->score.hunks - cand->score.failed - cand->score.fuzzy;
+}
+
+/*
+ * Best first: the larger share of hunks applying without fuzz, then fewer
+ * failed hunks, then the later name, which is usually the newer version.
+ */
+static int cmp_candidates(const void *a, const void *b) {
+    const struct diff_candidate *ca = a, *cb = b;
+    uint64_t ka, kb;
+
+    if (ca->broken != cb->broken)
+        return ca->broken ? 1 : -1;
+
+    ka = (uint64_t)clean_hunks(ca) * cb->score.hunks;
+    kb = (uint64_t)clean_hunks(cb) * ca->score.hunks;
+    if (ka != kb)
+        return ka > kb ? -1 : 1;
+
+    if (ca->score.failed != cb->score.failed)
+        return ca->score.failed < cb->score.failed ? -1 : 1;
+
+    return strcmp(cb->name, ca->name);
+}
+
+/*
+ * Dry-runs every diff of the patch on the work pool, against what the
+ * patches before it in the stack made of the current directory, then
+ * sorts the candidates best first.
+ */
+static result rank_diff_files(const char *ppath, char **diff_table,
+                              const struct apply_targets *stack,
+                              struct diff_candidate *cands, size_t cnt) {
+    struct workpool pool;
+    size_t workers = online_cpus();
+    ZIC_RESULT_INIT()
+
+    for (size_t i = 0; i < cnt; i++) {
+        cands[i].name = diff_table[i];
+        if (snprintf(cands[i].path, sizeof(cands[i].path), "%s/%s", ppath,
+                     diff_table[i]) >= (int)sizeof(cands[i].path))
+            cands[i].broken = true;
+    }
+
+    if (workers > cnt)
+        workers = cnt;
+
+    UNWRAP(workpool_init(&pool, workers ? workers : 1))
+
+    for (size_t i = 0; i < cnt; i++) {
+        if (!cands[i].broken)
+            UNWRAP_DO_CLEAN_ALL(workpool_push(&pool, cands + i))
+    }
+
+    UNWRAP_DO_CLEAN_ALL(workpool_run(&pool, &score_candidate, (void *)stack))
+
+    qsort(cands, cnt, sizeof(*cands), &cmp_candidates);
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(workpool_destroy(&pool));
+    ZIC_RETURN_RESULT()
+}
+
+static void print_candidate_score(const struct diff_candidate *cand) {
+    const struct diff_score *score = &cand->score;
+
+    if (cand->broken) {
+        printf("  [can't be read]");
+    } else if (!score->failed && !score->fuzzy) {
+        printf("  [applies cleanly]");
+    } else if (!score->failed) {
+        printf("  [applies, %zu of %zu hunks with fuzz]", score->fuzzy,
+               score->hunks);
+    } else {
+        printf("  [%zu of %zu hunks fail]", score->failed, score->hunks);
+    }
+}
+
+static result prompt_diff_file(const struct diff_candidate *cands,
+                               char **chosen_diff, const char *patch_name,
+                               size_t diff_f_cnt) {
     size_t usr_input = 0;
 
     printf(
@@ -179,60 +331,146 @@ static result prompt_diff_file(char **diff_table, char **chosen_diff,
         diff_f_cnt, patch_name);
 
     for (size_t diff_i = 0; diff_i < diff_f_cnt; diff_i++) {
-        printf("(%zu) %s\n", diff_i + 1, diff_table[diff_i]);
+        printf("(%zu) %s", diff_i + 1, cands[diff_i].name);
+        print_candidate_score(cands + diff_i);
+        putc('\n', stdout);
     }
 
 	puts("\n(0) Cancel");
 
     UNWRAP(read_prompt_diff_file(&usr_input, diff_f_cnt))
-    *chosen_diff = diff_table[usr_input - 1];
+    *chosen_diff = cands[usr_input - 1].name;
     RET_OK()
 }
 
-static void free_diff_f_table(char **diff_table, size_t diff_t_len) {
-    for (size_t diff_f_i = 0; diff_f_i < diff_t_len; diff_f_i++) {
-        free(diff_table[diff_f_i]);
-    }
-	free(diff_table);
-}
-
-result loadp(const char *toolname, const char *patchname,
-             const char *basecacherepo, struct load_args flags) {
+/*
+ * Finds the diff of a patch. When the patch has several, they are ranked
+ * by how well they apply to the current directory; the best one is taken
+ * with -y if it applies cleanly, otherwise the user is asked.
+ */
+static result choose_diff_file(const char *toolname, const char *patchname,
+                               const char *basecacherepo,
+                               const struct apply_targets *stack,
+                               bool assume_yes, char **patch_path,
+                               char **diff_f) {
     char *ppath = NULL;
     char **diff_table = NULL;
 	char *chosen_diff_f = NULL;
-    size_t patchn_len, diff_t_len = 0;
+    struct diff_candidate *cands = NULL;
+    size_t diff_t_len = 0;
     ZIC_RESULT_INIT();
 
-    patchn_len = strnlen(patchname, ENTRYLEN);
-    TRY(
-        build_patch_dir(&ppath, toolname, patchname, patchn_len, basecacherepo), DO_CLEAN(cl_ppath))
-
-    TRY(get_diff_file_list(&diff_table, &diff_t_len, ppath),
+    TRY(list_patch_diffs(toolname, patchname, basecacherepo, &ppath,
+                         &diff_table, &diff_t_len),
         CATCH(ERR_NO_DIFF_FILE,
-              HANDLE_PRINT_ERR("No diff files found for patch '%s'", patchname));
+              HANDLE_PRINT_ERR_DO_CLEAN_ALL("No diff files found for patch '%s'",
+                                            patchname));
         DO_CLEAN_ALL());
 
     if (diff_t_len == 1) {
 		chosen_diff_f = diff_table[0];
     } else {
-        TRY(prompt_diff_file(diff_table, &chosen_diff_f, patchname, diff_t_len),
-			CATCH(ERR_LOAD_CANCELED,
-				  HANDLE_PRINT_DO_CLEAN_ALL("Canceled\n")
-				)
-			DO_CLEAN_ALL());
+        TRY_PTR(cands = calloc(diff_t_len, sizeof(*cands)), DO_CLEAN_ALL())
+        TRY(rank_diff_files(ppath, diff_table, stack, cands, diff_t_len),
+            DO_CLEAN_ALL())
+
+        if (assume_yes && !cands[0].broken && !cands[0].score.failed &&
+            !cands[0].score.fuzzy) {
+            chosen_diff_f = cands[0].name;
+            printf("Using %s for patch '%s'\n", chosen_diff_f, patchname);
+        } else {
+            TRY(prompt_diff_file(cands, &chosen_diff_f, patchname, diff_t_len),
+                CATCH(ERR_LOAD_CANCELED,
+                      HANDLE_PRINT_DO_CLEAN_ALL("Canceled\n")
+                    )
+                DO_CLEAN_ALL());
+        }
     }
-	TRY(copy_diff_file(chosen_diff_f, ppath), DO_CLEAN_ALL())
 
-	if (flags.apply) {
-		UNWRAP_DO_CLEAN_ALL(do_apply(chosen_diff_f));
-	}
-	
-    CLEANUP_ALL(free_diff_f_table(diff_table, diff_t_len));
-    CLEANUP(cl_ppath, free(ppath));
+	TRY_PTR(*diff_f = strdup(chosen_diff_f), DO_CLEAN_ALL())
+	*patch_path = ppath;
+	ppath = NULL;
+
+	ZIC_RESULT = OK;
+    CLEANUP_ALL(
+        free(cands);
+        free_diff_f_table(diff_table, diff_t_len);
+        free(ppath));
     ZIC_RETURN_RESULT()
 }
 
+static void free_diff_paths(char **diff_paths, size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+        free(diff_paths[i]);
+    }
+	free(diff_paths);
+}
+
+/*
+ * Loads the diffs of the patches into the current directory, then applies
+ * them as one stack if asked to. A dry run checks the diffs in the mirror
+ * and leaves the tree alone. Patches of a stack are ranked against the
+ * files as the chosen diffs before them leave them in memory.
+ */
+result loadp_stack(const char *toolname, const char *const *patchnames,
+                   size_t patch_cnt, const char *basecacherepo,
+                   struct load_args flags) {
+    struct apply_targets stack = {0};
+    bool stacked = flags.apply || flags.dry_run;
+    char **diff_paths = NULL;
+    ZIC_RESULT_INIT();
+
+    UNWRAP_PTR(diff_paths = calloc(patch_cnt, sizeof(*diff_paths)))
+
+    for (size_t p = 0; p < patch_cnt; p++) {
+        char *ppath = NULL, *diff_f = NULL;
+
+        TRY(choose_diff_file(toolname, patchnames[p], basecacherepo,
+                             stacked ? &stack : NULL, flags.assume_yes,
+                             &ppath, &diff_f),
+            DO_CLEAN_ALL())
+
+        if (flags.dry_run) {
+            char diff_path[PATHBUF] = {0};
+
+            snprintf(diff_path, sizeof(diff_path), "%s/%s", ppath, diff_f);
+            diff_paths[p] = strdup(diff_path);
+        } else {
+            ZIC_RESULT = copy_diff_file(diff_f, ppath);
+            diff_paths[p] = diff_f;
+            diff_f = NULL;
+        }
+
+        free(ppath);
+        free(diff_f);
+        TRY(ZIC_RESULT, DO_CLEAN_ALL())
+        TRY_PTR(diff_paths[p], DO_CLEAN_ALL())
+
+        /* a diff that does not fit is reported by the apply below */
+        if (stacked && p + 1 < patch_cnt) {
+            ZIC_RESULT = stack_diff(diff_paths[p], &stack);
+            if (ZIC_RESULT && ZIC_RESULT != ERR_PATCH_FAILED)
+                DO_CLEAN_ALL()
+        }
+    }
+
+    if (flags.apply || flags.dry_run) {
+        TRY(do_apply((const char *const *)diff_paths, patch_cnt, flags.dry_run),
+            DO_CLEAN_ALL())
+    }
+
+	ZIC_RESULT = OK;
+    CLEANUP_ALL(
+        free_apply_targets(&stack);
+        free_diff_paths(diff_paths, patch_cnt));
+    ZIC_RETURN_RESULT()
+}
+
+result loadp(const char *toolname, const char *patchname,
+             const char *basecacherepo, struct load_args flags) {
+    return loadp_stack(toolname, &patchname, 1, basecacherepo, flags);
+}
+
 int parse_load_args(int argc, char **argv, const char *basecacherepo) {
 	int option;
 	struct load_args arg = {0};
@@ -243,11 +481,14 @@ int parse_load_args(int argc, char **argv, const char *basecacherepo) {
         ERROR(ERR_INVARG);
 	}
 
-	while ((option = getopt(argc, argv, "a")) != -1) {
+	while ((option = getopt(argc, argv, "ay")) != -1) {
 		switch (option) {
 		case 'a':
 			arg.apply = true;
 			break;
+		case 'y':
+			arg.assume_yes = true;
+			break;
 		case '?':
 			ERROR(ERR_INVARG);
 			break;
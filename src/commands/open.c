@@ -18,9 +18,13 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include "utils/entry-utils.h"
 #include "utils/logutils.h"
 #include "utils/pathutils.h"
+#include "utils/catalog.h"
+#include "utils/descstore.h"
+#include "utils/stats.h"
 #include <bits/types/__FILE.h>
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,6 +54,26 @@ static result xdg_open(const char *url) {
   return !!openst;
 }
 
+/*
+ * Descriptions are paged through less on a terminal only, a pipe or a
+ * file gets them as they are.
+ */
+FILE *open_pager(void) {
+  if (!isatty(STDOUT_FILENO))
+    return stdout;
+
+  return popen(LESS_CMD, "w");
+}
+
+void close_pager(FILE *pager) {
+  if (pager == stdout) {
+    fflush(stdout);
+    return;
+  }
+
+  pclose(pager);
+}
+
 result openp(const char *toolname, const char *patch_name,
              const char *basecacherepo) {
   char *url = NULL;
@@ -63,11 +87,81 @@ result openp(const char *toolname, const char *patch_name,
   ZIC_RETURN_RESULT()
 }
 
-static result print_pdescription(const char *toolname, const char *patch_name,
-                          const char *basecacherepo) {
-  char *pdir = NULL, *md = NULL;
+static result page_md(const char *md, size_t mdlen) {
+  FILE *targetp = NULL;
+  ZIC_RESULT_INIT()
+
+  UNWRAP_PTR(targetp = open_pager())
+
+  if (fwrite(md, sizeof(*md), mdlen, targetp) != mdlen)
+    ERROR_DO_CLEAN_ALL(ERR_SYS)
+
+  stats_count(STATS_BYTES_WRITTEN, mdlen);
+
+  ZIC_RESULT = OK;
+  CLEANUP_ALL(close_pager(targetp));
+  ZIC_RETURN_RESULT()
+}
+
+static result print_md(const char *md, size_t md_size) {
   char *print_buf = NULL;
-  FILE *patchf = NULL, *targetp = NULL;
+  FILE *patchf = NULL;
+  size_t md_read;
+  ZIC_RESULT_INIT()
+
+  UNWRAP_PTR(patchf = fopen(md, "r"));
+
+  print_buf = calloc(md_size + 1, sizeof(*print_buf));
+  TRY_PTR(print_buf, DO_CLEAN_ALL());
+
+  /* the file may have changed size since the catalog was written */
+  md_read = fread(print_buf, sizeof(*print_buf), md_size, patchf);
+
+  stats_count(STATS_FILES, 1);
+  stats_count(STATS_BYTES_READ, md_read);
+
+  ZIC_RESULT = page_md(print_buf, md_read);
+
+  free(print_buf);
+  CLEANUP_ALL(fclose(patchf));
+  ZIC_RETURN_RESULT()
+}
+
+/*
+ * Decodes only the block of the description store the patch is in.
+ * ERR_NO_CATALOG if the store is missing or does not agree with the
+ * catalog, the caller reads index.md then.
+ */
+static result print_stored_md(const struct patch_location *loc,
+                              const char *basecacherepo) {
+  struct desc_store store;
+  struct desc_cursor cur;
+  const char *md = NULL;
+  size_t mdlen;
+  ZIC_RESULT_INIT()
+
+  if (open_desc_store(&store, basecacherepo, loc->tool))
+    ERROR(ERR_NO_CATALOG)
+
+  init_desc_cursor(&cur);
+
+  if (store.hdr->patch_cnt != loc->cat.hdr->patch_cnt ||
+      desc_store_get(&store, loc->patch.id, &cur, &md, &mdlen) ||
+      mdlen != loc->patch.md_size)
+    ERROR_DO_CLEAN_ALL(ERR_NO_CATALOG)
+
+  ZIC_RESULT = page_md(md, mdlen);
+
+  CLEANUP_ALL(
+      free_desc_cursor(&cur);
+      close_desc_store(&store));
+  ZIC_RETURN_RESULT()
+}
+
+static result print_mirror_pdescription(const char *toolname,
+                                        const char *patch_name,
+                                        const char *basecacherepo) {
+  char *pdir = NULL, *md = NULL;
   struct stat sp = {0};
   size_t patchn_len;
   ZIC_RESULT_INIT()
@@ -78,28 +172,56 @@ static result print_pdescription(const char *toolname, const char *patch_name,
 
   TRY(spappend(&md, pdir, INDEXMD), DO_CLEAN(cl_pdir));
 
-  TRY(stat(md, &sp), DO_CLEAN(cl_md));
+  TRY(stat(md, &sp), DO_CLEAN_ALL());
 
-  TRY_PTR(patchf = fopen(md, "r"), DO_CLEAN(cl_md));
+  ZIC_RESULT = print_md(md, sp.st_size);
 
-  print_buf = calloc(sp.st_size, sizeof(*print_buf));
-  TRY_PTR(print_buf, DO_CLEAN(cl_bufclose));
-
-  TRY_PTR(targetp = popen(LESS_CMD, "w"), DO_CLEAN(cl_printbuf))
-  
-  TRY_NEG(
-      fread(print_buf, sizeof(*print_buf), sp.st_size, patchf), DO_CLEAN_ALL());
-  TRY_NEG (fwrite(print_buf, sizeof(*print_buf), sp.st_size, targetp), DO_CLEAN_ALL());
-
-  CLEANUP_ALL(pclose(targetp));
-  CLEANUP(cl_printbuf, free(print_buf));
-  CLEANUP(cl_bufclose, fclose(patchf));
-  CLEANUP(cl_md, free(md));
+  CLEANUP_ALL(free(md));
   CLEANUP(cl_pdir, free(pdir));
 
   ZIC_RETURN_RESULT()
 }
 
+/*
+ * The catalog knows whether the patch has an index.md and how long it
+ * is, the description store has its contents.
+ */
+static result print_pdescription(const char *toolname, const char *patch_name,
+                          const char *basecacherepo) {
+  struct patch_location loc;
+  char md[PATHBUF] = {0};
+  uint32_t md_size;
+  int md_len;
+  result located, printed;
+
+  located = locate_patch(&loc, toolname, patch_name, basecacherepo);
+  if (located == ERR_NO_CATALOG)
+    return print_mirror_pdescription(toolname, patch_name, basecacherepo);
+
+  UNWRAP(located)
+
+  md_size = loc.patch.md_size;
+  if (md_size == PCAT_NO_MD) {
+    release_patch_location(&loc);
+    errno = ENOENT;
+    ERROR(ERR_SYS)
+  }
+
+  printed = print_stored_md(&loc, basecacherepo);
+  if (printed != ERR_NO_CATALOG) {
+    release_patch_location(&loc);
+    return printed;
+  }
+
+  md_len = snprintf(md, sizeof(md), "%s%s", loc.dir, INDEXMD);
+  release_patch_location(&loc);
+
+  if (md_len < 0 || (size_t)md_len >= sizeof(md))
+    ERROR(ERR_LOCAL)
+
+  return print_md(md, md_size);
+}
+
 result parse_open_args(int argc, char **argv, const char *basecacherepo) {
   open_func openf = NULL;
   int opt;
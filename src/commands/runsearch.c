@@ -19,6 +19,7 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <math.h>
 #include <pwd.h>
 #include <stdarg.h>
@@ -32,12 +33,22 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <bsd/string.h>
 
 #include "commands/runsearch.h"
 #include "commands/search.h"
+#include "commands/searchindex.h"
+#include "utils/catalog.h"
+#include "utils/descstore.h"
 #include "utils/entry-utils.h"
+#include "utils/fuzzy.h"
 #include "utils/logutils.h"
+#include "utils/matcher.h"
 #include "utils/pathutils.h"
+#include "utils/stats.h"
+#include "utils/registry.h"
+#include "utils/uring.h"
+#include "utils/workpool.h"
 
 static int getwords_count(char *searchstr, int searchlen) {
     int symbolscount = 0;
@@ -118,171 +129,1063 @@ static int parse_search_symbols(searchsyms *sargs, char **sstrings,
     }
 
     sargs->words = words;
-    sargs->wordcount = tstrcnt;
+    sargs->wordcount = wid;
+    UNWRAP(matcher_build(&sargs->matcher, words, wid));
+
+    if (sargs->s_flags.max_edits) {
+        UNWRAP_PTR(sargs->patterns = calloc(wid + 1, sizeof(*sargs->patterns)));
+
+        for (size_t w = 0; w < wid; w++) {
+            fuzzy_compile(sargs->patterns + w, words[w]);
+        }
+    }
     ZIC_RETURN_RESULT();
 }
 
-int worth_multithread(int entrycount) {
-    (void)entrycount;
+/*
+ * An explicit -j is taken as given, short of more workers than patches;
+ * by default a worker is started per MIN_WORKAMOUNT patches, up to the
+ * CPU count.
+ */
+static size_t search_workers_count(const size_t entrycnt, size_t jobs) {
+    size_t workers = jobs;
 
-#ifdef USE_MULTITHREADED
-    return entrycount >=
-           ((OPTWORK_AMOUNT * 2) - (OPTWORK_AMOUNT - (OPTWORK_AMOUNT / 4)));
-#else
-    return OK;
-#endif
+    if (jobs == 0) {
+        workers = entrycnt / MIN_WORKAMOUNT;
+        if (workers > online_cpus())
+            workers = online_cpus();
+    }
+
+    if (workers > entrycnt)
+        workers = entrycnt;
+
+    return workers ? workers : 1;
 }
 
-static void assign_thread_bounds(lookupthread_args *threadargpool,
-                                 const int tid, const int thcount,
-                                 const int entrycnt) {
+/* where a scan reads the patches from, see struct threadargs */
+struct scan_source {
+    char *patchdir;
+    const struct patch_catalog *cat;
+    const struct desc_store *store;
+};
+
+static void setup_threadargs(lookupthread_args *threadargpool, const size_t tid,
+                             struct search_output *out, searchsyms *searchargs,
+                             const struct scan_source *src,
+                             pthread_mutex_t *fmutex,
+                             struct fuzzy_hits *fuzzy_hits) {
     lookupthread_args *thargs = threadargpool + tid;
 
-    if (tid == 0) {
-        thargs->startpoint = 0;
-        if (thcount < OPTTHREAD_COUNT) {
-            thargs->endpoint = thargs->startpoint + OPTWORK_AMOUNT;
-        } else {
-            double actworkamount = (double)entrycnt / (double)OPTTHREAD_COUNT;
-            int approxstartval = (int)(floor(actworkamount / 100.0)) + 2;
-            thargs->endpoint = thargs->startpoint + approxstartval;
-        }
-    } else {
-        lookupthread_args *prevthargs = threadargpool + (tid - 1);
-        thargs->startpoint = prevthargs->endpoint;
+    thargs->out = out;
+    thargs->mutex = fmutex;
+    thargs->patchdir = src->patchdir;
+    thargs->cat = src->cat;
+    thargs->store = src->store;
+    init_desc_cursor(&thargs->cursor);
+    thargs->searchargs = searchargs;
+    thargs->fuzzy_hits = fuzzy_hits;
+}
 
-        if (tid == thcount - 1) {
-            thargs->endpoint = entrycnt;
-        } else {
-            thargs->endpoint = (prevthargs->endpoint - prevthargs->startpoint) +
-                               thargs->startpoint;
+static void cleanup_searchargs(searchsyms *sargs) {
+    for (size_t i = 0; i < sargs->wordcount; i++) {
+        free(sargs->words[i]);
+    }
+    free(sargs->words);
+    free(sargs->patterns);
+    matcher_free(&sargs->matcher);
+}
+
+/*
+ * A patch directory of a scan. Its inode number is known from readdir
+ * for free, and patches are read in inode order: an index.md tends to
+ * be allocated near its directory, so the reads sweep the disk in one
+ * direction instead of in name hash order.
+ */
+struct patch_dirent {
+    ino_t ino;
+    char *name;
+};
+
+static void cleanup_entries(struct patch_dirent *entries, size_t entrycnt) {
+    for (size_t i = 0; i < entrycnt; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+static int cmp_entry_inodes(const void *a, const void *b) {
+    const struct patch_dirent *ea = a, *eb = b;
+
+    if (ea->ino != eb->ino)
+        return ea->ino < eb->ino ? -1 : 1;
+
+    return strcmp(ea->name, eb->name);
+}
+
+static result collect_patch_entries(struct patch_dirent **entries,
+                                    size_t *entrycnt, const char *patchdir) {
+    DIR *pd = NULL;
+    struct dirent *pdir = NULL;
+    size_t cap = 0;
+
+    ZIC_RESULT_INIT()
+
+    *entries = NULL;
+    *entrycnt = 0;
+
+    UNWRAP_PTR(pd = opendir(patchdir))
+    stats_count(STATS_DIRS, 1);
+
+    while ((pdir = readdir(pd))) {
+        if (check_isdir(pdir))
+            continue;
+
+        if (*entrycnt == cap) {
+            struct patch_dirent *newentries = NULL;
+
+            cap = cap ? cap * 2 : ENTRYLEN;
+            newentries = realloc(*entries, cap * sizeof(*newentries));
+            TRY_PTR(newentries, DO_CLEAN_ALL())
+            *entries = newentries;
+            stats_count(STATS_ALLOCS, 1);
         }
+
+        (*entries)[*entrycnt].ino = pdir->d_ino;
+        TRY_PTR((*entries)[*entrycnt].name = strdup(pdir->d_name),
+                DO_CLEAN_ALL())
+        stats_count(STATS_ALLOCS, 1);
+        (*entrycnt)++;
     }
+
+    closedir(pd);
+    qsort(*entries, *entrycnt, sizeof(**entries), &cmp_entry_inodes);
+    RET_OK()
+
+    CLEANUP_ALL(
+        closedir(pd);
+        cleanup_entries(*entries, *entrycnt);
+        *entries = NULL;
+        *entrycnt = 0);
+    ZIC_RETURN_RESULT()
 }
 
-static int setup_threadargs(lookupthread_args *threadargpool, const int tid,
-                            const int thcount, const int entrycnt,
-                            const int thoutfd, searchsyms *searchargs,
-                            char *patchdir, pthread_mutex_t *fmutex) {
-    lookupthread_args *thargs;
-    int descffd;
-    char descfname[] = DESCFILE;
+/* hits printed sorted are collected first, see struct fuzzy_hit */
+static bool collect_scan_hits(const searchsyms *searchargs) {
+    return searchargs->s_flags.max_edits || searchargs->s_flags.top_k;
+}
+
+/* the arguments of every worker of a scan and the state they share */
+struct scan_workers {
+    lookupthread_args *args;
+    size_t cnt;
+    pthread_mutex_t mutex;
+    struct fuzzy_hits fuzzy_hits;
+};
+
+static result init_scan_workers(struct scan_workers *workers, size_t cnt,
+                                const struct scan_source *src,
+                                searchsyms *searchargs,
+                                struct search_output *out) {
+    memset(workers, 0, sizeof(*workers));
+    pthread_mutex_init(&workers->mutex, NULL);
+
+    workers->args = calloc(cnt, sizeof(*workers->args));
+    UNWRAP_PTR(workers->args)
+    workers->cnt = cnt;
+
+    for (size_t tid = 0; tid < cnt; tid++) {
+        setup_threadargs(workers->args, tid, out, searchargs, src,
+                         cnt > 1 ? &workers->mutex : NULL,
+                         collect_scan_hits(searchargs) ? &workers->fuzzy_hits
+                                                       : NULL);
+    }
+
+    RET_OK()
+}
 
-    if (thcount < 1 || entrycnt < 1 || tid < 0 || tid >= thcount) {
-        ERROR(ERR_LOCAL)
+/* the first error of a worker, or the fuzzy hits printed */
+static result finish_scan_workers(struct scan_workers *workers,
+                                  searchsyms *searchargs,
+                                  struct search_output *out) {
+    for (size_t tid = 0; tid < workers->cnt; tid++) {
+        if (workers->args[tid].result)
+            return workers->args[tid].result;
     }
 
-    thargs = threadargpool + tid;
-    descffd = mkstemp(descfname);
-    UNWRAP_NEG(descffd)
+    if (collect_scan_hits(searchargs))
+        return print_fuzzy_hits(out, &workers->fuzzy_hits, searchargs);
 
-    thargs->descfname = strndup(descfname, DESCFILE_LEN);
-    UNWRAP_PTR(thargs->descfname)
+    RET_OK()
+}
 
-    thargs->descffd = descffd;
-    thargs->outfd = thoutfd;
-    thargs->mutex = fmutex;
-    thargs->patchdir = patchdir;
-    thargs->searchargs = searchargs;
+static void free_scan_workers(struct scan_workers *workers) {
+    for (size_t tid = 0; tid < workers->cnt; tid++) {
+        free_desc_cursor(&workers->args[tid].cursor);
+    }
+
+    free_fuzzy_hits(&workers->fuzzy_hits);
+    free(workers->args);
+    pthread_mutex_destroy(&workers->mutex);
+}
+
+/* the items are already pushed to the pool, fn searches one of them */
+static result run_workpool(struct workpool *pool, work_fn fn,
+                           const struct scan_source *src,
+                           searchsyms *searchargs, struct search_output *out) {
+    struct scan_workers workers;
+
+    ZIC_RESULT_INIT()
+
+    TRY(init_scan_workers(&workers, pool->worker_cnt, src, searchargs, out),
+        DO_CLEAN_ALL())
+
+    UNWRAP_DO_CLEAN_ALL(workpool_run(pool, fn, workers.args))
+
+    ZIC_RESULT = finish_scan_workers(&workers, searchargs, out);
+
+    CLEANUP_ALL(free_scan_workers(&workers));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * index.md files read through io_uring, copied out of the ring's buffers
+ * and handed to the pool a batch at a time
+ */
+struct read_batch {
+    size_t cnt;
+    const char *names[URING_BATCH];
+    uint32_t offs[URING_BATCH];
+    uint32_t lens[URING_BATCH];
+    struct growbuf text;
+};
+
+struct uring_scan {
+    lookupthread_args *args;
+    const struct patch_dirent *entries;
+    struct workpool *pool;
+    struct read_batch *batch;
+};
+
+static void free_read_batch(struct read_batch *batch) {
+    if (!batch)
+        return;
+
+    growbuf_free(&batch->text);
+    free(batch);
+}
+
+static void search_read_batch(void *item, void *thread_args,
+                              size_t worker_id) {
+    lookupthread_args *args = (lookupthread_args *)thread_args + worker_id;
+    struct read_batch *batch = item;
+    result search_res;
+
+    for (size_t i = 0; i < batch->cnt; i++) {
+        search_res = search_patch_text(args, batch->names[i],
+                                       batch->text.data + batch->offs[i],
+                                       batch->lens[i]);
+
+        if (IS_OK(args->result))
+            args->result = search_res;
+    }
+
+    free_read_batch(batch);
+}
 
-    if (thcount == 1) {
-        thargs->startpoint = 0;
-        thargs->endpoint = entrycnt;
+static result feed_read_batch(struct uring_scan *scan) {
+    result fed;
+
+    if (!scan->batch)
         RET_OK()
+
+    fed = workpool_feed(scan->pool, scan->batch);
+    if (fed)
+        free_read_batch(scan->batch);
+
+    scan->batch = NULL;
+    return fed;
+}
+
+static result search_read_md(size_t file, const char *md, size_t mdlen,
+                             void *ctx) {
+    struct uring_scan *scan = ctx;
+    struct read_batch *batch = scan->batch;
+
+    if (!scan->pool)
+        return search_patch_text(scan->args, scan->entries[file].name, md,
+                                 mdlen);
+
+    if (!batch) {
+        UNWRAP_PTR(batch = calloc(1, sizeof(*batch)))
+        stats_count(STATS_ALLOCS, 1);
+        scan->batch = batch;
     }
 
-    assign_thread_bounds(threadargpool, tid, thcount, entrycnt);
+    UNWRAP(growbuf_append(&batch->text, md, mdlen, batch->offs + batch->cnt))
+    batch->names[batch->cnt] = scan->entries[file].name;
+    batch->lens[batch->cnt] = (uint32_t)mdlen;
+
+    if (++batch->cnt == URING_BATCH)
+        return feed_read_batch(scan);
+
     RET_OK()
 }
 
-static void cleanup_descfname(lookupthread_args *thargs) {
-    free(thargs->descfname);
+static bool scan_io_pool_forced(void) {
+    const char *io = getenv(SCAN_IO_ENV);
+
+    return io && !strcmp(io, SCAN_IO_POOL);
 }
 
-static void cleanup_searchargs(searchsyms *sargs) {
-    for (size_t i = 0; i < sargs->wordcount; i++) {
-        free(sargs->words[i]);
+/*
+ * The index.md files are read in batches through io_uring. With a single
+ * worker they are matched on this thread as they arrive, the matching is
+ * cheap next to a cold read; otherwise the files are copied out and fed
+ * to the pool a batch at a time while the next batches are read.
+ * ERR_NO_URING leaves the scan to the pool of blocking readers.
+ */
+static result scan_uring(char *patchdir, const struct patch_dirent *entries,
+                         size_t entrycnt, searchsyms *searchargs,
+                         struct search_output *out, size_t workercnt) {
+    struct scan_source src = {.patchdir = patchdir};
+    struct scan_workers workers;
+    struct workpool pool;
+    struct uring_scan scan = {.entries = entries};
+    char **paths = NULL;
+    size_t pathcnt = 0;
+    result got;
+    int dirfd;
+
+    ZIC_RESULT_INIT()
+
+    UNWRAP_NEG(dirfd = open(patchdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+
+    paths = calloc(entrycnt ? entrycnt : 1, sizeof(*paths));
+    TRY_PTR(paths, DO_CLEAN(cl_dir))
+
+    for (; pathcnt < entrycnt; pathcnt++) {
+        TRY(spappend(paths + pathcnt, entries[pathcnt].name, INDEXMD),
+            DO_CLEAN(cl_paths))
     }
-    free(sargs->words);
+
+    TRY(init_scan_workers(&workers, workercnt, &src, searchargs, out),
+        DO_CLEAN(cl_workers))
+    scan.args = workers.args;
+
+    if (workercnt > 1) {
+        TRY(workpool_init(&pool, workercnt), DO_CLEAN(cl_workers))
+        TRY(workpool_start(&pool, &search_read_batch, workers.args),
+            DO_CLEAN(cl_pool))
+        scan.pool = &pool;
+    }
+
+    got = uring_read_files(dirfd, (const char *const *)paths, pathcnt,
+                            &search_read_md, &scan);
+
+    if (scan.pool) {
+        if (IS_OK(got))
+            got = feed_read_batch(&scan);
+
+        free_read_batch(scan.batch);
+        workpool_finish(scan.pool);
+    }
+
+    /* ERR_NO_URING is only returned before any file is fed */
+    ZIC_RESULT = got ? got
+                     : finish_scan_workers(&workers, searchargs, out);
+
+    CLEANUP(cl_pool,
+        if (workercnt > 1)
+            workpool_destroy(&pool));
+    CLEANUP(cl_workers, free_scan_workers(&workers));
+    CLEANUP(cl_paths,
+        for (size_t i = 0; i < pathcnt; i++)
+            free(paths[i]);
+        free(paths));
+    CLEANUP(cl_dir, close(dirfd));
+    ZIC_RETURN_RESULT()
 }
 
-int run_search(char *patchdir, searchsyms *searchargs) {
-    DIR *pd = NULL;
-    struct dirent *pdir = NULL;
-    int tentrycnt = 0;
+static result scan_tool(char *patchdir, searchsyms *searchargs,
+                        struct search_output *out, size_t jobs) {
+    struct scan_source src = {.patchdir = patchdir};
+    struct patch_dirent *entries = NULL;
+    struct workpool pool;
+    size_t entrycnt = 0;
+    size_t workers;
+    uint64_t start;
+    result scanned;
 
     ZIC_RESULT_INIT()
 
-    UNWRAP_PTR(pd = opendir(patchdir))
+    start = stats_begin();
+    UNWRAP(collect_patch_entries(&entries, &entrycnt, patchdir))
+    stats_end(STATS_READDIR, start);
 
-    while ((pdir = readdir(pd))) {
-        if (pdir->d_type == DT_DIR)
-            tentrycnt++;
+    workers = search_workers_count(entrycnt, jobs);
+
+    if (!scan_io_pool_forced()) {
+        scanned = scan_uring(patchdir, entries, entrycnt, searchargs, out,
+                             workers);
+        if (scanned != ERR_NO_URING) {
+            ZIC_RESULT = scanned;
+            DO_CLEAN(cl_entries)
+        }
     }
-    UNWRAP(closedir(pd))
 
-    if (worth_multithread(tentrycnt)) {
-        ZIC_RESULT = /*run_multithreaded(patchdir, searchargs, tentrycnt);*/ 0;
-    } else {
-        lookupthread_args thargs = {0};
-        lookupthread_args *thargsp = NULL;
+    TRY(workpool_init(&pool, workers), DO_CLEAN(cl_entries))
+
+    for (size_t i = 0; i < entrycnt; i++) {
+        UNWRAP_DO_CLEAN_ALL(workpool_push(&pool, entries[i].name))
+    }
 
-        UNWRAP(setup_threadargs(&thargs, 0, 1, tentrycnt, STDOUT_FILENO,
-                                searchargs, patchdir, NULL))
+    ZIC_RESULT = run_workpool(&pool, &search_entry, &src, searchargs, out);
 
-        thargsp = &thargs;
+    CLEANUP_ALL(workpool_destroy(&pool));
+    CLEANUP(cl_entries, cleanup_entries(entries, entrycnt));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Without a search index the descriptions are read from the store sync
+ * wrote with the catalog: one file, a block decoded per worker item,
+ * instead of an index.md per patch. ERR_NO_CATALOG if there is none.
+ */
+static result scan_store(const char *basecacherepo, const char *toolname,
+                         searchsyms *searchargs, struct search_output *out,
+                         size_t jobs) {
+    struct patch_catalog cat;
+    struct desc_store store;
+    struct scan_source src = {.cat = &cat, .store = &store};
+    struct workpool pool;
+    uint32_t *blocks = NULL;
+    size_t workers;
 
-        lookup_entries(thargsp);
-        ZIC_RESULT = thargsp->result;
-        cleanup_descfname(thargsp);
-        cleanup_searchargs(thargsp->searchargs);
+    ZIC_RESULT_INIT()
+
+    if (open_patch_catalog(&cat, basecacherepo, toolname))
+        ERROR(ERR_NO_CATALOG)
+
+    if (open_desc_store(&store, basecacherepo, toolname))
+        ERROR_DO_CLEAN(ERR_NO_CATALOG, DO_CLEAN(cl_cat))
+
+    if (store.hdr->patch_cnt != cat.hdr->patch_cnt)
+        ERROR_DO_CLEAN(ERR_NO_CATALOG, DO_CLEAN(cl_store))
+
+    blocks = calloc(store.hdr->block_cnt + 1, sizeof(*blocks));
+    TRY_PTR(blocks, DO_CLEAN(cl_store))
+
+    workers = search_workers_count(store.hdr->patch_cnt, jobs);
+    if (workers > store.hdr->block_cnt)
+        workers = store.hdr->block_cnt ? store.hdr->block_cnt : 1;
+
+    TRY(workpool_init(&pool, workers), DO_CLEAN(cl_blocks))
+
+    for (uint32_t b = 0; b < store.hdr->block_cnt; b++) {
+        blocks[b] = b;
+        UNWRAP_DO_CLEAN_ALL(workpool_push(&pool, blocks + b))
     }
+
+    ZIC_RESULT =
+        run_workpool(&pool, &search_store_block, &src, searchargs, out);
+
+    CLEANUP_ALL(workpool_destroy(&pool));
+    CLEANUP(cl_blocks, free(blocks));
+    CLEANUP(cl_store, close_desc_store(&store));
+    CLEANUP(cl_cat, close_patch_catalog(&cat));
     ZIC_RETURN_RESULT()
 }
 
-int parse_search_args(int argc, char **argv, const char *basecacherepo) {
-    char *patchdir = NULL;
-    searchsyms *searchargs = NULL;
-    size_t startp = 2, toolname_argpos;
-    int option;
+/* a scan cannot rank with BM25, -n gets the first K matches by name */
+static bool warn_unranked(const searchsyms *searchargs, const char *toolname) {
+    if (!searchargs->s_flags.top_k || searchargs->s_flags.max_edits)
+        return false;
 
-    ZIC_RESULT_INIT();
+    PRINT_ERR("Search index for '%s' is not available, results are not "
+              "ranked but taken by name.", toolname);
+    return true;
+}
 
-    if (IS_OK(strncmp(argv[CMD_ARGPOS], SEARCH_CMD, CMD_LEN))) {
-        startp++;
+static result scan_patches(const char *basecacherepo, const char *toolname,
+                           char *patchdir, searchsyms *searchargs,
+                           struct search_output *out, size_t jobs) {
+    result scanned;
+
+    scanned = scan_store(basecacherepo, toolname, searchargs, out, jobs);
+    if (scanned != ERR_NO_CATALOG)
+        return scanned;
+
+    return scan_tool(patchdir, searchargs, out, jobs);
+}
+
+static result search_tool(const char *basecacherepo, const char *toolname,
+                          char *patchdir, searchsyms *searchargs,
+                          struct search_output *out, size_t jobs) {
+    struct search_index idx;
+    uint64_t start = stats_begin();
+    result opened;
+
+    ZIC_RESULT_INIT()
+
+    opened = open_search_index(&idx, basecacherepo, toolname);
+    stats_end(STATS_INDEX_OPEN, start);
+
+    if (IS_OK(opened)) {
+        start = stats_begin();
+        ZIC_RESULT = search_index_lookup(&idx, searchargs, out);
+        stats_end(STATS_INDEX_LOOKUP, start);
+        close_search_index(&idx);
+        ZIC_RETURN_RESULT()
     }
 
-    toolname_argpos = startp - TOOLNAME_ARGPOS + 1;
+    warn_unranked(searchargs, toolname);
+    return scan_patches(basecacherepo, toolname, patchdir, searchargs, out,
+                        jobs);
+}
 
-    if (toolname_argpos >= (size_t)argc) {
+/*
+ * Full descriptions are bulky, so they skip stdio and are written to
+ * stdout from the mappings they are found in.
+ */
+int run_search(const char *basecacherepo, const char *toolname,
+               char *patchdir, searchsyms *searchargs) {
+    struct search_output out = {.f = stdout};
+    result flushed;
+
+    ZIC_RESULT_INIT()
+
+    if (searchargs->s_flags.print_full_patch)
+        UNWRAP(open_direct_output(&out, STDOUT_FILENO))
+
+    ZIC_RESULT = search_tool(basecacherepo, toolname, patchdir, searchargs,
+                             &out, searchargs->s_flags.jobs);
+
+    flushed = close_direct_output(&out);
+    if (IS_OK(ZIC_RESULT))
+        ZIC_RESULT = flushed;
+
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * A --all search runs one shard per tool. Every shard prints into its own
+ * memory stream, and the streams are merged in tool order once all of
+ * them are done.
+ */
+struct tool_shard {
+    char toolname[PATHBUF];
+    char *patchdir;
+    char *buf;
+    size_t buflen;
+    result result;
+};
+
+struct shard_list {
+    struct tool_shard *shards;
+    size_t cnt;
+    size_t cap;
+};
+
+struct shard_ctx {
+    const char *basecacherepo;
+    searchsyms *searchargs;
+};
+
+static result add_tool_shard(const char *toolname, const char *patchdir,
+                             void *ctx) {
+    struct shard_list *list = ctx;
+    struct tool_shard *shard = NULL;
+
+    if (list->cnt == list->cap) {
+        size_t newcap = list->cap ? list->cap * 2 : ENTRYLEN;
+        struct tool_shard *newshards =
+            realloc(list->shards, newcap * sizeof(*newshards));
+
+        UNWRAP_PTR(newshards)
+        list->shards = newshards;
+        list->cap = newcap;
+    }
+
+    shard = list->shards + list->cnt;
+    memset(shard, 0, sizeof(*shard));
+    strlcpy(shard->toolname, toolname, sizeof(shard->toolname));
+    UNWRAP_PTR(shard->patchdir = strdup(patchdir))
+
+    list->cnt++;
+    RET_OK()
+}
+
+static void cleanup_shards(struct shard_list *list) {
+    for (size_t i = 0; i < list->cnt; i++) {
+        free(list->shards[i].patchdir);
+        free(list->shards[i].buf);
+    }
+    free(list->shards);
+}
+
+static int cmp_shards(const void *a, const void *b) {
+    const struct tool_shard *sa = a, *sb = b;
+
+    return strcmp(sa->toolname, sb->toolname);
+}
+
+static void search_shard(void *item, void *ctx, size_t worker_id) {
+    struct tool_shard *shard = item;
+    struct shard_ctx *sctx = ctx;
+    struct search_output out = {0};
+
+    KINDA_USE_ARG(worker_id)
+
+    out.f = open_memstream(&shard->buf, &shard->buflen);
+    if (!out.f) {
+        shard->result = ERR_SYS;
+        return;
+    }
+
+    /* shards already run in parallel, so each one scans on its own */
+    shard->result = search_tool(sctx->basecacherepo, shard->toolname,
+                                shard->patchdir, sctx->searchargs, &out, 1);
+
+    if (fclose(out.f) && IS_OK(shard->result))
+        shard->result = ERR_SYS;
+}
+
+static result print_shards(const struct shard_list *list) {
+    bool printed = false;
+
+    for (size_t i = 0; i < list->cnt; i++) {
+        const struct tool_shard *shard = list->shards + i;
+
+        if (!shard->buflen)
+            continue;
+
+        printf("%s%s:\n", printed ? "\n" : "", shard->toolname);
+        if (fwrite(shard->buf, 1, shard->buflen, stdout) < shard->buflen)
+            ERROR(ERR_SYS)
+
+        printed = true;
+    }
+    RET_OK()
+}
+
+static result run_search_all(const char *basecacherepo,
+                             searchsyms *searchargs) {
+    struct shard_list list = {0};
+    struct shard_ctx ctx = {basecacherepo, searchargs};
+    struct workpool pool;
+    size_t jobs = searchargs->s_flags.jobs;
+
+    ZIC_RESULT_INIT()
+
+    TRY(iter_mirror_tools(basecacherepo, &add_tool_shard, &list),
+        DO_CLEAN(cl_shards))
+
+    qsort(list.shards, list.cnt, sizeof(*list.shards), cmp_shards);
+
+    if (!jobs)
+        jobs = online_cpus();
+    if (jobs > list.cnt)
+        jobs = list.cnt;
+
+    TRY(workpool_init(&pool, jobs ? jobs : 1), DO_CLEAN(cl_shards))
+
+    for (size_t i = 0; i < list.cnt; i++) {
+        UNWRAP_DO_CLEAN_ALL(workpool_push(&pool, list.shards + i))
+    }
+
+    UNWRAP_DO_CLEAN_ALL(workpool_run(&pool, &search_shard, &ctx))
+
+    for (size_t i = 0; i < list.cnt; i++) {
+        if (list.shards[i].result) {
+            ZIC_RESULT = list.shards[i].result;
+            DO_CLEAN_ALL()
+        }
+    }
+
+    ZIC_RESULT = print_shards(&list);
+
+    CLEANUP_ALL(workpool_destroy(&pool));
+    CLEANUP(cl_shards, cleanup_shards(&list));
+    ZIC_RETURN_RESULT()
+}
+
+static result parse_count(const char *countarg, size_t *count) {
+    char *endp = NULL;
+    unsigned long parsed_count;
+
+    errno = 0;
+    parsed_count = strtoul(countarg, &endp, 10);
+    if (errno || endp == countarg || *endp != ASCNULL || parsed_count == 0)
         ERROR(ERR_INVARG)
+
+    *count = parsed_count;
+    RET_OK()
+}
+
+/*
+ * Aliases from the tool registry share the index of the tool they name.
+ */
+static void resolve_toolname(char *toolname, size_t namesize,
+                             const char *basecacherepo, const char *name) {
+    struct tool_registry reg;
+    struct tool_entry tool;
+
+    strlcpy(toolname, name, namesize);
+
+    if (open_tool_registry(&reg, basecacherepo))
+        return;
+
+    if (IS_OK(registry_lookup(&reg, name, &tool)))
+        strlcpy(toolname, tool.name, namesize);
+
+    close_tool_registry(&reg);
+}
+
+/*
+ * --batch reads one '<tool> [keywords]' query per line from stdin. A tool
+ * is resolved and its index opened the first time a query names it, and
+ * every line a query prints is tagged with the query's line number.
+ * A tool without an index is reported as unranked once per batch.
+ */
+struct batch_tool {
+    char name[ENTRYLEN];
+    char toolname[ENTRYLEN];
+    char *patchdir;
+    struct search_index idx;
+    bool indexed;
+    bool warned_unranked;
+};
+
+struct batch_tools {
+    struct batch_tool *tools;
+    size_t cnt;
+    size_t cap;
+};
+
+static void cleanup_batch_tools(struct batch_tools *tools) {
+    for (size_t i = 0; i < tools->cnt; i++) {
+        free(tools->tools[i].patchdir);
+        close_search_index(&tools->tools[i].idx);
     }
+    free(tools->tools);
+}
 
-    TRY(append_toolpath(&patchdir, basecacherepo, argv[toolname_argpos]),
-        HANDLE_PRINT_ERR("Suckless tool with name: '%s' not found",
-               argv[toolname_argpos]););
+/*
+ * A tool that is not found is remembered too, with no patchdir, so a batch
+ * full of typos does not walk the mirror for every line.
+ */
+static result get_batch_tool(struct batch_tools *tools,
+                             const char *basecacherepo, const char *name,
+                             struct batch_tool **tool) {
+    struct batch_tool *added = NULL;
+    uint64_t start;
 
-    searchargs = calloc(1, sizeof(*searchargs));
-    TRY_PTR(searchargs, DO_CLEAN(cl_pdir));
+    for (size_t i = 0; i < tools->cnt; i++) {
+        if (IS_OK(strcmp(tools->tools[i].name, name))) {
+            *tool = tools->tools + i;
+            RET_OK()
+        }
+    }
 
-    TRY(parse_search_symbols(searchargs, argv + startp, argc - startp),
-        HANDLE_PRINT_ERR_DO_CLEAN_ALL("Invalid search string"));
+    if (tools->cnt == tools->cap) {
+        size_t newcap = tools->cap ? tools->cap * 2 : ENTRYLEN;
+        struct batch_tool *newtools =
+            realloc(tools->tools, newcap * sizeof(*newtools));
+
+        UNWRAP_PTR(newtools)
+        tools->tools = newtools;
+        tools->cap = newcap;
+    }
+
+    added = tools->tools + tools->cnt++;
+    memset(added, 0, sizeof(*added));
+    strlcpy(added->name, name, sizeof(added->name));
+
+    start = stats_begin();
+    if (IS_OK(append_toolpath(&added->patchdir, basecacherepo, name))) {
+        resolve_toolname(added->toolname, sizeof(added->toolname),
+                         basecacherepo, name);
+        stats_end(STATS_RESOLVE, start);
+
+        start = stats_begin();
+        added->indexed = IS_OK(
+            open_search_index(&added->idx, basecacherepo, added->toolname));
+        stats_end(STATS_INDEX_OPEN, start);
+    }
+
+    *tool = added;
+    RET_OK()
+}
+
+static result print_tagged(size_t queryid, const char *buf, size_t buflen) {
+    const char *pos = buf, *end = buf + buflen;
+
+    while (pos < end) {
+        const char *eol = memchr(pos, '\n', end - pos);
+        size_t linelen = eol ? (size_t)(eol - pos) : (size_t)(end - pos);
+
+        if (printf("%zu\t%.*s\n", queryid, (int)linelen, pos) < 0)
+            ERROR(ERR_SYS)
+
+        pos += linelen + 1;
+    }
+    RET_OK()
+}
 
-    while ((option = getopt(argc, argv, "f")) != -1) {
+/*
+ * Splits the query in place into words the way sh does: blanks separate
+ * words, single quotes keep everything up to the next one, double quotes
+ * keep blanks and a backslash outside single quotes takes the next
+ * character as it is. Nothing is expanded.
+ */
+static result split_query(char *query, char **words, size_t *wordcnt) {
+    char *in = query, *out = query;
+    char quote = ASCNULL;
+    bool inword = false;
+
+    *wordcnt = 0;
+
+    for (; *in; in++) {
+        if (!quote && isspace((unsigned char)*in)) {
+            if (inword)
+                *out++ = ASCNULL;
+            inword = false;
+            continue;
+        }
+
+        if (!inword) {
+            words[(*wordcnt)++] = out;
+            inword = true;
+        }
+
+        if (quote && *in == quote) {
+            quote = ASCNULL;
+        } else if (!quote && (*in == '\'' || *in == '"')) {
+            quote = *in;
+        } else if (*in == '\\' && quote != '\'' && in[1] &&
+                   (!quote || in[1] == '"' || in[1] == '\\')) {
+            *out++ = *++in;
+        } else {
+            *out++ = *in;
+        }
+    }
+
+    if (quote)
+        ERROR(ERR_INVARG)
+
+    *out = ASCNULL;
+    RET_OK()
+}
+
+static result run_batch_query(const char *basecacherepo,
+                              struct batch_tools *tools,
+                              const struct search_flags *flags, char *query,
+                              size_t queryid) {
+    searchsyms searchargs = {.s_flags = *flags};
+    struct search_output out = {0};
+    struct batch_tool *tool = NULL;
+    char **words = NULL, *buf = NULL;
+    size_t wordcnt = 0, buflen = 0;
+    uint64_t start;
+
+    ZIC_RESULT_INIT()
+
+    /* split like the shell would, so the words parse as search arguments */
+    UNWRAP_PTR(words = calloc(strlen(query) / 2 + 1, sizeof(*words)))
+
+    TRY(split_query(query, words, &wordcnt),
+        PRINT_ERR("%zu: Unterminated quote", queryid);
+        DO_CLEAN(cl_words))
+
+    /* blank lines keep their number but are not queries */
+    if (!wordcnt)
+        DO_CLEAN(cl_words)
+
+    TRY(get_batch_tool(tools, basecacherepo, words[0], &tool),
+        DO_CLEAN(cl_words))
+
+    if (!tool->patchdir) {
+        PRINT_ERR("%zu: Suckless tool with name: '%s' not found", queryid,
+                  words[0]);
+        ERROR_DO_CLEAN(ERR_ENTRY_NOT_FOUND, DO_CLEAN(cl_words))
+    }
+
+    start = stats_begin();
+    TRY(parse_search_symbols(&searchargs, words + 1, wordcnt - 1),
+        PRINT_ERR("%zu: Invalid search string", queryid);
+        DO_CLEAN_ALL())
+    stats_end(STATS_PARSE, start);
+
+    TRY_PTR(out.f = open_memstream(&buf, &buflen), DO_CLEAN_ALL())
+
+    if (tool->indexed) {
+        start = stats_begin();
+        ZIC_RESULT = search_index_lookup(&tool->idx, &searchargs, &out);
+        stats_end(STATS_INDEX_LOOKUP, start);
+    } else {
+        if (!tool->warned_unranked)
+            tool->warned_unranked = warn_unranked(&searchargs, tool->toolname);
+
+        ZIC_RESULT = scan_patches(basecacherepo, tool->toolname,
+                                  tool->patchdir, &searchargs, &out,
+                                  flags->jobs);
+    }
+
+    if (fclose(out.f) && IS_OK(ZIC_RESULT))
+        ZIC_RESULT = ERR_SYS;
+
+    if (IS_OK(ZIC_RESULT))
+        ZIC_RESULT = print_tagged(queryid, buf, buflen);
+
+    free(buf);
+    CLEANUP_ALL(cleanup_searchargs(&searchargs));
+    CLEANUP(cl_words, free(words));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * A failed query is reported and the batch goes on, the batch fails
+ * when any of its queries did.
+ */
+static result run_search_batch(const char *basecacherepo,
+                               const struct search_flags *flags) {
+    struct batch_tools tools = {0};
+    char *line = NULL;
+    size_t linecap = 0, queryid = 0;
+    ssize_t linelen;
+    bool failed = false;
+
+    ZIC_RESULT_INIT()
+
+    while ((linelen = getline(&line, &linecap, stdin)) >= 0) {
+        queryid++;
+
+        if (linelen && line[linelen - 1] == '\n')
+            line[linelen - 1] = ASCNULL;
+
+        ZIC_RESULT =
+            run_batch_query(basecacherepo, &tools, flags, line, queryid);
+
+        if (ZIC_RESULT == ERR_SYS)
+            DO_CLEAN_ALL()
+
+        failed |= ZIC_RESULT != OK;
+    }
+
+    ZIC_RESULT = ferror(stdin) ? ERR_SYS : failed ? FAIL : OK;
+
+    CLEANUP_ALL(
+        free(line);
+        cleanup_batch_tools(&tools));
+    ZIC_RETURN_RESULT()
+}
+
+static const struct option search_long_options[] = {
+    {"all", no_argument, NULL, 'a'},
+    {"batch", no_argument, NULL, 'b'},
+    {NULL, 0, NULL, 0},
+};
+
+int parse_search_args(int argc, char **argv, const char *basecacherepo) {
+    char toolname[ENTRYLEN] = {0};
+    char *patchdir = NULL;
+    searchsyms *searchargs = NULL;
+    size_t startp, toolname_argpos;
+    uint64_t start;
+    int option;
+
+    ZIC_RESULT_INIT();
+
+    searchargs = calloc(1, sizeof(*searchargs));
+    UNWRAP_PTR(searchargs);
+
+    while ((option = getopt_long(argc, argv, "fj:n:~:", search_long_options,
+                                 NULL)) != -1) {
         switch (option) {
+        case 'a':
+            searchargs->s_flags.all_tools = true;
+            break;
+        case 'b':
+            searchargs->s_flags.batch = true;
+            break;
         case 'f':
             searchargs->s_flags.print_full_patch = true;
             break;
+        case 'j':
+            TRY(parse_count(optarg, &searchargs->s_flags.jobs),
+                HANDLE_PRINT_ERR_DO_CLEAN_ALL("Invalid jobs count: '%s'",
+                                              optarg));
+            break;
+        case 'n':
+            TRY(parse_count(optarg, &searchargs->s_flags.top_k),
+                HANDLE_PRINT_ERR_DO_CLEAN_ALL("Invalid result count: '%s'",
+                                              optarg));
+            break;
+        case '~':
+            TRY(parse_count(optarg, &searchargs->s_flags.max_edits),
+                HANDLE_PRINT_ERR_DO_CLEAN_ALL("Invalid edit distance: '%s'",
+                                              optarg));
+            break;
         case '?':
             ERROR_DO_CLEAN(ERR_INVARG, DO_CLEAN_ALL());
             break;
         }
     }
 
-    TRY(run_search(patchdir, searchargs),
-        CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL()));
+    startp = optind;
+    if (startp < (size_t)argc &&
+        IS_OK(strncmp(argv[startp], SEARCH_CMD, CMD_LEN))) {
+        startp++;
+    }
+
+    if (searchargs->s_flags.batch) {
+        if (startp < (size_t)argc || searchargs->s_flags.all_tools)
+            ERROR_DO_CLEAN(ERR_INVARG, DO_CLEAN_ALL())
+
+        TRY(run_search_batch(basecacherepo, &searchargs->s_flags),
+            CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL());
+            DO_CLEAN_ALL());
+        RET_OK_DO_CLEAN_ALL()
+    }
+
+    if (searchargs->s_flags.all_tools) {
+        start = stats_begin();
+        TRY(parse_search_symbols(searchargs, argv + startp, argc - startp),
+            HANDLE_PRINT_ERR_DO_CLEAN_ALL("Invalid search string"));
+        stats_end(STATS_PARSE, start);
+
+        TRY(run_search_all(basecacherepo, searchargs),
+            CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL());
+            DO_CLEAN_ALL());
+        RET_OK_DO_CLEAN_ALL()
+    }
+
+    toolname_argpos = startp++;
+
+    if (toolname_argpos >= (size_t)argc) {
+        ERROR_DO_CLEAN(ERR_INVARG, DO_CLEAN_ALL())
+    }
+
+    start = stats_begin();
+    TRY(append_toolpath(&patchdir, basecacherepo, argv[toolname_argpos]),
+        HANDLE_PRINT_ERR_DO_CLEAN_ALL("Suckless tool with name: '%s' not found",
+               argv[toolname_argpos]););
+    resolve_toolname(toolname, sizeof(toolname), basecacherepo,
+                     argv[toolname_argpos]);
+    stats_end(STATS_RESOLVE, start);
+
+    start = stats_begin();
+    TRY(parse_search_symbols(searchargs, argv + startp, argc - startp),
+        HANDLE_PRINT_ERR_DO_CLEAN_ALL("Invalid search string"));
+    stats_end(STATS_PARSE, start);
+
+    TRY(run_search(basecacherepo, toolname, patchdir, searchargs),
+        CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL());
+        DO_CLEAN_ALL());
 
-    CLEANUP_ALL(free(searchargs));
-    CLEANUP(cl_pdir, free(patchdir))
+    CLEANUP_ALL(
+        cleanup_searchargs(searchargs);
+        free(patchdir);
+        free(searchargs));
     ZIC_RETURN_RESULT();
 }
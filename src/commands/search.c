@@ -14,6 +14,7 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 */
 
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,121 +30,84 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include <stdarg.h> 
 #include <ctype.h>
 #include <pwd.h>
+#include <sys/uio.h>
 #include "commands/search.h"
 #include "def.h"
 #include "utils/entry-utils.h"
+#include "utils/fileutils.h"
 #include "utils/pathutils.h"
+#include "utils/stats.h"
 #include "utils/logutils.h"
 
-static int 
-is_line_separator(const char *line) {
-    return (line[0] & line[1] & line[2]) == '-';
-}
-
-static result 
-check_matched_all(const bool *is_matched, const size_t wordcount) {
-    for (size_t i = 0; i < wordcount; i++) {
-        if (!is_matched[i])
-            FAIL()
-    }
-    RET_OK()
-}
+#define RESULT_HEAD_LEN (DESCRIPTION_SEPARATOR_LEN + ENTRYLEN + 32)
 
 static int 
-iter_search_words(const char *searchbuf, bool *matched, const searchsyms *sargs) {
-    for (size_t i = 0; i < sargs->wordcount; i++) {
-        if (!matched[i]) {
-            if (strstr(searchbuf, sargs->words[i])) {
-                matched[i] = true;
-
-                if (IS_OK(check_matched_all(matched, sargs->wordcount)))
-                    return 1;
-            }
-        }
-    }
-    return 0;
+is_line_separator(const char *line, const char *end) {
+    return end - line >= 3 && (line[0] & line[1] & line[2]) == '-';
 }
 
-static int
-toolname_contains_searchword(const char *toolname, bool *matched, const searchsyms *sargs) {
-    return iter_search_words(toolname, matched, sargs);
+static const char *
+next_line(const char *line, const char *end) {
+    const char *eol = memchr(line, '\n', end - line);
+    return eol ? eol + 1 : end;
 }
 
 static result
-searchdescr(FILE *descfile, const char *toolname, const searchsyms *sargs) {
-    char searchbuf[LINEBUF] = {0};
-    bool *matched = NULL;
+searchdescr(const struct desc_span *desc, const char *toolname, const searchsyms *sargs) {
+    uint64_t *matched = NULL;
 
     ZIC_RESULT_INIT()
 
-    matched = calloc(sargs->wordcount, sizeof(*matched));
+    matched = matcher_alloc_mask(&sargs->matcher);
     UNWRAP_PTR (matched)
+    stats_count(STATS_ALLOCS, 1);
 
-    if (toolname_contains_searchword(toolname, matched, sargs))
+    if (matcher_scan(&sargs->matcher, toolname, strlen(toolname), matched))
         RET_OK_DO_CLEAN_ALL()
 
-    while (fgets(searchbuf, sizeof(searchbuf), descfile)) {
-        if (iter_search_words(searchbuf, matched, sargs))
-            RET_OK_DO_CLEAN_ALL()
-
-        memset(searchbuf, ASCNULL, sizeof(searchbuf));
-    }
+    if (matcher_scan(&sargs->matcher, desc->text, desc->len, matched))
+        RET_OK_DO_CLEAN_ALL()
 
-    ZIC_RESULT = check_matched_all(matched, sargs->wordcount);
+    ZIC_RESULT = FAIL;
     
-    CLEANUP_ALL(
-        free(matched);
-        fseek(descfile, 0, SEEK_SET);
-	);
+    CLEANUP_ALL(free(matched));
 	ZIC_RETURN_RESULT()
 }
 
-static char *
-tryread_desc(FILE *index, char *buf, const bool descrexists) {
-    if (descrexists) {
-        return fgets(buf, LINEBUF, index);
+void
+find_description(const char *md, size_t mdlen, struct desc_span *desc) {
+    const size_t section_len = DESCRIPTION_SECTION_LENGTH - 1;
+    const char *end = md + mdlen;
+    const char *line = md, *prevline = NULL;
+
+    desc->text = NULL;
+    desc->len = 0;
+
+    for (; line < end; line = next_line(line, end)) {
+        if ((size_t)(end - line) >= section_len && 
+            IS_OK(memcmp(line, DESCRIPTION_SECTION, section_len)))
+            break;
     }
-    return fgets(buf, DESCRIPTION_SECTION_LENGTH, index);
-}
 
-static int
-read_description(FILE *descfile, const char *indexmd) {
-    FILE *index = NULL;
-    char tempbuf[LINEBUF] = {0};
-    char linebuf[LINEBUF] = {0};
-    bool description_exists = false;
+    if (line == end)
+        return;
 
-    ZIC_RESULT_INIT()
+    line = next_line(line, end);
+    if (is_line_separator(line, end))
+        line = next_line(line, end);
 
-    UNWRAP_PTR (index = fopen(indexmd, "r"))
-
-    for(int descrlen = 0; 
-        tryread_desc(index, linebuf, description_exists);
-        ) {
-        if (description_exists) {
-            if (is_line_separator(linebuf)) {
-                if (descrlen > 1)
-                    break;
-            } else {
-                if (descrlen > 0)
-                    TRY_NEG (fputs(tempbuf, descfile), DO_CLEAN_ALL());
-                
-                memcpy(tempbuf, linebuf, sizeof(linebuf));
-            }
-            descrlen++;
-        } else {
-            description_exists = !strcmp(linebuf, DESCRIPTION_SECTION);
-        }
-        memset(linebuf, ASCNULL, sizeof(linebuf));
-    }
+    desc->text = line;
 
-    if (description_exists) {
-        TRY_NEG (fflush(descfile), DO_CLEAN_ALL());
+    /* the description ends with the title line of the next section */
+    for (prevline = line; line < end; line = next_line(line, end)) {
+        if (is_line_separator(line, end) && line != desc->text) {
+            desc->len = prevline - desc->text;
+            return;
+        }
+        prevline = line;
     }
 
-	ZIC_RESULT = OK;
-	CLEANUP_ALL (fclose(index));
-	ZIC_RETURN_RESULT()
+    desc->len = end - desc->text;
 }
 
 static result 
@@ -162,122 +126,392 @@ unlock_if_multithreaded(pthread_mutex_t *mutex) {
     RET_OK()
 }
 
-static result
-get_descfile_size(FILE *descfile, size_t *size_p) {
-    UNWRAP_NEG (fseek(descfile, 0, SEEK_END));
-    UNWRAP_NEG (*size_p = ftell(descfile));
-    UNWRAP_NEG (fseek(descfile, 0, SEEK_SET));
-	RET_OK();
+result
+open_direct_output(struct search_output *out, int fd) {
+    if (fflush(out->f))
+        ERROR(ERR_SYS)
+
+    UNWRAP_PTR (out->buf = malloc(SEARCH_OUTBUF))
+    out->buflen = 0;
+    out->fd = fd;
+    RET_OK()
 }
 
 static result
-print_full_patch(FILE *descfile, int matchedc, const char *entryname, FILE *targetf) {
-	char *print_buf = NULL;
-    size_t descf_size;
-	ZIC_RESULT_INIT();
+write_iov(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt) {
+        ssize_t written = writev(fd, iov, iovcnt);
 
-	fputs( "--------------------------------------------------", targetf);
-    fprintf(targetf, "\n%d) %s:\n", matchedc, entryname);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
 
-    UNWRAP (get_descfile_size(descfile, &descf_size));
+            ERROR(ERR_SYS)
+        }
 
-    print_buf = calloc(descf_size + 1, sizeof(*print_buf));
-    UNWRAP_PTR (print_buf)
+        for (; iovcnt && (size_t)written >= iov->iov_len; iov++, iovcnt--)
+            written -= iov->iov_len;
 
-    if (fread(print_buf, descf_size, sizeof(*print_buf), descfile) == 0) {
-        TRY (ferror(descfile), DO_CLEAN_ALL())
+        if (iovcnt) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
     }
+    RET_OK()
+}
+
+result
+close_direct_output(struct search_output *out) {
+    struct iovec iov = { .iov_base = out->buf, .iov_len = out->buflen };
+    ZIC_RESULT_INIT()
+
+    if (!out->buf)
+        RET_OK()
+
+    ZIC_RESULT = write_iov(out->fd, &iov, 1);
 
-    if (fwrite(print_buf, descf_size, sizeof(*print_buf), targetf) == 0) {
-        TRY (ferror(descfile), DO_CLEAN_ALL())
+    free(out->buf);
+    out->buf = NULL;
+    out->buflen = 0;
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Results are packed into the output buffer while they fit. One that
+ * does not goes out together with the buffer in a single writev, its
+ * description straight from the mapping it was found in.
+ */
+static result
+print_direct(struct search_output *out, const char *head, size_t headlen,
+             const char *desc, size_t desclen) {
+    struct iovec iov[] = {
+        { .iov_base = out->buf, .iov_len = out->buflen },
+        { .iov_base = (char *)head, .iov_len = headlen },
+        { .iov_base = (char *)desc, .iov_len = desclen },
+    };
+
+    if (out->buflen + headlen + desclen <= SEARCH_OUTBUF) {
+        memcpy(out->buf + out->buflen, head, headlen);
+        out->buflen += headlen;
+
+        if (desclen) {
+            memcpy(out->buf + out->buflen, desc, desclen);
+            out->buflen += desclen;
+        }
+        RET_OK()
     }
-	
-    CLEANUP_ALL(free(print_buf));
-	ZIC_RETURN_RESULT()
+
+    UNWRAP (write_iov(out->fd, iov, sizeof(iov) / sizeof(*iov)))
+    out->buflen = 0;
+    RET_OK()
 }
 
-static result 
-print_matched_entry(FILE *descfile, FILE *targetf, const char *entryname, bool print_full_patch_description) {
-    static int matchedc;
+static result
+print_result_direct(struct search_output *out, const char *entryname,
+                    const char *desc, size_t desclen, bool print_full,
+                    size_t *written) {
+    char head[RESULT_HEAD_LEN];
+    int printed;
+
+    if (print_full) {
+        printed = snprintf(head, sizeof(head), DESCRIPTION_SEPARATOR
+                           "\n%zu) %s:\n\n", out->matchedc, entryname);
+    } else {
+        printed = snprintf(head, sizeof(head), "%zu) %s\n", out->matchedc,
+                           entryname);
+        desclen = 0;
+    }
+
+    if (printed < 0)
+        ERROR(ERR_SYS)
+
+    if ((size_t)printed >= sizeof(head))
+        printed = sizeof(head) - 1;
+
+    *written = printed + desclen;
+    return print_direct(out, head, printed, desc, desclen);
+}
+
+static result
+print_result_stream(struct search_output *out, const char *entryname,
+                    const char *desc, size_t desclen, bool print_full,
+                    size_t *written) {
+    int printed;
+
+	if (print_full) {
+        fputs(DESCRIPTION_SEPARATOR, out->f);
+        printed = fprintf(out->f, "\n%zu) %s:\n\n", out->matchedc, entryname);
 
-    matchedc++;
-	if (print_full_patch_description) {
-		UNWRAP(print_full_patch(descfile, matchedc, entryname, targetf));
+        if (fwrite(desc, sizeof(*desc), desclen, out->f) < desclen)
+            ERROR(ERR_SYS)
+
+        *written = DESCRIPTION_SEPARATOR_LEN + desclen;
 	} else {
-		fprintf(targetf, "%d) %s\n", matchedc, entryname);
+		printed = fprintf(out->f, "%zu) %s\n", out->matchedc, entryname);
 	}
-	
+
+    if (printed > 0)
+        *written += printed;
+
+    RET_OK()
+}
+
+result 
+print_matched_desc(struct search_output *out, const char *entryname, 
+                   const char *desc, size_t desclen, 
+                   bool print_full_patch_description) {
+    uint64_t start = stats_begin();
+    size_t written = 0;
+
+    out->matchedc++;
+    if (out->buf) {
+        UNWRAP (print_result_direct(out, entryname, desc, desclen,
+                                    print_full_patch_description, &written))
+    } else {
+        UNWRAP (print_result_stream(out, entryname, desc, desclen,
+                                    print_full_patch_description, &written))
+    }
+
+    stats_count(STATS_MATCHES, 1);
+    stats_count(STATS_BYTES_WRITTEN, written);
+    stats_end(STATS_OUTPUT, start);
 	RET_OK()
 }
 
+bool
+fuzzy_match(const searchsyms *sargs, const char *name, size_t namelen,
+            const char *desc, size_t desclen, size_t *distance) {
+    size_t total = 0;
+
+    for (size_t w = 0; w < sargs->wordcount; w++) {
+        const struct fuzzy_pattern *pat = sargs->patterns + w;
+        size_t dist = fuzzy_distance(pat, name, namelen);
+
+        if (dist) {
+            size_t descdist = fuzzy_distance(pat, desc, desclen);
+            if (descdist < dist)
+                dist = descdist;
+        }
+
+        if (dist > sargs->s_flags.max_edits)
+            return false;
+
+        total += dist;
+    }
+
+    *distance = total;
+    return true;
+}
+
+result
+add_fuzzy_hit(struct fuzzy_hits *hits, const struct fuzzy_hit *hit) {
+    if (hits->cnt == hits->cap) {
+        size_t newcap = hits->cap ? hits->cap * 2 : ENTRYLEN;
+        struct fuzzy_hit *newhits = realloc(hits->hits, newcap * sizeof(*newhits));
+
+        UNWRAP_PTR (newhits)
+        stats_count(STATS_ALLOCS, 1);
+        hits->hits = newhits;
+        hits->cap = newcap;
+    }
+
+    hits->hits[hits->cnt++] = *hit;
+    RET_OK()
+}
+
+static int
+cmp_fuzzy_hits(const void *a, const void *b) {
+    const struct fuzzy_hit *hita = a, *hitb = b;
+
+    if (hita->distance != hitb->distance)
+        return hita->distance < hitb->distance ? -1 : 1;
+
+    return strcmp(hita->name, hitb->name);
+}
+
+result
+print_fuzzy_hits(struct search_output *out, struct fuzzy_hits *hits,
+                 const searchsyms *sargs) {
+    size_t limit = hits->cnt;
+
+    if (sargs->s_flags.top_k && sargs->s_flags.top_k < limit)
+        limit = sargs->s_flags.top_k;
+
+    for (size_t i = 0; i < hits->cnt; i++) {
+        struct fuzzy_hit *hit = hits->hits + i;
+
+        if (!hit->copied)
+            continue;
+
+        hit->name = hits->text.data + hit->text_off;
+        hit->desc = hit->name + strlen(hit->name) + 1;
+    }
+
+    qsort(hits->hits, hits->cnt, sizeof(*hits->hits), cmp_fuzzy_hits);
+
+    for (size_t i = 0; i < limit; i++) {
+        const struct fuzzy_hit *hit = hits->hits + i;
+
+        UNWRAP (print_matched_desc(out, hit->name, hit->desc, hit->desclen,
+                                   sargs->s_flags.print_full_patch))
+    }
+    RET_OK()
+}
+
+void
+free_fuzzy_hits(struct fuzzy_hits *hits) {
+    growbuf_free(&hits->text);
+    free(hits->hits);
+    memset(hits, 0, sizeof(*hits));
+}
+
 static result
-lookup_entries_args(const char *descfname, 
-                    const int startpoint, const int endpoint, 
-                    const int outfd, 
-                    const char *patchdir, 
-                    const searchsyms *sargs, 
-                    pthread_mutex_t *fmutex) {
-    DIR *pd = NULL;
-    FILE *rescache = NULL;
-    struct dirent *pdir = NULL;
+collect_fuzzy_hit(struct fuzzy_hits *hits, const char *patchname,
+                  const struct desc_span *desc, size_t distance,
+                  bool keep_desc, pthread_mutex_t *fmutex) {
+    struct fuzzy_hit hit = { .distance = distance, .copied = true };
+    ZIC_RESULT_INIT()
+
+    if (keep_desc)
+        hit.desclen = desc->len;
+
+    lock_if_multithreaded(fmutex);
+    ZIC_RESULT = growbuf_append_string(&hits->text, patchname,
+                                       strlen(patchname), &hit.text_off);
+
+    if (IS_OK(ZIC_RESULT) && hit.desclen)
+        ZIC_RESULT = growbuf_append(&hits->text, desc->text, hit.desclen, NULL);
+
+    if (IS_OK(ZIC_RESULT))
+        ZIC_RESULT = add_fuzzy_hit(hits, &hit);
+    unlock_if_multithreaded(fmutex);
+
+    ZIC_RETURN_RESULT()
+}
+
+/* md is the whole index.md of the patch, wherever it was read from */
+result
+search_patch_text(lookupthread_args *args, const char *patchname,
+                const char *md, size_t mdlen) {
+    const searchsyms *sargs = args->searchargs;
+    struct search_output *out = args->out;
+    struct desc_span desc = {0};
+    result search_res;
+    uint64_t start = stats_begin();
+    bool fuzzy_matched;
 
     ZIC_RESULT_INIT()
 
-    rescache = fdopen(outfd, "w");
-    UNWRAP_PTR (rescache);
+    find_description(md, mdlen, &desc);
 
-	TRY_PTR (pd = opendir(patchdir), DO_CLEAN(cl_rescache));
-    
-    for (int entrid = 1;
-        (pdir = readdir(pd)) && 
-            (entrid > startpoint && entrid <= endpoint); 
-        entrid++) 
-        {
-        if (IS_OK(check_isdir(pdir))) {
-            FILE *descfile = NULL;
-            char *indexmd = NULL; 
-
-            TRY_PTR (descfile = fopen(descfname, "w+"), DO_CLEAN(cl_pdir));
-
-			TRY (append_patchmd(&indexmd, patchdir, pdir->d_name), DO_CLEAN_ALL());
-
-            if (IS_OK(read_description(descfile, indexmd))) {
-                result search_res;
-
-                TRY (fseek(descfile, 0, SEEK_SET), DO_CLEAN_ALL())
-
-                search_res = searchdescr(descfile, pdir->d_name, sargs);
-                lock_if_multithreaded(fmutex);
-                
-                if (IS_OK(search_res)) {
-                    TRY (print_matched_entry(descfile, rescache, pdir->d_name, sargs->s_flags.print_full_patch),
-						 DO_CLEAN_ALL()
-                    )
-                }
-
-                unlock_if_multithreaded(fmutex);
-            }
-            free(indexmd);
-            fclose(descfile);
+    if (sargs->s_flags.max_edits) {
+        size_t distance;
+
+        fuzzy_matched = fuzzy_match(sargs, patchname, strlen(patchname),
+                                    desc.text, desc.len, &distance);
+        stats_end(STATS_MATCH, start);
+
+        if (fuzzy_matched) {
+            ZIC_RESULT = collect_fuzzy_hit(args->fuzzy_hits, patchname, &desc,
+                                           distance,
+                                           sargs->s_flags.print_full_patch,
+                                           args->mutex);
         }
+        ZIC_RETURN_RESULT()
+    }
+
+    search_res = searchdescr(&desc, patchname, sargs);
+    stats_end(STATS_MATCH, start);
+
+    if (IS_OK(search_res) && args->fuzzy_hits) {
+        ZIC_RESULT = collect_fuzzy_hit(args->fuzzy_hits, patchname, &desc, 0,
+                                       sargs->s_flags.print_full_patch,
+                                       args->mutex);
+    } else if (IS_OK(search_res)) {
+        lock_if_multithreaded(args->mutex);
+        ZIC_RESULT = print_matched_desc(out, patchname, desc.text, desc.len,
+                                        sargs->s_flags.print_full_patch);
+        unlock_if_multithreaded(args->mutex);
     }
 
-	ZIC_RESULT = OK;
-    CLEANUP_ALL(remove(descfname));
-	CLEANUP (cl_pdir, closedir(pd));
-	CLEANUP (cl_rescache, fclose(rescache));
 	ZIC_RETURN_RESULT()
 }
 
-result 
-lookup_entries(const lookupthread_args *args) {
-    return lookup_entries_args(args->descfname, args->startpoint, args->endpoint, 
-        args->outfd, args->patchdir, args->searchargs, args->mutex);
+static result
+search_patch(lookupthread_args *args, const char *patchname) {
+    struct mapped_file md = {0};
+    char *indexmd = NULL; 
+    uint64_t start = stats_begin();
+
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_patchmd(&indexmd, args->patchdir, (char *)patchname))
+    stats_count(STATS_ALLOCS, 1);
+
+    if (map_file(&md, indexmd))
+        RET_OK_DO_CLEAN_ALL()
+
+    stats_end(STATS_READ, start);
+
+    ZIC_RESULT = search_patch_text(args, patchname, md.data, md.size);
+
+    unmap_file(&md);
+    CLEANUP_ALL(free(indexmd));
+	ZIC_RETURN_RESULT()
+}
+
+void
+search_entry(void *patchname, void *thread_args, size_t worker_id) {
+    lookupthread_args *args = (lookupthread_args *)thread_args + worker_id;
+    result search_res;
+
+    search_res = search_patch(args, patchname);
+
+    if (IS_OK(args->result))
+        args->result = search_res;
 }
 
-void *
-search_entry(void *thread_args) {
-    lookupthread_args *args = (lookupthread_args *)thread_args;
-    args->result = lookup_entries(args);
-    return NULL;
+static result
+search_stored_patch(lookupthread_args *args, uint32_t id) {
+    struct patch_entry patch;
+    const char *md = NULL;
+    size_t mdlen;
+    uint64_t start;
+    result got;
+
+    UNWRAP (catalog_patch(args->cat, id, &patch))
+
+    start = stats_begin();
+    got = desc_store_get(args->store, id, &args->cursor, &md, &mdlen);
+    stats_end(STATS_READ, start);
+
+    if (got == ERR_ENTRY_NOT_FOUND)
+        RET_OK()
+
+    UNWRAP (got)
+    return search_patch_text(args, patch.name, md, mdlen);
+}
+
+/*
+ * The patches of a block are searched in order, so the block is decoded
+ * by the first one and its neighbours find it in the worker's cursor.
+ */
+void
+search_store_block(void *block, void *thread_args, size_t worker_id) {
+    lookupthread_args *args = (lookupthread_args *)thread_args + worker_id;
+    const struct desc_store *store = args->store;
+    uint32_t b = *(uint32_t *)block, first, cnt;
+    result search_res = OK;
+
+    first = store->blocks[PDSC_BLOCK_FIRST_PATCH][b];
+    cnt = store->blocks[PDSC_BLOCK_PATCH_CNT][b];
+
+    if ((uint64_t)first + cnt > store->hdr->patch_cnt)
+        search_res = ERR_LOCAL;
+
+    for (uint32_t p = first; IS_OK(search_res) && p < first + cnt; p++)
+        search_res = search_stored_patch(args, p);
+
+    if (IS_OK(args->result))
+        args->result = search_res;
 }
@@ -0,0 +1,1330 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <bsd/string.h>
+#include "commands/search.h"
+#include "commands/searchindex.h"
+#include "commands/sync.h"
+#include "def.h"
+#include "utils/entry-utils.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+#include "utils/logutils.h"
+#include "utils/matcher.h"
+#include "utils/pathutils.h"
+#include "utils/registry.h"
+#include "utils/stats.h"
+
+struct term_occ {
+    uint32_t str_off;
+    uint32_t str_len;
+    uint32_t doc;
+    uint32_t weight;
+};
+
+struct trigram_occ {
+    uint32_t key;
+    uint32_t doc;
+};
+
+struct index_builder {
+    struct growbuf docs;
+    struct growbuf strings;
+    struct growbuf occs;
+    struct growbuf terms;
+    struct growbuf postings;
+    struct growbuf term_freqs;
+    struct growbuf trigram_occs;
+    struct growbuf trigrams;
+    struct growbuf trigram_postings;
+    uint32_t token_cnt;
+};
+
+static uint64_t
+fnv1a(const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static result
+tokenize(struct index_builder *builder, uint32_t str_off, uint32_t str_len,
+         uint32_t doc, uint32_t weight, uint32_t *token_cnt) {
+    for (uint32_t i = 0; i < str_len;) {
+        struct term_occ occ = {0};
+        const char *str = builder->strings.data + str_off;
+
+        for (; i < str_len && isspace((unsigned char)str[i]); i++);
+
+        occ.str_off = str_off + i;
+        occ.doc = doc;
+        occ.weight = weight;
+
+        for (; i < str_len && !isspace((unsigned char)str[i]); i++);
+
+        occ.str_len = str_off + i - occ.str_off;
+        if (occ.str_len) {
+            UNWRAP (growbuf_append(&builder->occs, &occ, sizeof(occ), NULL))
+            *token_cnt += weight;
+        }
+    }
+    RET_OK()
+}
+
+static uint32_t
+trigram_key(const char *str) {
+    const unsigned char *bytes = (const unsigned char *)str;
+
+    return (uint32_t)bytes[0] << 16 | (uint32_t)bytes[1] << 8 | bytes[2];
+}
+
+static bool
+trigram_indexable(const char *str) {
+    for (size_t i = 0; i < TRIGRAM_LEN; i++) {
+        if (isspace((unsigned char)str[i]))
+            return false;
+    }
+    return true;
+}
+
+static result
+collect_trigrams(struct index_builder *builder, uint32_t str_off,
+                 uint32_t str_len, uint32_t doc) {
+    for (uint32_t i = 0; i + TRIGRAM_LEN <= str_len; i++) {
+        const char *str = builder->strings.data + str_off + i;
+        struct trigram_occ occ = { .doc = doc };
+
+        if (!trigram_indexable(str))
+            continue;
+
+        occ.key = trigram_key(str);
+        UNWRAP (growbuf_append(&builder->trigram_occs, &occ, sizeof(occ), NULL))
+    }
+    RET_OK()
+}
+
+static result
+add_doc(struct index_builder *builder, const char *name, size_t namelen,
+        const char *desc, size_t desclen) {
+    struct sidx_doc doc = {0};
+    uint32_t docid = (uint32_t)(builder->docs.len / sizeof(doc));
+
+    doc.name_len = (uint32_t)namelen;
+    doc.desc_len = (uint32_t)desclen;
+
+    UNWRAP (growbuf_append_string(&builder->strings, name, doc.name_len,
+                                  &doc.name_off))
+    UNWRAP (growbuf_append_string(&builder->strings, desclen ? desc : "",
+                                  doc.desc_len, &doc.desc_off))
+
+    UNWRAP (tokenize(builder, doc.name_off, doc.name_len, docid,
+                     NAME_TERM_WEIGHT, &doc.token_cnt))
+    UNWRAP (tokenize(builder, doc.desc_off, doc.desc_len, docid,
+                     DESC_TERM_WEIGHT, &doc.token_cnt))
+    builder->token_cnt += doc.token_cnt;
+
+    UNWRAP (collect_trigrams(builder, doc.name_off, doc.name_len, docid))
+    UNWRAP (collect_trigrams(builder, doc.desc_off, doc.desc_len, docid))
+
+    return growbuf_append(&builder->docs, &doc, sizeof(doc), NULL);
+}
+
+static result
+add_patch_doc(struct index_builder *builder, const char *patchdir,
+              char *patchname) {
+    struct mapped_file md = {0};
+    struct desc_span desc = {0};
+    char *indexmd = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_patchmd(&indexmd, patchdir, patchname))
+
+    /* a patch without index.md, or one removed since, has nothing to index */
+    if (map_file(&md, indexmd))
+        RET_OK_DO_CLEAN_ALL()
+
+    find_description(md.data, md.size, &desc);
+    ZIC_RESULT = add_doc(builder, patchname, strlen(patchname), desc.text, 
+                         desc.len);
+
+    unmap_file(&md);
+    CLEANUP_ALL(free(indexmd));
+    ZIC_RETURN_RESULT()
+}
+
+static void
+free_index_builder(struct index_builder *builder) {
+    growbuf_free(&builder->docs);
+    growbuf_free(&builder->strings);
+    growbuf_free(&builder->occs);
+    growbuf_free(&builder->terms);
+    growbuf_free(&builder->postings);
+    growbuf_free(&builder->term_freqs);
+    growbuf_free(&builder->trigram_occs);
+    growbuf_free(&builder->trigrams);
+    growbuf_free(&builder->trigram_postings);
+}
+
+static int
+cmp_patchnames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int
+cmp_term_occs(const void *a, const void *b, void *strings) {
+    const struct term_occ *occa = a, *occb = b;
+    const char *strs = strings;
+    int cmp;
+
+    cmp = memcmp(strs + occa->str_off, strs + occb->str_off,
+                 occa->str_len < occb->str_len ? occa->str_len : occb->str_len);
+    if (cmp)
+        return cmp;
+
+    if (occa->str_len != occb->str_len)
+        return occa->str_len < occb->str_len ? -1 : 1;
+
+    return (occa->doc > occb->doc) - (occa->doc < occb->doc);
+}
+
+static bool
+same_term(const char *strings, const struct term_occ *a,
+          const struct term_occ *b) {
+    return a->str_len == b->str_len &&
+        IS_OK(memcmp(strings + a->str_off, strings + b->str_off, a->str_len));
+}
+
+static result
+build_dictionary(struct index_builder *builder) {
+    struct term_occ *occs = (struct term_occ *)builder->occs.data;
+    size_t occ_cnt = builder->occs.len / sizeof(*occs);
+    struct sidx_term term = {0};
+    struct term_occ *term_occ = NULL;
+
+    qsort_r(occs, occ_cnt, sizeof(*occs), cmp_term_occs,
+            builder->strings.data);
+
+    for (size_t i = 0; i < occ_cnt; i++) {
+        uint32_t posting_off = (uint32_t)(builder->postings.len / sizeof(uint32_t));
+
+        if (!term_occ || !same_term(builder->strings.data, term_occ, occs + i)) {
+            if (term_occ) {
+                UNWRAP (growbuf_append(&builder->terms, &term, sizeof(term), NULL))
+            }
+
+            term_occ = occs + i;
+            term.str_off = term_occ->str_off;
+            term.str_len = term_occ->str_len;
+            term.post_off = posting_off;
+            term.post_cnt = 0;
+        } else if (occs[i - 1].doc == occs[i].doc) {
+            uint32_t *term_freqs = (uint32_t *)builder->term_freqs.data;
+
+            term_freqs[posting_off - 1] += occs[i].weight;
+            continue;
+        }
+
+        UNWRAP (growbuf_append(&builder->postings, &occs[i].doc,
+                               sizeof(occs[i].doc), NULL))
+        UNWRAP (growbuf_append(&builder->term_freqs, &occs[i].weight,
+                               sizeof(occs[i].weight), NULL))
+        term.post_cnt++;
+    }
+
+    if (term_occ) {
+        UNWRAP (growbuf_append(&builder->terms, &term, sizeof(term), NULL))
+    }
+    RET_OK()
+}
+
+static int
+cmp_trigram_occs(const void *a, const void *b) {
+    const struct trigram_occ *occa = a, *occb = b;
+
+    if (occa->key != occb->key)
+        return occa->key < occb->key ? -1 : 1;
+
+    return (occa->doc > occb->doc) - (occa->doc < occb->doc);
+}
+
+static result
+build_trigrams(struct index_builder *builder) {
+    struct trigram_occ *occs = (struct trigram_occ *)builder->trigram_occs.data;
+    size_t occ_cnt = builder->trigram_occs.len / sizeof(*occs);
+    struct sidx_trigram trigram = {0};
+
+    qsort(occs, occ_cnt, sizeof(*occs), cmp_trigram_occs);
+
+    for (size_t i = 0; i < occ_cnt; i++) {
+        if (i && occs[i - 1].key == occs[i].key) {
+            if (occs[i - 1].doc == occs[i].doc)
+                continue;
+        } else {
+            if (i) {
+                UNWRAP (growbuf_append(&builder->trigrams, &trigram,
+                                       sizeof(trigram), NULL))
+            }
+
+            trigram.key = occs[i].key;
+            trigram.post_off = (uint32_t)(builder->trigram_postings.len / 
+                                          sizeof(uint32_t));
+            trigram.post_cnt = 0;
+        }
+
+        UNWRAP (growbuf_append(&builder->trigram_postings, &occs[i].doc,
+                               sizeof(occs[i].doc), NULL))
+        trigram.post_cnt++;
+    }
+
+    if (occ_cnt) {
+        UNWRAP (growbuf_append(&builder->trigrams, &trigram, sizeof(trigram), NULL))
+    }
+    RET_OK()
+}
+
+static result
+append_section(struct growbuf *image, struct sidx_header *hdr,
+               enum sidx_section sec, const struct growbuf *data) {
+    hdr->sections[sec].len = (uint32_t)data->len;
+    return growbuf_append(image, data->data, data->len, &hdr->sections[sec].off);
+}
+
+static result
+write_search_index(struct index_builder *builder, const char *indexpath,
+                   const char *head) {
+    struct growbuf image = {0};
+    struct sidx_header hdr = {0};
+    ZIC_RESULT_INIT()
+
+    memcpy(hdr.magic, SIDX_MAGIC, SIDX_MAGIC_LEN);
+    memcpy(hdr.head, head, GIT_HEAD_LEN);
+    hdr.version = SIDX_VERSION;
+    hdr.doc_cnt = (uint32_t)(builder->docs.len / sizeof(struct sidx_doc));
+    hdr.term_cnt = (uint32_t)(builder->terms.len / sizeof(struct sidx_term));
+    hdr.token_cnt = builder->token_cnt;
+
+    UNWRAP (growbuf_append(&image, &hdr, sizeof(hdr), NULL))
+    UNWRAP_DO_CLEAN_ALL (append_section(&image, &hdr, SIDX_DOCS, &builder->docs))
+    UNWRAP_DO_CLEAN_ALL (append_section(&image, &hdr, SIDX_TERMS, &builder->terms))
+    UNWRAP_DO_CLEAN_ALL (append_section(&image, &hdr, SIDX_POSTINGS,
+                                        &builder->postings))
+    UNWRAP_DO_CLEAN_ALL (append_section(&image, &hdr, SIDX_TERM_FREQS,
+                                        &builder->term_freqs))
+    UNWRAP_DO_CLEAN_ALL (append_section(&image, &hdr, SIDX_TRIGRAMS,
+                                        &builder->trigrams))
+    UNWRAP_DO_CLEAN_ALL (append_section(&image, &hdr, SIDX_TRIGRAM_POSTINGS,
+                                        &builder->trigram_postings))
+    UNWRAP_DO_CLEAN_ALL (append_section(&image, &hdr, SIDX_STRINGS,
+                                        &builder->strings))
+
+    hdr.checksum = fnv1a(image.data + sizeof(hdr), image.len - sizeof(hdr));
+    memcpy(image.data, &hdr, sizeof(hdr));
+
+    ZIC_RESULT = write_file_atomic(indexpath, image.data, image.len);
+
+    CLEANUP_ALL(growbuf_free(&image));
+    ZIC_RETURN_RESULT()
+}
+
+static result
+finish_search_index(struct index_builder *builder, const char *indexpath,
+                    const char *head) {
+    UNWRAP (build_dictionary(builder))
+    UNWRAP (build_trigrams(builder))
+    return write_search_index(builder, indexpath, head);
+}
+
+void
+free_patchnames(struct growbuf *names) {
+    for (size_t i = 0; i < names->len / sizeof(char *); i++)
+        free(((char **)names->data)[i]);
+
+    growbuf_free(names);
+}
+
+static result
+collect_patchnames(struct growbuf *names, const char *patchdir) {
+    DIR *pd = NULL;
+    struct dirent *pdir = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR (pd = opendir(patchdir))
+
+    while ((pdir = readdir(pd))) {
+        if (IS_OK(check_isdir(pdir))) {
+            char *name = strdup(pdir->d_name);
+
+            TRY_PTR (name, DO_CLEAN_ALL())
+            TRY (growbuf_append(names, &name, sizeof(name), NULL),
+                free(name); DO_CLEAN_ALL())
+        }
+    }
+
+    qsort(names->data, names->len / sizeof(char *), sizeof(char *),
+          cmp_patchnames);
+
+	ZIC_RESULT = OK;
+    CLEANUP_ALL(closedir(pd));
+    ZIC_RETURN_RESULT()
+}
+
+result
+build_search_index(const char *indexpath, const char *patchdir,
+                   const char *head) {
+    struct index_builder builder = {0};
+    struct growbuf names = {0};
+    size_t name_cnt;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_DO_CLEAN_ALL (collect_patchnames(&names, patchdir))
+
+    name_cnt = names.len / sizeof(char *);
+    for (size_t i = 0; i < name_cnt; i++) {
+        UNWRAP_DO_CLEAN_ALL (add_patch_doc(&builder, patchdir,
+                                           ((char **)names.data)[i]))
+    }
+
+    ZIC_RESULT = finish_search_index(&builder, indexpath, head);
+
+    CLEANUP_ALL(
+        free_patchnames(&names);
+        free_index_builder(&builder));
+    ZIC_RETURN_RESULT()
+}
+
+struct build_ctx {
+    const char *basecacherepo;
+    const char *head;
+};
+
+static result
+build_tool_index(const char *toolname, const char *patchdir, void *ctx) {
+    const struct build_ctx *bctx = ctx;
+    char *indexpath = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexpath(&indexpath, bctx->basecacherepo, toolname))
+
+    ZIC_RESULT = build_search_index(indexpath, patchdir, bctx->head);
+
+    free(indexpath);
+    ZIC_RETURN_RESULT()
+}
+
+result
+build_search_indexes(const char *basecacherepo) {
+    char head[GIT_HEAD_LEN + 1] = {0};
+    char *indexdir = NULL;
+    struct build_ctx ctx = {0};
+    ZIC_RESULT_INIT()
+
+    UNWRAP (get_mirror_head(basecacherepo, head))
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+
+    if (mkdir(indexdir, 0755) && errno != EEXIST)
+        ERROR_DO_CLEAN_ALL(ERR_SYS)
+
+    ctx.basecacherepo = basecacherepo;
+    ctx.head = head;
+    ZIC_RESULT = iter_mirror_tools(basecacherepo, &build_tool_index, &ctx);
+
+    CLEANUP_ALL(free(indexdir));
+    ZIC_RETURN_RESULT()
+}
+
+static bool
+section_fits(const struct search_index *idx, enum sidx_section sec,
+             size_t elemsize, size_t elemcnt) {
+    const struct sidx_section_ref *ref = idx->hdr->sections + sec;
+
+    return ref->off >= sizeof(*idx->hdr) && ref->off % sizeof(uint32_t) == 0 &&
+        (size_t)ref->off + ref->len <= idx->size &&
+        (elemsize == 0 || (size_t)ref->len == elemsize * elemcnt);
+}
+
+static bool
+span_fits(uint64_t off, uint64_t len, uint64_t limit) {
+    return off + len <= limit;
+}
+
+/*
+ * The layout and every offset into it are checked on each open, so a
+ * lookup never reads outside the map. Sync replaces an index atomically,
+ * hence the checksum over the whole file is only verified by the long
+ * lived readers: sync building on the old index and the server keeping
+ * it resident.
+ */
+static result
+validate_search_index(const struct search_index *idx, const char *head,
+                      bool verify_checksum) {
+    const struct sidx_header *hdr = idx->hdr;
+    uint32_t strings_len, postings_cnt;
+
+    if (idx->size < sizeof(*hdr) ||
+        memcmp(hdr->magic, SIDX_MAGIC, SIDX_MAGIC_LEN) ||
+        hdr->version != SIDX_VERSION ||
+        memcmp(hdr->head, head, GIT_HEAD_LEN))
+        ERROR(ERR_INDEX_STALE)
+
+    if (!section_fits(idx, SIDX_DOCS, sizeof(struct sidx_doc), hdr->doc_cnt) ||
+        !section_fits(idx, SIDX_TERMS, sizeof(struct sidx_term), hdr->term_cnt) ||
+        !section_fits(idx, SIDX_POSTINGS, 0, 0) ||
+        !section_fits(idx, SIDX_TERM_FREQS, 0, 0) ||
+        hdr->sections[SIDX_TERM_FREQS].len != hdr->sections[SIDX_POSTINGS].len ||
+        !section_fits(idx, SIDX_TRIGRAMS, sizeof(struct sidx_trigram),
+                      idx->trigram_cnt) ||
+        !section_fits(idx, SIDX_TRIGRAM_POSTINGS, 0, 0) ||
+        !section_fits(idx, SIDX_STRINGS, 0, 0))
+        ERROR(ERR_INDEX_STALE)
+
+    if (verify_checksum && hdr->checksum != fnv1a((const char *)idx->map + sizeof(*hdr),
+                               idx->size - sizeof(*hdr)))
+        ERROR(ERR_INDEX_STALE)
+
+    strings_len = hdr->sections[SIDX_STRINGS].len;
+    postings_cnt = hdr->sections[SIDX_POSTINGS].len / sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < hdr->doc_cnt; i++) {
+        const struct sidx_doc *doc = idx->docs + i;
+
+        if (!span_fits(doc->name_off, doc->name_len + 1ULL, strings_len) ||
+            !span_fits(doc->desc_off, doc->desc_len + 1ULL, strings_len))
+            ERROR(ERR_INDEX_STALE)
+    }
+
+    for (uint32_t i = 0; i < hdr->term_cnt; i++) {
+        const struct sidx_term *term = idx->terms + i;
+
+        if (!span_fits(term->str_off, term->str_len, strings_len) ||
+            !span_fits(term->post_off, term->post_cnt, postings_cnt))
+            ERROR(ERR_INDEX_STALE)
+
+        for (uint32_t p = 0; p < term->post_cnt; p++) {
+            if (idx->postings[term->post_off + p] >= hdr->doc_cnt)
+                ERROR(ERR_INDEX_STALE)
+        }
+    }
+
+    postings_cnt = hdr->sections[SIDX_TRIGRAM_POSTINGS].len / sizeof(uint32_t);
+
+    for (size_t i = 0; i < idx->trigram_cnt; i++) {
+        const struct sidx_trigram *trigram = idx->trigrams + i;
+
+        if (!span_fits(trigram->post_off, trigram->post_cnt, postings_cnt))
+            ERROR(ERR_INDEX_STALE)
+
+        for (uint32_t p = 0; p < trigram->post_cnt; p++) {
+            if (idx->trigram_postings[trigram->post_off + p] >= hdr->doc_cnt)
+                ERROR(ERR_INDEX_STALE)
+        }
+    }
+    RET_OK()
+}
+
+static result
+map_search_index(struct search_index *idx, const char *indexpath,
+                 const char *head, bool verify_checksum) {
+    struct stat indexst = {0};
+    int indexfd;
+    ZIC_RESULT_INIT()
+
+    memset(idx, 0, sizeof(*idx));
+
+    UNWRAP_NEG (indexfd = open(indexpath, O_RDONLY))
+    TRY_NEG (fstat(indexfd, &indexst), DO_CLEAN_ALL())
+
+    if ((size_t)indexst.st_size < sizeof(struct sidx_header))
+        ERROR_DO_CLEAN(ERR_INDEX_STALE, DO_CLEAN_ALL())
+
+    idx->size = indexst.st_size;
+    idx->map = mmap(NULL, idx->size, PROT_READ, MAP_PRIVATE, indexfd, 0);
+    if (idx->map == MAP_FAILED) {
+        idx->map = NULL;
+        ERROR_DO_CLEAN(ERR_SYS, DO_CLEAN_ALL())
+    }
+
+    stats_count(STATS_FILES, 1);
+    stats_count(STATS_BYTES_READ, idx->size);
+    idx->hdr = idx->map;
+    idx->docs = (const void *)((const char *)idx->map +
+                               idx->hdr->sections[SIDX_DOCS].off);
+    idx->terms = (const void *)((const char *)idx->map +
+                                idx->hdr->sections[SIDX_TERMS].off);
+    idx->postings = (const void *)((const char *)idx->map +
+                                   idx->hdr->sections[SIDX_POSTINGS].off);
+    idx->term_freqs = (const void *)((const char *)idx->map +
+                                     idx->hdr->sections[SIDX_TERM_FREQS].off);
+    idx->trigrams = (const void *)((const char *)idx->map +
+                                   idx->hdr->sections[SIDX_TRIGRAMS].off);
+    idx->trigram_postings = (const void *)((const char *)idx->map + 
+        idx->hdr->sections[SIDX_TRIGRAM_POSTINGS].off);
+    idx->trigram_cnt = idx->hdr->sections[SIDX_TRIGRAMS].len / 
+        sizeof(struct sidx_trigram);
+    idx->strings = (const char *)idx->map + idx->hdr->sections[SIDX_STRINGS].off;
+
+    ZIC_RESULT = validate_search_index(idx, head, verify_checksum);
+    if (ZIC_RESULT)
+        close_search_index(idx);
+
+    CLEANUP_ALL(close(indexfd));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Indexes kept mapped by spmn serve, sorted by tool name. They are
+ * validated against the mirror head once, when they are kept, and the
+ * server drops them as soon as the head or the index directory moves.
+ */
+struct resident_index {
+    char toolname[ENTRYLEN];
+    struct search_index idx;
+};
+
+static struct resident_index *resident_indexes;
+static size_t resident_cnt;
+
+static int
+cmp_resident_index(const void *a, const void *b) {
+    const struct resident_index *ra = a, *rb = b;
+
+    return strcmp(ra->toolname, rb->toolname);
+}
+
+static const struct search_index *
+find_resident_index(const char *toolname) {
+    struct resident_index key;
+    const struct resident_index *found;
+
+    if (!resident_cnt || strlcpy(key.toolname, toolname, 
+                                 sizeof(key.toolname)) >= sizeof(key.toolname))
+        return NULL;
+
+    found = bsearch(&key, resident_indexes, resident_cnt,
+                    sizeof(*resident_indexes), cmp_resident_index);
+    return found ? &found->idx : NULL;
+}
+
+static result
+map_tool_index(struct search_index *idx, const char *basecacherepo,
+               const char *toolname, bool verify_checksum) {
+    char head[GIT_HEAD_LEN + 1] = {0};
+    char *indexpath = NULL;
+    ZIC_RESULT_INIT()
+
+    memset(idx, 0, sizeof(*idx));
+
+    UNWRAP_ERR (get_mirror_head(basecacherepo, head), ERR_INDEX_STALE)
+    UNWRAP (append_indexpath(&indexpath, basecacherepo, toolname))
+
+    ZIC_RESULT = map_search_index(idx, indexpath, head, verify_checksum);
+
+    free(indexpath);
+    ZIC_RETURN_RESULT()
+}
+
+result
+open_search_index(struct search_index *idx, const char *basecacherepo,
+                  const char *toolname) {
+    const struct search_index *resident;
+
+    if ((resident = find_resident_index(toolname))) {
+        *idx = *resident;
+        RET_OK()
+    }
+
+    return map_tool_index(idx, basecacherepo, toolname, false);
+}
+
+void
+close_search_index(struct search_index *idx) {
+    if (idx->map && !idx->retained)
+        munmap(idx->map, idx->size);
+
+    memset(idx, 0, sizeof(*idx));
+}
+
+static void
+unmap_resident(struct resident_index *kept, size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+        munmap(kept[i].idx.map, kept[i].idx.size);
+    }
+}
+
+struct keep_ctx {
+    const char *basecacherepo;
+    struct growbuf kept;
+};
+
+static result
+keep_tool_index(const char *toolname, const char *patchdir, void *ctx) {
+    struct keep_ctx *kctx = ctx;
+    struct resident_index kept = {0};
+    ZIC_RESULT_INIT()
+
+    KINDA_USE_ARG(patchdir)
+
+    /* a tool without a usable index is scanned on every request instead */
+    if (strlcpy(kept.toolname, toolname, sizeof(kept.toolname)) >=
+            sizeof(kept.toolname) ||
+        map_tool_index(&kept.idx, kctx->basecacherepo, toolname, true))
+        RET_OK()
+
+    kept.idx.retained = true;
+    TRY (growbuf_append(&kctx->kept, &kept, sizeof(kept), NULL),
+         munmap(kept.idx.map, kept.idx.size); FAIL())
+    RET_OK()
+}
+
+result
+keep_search_indexes(const char *basecacherepo) {
+    struct keep_ctx ctx = {.basecacherepo = basecacherepo};
+    ZIC_RESULT_INIT()
+
+    drop_search_indexes();
+
+    TRY (iter_mirror_tools(basecacherepo, &keep_tool_index, &ctx),
+         DO_CLEAN_ALL())
+
+    resident_indexes = (struct resident_index *)ctx.kept.data;
+    resident_cnt = ctx.kept.len / sizeof(*resident_indexes);
+    qsort(resident_indexes, resident_cnt, sizeof(*resident_indexes),
+          cmp_resident_index);
+    RET_OK()
+
+    CLEANUP_ALL(
+        unmap_resident((struct resident_index *)ctx.kept.data,
+                       ctx.kept.len / sizeof(struct resident_index));
+        growbuf_free(&ctx.kept));
+    ZIC_RETURN_RESULT()
+}
+
+void
+drop_search_indexes(void) {
+    unmap_resident(resident_indexes, resident_cnt);
+    free(resident_indexes);
+    resident_indexes = NULL;
+    resident_cnt = 0;
+}
+
+struct reindex_ctx {
+    const char *basecacherepo;
+    const char *old_head;
+    const char *head;
+    const struct mirror_changes *changes;
+};
+
+/*
+ * Names of the patches of one tool touched by the diff, sorted and
+ * unique. Diff paths are relative to the mirror, a path below
+ * <patchdir><patch>/ changes <patch>.
+ */
+result
+collect_changed_patches(struct growbuf *names,
+                        const struct mirror_changes *changes,
+                        const char *basecacherepo, const char *patchdir) {
+    const char *reldir = patchdir + strlen(basecacherepo);
+    size_t reldir_len = strlen(reldir);
+    char **sorted;
+    size_t name_cnt, uniq_cnt = 0;
+
+    for (size_t i = 0; i < changes->cnt; i++) {
+        const char *path = changes->changes[i].path;
+        const char *slash;
+        char *name;
+
+        if (strncmp(path, reldir, reldir_len) ||
+            !(slash = strchr(path + reldir_len, '/')))
+            continue;
+
+        UNWRAP_PTR (name = strndup(path + reldir_len, slash - path - reldir_len))
+        if (growbuf_append(names, &name, sizeof(name), NULL)) {
+            free(name);
+            ERROR(ERR_SYS)
+        }
+    }
+
+    sorted = (char **)names->data;
+    name_cnt = names->len / sizeof(char *);
+    qsort(sorted, name_cnt, sizeof(char *), cmp_patchnames);
+
+    for (size_t i = 0; i < name_cnt; i++) {
+        if (uniq_cnt && IS_OK(strcmp(sorted[uniq_cnt - 1], sorted[i]))) {
+            free(sorted[i]);
+            continue;
+        }
+        sorted[uniq_cnt++] = sorted[i];
+    }
+
+    names->len = uniq_cnt * sizeof(char *);
+    RET_OK()
+}
+
+/*
+ * Only the index head moved, the payload and so the checksum stay.
+ */
+static result
+rehead_search_index(const struct search_index *idx, const char *indexpath,
+                    const char *head) {
+    struct sidx_header *hdr = NULL;
+    char *image = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR (image = malloc(idx->size))
+    memcpy(image, idx->map, idx->size);
+
+    hdr = (struct sidx_header *)image;
+    memcpy(hdr->head, head, GIT_HEAD_LEN);
+
+    ZIC_RESULT = write_file_atomic(indexpath, image, idx->size);
+
+    free(image);
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Merge the unchanged docs of the old index with the changed patches read
+ * from disk. Docs stay sorted by name, so the result is the same index a
+ * full build would write.
+ */
+static result
+update_search_index(const struct search_index *idx, const char *indexpath,
+                    const char *patchdir, const struct growbuf *changed,
+                    const char *head) {
+    struct index_builder builder = {0};
+    char *const *changed_names = (char *const *)changed->data;
+    size_t changed_cnt = changed->len / sizeof(char *);
+    uint32_t d = 0;
+    size_t c = 0;
+    ZIC_RESULT_INIT()
+
+    while (d < idx->hdr->doc_cnt || c < changed_cnt) {
+        const struct sidx_doc *doc = idx->docs + d;
+        const char *docname = d < idx->hdr->doc_cnt ? 
+            idx->strings + doc->name_off : NULL;
+        int cmp = !docname ? 1 : c == changed_cnt ? -1 : 
+            strcmp(docname, changed_names[c]);
+
+        if (cmp < 0) {
+            UNWRAP_DO_CLEAN_ALL (add_doc(&builder, docname, doc->name_len,
+                                         idx->strings + doc->desc_off,
+                                         doc->desc_len))
+            d++;
+            continue;
+        }
+
+        UNWRAP_DO_CLEAN_ALL (add_patch_doc(&builder, patchdir, changed_names[c]))
+        c++;
+        if (!cmp)
+            d++;
+    }
+
+    ZIC_RESULT = finish_search_index(&builder, indexpath, head);
+
+    CLEANUP_ALL(free_index_builder(&builder));
+    ZIC_RETURN_RESULT()
+}
+
+static result
+reindex_tool(const char *toolname, const char *patchdir, void *ctx) {
+    const struct reindex_ctx *rctx = ctx;
+    struct search_index idx;
+    struct growbuf changed = {0};
+    char *indexpath = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexpath(&indexpath, rctx->basecacherepo, toolname))
+
+    /* a tool without a usable index of the old head gets a full build */
+    if (map_search_index(&idx, indexpath, rctx->old_head, true)) {
+        ZIC_RESULT = build_search_index(indexpath, patchdir, rctx->head);
+        DO_CLEAN(cl_indexpath)
+    }
+
+    UNWRAP_DO_CLEAN_ALL (collect_changed_patches(&changed, rctx->changes,
+                                                 rctx->basecacherepo,
+                                                 patchdir))
+
+    if (changed.len) {
+        ZIC_RESULT = update_search_index(&idx, indexpath, patchdir, &changed,
+                                         rctx->head);
+    } else if (strcmp(rctx->old_head, rctx->head)) {
+        ZIC_RESULT = rehead_search_index(&idx, indexpath, rctx->head);
+    }
+
+    CLEANUP_ALL(
+        free_patchnames(&changed);
+        close_search_index(&idx));
+    CLEANUP(cl_indexpath, free(indexpath));
+    ZIC_RETURN_RESULT()
+}
+
+result
+update_search_indexes(const char *basecacherepo, const char *old_head,
+                      const struct mirror_changes *changes) {
+    char head[GIT_HEAD_LEN + 1] = {0};
+    char *indexdir = NULL;
+    struct reindex_ctx ctx = {0};
+    ZIC_RESULT_INIT()
+
+    UNWRAP (get_mirror_head(basecacherepo, head))
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+
+    if (mkdir(indexdir, 0755) && errno != EEXIST)
+        ERROR_DO_CLEAN_ALL(ERR_SYS)
+
+    ctx.basecacherepo = basecacherepo;
+    ctx.old_head = old_head;
+    ctx.head = head;
+    ctx.changes = changes;
+    ZIC_RESULT = iter_mirror_tools(basecacherepo, &reindex_tool, &ctx);
+
+    CLEANUP_ALL(free(indexdir));
+    ZIC_RETURN_RESULT()
+}
+
+struct scored_doc {
+    double score;
+    uint32_t doc;
+};
+
+struct topk_heap {
+    struct scored_doc *docs;
+    size_t len;
+    size_t cap;
+};
+
+static void
+mark_term_docs(const struct search_index *idx, const struct sidx_term *term,
+               const uint64_t *termwords, uint64_t *docwords,
+               size_t mask_words) {
+    const uint32_t *postings = idx->postings + term->post_off;
+
+    for (uint32_t p = 0; p < term->post_cnt; p++) {
+        uint64_t *words = docwords + (size_t)postings[p] * mask_words;
+
+        for (size_t w = 0; w < mask_words; w++)
+            words[w] |= termwords[w];
+    }
+}
+
+static void
+count_term_freqs(const struct search_index *idx, const struct sidx_term *term,
+                 const uint64_t *termwords, size_t mask_words,
+                 uint32_t *wordtf, size_t word_cnt) {
+    const uint32_t *postings = idx->postings + term->post_off;
+    const uint32_t *term_freqs = idx->term_freqs + term->post_off;
+
+    for (size_t w = 0; w < mask_words; w++) {
+        for (uint64_t bits = termwords[w]; bits; bits &= bits - 1) {
+            size_t wid = w * 64 + __builtin_ctzll(bits);
+
+            for (uint32_t p = 0; p < term->post_cnt; p++)
+                wordtf[(size_t)postings[p] * word_cnt + wid] += term_freqs[p];
+        }
+    }
+}
+
+static bool
+ranks_below(const struct scored_doc *a, const struct scored_doc *b) {
+    return a->score < b->score || (a->score == b->score && a->doc > b->doc);
+}
+
+static void
+swap_scored(struct scored_doc *a, struct scored_doc *b) {
+    struct scored_doc tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void
+heap_sift_down(struct topk_heap *heap, size_t i) {
+    for (;;) {
+        size_t lowest = i, left = 2 * i + 1, right = 2 * i + 2;
+
+        if (left < heap->len && ranks_below(heap->docs + left, heap->docs + lowest))
+            lowest = left;
+        if (right < heap->len && ranks_below(heap->docs + right, heap->docs + lowest))
+            lowest = right;
+        if (lowest == i)
+            return;
+
+        swap_scored(heap->docs + i, heap->docs + lowest);
+        i = lowest;
+    }
+}
+
+/* keeps the cap best documents, the worst of them at the root */
+static void
+heap_offer(struct topk_heap *heap, struct scored_doc doc) {
+    size_t i;
+
+    if (heap->len == heap->cap) {
+        if (!ranks_below(heap->docs, &doc))
+            return;
+
+        heap->docs[0] = doc;
+        heap_sift_down(heap, 0);
+        return;
+    }
+
+    for (i = heap->len++, heap->docs[i] = doc; i; i = (i - 1) / 2) {
+        if (!ranks_below(heap->docs + i, heap->docs + (i - 1) / 2))
+            break;
+
+        swap_scored(heap->docs + i, heap->docs + (i - 1) / 2);
+    }
+}
+
+static double
+bm25_idf(uint32_t doc_cnt, uint32_t df) {
+    return log(1.0 + ((double)doc_cnt - df + 0.5) / ((double)df + 0.5));
+}
+
+static double
+bm25_score(const struct search_index *idx, const struct sidx_doc *doc,
+           const uint32_t *doctf, const double *idf, size_t word_cnt) {
+    double avgdl = idx->hdr->doc_cnt ? 
+        (double)idx->hdr->token_cnt / idx->hdr->doc_cnt : 1.0;
+    double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * doc->token_cnt / avgdl);
+    double score = 0.0;
+
+    for (size_t w = 0; w < word_cnt; w++) {
+        score += idf[w] * doctf[w] * (BM25_K1 + 1.0) / (doctf[w] + norm);
+    }
+    return score;
+}
+
+static result
+print_ranked(const struct search_index *idx, const searchsyms *sargs,
+             const uint64_t *docwords, const uint32_t *wordtf,
+             struct search_output *out) {
+    const struct ac_matcher *matcher = &sargs->matcher;
+    uint32_t doc_cnt = idx->hdr->doc_cnt;
+    size_t word_cnt = matcher->word_cnt;
+    struct topk_heap heap = {0};
+    size_t ranked_cnt;
+    double *idf = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR (idf = calloc(word_cnt + 1, sizeof(*idf)))
+
+    heap.cap = sargs->s_flags.top_k;
+    TRY_PTR (heap.docs = calloc(heap.cap, sizeof(*heap.docs)), DO_CLEAN(cl_idf))
+    stats_count(STATS_ALLOCS, 2);
+
+    for (size_t w = 0; w < word_cnt; w++) {
+        uint32_t df = 0;
+
+        for (uint32_t d = 0; d < doc_cnt; d++)
+            df += wordtf[(size_t)d * word_cnt + w] > 0;
+
+        idf[w] = bm25_idf(doc_cnt, df);
+    }
+
+    for (uint32_t d = 0; d < doc_cnt; d++) {
+        struct scored_doc scored = { .doc = d };
+
+        if (!matcher_all_matched(matcher, docwords + (size_t)d * matcher->mask_words))
+            continue;
+
+        scored.score = bm25_score(idx, idx->docs + d, 
+                                  wordtf + (size_t)d * word_cnt, idf, word_cnt);
+        heap_offer(&heap, scored);
+    }
+
+    /* pop the worst to the back, leaving the best-first order */
+    ranked_cnt = heap.len;
+    for (size_t n = heap.len; n > 1; n--) {
+        swap_scored(heap.docs, heap.docs + n - 1);
+        heap.len--;
+        heap_sift_down(&heap, 0);
+    }
+
+    for (size_t i = 0; i < ranked_cnt; i++) {
+        const struct sidx_doc *doc = idx->docs + heap.docs[i].doc;
+
+        TRY (print_matched_desc(out, idx->strings + doc->name_off,
+                                idx->strings + doc->desc_off, doc->desc_len,
+                                sargs->s_flags.print_full_patch),
+            DO_CLEAN_ALL())
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free(heap.docs));
+    CLEANUP(cl_idf, free(idf));
+    ZIC_RETURN_RESULT()
+}
+
+static const struct sidx_trigram *
+find_trigram(const struct search_index *idx, uint32_t key) {
+    size_t lo = 0, hi = idx->trigram_cnt;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (idx->trigrams[mid].key == key)
+            return idx->trigrams + mid;
+
+        if (idx->trigrams[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static bool
+doc_in_postings(const uint32_t *postings, uint32_t post_cnt, uint32_t doc) {
+    size_t lo = 0, hi = post_cnt;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (postings[mid] == doc)
+            return true;
+
+        if (postings[mid] < doc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+/*
+ * Drop every candidate missing from the trigram's postings. The first
+ * trigram seeds the candidate list with its own postings.
+ */
+static void
+intersect_trigram(const struct search_index *idx,
+                  const struct sidx_trigram *trigram,
+                  uint32_t *cands, size_t *cand_cnt, bool *seeded) {
+    const uint32_t *postings = idx->trigram_postings + trigram->post_off;
+    size_t kept = 0;
+
+    if (!*seeded) {
+        memcpy(cands, postings, trigram->post_cnt * sizeof(*cands));
+        *cand_cnt = trigram->post_cnt;
+        *seeded = true;
+        return;
+    }
+
+    for (size_t i = 0; i < *cand_cnt; i++) {
+        if (doc_in_postings(postings, trigram->post_cnt, cands[i]))
+            cands[kept++] = cands[i];
+    }
+    *cand_cnt = kept;
+}
+
+/*
+ * Every keyword of three bytes or more must contain all of its trigrams,
+ * so intersecting their postings leaves a superset of the matching docs.
+ * Shorter keywords and ones with whitespace in them do not narrow the set;
+ * if no keyword does, *seeded stays false and every doc is a candidate.
+ */
+static void
+trigram_candidates(const struct search_index *idx, const searchsyms *sargs,
+                   uint32_t *cands, size_t *cand_cnt, bool *seeded) {
+    *cand_cnt = 0;
+    *seeded = false;
+
+    for (size_t w = 0; w < sargs->wordcount; w++) {
+        const char *word = sargs->words[w];
+        size_t wordlen = strlen(word);
+
+        for (size_t i = 0; i + TRIGRAM_LEN <= wordlen; i++) {
+            const struct sidx_trigram *trigram;
+
+            if (!trigram_indexable(word + i))
+                continue;
+
+            trigram = find_trigram(idx, trigram_key(word + i));
+            if (!trigram) {
+                *cand_cnt = 0;
+                *seeded = true;
+                return;
+            }
+
+            intersect_trigram(idx, trigram, cands, cand_cnt, seeded);
+            if (!*cand_cnt)
+                return;
+        }
+    }
+}
+
+static bool
+doc_matches(const struct search_index *idx, const struct ac_matcher *matcher,
+            const struct sidx_doc *doc, uint64_t *matched) {
+    memset(matched, 0, matcher->mask_words * sizeof(*matched));
+
+    if (matcher_scan(matcher, idx->strings + doc->name_off, doc->name_len,
+                     matched))
+        return true;
+
+    return matcher_scan(matcher, idx->strings + doc->desc_off, doc->desc_len,
+                        matched);
+}
+
+/*
+ * Unranked lookup: narrow the docs down with the trigram postings, then
+ * verify each candidate against its stored name and description.
+ */
+static result
+lookup_trigram_candidates(const struct search_index *idx,
+                          const searchsyms *sargs,
+                          struct search_output *out) {
+    const struct ac_matcher *matcher = &sargs->matcher;
+    uint32_t doc_cnt = idx->hdr->doc_cnt;
+    uint32_t *cands = NULL;
+    uint64_t *matched = NULL;
+    size_t cand_cnt;
+    bool seeded;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR (cands = calloc((size_t)doc_cnt + 1, sizeof(*cands)))
+    TRY_PTR (matched = matcher_alloc_mask(matcher), DO_CLEAN(cl_cands))
+    stats_count(STATS_ALLOCS, 2);
+
+    trigram_candidates(idx, sargs, cands, &cand_cnt, &seeded);
+
+    if (!seeded) {
+        for (uint32_t d = 0; d < doc_cnt; d++)
+            cands[d] = d;
+        cand_cnt = doc_cnt;
+    }
+
+    for (size_t i = 0; i < cand_cnt; i++) {
+        const struct sidx_doc *doc = idx->docs + cands[i];
+
+        if (!doc_matches(idx, matcher, doc, matched))
+            continue;
+
+        TRY (print_matched_desc(out, idx->strings + doc->name_off,
+                                idx->strings + doc->desc_off, doc->desc_len,
+                                sargs->s_flags.print_full_patch),
+            DO_CLEAN_ALL())
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free(matched));
+    CLEANUP(cl_cands, free(cands));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Ranked lookup: one pass of the automaton over the dictionary yields the
+ * matched docs along with every keyword's term and document frequencies.
+ */
+static result
+lookup_ranked(const struct search_index *idx, const searchsyms *sargs,
+              struct search_output *out) {
+    const struct ac_matcher *matcher = &sargs->matcher;
+    uint64_t *docwords = NULL, *termwords = NULL;
+    uint32_t *wordtf = NULL;
+    uint32_t doc_cnt = idx->hdr->doc_cnt;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR (docwords = calloc((size_t)doc_cnt * matcher->mask_words + 1,
+                                  sizeof(*docwords)))
+    TRY_PTR (termwords = matcher_alloc_mask(matcher), DO_CLEAN(cl_docwords))
+
+    wordtf = calloc((size_t)doc_cnt * matcher->word_cnt + 1, sizeof(*wordtf));
+    TRY_PTR (wordtf, DO_CLEAN_ALL())
+    stats_count(STATS_ALLOCS, 3);
+
+    for (uint32_t t = 0; t < idx->hdr->term_cnt && matcher->word_cnt; t++) {
+        const struct sidx_term *term = idx->terms + t;
+
+        memset(termwords, 0, matcher->mask_words * sizeof(*termwords));
+        matcher_scan(matcher, idx->strings + term->str_off, term->str_len,
+                     termwords);
+        mark_term_docs(idx, term, termwords, docwords, matcher->mask_words);
+        count_term_freqs(idx, term, termwords, matcher->mask_words,
+                         wordtf, matcher->word_cnt);
+    }
+
+    ZIC_RESULT = print_ranked(idx, sargs, docwords, wordtf, out);
+
+    CLEANUP_ALL(
+        free(wordtf);
+        free(termwords));
+    CLEANUP(cl_docwords, free(docwords));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Fuzzy lookup checks the stored name and description of every doc, since
+ * a keyword with edits in it need not share any trigram with the text.
+ */
+static result
+lookup_fuzzy(const struct search_index *idx, const searchsyms *sargs,
+             struct search_output *out) {
+    struct fuzzy_hits hits = {0};
+    ZIC_RESULT_INIT()
+
+    for (uint32_t d = 0; d < idx->hdr->doc_cnt; d++) {
+        const struct sidx_doc *doc = idx->docs + d;
+        struct fuzzy_hit hit = {
+            .name = idx->strings + doc->name_off,
+            .desc = idx->strings + doc->desc_off,
+            .desclen = doc->desc_len,
+        };
+
+        if (!fuzzy_match(sargs, hit.name, doc->name_len, hit.desc, hit.desclen,
+                         &hit.distance))
+            continue;
+
+        UNWRAP_DO_CLEAN_ALL (add_fuzzy_hit(&hits, &hit))
+    }
+
+    ZIC_RESULT = print_fuzzy_hits(out, &hits, sargs);
+
+    CLEANUP_ALL(free_fuzzy_hits(&hits));
+    ZIC_RETURN_RESULT()
+}
+
+result
+search_index_lookup(const struct search_index *idx, const searchsyms *sargs,
+                    struct search_output *out) {
+    if (sargs->s_flags.max_edits)
+        return lookup_fuzzy(idx, sargs, out);
+
+    if (sargs->s_flags.top_k)
+        return lookup_ranked(idx, sargs, out);
+
+    return lookup_trigram_candidates(idx, sargs, out);
+}
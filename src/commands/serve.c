@@ -0,0 +1,567 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include "def.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <bsd/string.h>
+#include "commands/download.h"
+#include "commands/open.h"
+#include "commands/runsearch.h"
+#include "commands/searchindex.h"
+#include "commands/serve.h"
+#include "commands/sync.h"
+#include "utils/growbuf.h"
+#include "utils/logutils.h"
+#include "utils/pathutils.h"
+#include "utils/registry.h"
+#include "utils/snapshot.h"
+
+typedef int (*served_func)(int, char **, const char *);
+
+static const served_func served_commands[SERVE_CMD_CNT] = {
+    &parse_search_args, &parse_open_args, &parse_load_args};
+
+/*
+ * The server keeps the registry and every search index mapped between
+ * requests and reloads them once the mirror head or the index directory
+ * changes, that is after a sync. Every request pins the published
+ * snapshot, so the one before is released once the server moves on.
+ */
+struct server {
+    const char *basecacherepo;
+    struct snapshot snap;
+    char *indexdir;
+    int listenfd;
+    char head[GIT_HEAD_LEN + 1];
+    struct timespec index_mtime;
+    bool kept;
+};
+
+static volatile sig_atomic_t serving = 1;
+
+static void stop_serving(int sig) {
+    KINDA_USE_ARG(sig)
+    serving = 0;
+}
+
+static result socket_address(struct sockaddr_un *addr,
+                             const char *basecacherepo) {
+    char *sockpath = NULL;
+    ZIC_RESULT_INIT()
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    UNWRAP(append_socketpath(&sockpath, basecacherepo))
+
+    if (strlcpy(addr->sun_path, sockpath, sizeof(addr->sun_path)) >=
+        sizeof(addr->sun_path))
+        FAIL_DO_CLEAN_ALL()
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free(sockpath));
+    ZIC_RETURN_RESULT()
+}
+
+static result connect_socket(int *sockfd, const struct sockaddr_un *addr) {
+    UNWRAP_NEG(*sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))
+
+    if (connect(*sockfd, (const struct sockaddr *)addr, sizeof(*addr))) {
+        close(*sockfd);
+        FAIL()
+    }
+    RET_OK()
+}
+
+static result read_full(int fd, void *buf, size_t len) {
+    char *pos = buf;
+
+    while (len) {
+        ssize_t rres = read(fd, pos, len);
+
+        if (rres < 0 && errno == EINTR)
+            continue;
+        if (rres <= 0)
+            FAIL()
+
+        pos += rres;
+        len -= rres;
+    }
+    RET_OK()
+}
+
+static result write_full(int fd, const void *buf, size_t len) {
+    const char *pos = buf;
+
+    while (len) {
+        ssize_t wres = write(fd, pos, len);
+
+        if (wres < 0 && errno == EINTR)
+            continue;
+        if (wres <= 0)
+            FAIL()
+
+        pos += wres;
+        len -= wres;
+    }
+    RET_OK()
+}
+
+static result pack_request(struct growbuf *msg, enum served_command cmd,
+                           int argc, char **argv) {
+    struct serve_request req = {.magic = SERVE_MAGIC,
+                                .command = cmd,
+                                .argc = argc};
+
+    if (argc < 1 || argc > SERVE_MAX_ARGC)
+        FAIL()
+
+    for (int i = 0; i < argc; i++) {
+        req.argv_len += strlen(argv[i]) + 1;
+    }
+
+    if (req.argv_len > SERVE_MAX_ARGV)
+        FAIL()
+
+    UNWRAP(growbuf_append(msg, &req, sizeof(req), NULL))
+
+    for (int i = 0; i < argc; i++) {
+        UNWRAP(growbuf_append(msg, argv[i], strlen(argv[i]) + 1, NULL))
+    }
+    RET_OK()
+}
+
+/*
+ * The header goes out with the client's descriptors attached, so the
+ * server prints straight into the client's terminal or pipe and loads
+ * patches into the client's working directory.
+ */
+static result send_request(int sockfd, const struct growbuf *msg,
+                           const int *fds) {
+    union {
+        char buf[CMSG_SPACE(SERVE_FD_CNT * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {.iov_base = msg->data, .iov_len = msg->len};
+    struct msghdr hdr = {0};
+    struct cmsghdr *cmsg = NULL;
+    ssize_t sent;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(SERVE_FD_CNT * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, SERVE_FD_CNT * sizeof(int));
+
+    UNWRAP_NEG(sent = sendmsg(sockfd, &hdr, MSG_NOSIGNAL))
+
+    return write_full(sockfd, msg->data + sent, msg->len - sent);
+}
+
+/*
+ * Returns OK when a running server took the request, cmd_result is then
+ * what the command returned there. Anything else means no server is
+ * listening and the command has to run in this process.
+ */
+result ask_server(enum served_command cmd, int argc, char **argv,
+                  const char *basecacherepo, result *cmd_result) {
+    struct sockaddr_un addr;
+    struct growbuf msg = {0};
+    struct serve_reply reply = {0};
+    int fds[SERVE_FD_CNT] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1};
+    FILE *pager = NULL;
+    int sockfd;
+    ZIC_RESULT_INIT()
+
+    UNWRAP(socket_address(&addr, basecacherepo))
+    UNWRAP(connect_socket(&sockfd, &addr))
+
+    TRY(pack_request(&msg, cmd, argc, argv), DO_CLEAN(cl_sock))
+    TRY_NEG(fds[SERVE_FD_CWD] = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+            DO_CLEAN(cl_msg))
+
+    /* the pager has to run here, where the terminal is */
+    if (cmd == SERVE_OPEN) {
+        TRY_PTR(pager = open_pager(), DO_CLEAN(cl_cwd))
+        fflush(stdout);
+        fds[SERVE_FD_STDOUT] = fileno(pager);
+    }
+
+    TRY(send_request(sockfd, &msg, fds), DO_CLEAN_ALL())
+
+    if (read_full(sockfd, &reply, sizeof(reply)) || reply.magic != SERVE_MAGIC) {
+        PRINT_ERR("Lost connection to the spmn server.");
+        reply.result = ERR_SYS;
+    }
+
+    *cmd_result = reply.result;
+    ZIC_RESULT = OK;
+
+    CLEANUP_ALL(if (pager) close_pager(pager));
+    CLEANUP(cl_cwd, close(fds[SERVE_FD_CWD]));
+    CLEANUP(cl_msg, growbuf_free(&msg));
+    CLEANUP(cl_sock, close(sockfd));
+    ZIC_RETURN_RESULT()
+}
+
+static void refresh_resident(struct server *srv) {
+    char head[GIT_HEAD_LEN + 1] = {0};
+    struct stat indexst = {0};
+    struct snapshot snap;
+
+    /* without a new pin, keep serving the snapshot pinned before */
+    if (pin_snapshot(&snap, srv->basecacherepo))
+        return;
+
+    get_mirror_head(snap.basecacherepo, head);
+    stat(srv->indexdir, &indexst);
+
+    if (srv->kept && IS_OK(strcmp(head, srv->head)) &&
+        IS_OK(strcmp(snap.basecacherepo, srv->snap.basecacherepo)) &&
+        indexst.st_mtim.tv_sec == srv->index_mtime.tv_sec &&
+        indexst.st_mtim.tv_nsec == srv->index_mtime.tv_nsec) {
+        unpin_snapshot(&snap);
+        return;
+    }
+
+    unpin_snapshot(&srv->snap);
+    srv->snap = snap;
+
+    keep_tool_registry(srv->snap.basecacherepo);
+    if (keep_search_indexes(srv->snap.basecacherepo)) {
+        PRINT_ERR("Failed to load search indexes. "
+                  "Search will scan the patch directories.");
+    }
+
+    strlcpy(srv->head, head, sizeof(srv->head));
+    srv->index_mtime = indexst.st_mtim;
+    srv->kept = true;
+}
+
+static bool peer_is_owner(int conn) {
+    struct ucred cred;
+    socklen_t credlen = sizeof(cred);
+
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &credlen))
+        return false;
+
+    return cred.uid == geteuid();
+}
+
+static result recv_request(int conn, struct serve_request *req, int *fds) {
+    union {
+        char buf[CMSG_SPACE(SERVE_FD_CNT * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {.iov_base = req, .iov_len = sizeof(*req)};
+    struct msghdr hdr = {0};
+    struct cmsghdr *cmsg = NULL;
+    size_t fdcnt = 0;
+    ssize_t rres;
+
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+
+    UNWRAP_NEG(rres = recvmsg(conn, &hdr, MSG_WAITALL | MSG_CMSG_CLOEXEC))
+
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS) {
+        fdcnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), fdcnt * sizeof(int));
+    }
+
+    if (fdcnt != SERVE_FD_CNT || (size_t)rres != sizeof(*req) ||
+        req->magic != SERVE_MAGIC || req->command >= SERVE_CMD_CNT ||
+        req->argc < 1 || req->argc > SERVE_MAX_ARGC ||
+        req->argv_len < req->argc || req->argv_len > SERVE_MAX_ARGV) {
+        for (size_t i = 0; i < fdcnt; i++) {
+            close(fds[i]);
+        }
+        ERROR(ERR_INVARG)
+    }
+    RET_OK()
+}
+
+static result recv_args(int conn, const struct serve_request *req,
+                        char **args, char **argv) {
+    char *pos = NULL, *end = NULL;
+    uint32_t argi = 0;
+
+    UNWRAP_PTR(*args = malloc(req->argv_len))
+    UNWRAP(read_full(conn, *args, req->argv_len))
+
+    end = *args + req->argv_len;
+    if (end[-1] != ASCNULL)
+        ERROR(ERR_INVARG)
+
+    for (pos = *args; pos < end && argi < req->argc; pos += strlen(pos) + 1) {
+        argv[argi++] = pos;
+    }
+
+    if (argi != req->argc || pos != end)
+        ERROR(ERR_INVARG)
+
+    argv[argi] = NULL;
+    RET_OK()
+}
+
+static result redirect_stdio(const int *fds) {
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int fd = SERVE_FD_STDIN; fd <= SERVE_FD_STDERR; fd++) {
+        UNWRAP_NEG(dup2(fds[fd], fd))
+    }
+
+    UNWRAP_NEG(fchdir(fds[SERVE_FD_CWD]))
+    RET_OK()
+}
+
+static result run_served(const struct server *srv,
+                         const struct serve_request *req, const int *fds,
+                         char **argv) {
+    UNWRAP(redirect_stdio(fds))
+
+    /* a zero optind makes getopt forget the options of the server */
+    optind = 0;
+    return served_commands[req->command](req->argc, argv,
+                                         srv->snap.basecacherepo);
+}
+
+static void answer_client(const struct server *srv, int conn) {
+    struct serve_request req;
+    struct serve_reply reply = {.magic = SERVE_MAGIC};
+    int fds[SERVE_FD_CNT];
+    char *argv[SERVE_MAX_ARGC + 1];
+    char *args = NULL;
+
+    if (!peer_is_owner(conn) || recv_request(conn, &req, fds))
+        return;
+
+    if (IS_OK(recv_args(conn, &req, &args, argv))) {
+        reply.result = run_served(srv, &req, fds, argv);
+        fflush(stdout);
+        fflush(stderr);
+        write_full(conn, &reply, sizeof(reply));
+    }
+
+    for (int i = 0; i < SERVE_FD_CNT; i++) {
+        close(fds[i]);
+    }
+    free(args);
+}
+
+/*
+ * Every request is answered by a child of its own, so a client that takes
+ * its time, at a prompt of load or feeding a --batch search, does not hold
+ * up the others. The child shares the mapped indexes and the snapshot pin
+ * of the server and replies on its own.
+ */
+static void serve_client(struct server *srv, int conn) {
+    pid_t pid;
+
+    /* the request goes on with the pinned snapshot meanwhile */
+    if (autosync_repo(srv->basecacherepo))
+        PRINT_ERR("Failed to autosync caches. Continuing without syncing...");
+
+    refresh_resident(srv);
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((pid = fork()) < 0) {
+        perror(ERROR_PREFIX);
+        return;
+    }
+
+    if (pid) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    /* double fork: the server does not have to reap the request */
+    if (fork() != 0)
+        _exit(OK);
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(srv->listenfd);
+
+    answer_client(srv, conn);
+    _exit(OK);
+}
+
+static result listen_server(struct server *srv) {
+    struct sockaddr_un addr;
+    mode_t oldmask;
+    int probe;
+    ZIC_RESULT_INIT()
+
+    TRY(socket_address(&addr, srv->basecacherepo),
+        HANDLE_PRINT_ERR("Socket path for the spmn server is too long."))
+
+    if (IS_OK(connect_socket(&probe, &addr))) {
+        close(probe);
+        PRINT_ERR("spmn server is already running on '%s'.", addr.sun_path);
+        FAIL()
+    }
+
+    /* nobody answers, so the socket is left over from a server that died */
+    unlink(addr.sun_path);
+
+    UNWRAP_NEG(srv->listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))
+
+    oldmask = umask(S_IRWXG | S_IRWXO);
+    ZIC_RESULT = bind(srv->listenfd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(oldmask);
+
+    TRY_NEG(ZIC_RESULT, DO_CLEAN_ALL())
+    TRY_NEG(listen(srv->listenfd, SERVE_BACKLOG), DO_CLEAN_ALL())
+
+    printf("Serving on '%s'.\n", addr.sun_path);
+    RET_OK()
+
+    CLEANUP_ALL(close(srv->listenfd));
+    ZIC_RETURN_RESULT()
+}
+
+static void unlink_socket(const struct server *srv) {
+    struct sockaddr_un addr;
+
+    if (IS_OK(socket_address(&addr, srv->basecacherepo)))
+        unlink(addr.sun_path);
+}
+
+/*
+ * Leave the terminal behind: a server that kept it would be stopped by
+ * job control as soon as it reads a client's prompt answer.
+ */
+static result detach_server(void) {
+    pid_t pid;
+    int nullfd;
+
+    fflush(stdout);
+    UNWRAP_NEG(pid = fork())
+
+    if (pid)
+        exit(OK);
+
+    UNWRAP_NEG(setsid())
+    UNWRAP_NEG(chdir("/"))
+    UNWRAP_NEG(nullfd = open(DEVNULL, O_RDWR))
+
+    for (int fd = SERVE_FD_STDIN; fd <= SERVE_FD_STDERR; fd++) {
+        dup2(nullfd, fd);
+    }
+
+    close(nullfd);
+    RET_OK()
+}
+
+static void setup_signals(void) {
+    struct sigaction stop = {0};
+
+    /* no SA_RESTART, accept has to return to notice the stop */
+    stop.sa_handler = &stop_serving;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static result serve_loop(struct server *srv) {
+    while (serving) {
+        int conn = accept4(srv->listenfd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            ERROR(ERR_SYS)
+        }
+
+        serve_client(srv, conn);
+        close(conn);
+    }
+    RET_OK()
+}
+
+int parse_serve_args(int argc, char **argv, const char *basecacherepo) {
+    struct server srv = {.basecacherepo = basecacherepo,
+                         .snap = {.lockfd = -1},
+                         .listenfd = -1};
+    bool foreground = false;
+    int opt;
+    ZIC_RESULT_INIT()
+
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        switch (opt) {
+        case 'f':
+            foreground = true;
+            break;
+        case '?':
+            ERROR(ERR_INVARG)
+            break;
+        }
+    }
+
+    UNWRAP(append_indexdir(&srv.indexdir, basecacherepo))
+    TRY(listen_server(&srv), DO_CLEAN(cl_indexdir))
+
+    refresh_resident(&srv);
+
+    if (!foreground)
+        TRY(detach_server(), CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL()))
+
+    /* prompts go out before a read, the output is flushed per request */
+    setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+
+    setup_signals();
+
+    TRY(serve_loop(&srv), CATCH(ERR_SYS, HANDLE_SYS_DO_CLEAN_ALL()))
+
+    CLEANUP_ALL(
+        unlink_socket(&srv);
+        close(srv.listenfd);
+        drop_search_indexes();
+        drop_tool_registry();
+        unpin_snapshot(&srv.snap));
+    CLEANUP(cl_indexdir, free(srv.indexdir));
+    ZIC_RETURN_RESULT()
+}
@@ -14,86 +14,648 @@ spmnn. If not, see <https://www.gnu.org/licenses/>.
 */
 
 
-#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
 #include "def.h"
+#include "commands/searchindex.h"
+#include "commands/sync.h"
+#include "utils/catalog.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
 #include "utils/logutils.h"
 #include "utils/pathutils.h"
+#include "utils/registry.h"
+#include "utils/snapshot.h"
+#include <ctype.h>
 #include <dirent.h>
-#include <ftw.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 static const char *const GIT_CMD = "/bin/git";
 static const char *const CLONE_CMD = "clone";
-static const char *const PULL_CMD = "pull";
+static const char *const FETCH_CMD = "fetch";
+static const char *const RESET_CMD = "reset";
+static const char *const REMOTE_CMD = "remote";
+static const char *const SET_URL_CMD = "set-url";
+static const char *const SPARSE_CHECKOUT_CMD = "sparse-checkout";
+static const char *const SET_CMD = "set";
 static const char *const QUITE_ARG = "-q";
 static const char *const CHANGE_DIR_OPT = "-C";
+static const char *const CONFIG_OPT = "-c";
+static const char *const NO_CTIME_CONF = "core.trustctime=false";
+static const char *const SHALLOW_ARG = "--depth=1";
+static const char *const BLOBLESS_ARG = "--filter=blob:none";
+static const char *const SPARSE_ARG = "--sparse";
+static const char *const NO_CONE_ARG = "--no-cone";
+static const char *const HARD_ARG = "--hard";
+static const char *const DIFF_CMD = "diff";
+static const char *const NAME_STATUS_ARG = "--name-status";
+static const char *const NO_RENAMES_ARG = "--no-renames";
+static const char *const NUL_TERMINATED_ARG = "-z";
+static const char *const ORIGIN = "origin";
+static const char *const FETCH_HEAD = "FETCH_HEAD";
 static const char *const SUCKLESS_REPO = "git://git.suckless.org/sites";
 
-static int git_pull(const char *base_cache_repo) {
-    return execl(GIT_CMD, GIT_CMD, CHANGE_DIR_OPT, base_cache_repo, PULL_CMD,
-                 QUITE_ARG, SUCKLESS_REPO, (char *)NULL);
+/*
+ * Only the patch trees and the tools.suckless.org pages are checked out.
+ * These are non-cone patterns, the wildcard matching the site directories.
+ */
+static const char *const PATCH_TREES = "/*/patches/";
+static const char *const TOOLS_TREE = "/tools.suckless.org/";
+
+static const char *const GIT_HEAD = "HEAD";
+static const char *const GIT_PACKED_REFS = "packed-refs";
+static const char *const GIT_REF_PREFIX = "ref: ";
+
+static result open_git_file(FILE **gitf, const char *basecacherepo,
+                            const char *gitpath) {
+    char path[PATHBUF] = {0};
+
+    snprintf(path, sizeof(path), "%s%s%s", basecacherepo, GITDIR, gitpath);
+    UNWRAP_PTR(*gitf = fopen(path, "r"))
+    RET_OK();
 }
 
-static int git_clone(const char *base_cache_repo) {
-    return execl(GIT_CMD, GIT_CMD, CLONE_CMD, QUITE_ARG, SUCKLESS_REPO,
-                 base_cache_repo, (char *)NULL);
+static result read_git_line(char *linebuf, size_t bufsize,
+                            const char *basecacherepo, const char *gitpath) {
+    FILE *gitf = NULL;
+    ZIC_RESULT_INIT();
+
+    UNWRAP(open_git_file(&gitf, basecacherepo, gitpath))
+
+    if (!fgets(linebuf, bufsize, gitf))
+        FAIL_DO_CLEAN_ALL()
+
+    linebuf[strcspn(linebuf, "\n")] = ASCNULL;
+
+    CLEANUP_ALL(fclose(gitf));
+    ZIC_RETURN_RESULT();
 }
 
-int unlink_cb(const char *fpath, const struct stat *sb, int typeflag,
-              struct FTW *ftwbuf) {
-    if (remove(fpath))
-        perror(fpath);
+static result copy_head(char *head, const char *object_id) {
+    for (size_t i = 0; i < GIT_HEAD_LEN; i++) {
+        if (!isxdigit((unsigned char)object_id[i]))
+            FAIL();
+    }
 
-    return OK;
+    memcpy(head, object_id, GIT_HEAD_LEN);
+    head[GIT_HEAD_LEN] = ASCNULL;
+    RET_OK();
 }
 
-int rm_repo(const char *path) {
-    return nftw(path, unlink_cb, 64, FTW_DEPTH | FTW_PHYS);
+static result find_packed_ref(char *head, const char *basecacherepo,
+                              const char *ref) {
+    char linebuf[LINEBUF] = {0};
+    FILE *packed_refs = NULL;
+    ZIC_RESULT_INIT();
+
+    UNWRAP(open_git_file(&packed_refs, basecacherepo, GIT_PACKED_REFS))
+
+    ZIC_RESULT = FAIL;
+    while (fgets(linebuf, sizeof(linebuf), packed_refs)) {
+        linebuf[strcspn(linebuf, "\n")] = ASCNULL;
+
+        if (linebuf[GIT_HEAD_LEN] == ' ' &&
+            IS_OK(strcmp(linebuf + GIT_HEAD_LEN + 1, ref))) {
+            ZIC_RESULT = copy_head(head, linebuf);
+            break;
+        }
+    }
+
+    fclose(packed_refs);
+    ZIC_RETURN_RESULT();
 }
 
-result run_sync(const char *basecacherepo, int *gitclone_st) {
+result get_mirror_head(const char *basecacherepo, char *head) {
+    char headbuf[LINEBUF] = {0};
+    char refbuf[LINEBUF] = {0};
+    const size_t ref_prefix_len = strlen(GIT_REF_PREFIX);
+    const char *ref = NULL;
+
+    UNWRAP(read_git_line(headbuf, sizeof(headbuf), basecacherepo, GIT_HEAD))
+
+    if (strncmp(headbuf, GIT_REF_PREFIX, ref_prefix_len))
+        return copy_head(head, headbuf);
+
+    ref = headbuf + ref_prefix_len;
+    if (IS_OK(read_git_line(refbuf, sizeof(refbuf), basecacherepo, ref)))
+        return copy_head(head, refbuf);
+
+    return find_packed_ref(head, basecacherepo, ref);
+}
+
+static const char *mirror_remote(void) {
+    const char *remote = getenv(MIRROR_REMOTE_ENV);
+
+    return remote && *remote ? remote : SUCKLESS_REPO;
+}
+
+/*
+ * Runs the git command line and leaves its wait status in git_st,
+ * so that a failing command is not an error of its own.
+ */
+static result run_git(const char *const *args, int *git_st) {
     pid_t gitpid;
 
-    puts("Synchronizing git repositories...");
-    UNWRAP_NEG(gitpid = fork());
+    /* the child would write out whatever is still buffered */
+    fflush(stdout);
+    UNWRAP_NEG(gitpid = fork())
 
     if (gitpid == 0) {
-        if (check_baserepo_exists(basecacherepo)) {
-            if (check_baserepo_valid(basecacherepo)) {
-                if (git_pull(basecacherepo)) {
-                    perror(ERROR_PREFIX);
-                    exit(FAIL);
-                }
-            }
-            rm_repo(basecacherepo);
+        execv(GIT_CMD, (char *const *)args);
+        perror(ERROR_PREFIX);
+        exit(FAIL);
+    }
+
+    UNWRAP_NEG(waitpid(gitpid, git_st, 0))
+    RET_OK();
+}
+
+static result run_git_steps(const char *const *const *steps, size_t cnt,
+                            int *git_st) {
+    *git_st = 0;
+
+    for (size_t i = 0; i < cnt && !*git_st; i++) {
+        UNWRAP(run_git(steps[i], git_st))
+    }
+    RET_OK();
+}
+
+/*
+ * Fetches the remote tip alone and moves the mirror onto it. A mirror
+ * cloned in full by an older spmn is narrowed to the patch trees on the way.
+ * The worktree is made of hard links to the previous snapshot, whose
+ * ctimes moved, so git is told to only trust the rest of the stat data.
+ */
+static result git_update(const char *basecacherepo, int *git_st) {
+    const char *const set_url[] = {GIT_CMD,    CHANGE_DIR_OPT, basecacherepo,
+                                   REMOTE_CMD, SET_URL_CMD,    ORIGIN,
+                                   mirror_remote(), NULL};
+    const char *const fetch[] = {GIT_CMD,   CHANGE_DIR_OPT, basecacherepo,
+                                 FETCH_CMD, QUITE_ARG,      SHALLOW_ARG,
+                                 ORIGIN,    NULL};
+    const char *const sparse[] = {GIT_CMD,       CONFIG_OPT,
+                                  NO_CTIME_CONF, CHANGE_DIR_OPT,
+                                  basecacherepo, SPARSE_CHECKOUT_CMD,
+                                  SET_CMD,       NO_CONE_ARG,
+                                  PATCH_TREES,   TOOLS_TREE,
+                                  NULL};
+    const char *const reset[] = {GIT_CMD,        CONFIG_OPT,
+                                 NO_CTIME_CONF,  CHANGE_DIR_OPT,
+                                 basecacherepo,  RESET_CMD,
+                                 QUITE_ARG,      HARD_ARG,
+                                 FETCH_HEAD,     NULL};
+    const char *const *const steps[] = {set_url, fetch, sparse, reset};
+
+    return run_git_steps(steps, sizeof(steps) / sizeof(*steps), git_st);
+}
+
+/*
+ * Shallow, blobless and sparse: one commit, its trees, and the blobs of
+ * the patch trees only.
+ */
+static result git_clone(const char *basecacherepo, int *git_st) {
+    const char *const clone[] = {GIT_CMD,      CLONE_CMD,       QUITE_ARG,
+                                 SHALLOW_ARG,  BLOBLESS_ARG,    SPARSE_ARG,
+                                 mirror_remote(), basecacherepo, NULL};
+    const char *const sparse[] = {GIT_CMD,     CHANGE_DIR_OPT,
+                                  basecacherepo, SPARSE_CHECKOUT_CMD,
+                                  SET_CMD,     NO_CONE_ARG,
+                                  PATCH_TREES, TOOLS_TREE,
+                                  NULL};
+    const char *const *const steps[] = {clone, sparse};
+
+    return run_git_steps(steps, sizeof(steps) / sizeof(*steps), git_st);
+}
+
+static int git_diff(const char *base_cache_repo, const char *old_head,
+                    const char *new_head) {
+    return execl(GIT_CMD, GIT_CMD, CHANGE_DIR_OPT, base_cache_repo, DIFF_CMD,
+                 NAME_STATUS_ARG, NO_RENAMES_ARG, NUL_TERMINATED_ARG, old_head,
+                 new_head, (char *)NULL);
+}
+
+static result read_pipe(int pipefd, struct growbuf *out) {
+    char chunk[LINEBUF];
+    ssize_t rres;
+
+    while ((rres = read(pipefd, chunk, sizeof(chunk))) > 0) {
+        UNWRAP(growbuf_append(out, chunk, rres, NULL))
+    }
+
+    if (rres < 0)
+        ERROR(ERR_SYS)
+
+    RET_OK();
+}
+
+static result parse_mirror_changes(struct mirror_changes *changes) {
+    const char *pos = changes->raw, *end = changes->raw + changes->raw_len;
+    size_t cap = 0;
+
+    while (pos < end) {
+        const char *status = pos;
+        const char *path = status + strlen(status) + 1;
+
+        if (path >= end)
+            ERROR(ERR_LOCAL)
+
+        if (changes->cnt == cap) {
+            struct mirror_change *newchanges = NULL;
+
+            cap = cap ? cap * 2 : ENTRYLEN;
+            newchanges = realloc(changes->changes, cap * sizeof(*newchanges));
+            UNWRAP_PTR(newchanges)
+            changes->changes = newchanges;
         }
 
-        if (git_clone(basecacherepo)) {
+        changes->changes[changes->cnt].status = *status;
+        changes->changes[changes->cnt].path = path;
+        changes->cnt++;
+
+        pos = path + strlen(path) + 1;
+    }
+    RET_OK();
+}
+
+static result run_git_diff(const char *basecacherepo, const char *old_head,
+                           const char *new_head, struct growbuf *out) {
+    int pipefds[2];
+    int diff_st;
+    pid_t gitpid;
+    ZIC_RESULT_INIT();
+
+    UNWRAP_NEG(pipe(pipefds))
+
+    if ((gitpid = fork()) < 0) {
+        close(pipefds[0]);
+        close(pipefds[1]);
+        ERROR(ERR_SYS)
+    }
+
+    if (gitpid == 0) {
+        close(pipefds[0]);
+        if (dup2(pipefds[1], STDOUT_FILENO) < 0 ||
+            git_diff(basecacherepo, old_head, new_head)) {
             perror(ERROR_PREFIX);
             exit(FAIL);
         }
     }
 
-    UNWRAP_NEG(waitpid(gitpid, gitclone_st, 0));
+    close(pipefds[1]);
+    ZIC_RESULT = read_pipe(pipefds[0], out);
+    close(pipefds[0]);
+
+    UNWRAP_NEG(waitpid(gitpid, &diff_st, 0))
+    if (IS_OK(ZIC_RESULT) && diff_st)
+        FAIL();
+
+    ZIC_RETURN_RESULT();
+}
+
+result diff_mirror(const char *basecacherepo, const char *old_head,
+                   const char *new_head, struct mirror_changes *changes) {
+    struct growbuf out = {0};
+    ZIC_RESULT_INIT();
+
+    memset(changes, 0, sizeof(*changes));
+
+    UNWRAP_DO_CLEAN_ALL(run_git_diff(basecacherepo, old_head, new_head, &out))
+
+    /* paths are parsed in place and need a terminator after the last one */
+    UNWRAP_DO_CLEAN_ALL(growbuf_append(&out, "", 1, NULL))
+
+    changes->raw = out.data;
+    changes->raw_len = out.len - 1;
+    if (IS_OK(parse_mirror_changes(changes)))
+        RET_OK();
+
+    free_mirror_changes(changes);
+    FAIL();
+
+    CLEANUP_ALL(growbuf_free(&out));
+    ZIC_RETURN_RESULT();
+}
+
+void free_mirror_changes(struct mirror_changes *changes) {
+    free(changes->raw);
+    free(changes->changes);
+    memset(changes, 0, sizeof(*changes));
+}
+
+result run_sync(const char *basecacherepo, int *gitclone_st) {
+    puts("Synchronizing git repositories...");
+
+    if (check_baserepo_valid(basecacherepo)) {
+        UNWRAP(git_update(basecacherepo, gitclone_st))
+    } else {
+        if (check_baserepo_exists(basecacherepo))
+            remove_tree(basecacherepo);
+
+        UNWRAP(git_clone(basecacherepo, gitclone_st))
+    }
 
     puts("Done.");
     RET_OK();
 }
 
+static bool tools_changed(const char *basecacherepo,
+                          const struct mirror_changes *changes) {
+    struct tool_registry reg;
+
+    if (open_tool_registry(&reg, basecacherepo))
+        return true;
+
+    close_tool_registry(&reg);
+
+    /* patch counts and the tool list only move when paths come or go */
+    for (size_t i = 0; i < changes->cnt; i++) {
+        if (changes->changes[i].status == GIT_STATUS_ADDED ||
+            changes->changes[i].status == GIT_STATUS_DELETED)
+            return true;
+    }
+    return false;
+}
+
+struct recatalog_ctx {
+    const char *basecacherepo;
+    const struct mirror_changes *changes;
+};
+
+/*
+ * The catalog and description store of a tool are rebuilt when the diff
+ * touches one of its patches, or when it has none yet. Any other tool
+ * keeps the files hard linked from the snapshot before.
+ */
+static result recatalog_tool(const char *toolname, const char *patchdir,
+                             void *ctx) {
+    const struct recatalog_ctx *rctx = ctx;
+    struct growbuf changed = {0};
+    result collected;
+    bool touched;
+
+    collected = collect_changed_patches(&changed, rctx->changes,
+                                        rctx->basecacherepo, patchdir);
+    touched = changed.len;
+    free_patchnames(&changed);
+    UNWRAP(collected)
+
+    if (!touched && has_tool_catalog(rctx->basecacherepo, toolname))
+        RET_OK();
+
+    return build_tool_catalog(rctx->basecacherepo, toolname, patchdir);
+}
+
+static result update_patch_catalogs(const char *basecacherepo,
+                                    const struct mirror_changes *changes) {
+    struct recatalog_ctx ctx = {basecacherepo, changes};
+
+    return iter_mirror_tools(basecacherepo, &recatalog_tool, &ctx);
+}
+
+/*
+ * Bring the registry, search indexes and patch catalogs up to the new
+ * head. With the old head known, only what git diff reports as changed
+ * is rebuilt.
+ */
+static void reindex_mirror(const char *basecacherepo, const char *old_head) {
+    struct mirror_changes changes = {0};
+    char new_head[GIT_HEAD_LEN + 1] = {0};
+    bool incremental = old_head &&
+                       IS_OK(get_mirror_head(basecacherepo, new_head));
+
+    if (incremental && strcmp(old_head, new_head)) {
+        incremental =
+            IS_OK(diff_mirror(basecacherepo, old_head, new_head, &changes));
+    }
+
+    if ((!incremental || tools_changed(basecacherepo, &changes)) &&
+        build_tool_registry(basecacherepo)) {
+        PRINT_ERR("Failed to build tool registry. "
+                  "Tools will be looked up in the mirror directories.");
+    }
+
+    if (incremental ? update_search_indexes(basecacherepo, old_head, &changes)
+                    : build_search_indexes(basecacherepo)) {
+        PRINT_ERR("Failed to build search index. "
+                  "Search will scan the patch directories.");
+    }
+
+    if (incremental ? update_patch_catalogs(basecacherepo, &changes)
+                    : build_patch_catalogs(basecacherepo)) {
+        PRINT_ERR("Failed to build patch catalog. "
+                  "Patches will be looked up in the mirror directories.");
+    }
+
+    free_mirror_changes(&changes);
+}
+
+/*
+ * Updates a new snapshot of the mirror and its indexes, fetching first
+ * unless only a rebuild is asked for, and publishes it if it holds a
+ * mirror. A failed sync leaves the published snapshot as it was.
+ */
+static result sync_snapshot(const char *basecacherepo, bool fetch,
+                            bool wait) {
+    struct snapshot_stage stage;
+    char old_head[GIT_HEAD_LEN + 1] = {0};
+    bool had_head = false;
+    int lockfd, sync_stat = 0;
+    ZIC_RESULT_INIT();
+
+    UNWRAP(lock_snapshots(&lockfd, basecacherepo, wait))
+    TRY(stage_snapshot(&stage, basecacherepo), DO_CLEAN(cl_lock))
+
+    if (fetch) {
+        had_head = IS_OK(get_mirror_head(stage.basecacherepo, old_head));
+
+        UNWRAP_DO_CLEAN_ALL(run_sync(stage.basecacherepo, &sync_stat))
+        if (sync_stat)
+            FAIL_DO_CLEAN_ALL()
+    }
+
+    if (!check_baserepo_valid(stage.basecacherepo))
+        FAIL_DO_CLEAN_ALL()
+
+    reindex_mirror(stage.basecacherepo, had_head ? old_head : NULL);
+
+    UNWRAP_DO_CLEAN_ALL(publish_snapshot(&stage, basecacherepo))
+    retire_snapshots(basecacherepo);
+
+    CLEANUP_ALL(drop_snapshot_stage(&stage));
+    CLEANUP(cl_lock, unlock_snapshots(lockfd));
+    ZIC_RETURN_RESULT();
+}
+
+/*
+ * When the last sync succeeded, and until when a failed autosync
+ * backs off, kept in SYNC_STATE as text.
+ */
+struct sync_state {
+    time_t last_ok;
+    uintmax_t failures;
+    time_t retry_at;
+};
+
+static void read_sync_state(struct sync_state *state,
+                            const char *basecacherepo) {
+    char *statepath = NULL;
+    intmax_t last_ok = 0, retry_at = 0;
+    struct stat mirrorst;
+    FILE *statef = NULL;
+
+    memset(state, 0, sizeof(*state));
+
+    if (IS_OK(append_syncstatepath(&statepath, basecacherepo)))
+        statef = fopen(statepath, "r");
+    free(statepath);
+
+    if (statef && fscanf(statef, "%jd %ju %jd", &last_ok, &state->failures,
+                         &retry_at) == 3) {
+        state->last_ok = (time_t)last_ok;
+        state->retry_at = (time_t)retry_at;
+    } else if (IS_OK(stat(basecacherepo, &mirrorst))) {
+        /* synced before the state was kept */
+        state->last_ok = mirrorst.st_mtim.tv_sec;
+    }
+
+    if (statef)
+        fclose(statef);
+}
+
+static result write_sync_state(const struct sync_state *state,
+                               const char *basecacherepo) {
+    char line[LINEBUF] = {0};
+    char *statepath = NULL;
+    int len;
+    ZIC_RESULT_INIT();
+
+    len = snprintf(line, sizeof(line), "%jd %ju %jd\n",
+                   (intmax_t)state->last_ok, state->failures,
+                   (intmax_t)state->retry_at);
+
+    UNWRAP(append_syncstatepath(&statepath, basecacherepo))
+    ZIC_RESULT = write_file_atomic(statepath, line, len);
+    free(statepath);
+    ZIC_RETURN_RESULT();
+}
+
+static time_t retry_delay(uintmax_t failures) {
+    time_t delay = SYNC_RETRY_BASE_S;
+
+    for (uintmax_t i = 1; i < failures && delay < SYNC_RETRY_MAX_S; i++)
+        delay *= 2;
+
+    return delay < SYNC_RETRY_MAX_S ? delay : SYNC_RETRY_MAX_S;
+}
+
+static void record_sync(const char *basecacherepo, result sync_res) {
+    struct sync_state state;
+    time_t now = time(NULL);
+
+    read_sync_state(&state, basecacherepo);
+
+    if (IS_OK(sync_res)) {
+        state.last_ok = now;
+        state.failures = 0;
+        state.retry_at = 0;
+    } else {
+        state.failures++;
+        state.retry_at = now + retry_delay(state.failures);
+    }
+
+    write_sync_state(&state, basecacherepo);
+}
+
 int sync_repo(const char *basecacherepo) {
     ZIC_RESULT_INIT();
-    int sync_stat;
 
-    TRY(run_sync(basecacherepo, &sync_stat), HANDLE_SYS(););
+    ZIC_RESULT = sync_snapshot(basecacherepo, true, true);
+    record_sync(basecacherepo, ZIC_RESULT);
 
-    return !!sync_stat;
+    TRY(ZIC_RESULT, HANDLE_SYS(););
+    RET_OK();
+}
+
+/*
+ * Runs in the detached process: there is nobody to report to, so the
+ * outcome only goes to the sync state.
+ */
+static void run_autosync(const char *basecacherepo) {
+    int nullfd = open(DEVNULL, O_RDWR);
+    result sync_res;
+
+    if (nullfd >= 0) {
+        dup2(nullfd, STDIN_FILENO);
+        dup2(nullfd, STDOUT_FILENO);
+        dup2(nullfd, STDERR_FILENO);
+    }
+
+    /* the pinned snapshot of the parent must not be held here */
+    closefrom(STDERR_FILENO + 1);
+
+    sync_res = sync_snapshot(basecacherepo, true, false);
+    if (sync_res != ERR_SYNC_BUSY)
+        record_sync(basecacherepo, sync_res);
+
+    exit(sync_res ? FAIL : OK);
+}
+
+/*
+ * Serves the published snapshot as it is and, once it is older than
+ * SYNC_INTERVAL_D days, refreshes it from a detached process. The
+ * attempt is recorded first, so the commands that follow do not start
+ * another one before it had time to finish.
+ */
+result autosync_repo(const char *basecacherepo) {
+    struct sync_state state;
+    time_t now = time(NULL);
+    pid_t syncpid;
+
+    read_sync_state(&state, basecacherepo);
+
+    if (now - state.last_ok < SYNC_INTERVAL_D * SECONDS_PER_DAY ||
+        now < state.retry_at)
+        RET_OK();
+
+    state.retry_at = now + retry_delay(state.failures + 1);
+    UNWRAP(write_sync_state(&state, basecacherepo))
+
+    fflush(stdout);
+    fflush(stderr);
+    UNWRAP_NEG(syncpid = fork())
+
+    if (syncpid == 0) {
+        /* double fork: the sync outlives the command and is not its child */
+        if (setsid() < 0 || fork() != 0)
+            _exit(OK);
+
+        run_autosync(basecacherepo);
+    }
+
+    UNWRAP_NEG(waitpid(syncpid, NULL, 0))
+    RET_OK();
 }
 
 int parse_sync_args(int argc, char **argv, const char *basecacherepo) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r")) != -1) {
+        switch (opt) {
+        case 'r':
+            /* rebuild what sync derives from the mirror, without fetching */
+            return sync_snapshot(basecacherepo, false, true);
+        case '?':
+            ERROR(ERR_INVARG)
+        }
+    }
+
     return sync_repo(basecacherepo);
 }
@@ -39,14 +39,17 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include "commands/download.h"
 #include "commands/open.h"
 #include "commands/runsearch.h"
+#include "commands/serve.h"
 #include "commands/sync.h"
 #include "utils/logutils.h"
 #include "utils/pathutils.h"
+#include "utils/snapshot.h"
+#include "utils/stats.h"
 #include "zic.h"
 
 typedef int (*commandp)(int, char **, const char *);
 
-#define CMD_CNT 7
+#define CMD_CNT 8
 
 result help(int, char **, const char *);
 result version(int, char **, const char *);
@@ -54,10 +57,10 @@ result version(int, char **, const char *);
 static const commandp commands[CMD_CNT] = {
     &parse_sync_args, &parse_search_args, &parse_open_args,
     &parse_load_args, &parse_apply_args,  &help,
-    &version};
+    &version,         &parse_serve_args};
 
 static const char *const command_names[CMD_CNT] = {
-    "sync", SEARCH_CMD, "open", "load", "apply", "help", "version"};
+    "sync", SEARCH_CMD, "open", "load", "apply", "help", "version", "serve"};
 
 enum command {
     SYNC = 0,
@@ -66,15 +69,10 @@ enum command {
     DOWNLOAD = 3,
     APPLY = 4,
     HELP = 5,
-    VERSION = 6
+    VERSION = 6,
+    SERVE = 7
 };
 
-static int local_repo_is_obsolete(struct tm *cttm, struct tm *lmttm) {
-    return cttm->tm_mday - lmttm->tm_mday >= SYNC_INTERVAL_D ||
-           (cttm->tm_mon > lmttm->tm_mon && cttm->tm_mday > SYNC_INTERVAL_D) ||
-           (cttm->tm_year > lmttm->tm_year && cttm->tm_mday > SYNC_INTERVAL_D);
-}
-
 result help(int argc, char **argv, const char *basecacherepo) {
     KINDA_USE_3ARG(argc, argv, basecacherepo);
     print_usage();
@@ -87,24 +85,6 @@ result version(int argc, char **argv, const char *basecacherepo) {
     RET_OK()
 }
 
-static result try_sync_caches(const char *basecacherepo) {
-    struct stat cache_sb = {0};
-    time_t lastmtime, curtime;
-    struct tm *lmttm = NULL, *cttm = NULL;
-
-    UNWRAP(stat(basecacherepo, &cache_sb))
-
-    lastmtime = cache_sb.st_mtim.tv_sec;
-    time(&curtime);
-    cttm = gmtime(&curtime);
-    lmttm = gmtime(&lastmtime);
-
-    if (local_repo_is_obsolete(cttm, lmttm)) {
-        return run_sync();
-    }
-    RET_OK();
-}
-
 static result parse_command(const int argc, char **argv,
                             enum command *commandarg) {
     int set_cmd = 0;
@@ -139,11 +119,57 @@ static result parse_command(const int argc, char **argv,
     RET_OK();
 }
 
+/*
+ * Lookups are answered by a running 'spmn serve' when there is one: OK
+ * then, with what the command returned there in cmd_result. The server
+ * pins and autosyncs the snapshot itself. With --stats lookups always run
+ * here, the numbers would not describe this process otherwise.
+ */
+static result forward_command(enum command cmd, int argc, char **argv,
+                              const char *basecacherepo, result *cmd_result) {
+    enum served_command served;
+
+    switch (cmd) {
+    case SEARCH:
+        served = SERVE_SEARCH;
+        break;
+    case OPEN:
+        served = SERVE_OPEN;
+        break;
+    case DOWNLOAD:
+        served = SERVE_LOAD;
+        break;
+    default:
+        FAIL();
+    }
+
+    if (stats_enabled)
+        FAIL();
+
+    return ask_server(served, argc, argv, basecacherepo, cmd_result);
+}
+
+/* sync, serve and the server socket work on the cache directory */
+static result run_command(enum command cmd, int argc, char **argv,
+                          const char *basecacherepo, const char *pinnedrepo) {
+    switch (cmd) {
+    case SYNC:
+    case SERVE:
+        return commands[(int)cmd](argc, argv, basecacherepo);
+    default:
+        return commands[(int)cmd](argc, argv, pinnedrepo);
+    }
+}
+
 int main(int argc, char **argv) {
     char *basecacherepo;
+    struct snapshot snap = {.lockfd = -1};
     enum command cmd;
+    result cmd_result;
     ZIC_RESULT_INIT();
 
+    stats_init(&argc, argv);
+
     if (parse_command(argc, argv, &cmd)) {
         print_usage();
         FAIL();
@@ -153,21 +179,32 @@ int main(int argc, char **argv) {
         FAIL();
     }
 
-    if (cmd != SYNC) {
-        if (!check_baserepo_valid(basecacherepo)) {
-            PRINT_ERR("Could not find base suckless repo. Run '%s sync' to initialize mirror repository.", argv[0]);
-            FAIL_DO_CLEAN_ALL();
+    if (forward_command(cmd, argc, argv, basecacherepo, &cmd_result)) {
+        if (cmd != SYNC) {
+            if (pin_snapshot(&snap, basecacherepo) ||
+                !check_baserepo_valid(snap.basecacherepo)) {
+                PRINT_ERR("Could not find base suckless repo. Run '%s sync' to initialize mirror repository.", argv[0]);
+                FAIL_DO_CLEAN_ALL();
+            }
+
+            /* the command goes on with the pinned snapshot meanwhile */
+            if (autosync_repo(basecacherepo))
+                PRINT_ERR("Failed to autosync caches. Continuing without syncing...");
+
+            /* the server pins a snapshot of its own for every request */
+            if (cmd == SERVE)
+                unpin_snapshot(&snap);
         }
 
-        if (try_sync_caches(basecacherepo)) {
-            PRINT_ERR("Failed to autosync caches. Continuing without syncing...");
-            FAIL_DO_CLEAN_ALL();
-        }
+        cmd_result = run_command(cmd, argc, argv, basecacherepo,
+                                 snap.basecacherepo);
     }
 
-    TRY(commands[(int)cmd](argc, argv, basecacherepo),
-        CATCH(ERR_INVARG, print_usage(); FAIL_DO_CLEAN_ALL()));
+    TRY(cmd_result, CATCH(ERR_INVARG, print_usage(); FAIL_DO_CLEAN_ALL()));
 
-    CLEANUP_ALL(free(basecacherepo));
+    CLEANUP_ALL(
+        stats_report();
+        unpin_snapshot(&snap);
+        free(basecacherepo));
     ZIC_RETURN_RESULT();
 }
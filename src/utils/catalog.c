@@ -0,0 +1,503 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "def.h"
+#include "utils/catalog.h"
+#include "utils/descstore.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+#include "utils/pathutils.h"
+#include "utils/registry.h"
+
+#define DIFF_SUFFIX ".diff"
+#define INDEXMD_NAME (INDEXMD + 1)
+
+struct catalog_builder {
+    struct growbuf patches[PCAT_PATCH_COLS];
+    struct growbuf diffs[PCAT_DIFF_COLS];
+    struct growbuf strings;
+    struct desc_store_builder descs;
+};
+
+struct name_list {
+    char **names;
+    size_t cnt;
+    size_t cap;
+};
+
+typedef bool (*entry_filter)(int dirfd, const struct dirent *entry);
+
+static size_t
+catalog_size(const struct pcat_header *hdr) {
+    return sizeof(*hdr) +
+        (size_t)hdr->patch_cnt * PCAT_PATCH_COLS * sizeof(uint32_t) +
+        (size_t)hdr->diff_cnt * PCAT_DIFF_COLS * sizeof(uint32_t) +
+        hdr->strings_len;
+}
+
+static result
+validate_patch_catalog(const struct patch_catalog *cat) {
+    const struct pcat_header *hdr = cat->hdr;
+
+    if (cat->map.size < sizeof(*hdr) ||
+        memcmp(hdr->magic, PCAT_MAGIC, PCAT_MAGIC_LEN) ||
+        hdr->version != PCAT_VERSION ||
+        cat->map.size != catalog_size(hdr) ||
+        (hdr->strings_len && cat->strings[hdr->strings_len - 1] != ASCNULL))
+        ERROR(ERR_LOCAL)
+
+    RET_OK()
+}
+
+result
+open_patch_catalog(struct patch_catalog *cat, const char *basecacherepo,
+                   const char *toolname) {
+    const uint32_t *col = NULL;
+    char *catpath = NULL;
+    ZIC_RESULT_INIT()
+
+    memset(cat, 0, sizeof(*cat));
+
+    UNWRAP (append_catalogpath(&catpath, basecacherepo, toolname))
+    TRY (map_file(&cat->map, catpath), DO_CLEAN_ALL())
+
+    cat->hdr = (const struct pcat_header *)cat->map.data;
+    if (cat->map.size >= sizeof(*cat->hdr)) {
+        col = (const uint32_t *)(cat->hdr + 1);
+        for (size_t c = 0; c < PCAT_PATCH_COLS; c++, col += cat->hdr->patch_cnt)
+            cat->patches[c] = col;
+        for (size_t c = 0; c < PCAT_DIFF_COLS; c++, col += cat->hdr->diff_cnt)
+            cat->diffs[c] = col;
+
+        cat->strings = (const char *)col;
+    }
+
+    ZIC_RESULT = validate_patch_catalog(cat);
+    if (ZIC_RESULT)
+        close_patch_catalog(cat);
+
+    CLEANUP_ALL(free(catpath));
+    ZIC_RETURN_RESULT()
+}
+
+void
+close_patch_catalog(struct patch_catalog *cat) {
+    unmap_file(&cat->map);
+    memset(cat, 0, sizeof(*cat));
+}
+
+result
+catalog_find_patch(const struct patch_catalog *cat, const char *name,
+                   struct patch_entry *patch) {
+    const struct pcat_header *hdr = cat->hdr;
+    const uint32_t *name_offs = cat->patches[PCAT_PATCH_NAME_OFF];
+    uint32_t lo = 0, hi = hdr->patch_cnt;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp;
+
+        if (name_offs[mid] >= hdr->strings_len)
+            ERROR(ERR_LOCAL)
+
+        cmp = strcmp(cat->strings + name_offs[mid], name);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            return catalog_patch(cat, mid, patch);
+        }
+    }
+    ERROR(ERR_ENTRY_NOT_FOUND)
+}
+
+result
+catalog_patch(const struct patch_catalog *cat, uint32_t id,
+              struct patch_entry *patch) {
+    const struct pcat_header *hdr = cat->hdr;
+    uint32_t name_off;
+
+    if (id >= hdr->patch_cnt)
+        ERROR(ERR_LOCAL)
+
+    name_off = cat->patches[PCAT_PATCH_NAME_OFF][id];
+    if (name_off >= hdr->strings_len)
+        ERROR(ERR_LOCAL)
+
+    patch->name = cat->strings + name_off;
+    patch->id = id;
+    patch->first_diff = cat->patches[PCAT_PATCH_FIRST_DIFF][id];
+    patch->diff_cnt = cat->patches[PCAT_PATCH_DIFF_CNT][id];
+    patch->md_size = cat->patches[PCAT_PATCH_MD_SIZE][id];
+
+    if ((uint64_t)patch->first_diff + patch->diff_cnt > hdr->diff_cnt)
+        ERROR(ERR_LOCAL)
+
+    RET_OK()
+}
+
+result
+catalog_diff(const struct patch_catalog *cat, uint32_t diff,
+             struct diff_entry *entry) {
+    const struct pcat_header *hdr = cat->hdr;
+    uint32_t name_off, version_off, version_len;
+
+    if (diff >= hdr->diff_cnt)
+        ERROR(ERR_LOCAL)
+
+    name_off = cat->diffs[PCAT_DIFF_NAME_OFF][diff];
+    version_off = cat->diffs[PCAT_DIFF_VERSION_OFF][diff];
+    version_len = cat->diffs[PCAT_DIFF_VERSION_LEN][diff];
+
+    if (name_off >= hdr->strings_len ||
+        (uint64_t)version_off + version_len >= hdr->strings_len)
+        ERROR(ERR_LOCAL)
+
+    entry->name = cat->strings + name_off;
+    entry->size = cat->diffs[PCAT_DIFF_SIZE][diff];
+    entry->version = cat->strings + version_off;
+    entry->version_len = version_len;
+    RET_OK()
+}
+
+static void
+free_names(struct name_list *list) {
+    for (size_t i = 0; i < list->cnt; i++)
+        free(list->names[i]);
+
+    free(list->names);
+}
+
+static int
+cmp_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* the entries of dirfd that filter keeps, sorted for catalog_find_patch */
+static result
+list_dir(int dirfd, entry_filter filter, struct name_list *list) {
+    struct dirent *entry = NULL;
+    DIR *dir = NULL;
+    int fd;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_NEG (fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY))
+    if (!(dir = fdopendir(fd))) {
+        close(fd);
+        ERROR(ERR_SYS)
+    }
+
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.' || !filter(dirfd, entry))
+            continue;
+
+        if (list->cnt == list->cap) {
+            size_t newcap = list->cap ? list->cap * 2 : ENTRYLEN;
+            char **names = realloc(list->names, newcap * sizeof(*names));
+
+            TRY_PTR (names, DO_CLEAN_ALL())
+            list->names = names;
+            list->cap = newcap;
+        }
+
+        TRY_PTR (list->names[list->cnt] = strdup(entry->d_name), DO_CLEAN_ALL())
+        list->cnt++;
+    }
+
+    qsort(list->names, list->cnt, sizeof(*list->names), &cmp_names);
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(closedir(dir));
+    ZIC_RETURN_RESULT()
+}
+
+static bool
+is_patch_dir(int dirfd, const struct dirent *entry) {
+    struct stat st;
+
+    if (entry->d_type != DT_UNKNOWN)
+        return entry->d_type == DT_DIR;
+
+    return IS_OK(fstatat(dirfd, entry->d_name, &st, 0)) && S_ISDIR(st.st_mode);
+}
+
+static bool
+is_diff_file(int dirfd, const struct dirent *entry) {
+    const size_t suffix_len = sizeof(DIFF_SUFFIX) - 1;
+    size_t len = strlen(entry->d_name);
+    struct stat st;
+
+    if (len <= suffix_len ||
+        strcmp(entry->d_name + len - suffix_len, DIFF_SUFFIX))
+        return false;
+
+    if (entry->d_type == DT_REG)
+        return true;
+
+    return IS_OK(fstatat(dirfd, entry->d_name, &st, 0)) && S_ISREG(st.st_mode);
+}
+
+/*
+ * Suckless diffs are named <tool>-<patch>-<version>.diff, the version
+ * being a release (6.3), a date (20220101) or the commit the diff was
+ * made against (61bb8b2). Other names have no version.
+ */
+static void
+diff_version(const char *name, size_t len, uint32_t *start, uint32_t *ver_len) {
+    size_t end = len - (sizeof(DIFF_SUFFIX) - 1), begin = end;
+    bool has_digit = false;
+
+    *start = *ver_len = 0;
+
+    while (begin && name[begin - 1] != '-')
+        begin--;
+
+    if (!begin || begin == end)
+        return;
+
+    for (size_t i = begin; i < end; i++) {
+        if (isdigit((unsigned char)name[i]))
+            has_digit = true;
+        else if (name[i] != '.' && !(name[i] >= 'a' && name[i] <= 'f'))
+            return;
+    }
+
+    if (has_digit) {
+        *start = (uint32_t)begin;
+        *ver_len = (uint32_t)(end - begin);
+    }
+}
+
+static uint32_t
+col_len(const struct growbuf *col) {
+    return (uint32_t)(col->len / sizeof(uint32_t));
+}
+
+static uint32_t
+clamp_size(off_t size, uint32_t max) {
+    return (uint64_t)size < max ? (uint32_t)size : max;
+}
+
+static result
+append_row(struct growbuf *cols, const uint32_t *row, size_t col_cnt) {
+    for (size_t c = 0; c < col_cnt; c++)
+        UNWRAP (growbuf_append(cols + c, row + c, sizeof(*row), NULL))
+
+    RET_OK()
+}
+
+static result
+add_diff(struct catalog_builder *builder, int patchdir, const char *name) {
+    uint32_t row[PCAT_DIFF_COLS] = {0};
+    size_t len = strlen(name);
+    struct stat st;
+
+    UNWRAP_NEG (fstatat(patchdir, name, &st, 0))
+    UNWRAP (growbuf_append_string(&builder->strings, name, len,
+                                  row + PCAT_DIFF_NAME_OFF))
+
+    row[PCAT_DIFF_SIZE] = clamp_size(st.st_size, UINT32_MAX);
+    diff_version(name, len, row + PCAT_DIFF_VERSION_OFF,
+                 row + PCAT_DIFF_VERSION_LEN);
+    row[PCAT_DIFF_VERSION_OFF] += row[PCAT_DIFF_NAME_OFF];
+
+    return append_row(builder->diffs, row, PCAT_DIFF_COLS);
+}
+
+/* the index.md goes to the description store as it is read */
+static result
+add_patch_md(struct catalog_builder *builder, int patchdir, uint32_t *md_size) {
+    int mdfd;
+    ZIC_RESULT_INIT()
+
+    *md_size = PCAT_NO_MD;
+    mdfd = openat(patchdir, INDEXMD_NAME, O_RDONLY);
+    if (mdfd < 0)
+        return desc_store_skip(&builder->descs);
+
+    ZIC_RESULT = desc_store_add_fd(&builder->descs, mdfd, md_size);
+    if (IS_OK(ZIC_RESULT))
+        *md_size = clamp_size(*md_size, PCAT_NO_MD - 1);
+
+    close(mdfd);
+    ZIC_RETURN_RESULT()
+}
+
+static result
+add_patch(struct catalog_builder *builder, int tooldir, const char *name) {
+    uint32_t row[PCAT_PATCH_COLS] = {0};
+    struct name_list diffs = {0};
+    int patchdir;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_NEG (patchdir = openat(tooldir, name, O_RDONLY | O_DIRECTORY))
+
+    TRY (add_patch_md(builder, patchdir, row + PCAT_PATCH_MD_SIZE),
+         DO_CLEAN_ALL())
+    TRY (list_dir(patchdir, &is_diff_file, &diffs), DO_CLEAN_ALL())
+    TRY (growbuf_append_string(&builder->strings, name, strlen(name),
+                               row + PCAT_PATCH_NAME_OFF), DO_CLEAN_ALL())
+
+    row[PCAT_PATCH_FIRST_DIFF] = col_len(builder->diffs);
+    row[PCAT_PATCH_DIFF_CNT] = (uint32_t)diffs.cnt;
+    TRY (append_row(builder->patches, row, PCAT_PATCH_COLS), DO_CLEAN_ALL())
+
+    for (size_t d = 0; d < diffs.cnt; d++)
+        TRY (add_diff(builder, patchdir, diffs.names[d]), DO_CLEAN_ALL())
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(
+        free_names(&diffs);
+        close(patchdir));
+    ZIC_RETURN_RESULT()
+}
+
+static result
+write_patch_catalog(const struct catalog_builder *builder, const char *catpath) {
+    struct pcat_header hdr = {0};
+    struct growbuf image = {0};
+    ZIC_RESULT_INIT()
+
+    memcpy(hdr.magic, PCAT_MAGIC, PCAT_MAGIC_LEN);
+    hdr.version = PCAT_VERSION;
+    hdr.patch_cnt = col_len(builder->patches);
+    hdr.diff_cnt = col_len(builder->diffs);
+    hdr.strings_len = (uint32_t)builder->strings.len;
+
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, &hdr, sizeof(hdr), NULL))
+
+    for (size_t c = 0; c < PCAT_PATCH_COLS; c++) {
+        UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, builder->patches[c].data,
+                                            builder->patches[c].len, NULL))
+    }
+
+    for (size_t c = 0; c < PCAT_DIFF_COLS; c++) {
+        UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, builder->diffs[c].data,
+                                            builder->diffs[c].len, NULL))
+    }
+
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, builder->strings.data,
+                                        builder->strings.len, NULL))
+
+    ZIC_RESULT = write_file_atomic(catpath, image.data, image.len);
+
+    CLEANUP_ALL(growbuf_free(&image));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * The description store is written first: a catalog is never newer than
+ * the store its patch numbers refer to.
+ */
+result
+build_patch_catalog(const char *catpath, const char *storepath,
+                    const char *patchdir) {
+    struct catalog_builder builder = {0};
+    struct name_list patches = {0};
+    int tooldir;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_NEG (tooldir = open(patchdir, O_RDONLY | O_DIRECTORY))
+
+    TRY (list_dir(tooldir, &is_patch_dir, &patches), DO_CLEAN_ALL())
+
+    for (size_t p = 0; p < patches.cnt; p++)
+        TRY (add_patch(&builder, tooldir, patches.names[p]), DO_CLEAN_ALL())
+
+    TRY (write_desc_store(&builder.descs, storepath), DO_CLEAN_ALL())
+    ZIC_RESULT = write_patch_catalog(&builder, catpath);
+
+    CLEANUP_ALL(
+        for (size_t c = 0; c < PCAT_PATCH_COLS; c++)
+            growbuf_free(builder.patches + c);
+        for (size_t c = 0; c < PCAT_DIFF_COLS; c++)
+            growbuf_free(builder.diffs + c);
+        growbuf_free(&builder.strings);
+        free_desc_store_builder(&builder.descs);
+        free_names(&patches);
+        close(tooldir));
+    ZIC_RETURN_RESULT()
+}
+
+/* the catalog and the description store of one tool of the mirror */
+result
+build_tool_catalog(const char *basecacherepo, const char *toolname,
+                   const char *patchdir) {
+    char *catpath = NULL, *storepath = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_catalogpath(&catpath, basecacherepo, toolname))
+    TRY (append_descstorepath(&storepath, basecacherepo, toolname),
+         DO_CLEAN_ALL())
+
+    ZIC_RESULT = build_patch_catalog(catpath, storepath, patchdir);
+
+    CLEANUP_ALL(
+        free(storepath);
+        free(catpath));
+    ZIC_RETURN_RESULT()
+}
+
+bool
+has_tool_catalog(const char *basecacherepo, const char *toolname) {
+    struct patch_catalog cat;
+    struct desc_store store;
+
+    if (open_patch_catalog(&cat, basecacherepo, toolname))
+        return false;
+
+    close_patch_catalog(&cat);
+    if (open_desc_store(&store, basecacherepo, toolname))
+        return false;
+
+    close_desc_store(&store);
+    return true;
+}
+
+static result
+catalog_tool(const char *toolname, const char *patchdir, void *ctx) {
+    return build_tool_catalog(ctx, toolname, patchdir);
+}
+
+result
+build_patch_catalogs(const char *basecacherepo) {
+    char *indexdir = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+
+    if (mkdir(indexdir, 0755) && errno != EEXIST)
+        ERROR_DO_CLEAN_ALL(ERR_SYS)
+
+    ZIC_RESULT = iter_mirror_tools(basecacherepo, &catalog_tool,
+                                   (void *)basecacherepo);
+
+    CLEANUP_ALL(free(indexdir));
+    ZIC_RETURN_RESULT()
+}
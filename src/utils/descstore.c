@@ -0,0 +1,644 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "def.h"
+#include "utils/descstore.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+#include "utils/pathutils.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1U << LZ_HASH_BITS)
+#define LZ_NO_POS UINT32_MAX
+#define LZ_MAX_DIST UINT16_MAX
+#define LZ_NIBBLE_MAX 15
+#define LZ_LENGTH_BYTE_MAX 255
+
+/* only lines this long are worth a place in the dictionary */
+#define DICT_MIN_LINE 8
+#define DICT_MAX_LINE 256
+
+struct dict_line {
+    const char *text;
+    uint32_t len;
+    uint32_t cnt;
+};
+
+struct dict_lines {
+    struct dict_line *lines;
+    size_t cnt;
+    size_t cap;
+};
+
+struct store_image {
+    struct growbuf patches[PDSC_PATCH_COLS];
+    struct growbuf blocks[PDSC_BLOCK_COLS];
+    struct growbuf dict;
+    struct growbuf data;
+    struct growbuf window;
+};
+
+static size_t
+store_size(const struct pdsc_header *hdr) {
+    return sizeof(*hdr) +
+        (size_t)hdr->patch_cnt * PDSC_PATCH_COLS * sizeof(uint32_t) +
+        (size_t)hdr->block_cnt * PDSC_BLOCK_COLS * sizeof(uint32_t) +
+        hdr->dict_len + hdr->data_len;
+}
+
+static result
+validate_desc_store(const struct desc_store *store) {
+    const struct pdsc_header *hdr = store->hdr;
+
+    if (store->map.size < sizeof(*hdr) ||
+        memcmp(hdr->magic, PDSC_MAGIC, PDSC_MAGIC_LEN) ||
+        hdr->version != PDSC_VERSION ||
+        hdr->dict_len > PDSC_DICT_MAX ||
+        store->map.size != store_size(hdr))
+        ERROR(ERR_LOCAL)
+
+    RET_OK()
+}
+
+result
+open_desc_store(struct desc_store *store, const char *basecacherepo,
+                const char *toolname) {
+    const uint32_t *col = NULL;
+    char *storepath = NULL;
+    ZIC_RESULT_INIT()
+
+    memset(store, 0, sizeof(*store));
+
+    UNWRAP (append_descstorepath(&storepath, basecacherepo, toolname))
+    TRY (map_file(&store->map, storepath), DO_CLEAN_ALL())
+
+    store->hdr = (const struct pdsc_header *)store->map.data;
+    if (store->map.size >= sizeof(*store->hdr)) {
+        col = (const uint32_t *)(store->hdr + 1);
+        for (size_t c = 0; c < PDSC_PATCH_COLS;
+             c++, col += store->hdr->patch_cnt)
+            store->patches[c] = col;
+        for (size_t c = 0; c < PDSC_BLOCK_COLS;
+             c++, col += store->hdr->block_cnt)
+            store->blocks[c] = col;
+
+        store->dict = (const unsigned char *)col;
+        store->data = store->dict + store->hdr->dict_len;
+    }
+
+    ZIC_RESULT = validate_desc_store(store);
+    if (ZIC_RESULT)
+        close_desc_store(store);
+
+    CLEANUP_ALL(free(storepath));
+    ZIC_RETURN_RESULT()
+}
+
+void
+close_desc_store(struct desc_store *store) {
+    unmap_file(&store->map);
+    memset(store, 0, sizeof(*store));
+}
+
+void
+init_desc_cursor(struct desc_cursor *cur) {
+    memset(cur, 0, sizeof(*cur));
+    cur->block = PDSC_NO_BLOCK;
+}
+
+void
+free_desc_cursor(struct desc_cursor *cur) {
+    free(cur->window);
+    init_desc_cursor(cur);
+}
+
+static result
+get_length(const unsigned char **in, const unsigned char *in_end,
+           size_t *len) {
+    unsigned char byte;
+
+    do {
+        if (*in == in_end)
+            ERROR(ERR_LOCAL)
+
+        byte = *(*in)++;
+        *len += byte;
+    } while (byte == LZ_LENGTH_BYTE_MAX);
+
+    RET_OK()
+}
+
+/* a match may overlap the bytes it produces, then it repeats them */
+static void
+copy_match(char *window, size_t pos, size_t dist, size_t len) {
+    char *dst = window + pos;
+    const char *src = dst - dist;
+
+    if (dist >= len) {
+        memcpy(dst, src, len);
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++)
+        dst[i] = src[i];
+}
+
+/* window holds the dictionary up to pos, the block is decoded up to end */
+static result
+lz_decode(const unsigned char *src, size_t srclen, char *window, size_t pos,
+          size_t end) {
+    const unsigned char *in = src, *in_end = src + srclen;
+
+    while (in < in_end) {
+        unsigned char token = *in++;
+        size_t lit = token >> 4, match = token & LZ_NIBBLE_MAX, dist;
+
+        if (lit == LZ_NIBBLE_MAX)
+            UNWRAP (get_length(&in, in_end, &lit))
+
+        if (lit > (size_t)(in_end - in) || lit > end - pos)
+            ERROR(ERR_LOCAL)
+
+        memcpy(window + pos, in, lit);
+        pos += lit;
+        in += lit;
+
+        if (in == in_end)
+            break;
+
+        if (in_end - in < 2)
+            ERROR(ERR_LOCAL)
+
+        dist = in[0] | (size_t)in[1] << 8;
+        in += 2;
+
+        if (match == LZ_NIBBLE_MAX)
+            UNWRAP (get_length(&in, in_end, &match))
+
+        match += PDSC_MIN_MATCH;
+        if (!dist || dist > pos || match > end - pos)
+            ERROR(ERR_LOCAL)
+
+        copy_match(window, pos, dist, match);
+        pos += match;
+    }
+
+    if (pos != end)
+        ERROR(ERR_LOCAL)
+
+    RET_OK()
+}
+
+static result
+decode_block(const struct desc_store *store, uint32_t block,
+             struct desc_cursor *cur) {
+    const struct pdsc_header *hdr = store->hdr;
+    uint32_t off = store->blocks[PDSC_BLOCK_OFF][block];
+    uint32_t len = store->blocks[PDSC_BLOCK_LEN][block];
+    size_t end = (size_t)hdr->dict_len +
+        store->blocks[PDSC_BLOCK_RAW_LEN][block];
+
+    if ((uint64_t)off + len > hdr->data_len)
+        ERROR(ERR_LOCAL)
+
+    if (end > cur->cap) {
+        char *window = realloc(cur->window, end);
+
+        UNWRAP_PTR (window)
+        cur->window = window;
+        cur->cap = end;
+    }
+
+    cur->block = PDSC_NO_BLOCK;
+    if (hdr->dict_len)
+        memcpy(cur->window, store->dict, hdr->dict_len);
+
+    UNWRAP (lz_decode(store->data + off, len, cur->window, hdr->dict_len, end))
+
+    cur->block = block;
+    RET_OK()
+}
+
+/*
+ * The index.md of the patch-th patch of the catalog, valid until the
+ * cursor moves to another block. ERR_ENTRY_NOT_FOUND if it has none.
+ */
+result
+desc_store_get(const struct desc_store *store, uint32_t patch,
+               struct desc_cursor *cur, const char **md, size_t *mdlen) {
+    const struct pdsc_header *hdr = store->hdr;
+    uint32_t block, off, len;
+
+    if (patch >= hdr->patch_cnt)
+        ERROR(ERR_LOCAL)
+
+    block = store->patches[PDSC_PATCH_BLOCK][patch];
+    if (block == PDSC_NO_BLOCK)
+        ERROR(ERR_ENTRY_NOT_FOUND)
+
+    off = store->patches[PDSC_PATCH_OFF][patch];
+    len = store->patches[PDSC_PATCH_LEN][patch];
+
+    if (block >= hdr->block_cnt ||
+        (uint64_t)off + len > store->blocks[PDSC_BLOCK_RAW_LEN][block])
+        ERROR(ERR_LOCAL)
+
+    if (cur->block != block)
+        UNWRAP (decode_block(store, block, cur))
+
+    *md = cur->window + hdr->dict_len + off;
+    *mdlen = len;
+    RET_OK()
+}
+
+static result
+add_patch_row(struct desc_store_builder *builder, uint32_t off, uint32_t len) {
+    UNWRAP (growbuf_append(&builder->offs, &off, sizeof(off), NULL))
+    return growbuf_append(&builder->lens, &len, sizeof(len), NULL);
+}
+
+/* reads the index.md open on fd into the store as the next patch */
+result
+desc_store_add_fd(struct desc_store_builder *builder, int fd,
+                  uint32_t *mdlen) {
+    struct stat st;
+    size_t off = builder->raw.len, len = 0;
+
+    UNWRAP_NEG (fstat(fd, &st))
+
+    if ((uint64_t)st.st_size > UINT32_MAX - off)
+        ERROR(ERR_LOCAL)
+
+    UNWRAP (growbuf_reserve(&builder->raw, st.st_size))
+
+    /* an index.md cut short meanwhile is packed as far as it goes */
+    while (len < (size_t)st.st_size) {
+        ssize_t rres = read(fd, builder->raw.data + off + len,
+                            st.st_size - len);
+
+        UNWRAP_NEG (rres)
+        if (!rres)
+            break;
+
+        len += rres;
+    }
+
+    builder->raw.len += len;
+    *mdlen = (uint32_t)len;
+    return add_patch_row(builder, (uint32_t)off, (uint32_t)len);
+}
+
+/* the next patch has no index.md */
+result
+desc_store_skip(struct desc_store_builder *builder) {
+    return add_patch_row(builder, PDSC_NO_BLOCK, 0);
+}
+
+void
+free_desc_store_builder(struct desc_store_builder *builder) {
+    growbuf_free(&builder->raw);
+    growbuf_free(&builder->offs);
+    growbuf_free(&builder->lens);
+}
+
+static int
+cmp_line_text(const void *a, const void *b) {
+    const struct dict_line *la = a, *lb = b;
+
+    if (la->len != lb->len)
+        return la->len < lb->len ? -1 : 1;
+
+    return memcmp(la->text, lb->text, la->len);
+}
+
+static uint64_t
+line_gain(const struct dict_line *line) {
+    return (uint64_t)(line->cnt - 1) * line->len;
+}
+
+/* the lines saving the most bytes first */
+static int
+cmp_line_gain(const void *a, const void *b) {
+    uint64_t ga = line_gain(a), gb = line_gain(b);
+
+    if (ga != gb)
+        return ga > gb ? -1 : 1;
+
+    return cmp_line_text(a, b);
+}
+
+static result
+collect_lines(const struct growbuf *raw, struct dict_lines *list) {
+    const char *line = raw->data, *end = raw->data + raw->len;
+
+    while (line < end) {
+        const char *nl = memchr(line, '\n', end - line);
+        size_t len = nl ? (size_t)(nl - line) + 1 : (size_t)(end - line);
+
+        if (len >= DICT_MIN_LINE && len <= DICT_MAX_LINE) {
+            if (list->cnt == list->cap) {
+                size_t newcap = list->cap ? list->cap * 2 : ENTRYLEN;
+                struct dict_line *lines =
+                    realloc(list->lines, newcap * sizeof(*lines));
+
+                UNWRAP_PTR (lines)
+                list->lines = lines;
+                list->cap = newcap;
+            }
+
+            list->lines[list->cnt++] = (struct dict_line){
+                .text = line, .len = (uint32_t)len, .cnt = 1};
+        }
+
+        line += len;
+    }
+
+    RET_OK()
+}
+
+/*
+ * The dictionary is made of the lines repeated the most across the
+ * descriptions, weighted by their length: the section headers,
+ * separators and link boilerplate every index.md has.
+ */
+static result
+build_dictionary(const struct growbuf *raw, struct growbuf *dict) {
+    struct dict_lines list = {0};
+    size_t uniq = 0;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_DO_CLEAN_ALL (collect_lines(raw, &list))
+
+    qsort(list.lines, list.cnt, sizeof(*list.lines), &cmp_line_text);
+    for (size_t i = 0; i < list.cnt; i++) {
+        if (uniq && !cmp_line_text(list.lines + uniq - 1, list.lines + i))
+            list.lines[uniq - 1].cnt++;
+        else
+            list.lines[uniq++] = list.lines[i];
+    }
+
+    qsort(list.lines, uniq, sizeof(*list.lines), &cmp_line_gain);
+    for (size_t i = 0; i < uniq && list.lines[i].cnt > 1; i++) {
+        if (dict->len + list.lines[i].len > PDSC_DICT_MAX)
+            continue;
+
+        UNWRAP_DO_CLEAN_ALL (growbuf_append(dict, list.lines[i].text,
+                                            list.lines[i].len, NULL))
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free(list.lines));
+    ZIC_RETURN_RESULT()
+}
+
+static uint32_t
+lz_hash(const char *p) {
+    uint32_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return (word * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static result
+put_byte(struct growbuf *out, unsigned char byte) {
+    return growbuf_append(out, &byte, sizeof(byte), NULL);
+}
+
+static result
+put_length(struct growbuf *out, size_t len) {
+    for (; len >= LZ_LENGTH_BYTE_MAX; len -= LZ_LENGTH_BYTE_MAX)
+        UNWRAP (put_byte(out, LZ_LENGTH_BYTE_MAX))
+
+    return put_byte(out, (unsigned char)len);
+}
+
+/* a match of 0 bytes ends the block with its literals */
+static result
+put_sequence(struct growbuf *out, const char *lit, size_t litlen,
+             size_t match, size_t dist) {
+    size_t mcode = match ? match - PDSC_MIN_MATCH : 0;
+    unsigned char token = (unsigned char)(
+        (litlen < LZ_NIBBLE_MAX ? litlen : LZ_NIBBLE_MAX) << 4 |
+        (mcode < LZ_NIBBLE_MAX ? mcode : LZ_NIBBLE_MAX));
+
+    UNWRAP (put_byte(out, token))
+    if (litlen >= LZ_NIBBLE_MAX)
+        UNWRAP (put_length(out, litlen - LZ_NIBBLE_MAX))
+
+    UNWRAP (growbuf_append(out, lit, litlen, NULL))
+
+    if (!match)
+        RET_OK()
+
+    UNWRAP (put_byte(out, dist & 0xff))
+    UNWRAP (put_byte(out, dist >> 8))
+    if (mcode >= LZ_NIBBLE_MAX)
+        UNWRAP (put_length(out, mcode - LZ_NIBBLE_MAX))
+
+    RET_OK()
+}
+
+/*
+ * Greedy LZ77 over window[start, end), with window[0, start) the
+ * dictionary: every position is hashed by its first PDSC_MIN_MATCH
+ * bytes, and the last position seen with the same hash is the match
+ * candidate.
+ */
+static result
+lz_encode(const char *window, size_t start, size_t end,
+          struct growbuf *out) {
+    uint32_t table[LZ_HASH_SIZE];
+    size_t pos, anchor;
+
+    for (size_t i = 0; i < LZ_HASH_SIZE; i++)
+        table[i] = LZ_NO_POS;
+
+    for (pos = 0; pos + PDSC_MIN_MATCH <= start; pos++)
+        table[lz_hash(window + pos)] = (uint32_t)pos;
+
+    for (pos = anchor = start; pos + PDSC_MIN_MATCH <= end;) {
+        uint32_t *slot = table + lz_hash(window + pos);
+        size_t cand = *slot, match = PDSC_MIN_MATCH;
+
+        *slot = (uint32_t)pos;
+        if (cand == LZ_NO_POS || pos - cand > LZ_MAX_DIST ||
+            memcmp(window + cand, window + pos, PDSC_MIN_MATCH)) {
+            pos++;
+            continue;
+        }
+
+        while (pos + match < end && window[cand + match] == window[pos + match])
+            match++;
+
+        UNWRAP (put_sequence(out, window + anchor, pos - anchor, match,
+                             pos - cand))
+
+        for (size_t i = pos + 1; i < pos + match && i + PDSC_MIN_MATCH <= end;
+             i++)
+            table[lz_hash(window + i)] = (uint32_t)i;
+
+        pos += match;
+        anchor = pos;
+    }
+
+    if (anchor < end)
+        UNWRAP (put_sequence(out, window + anchor, end - anchor, 0, 0))
+
+    RET_OK()
+}
+
+static result
+append_col(struct growbuf *cols, enum pdsc_block_col col, uint32_t val) {
+    return growbuf_append(cols + col, &val, sizeof(val), NULL);
+}
+
+static uint32_t
+block_cnt(const struct store_image *image) {
+    return (uint32_t)(image->blocks[PDSC_BLOCK_OFF].len / sizeof(uint32_t));
+}
+
+static result
+flush_block(struct store_image *image, const struct growbuf *raw,
+            uint32_t raw_off, uint32_t raw_len, uint32_t first_patch,
+            uint32_t patch_cnt) {
+    uint32_t data_off = (uint32_t)image->data.len;
+
+    image->window.len = 0;
+    UNWRAP (growbuf_append(&image->window, image->dict.data, image->dict.len,
+                           NULL))
+    UNWRAP (growbuf_append(&image->window, raw->data + raw_off, raw_len, NULL))
+    UNWRAP (lz_encode(image->window.data, image->dict.len, image->window.len,
+                      &image->data))
+
+    UNWRAP (append_col(image->blocks, PDSC_BLOCK_OFF, data_off))
+    UNWRAP (append_col(image->blocks, PDSC_BLOCK_LEN,
+                       (uint32_t)image->data.len - data_off))
+    UNWRAP (append_col(image->blocks, PDSC_BLOCK_RAW_LEN, raw_len))
+    UNWRAP (append_col(image->blocks, PDSC_BLOCK_FIRST_PATCH, first_patch))
+    return append_col(image->blocks, PDSC_BLOCK_PATCH_CNT, patch_cnt);
+}
+
+/*
+ * Patches without an index.md between two blocks go with the first, so
+ * the patch ranges of the blocks only leave out leading ones.
+ */
+static result
+pack_blocks(const struct desc_store_builder *builder,
+            struct store_image *image) {
+    const uint32_t *offs = (const uint32_t *)builder->offs.data;
+    const uint32_t *lens = (const uint32_t *)builder->lens.data;
+    uint32_t patch_cnt = (uint32_t)(builder->offs.len / sizeof(*offs));
+    uint32_t block_start = 0, first_patch = 0;
+    bool open_block = false;
+
+    for (uint32_t p = 0; p < patch_cnt; p++) {
+        uint32_t row[PDSC_PATCH_COLS] = {PDSC_NO_BLOCK, 0, 0};
+
+        if (offs[p] != PDSC_NO_BLOCK) {
+            if (open_block &&
+                offs[p] + lens[p] - block_start > PDSC_BLOCK_SIZE) {
+                UNWRAP (flush_block(image, &builder->raw, block_start,
+                                    offs[p] - block_start, first_patch,
+                                    p - first_patch))
+                open_block = false;
+            }
+
+            if (!open_block) {
+                block_start = offs[p];
+                first_patch = p;
+                open_block = true;
+            }
+
+            row[PDSC_PATCH_BLOCK] = block_cnt(image);
+            row[PDSC_PATCH_OFF] = offs[p] - block_start;
+            row[PDSC_PATCH_LEN] = lens[p];
+        }
+
+        for (size_t c = 0; c < PDSC_PATCH_COLS; c++)
+            UNWRAP (growbuf_append(image->patches + c, row + c, sizeof(*row),
+                                   NULL))
+    }
+
+    if (open_block) {
+        UNWRAP (flush_block(image, &builder->raw, block_start,
+                            (uint32_t)builder->raw.len - block_start,
+                            first_patch, patch_cnt - first_patch))
+    }
+
+    RET_OK()
+}
+
+static void
+free_store_image(struct store_image *image) {
+    for (size_t c = 0; c < PDSC_PATCH_COLS; c++)
+        growbuf_free(image->patches + c);
+    for (size_t c = 0; c < PDSC_BLOCK_COLS; c++)
+        growbuf_free(image->blocks + c);
+    growbuf_free(&image->dict);
+    growbuf_free(&image->data);
+    growbuf_free(&image->window);
+}
+
+result
+write_desc_store(const struct desc_store_builder *builder,
+                 const char *storepath) {
+    struct store_image image = {0};
+    struct pdsc_header hdr = {0};
+    struct growbuf out = {0};
+    ZIC_RESULT_INIT()
+
+    UNWRAP_DO_CLEAN_ALL (build_dictionary(&builder->raw, &image.dict))
+    UNWRAP_DO_CLEAN_ALL (pack_blocks(builder, &image))
+
+    memcpy(hdr.magic, PDSC_MAGIC, PDSC_MAGIC_LEN);
+    hdr.version = PDSC_VERSION;
+    hdr.patch_cnt = (uint32_t)(builder->offs.len / sizeof(uint32_t));
+    hdr.block_cnt = block_cnt(&image);
+    hdr.dict_len = (uint32_t)image.dict.len;
+    hdr.data_len = (uint32_t)image.data.len;
+
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&out, &hdr, sizeof(hdr), NULL))
+
+    for (size_t c = 0; c < PDSC_PATCH_COLS; c++) {
+        UNWRAP_DO_CLEAN_ALL (growbuf_append(&out, image.patches[c].data,
+                                            image.patches[c].len, NULL))
+    }
+
+    for (size_t c = 0; c < PDSC_BLOCK_COLS; c++) {
+        UNWRAP_DO_CLEAN_ALL (growbuf_append(&out, image.blocks[c].data,
+                                            image.blocks[c].len, NULL))
+    }
+
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&out, image.dict.data, image.dict.len,
+                                        NULL))
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&out, image.data.data, image.data.len,
+                                        NULL))
+
+    ZIC_RESULT = write_file_atomic(storepath, out.data, out.len);
+
+    CLEANUP_ALL(
+        growbuf_free(&out);
+        free_store_image(&image));
+    ZIC_RETURN_RESULT()
+}
@@ -18,6 +18,8 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include "def.h"
 #include "utils/logutils.h"
 #include "utils/pathutils.h"
+#include "utils/catalog.h"
+#include "utils/registry.h"
 #include <ctype.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -136,6 +138,60 @@ result build_patch_dir(char **pdir, const char *toolname,
     ZIC_RETURN_RESULT()
 }
 
+/*
+ * Resolves the tool from the registry and the patch from the tool's
+ * catalog, both written by the last sync, without looking at the
+ * mirror. ERR_NO_CATALOG tells the caller to fall back to
+ * build_patch_dir.
+ */
+result locate_patch(struct patch_location *loc, const char *toolname,
+                    const char *patch_name, const char *basecacherepo) {
+    struct tool_registry reg;
+    struct tool_entry tool;
+    int dir_len, tool_len;
+    ZIC_RESULT_INIT();
+
+    TRY(check_entrname_valid(patch_name, strnlen(patch_name, ENTRYLEN)),
+        HANDLE_PRINT_ERR("Invalid patch name: '%s'", patch_name));
+
+    TRY(check_entrname_valid(toolname, strnlen(toolname, ENTRYLEN)),
+        HANDLE_PRINT_ERR("Invalid tool name: '%s'", toolname));
+
+    if (open_tool_registry(&reg, basecacherepo))
+        ERROR(ERR_NO_CATALOG)
+
+    TRY(registry_lookup(&reg, toolname, &tool),
+        PRINT_ERR("Suckless tool with name: '%s' not found", toolname);
+        DO_CLEAN(cl_reg));
+
+    if (open_patch_catalog(&loc->cat, basecacherepo, tool.name))
+        ERROR_DO_CLEAN(ERR_NO_CATALOG, DO_CLEAN(cl_reg))
+
+    TRY(catalog_find_patch(&loc->cat, patch_name, &loc->patch),
+        HANDLE_PRINT_ERR_DO_CLEAN_ALL("A patch with name: '%s' not found",
+                                      patch_name));
+
+    dir_len = snprintf(loc->dir, sizeof(loc->dir), "%s%s%s", basecacherepo,
+                       tool.patchdir, loc->patch.name);
+    if (dir_len < 0 || (size_t)dir_len >= sizeof(loc->dir))
+        ERROR_DO_CLEAN_ALL(ERR_LOCAL)
+
+    tool_len = snprintf(loc->tool, sizeof(loc->tool), "%s", tool.name);
+    if (tool_len < 0 || (size_t)tool_len >= sizeof(loc->tool))
+        ERROR_DO_CLEAN_ALL(ERR_LOCAL)
+
+    close_tool_registry(&reg);
+    RET_OK()
+
+    CLEANUP_ALL(close_patch_catalog(&loc->cat));
+    CLEANUP(cl_reg, close_tool_registry(&reg));
+    ZIC_RETURN_RESULT()
+}
+
+void release_patch_location(struct patch_location *loc) {
+    close_patch_catalog(&loc->cat);
+}
+
 result build_patch_url(char **url, const char *toolname, const char *patch_name,
                        const char *basecacherepo) {
     size_t patchn_len;
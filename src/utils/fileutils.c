@@ -0,0 +1,210 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "def.h"
+#include "utils/fileutils.h"
+#include "utils/stats.h"
+
+#define COPY_CHUNK (64 * 1024)
+#define COPY_RANGE_MAX (1 << 30)
+
+result
+map_file(struct mapped_file *mfile, const char *path) {
+    struct stat fst = {0};
+    int fd;
+    ZIC_RESULT_INIT()
+
+    memset(mfile, 0, sizeof(*mfile));
+
+    UNWRAP_NEG (fd = open(path, O_RDONLY))
+    TRY_NEG (fstat(fd, &fst), DO_CLEAN_ALL())
+
+    /* mmap refuses empty mappings, an empty file is just an empty span */
+    if (fst.st_size == 0)
+        RET_OK_DO_CLEAN_ALL()
+
+    mfile->data = mmap(NULL, fst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mfile->data == MAP_FAILED) {
+        mfile->data = NULL;
+        ERROR_DO_CLEAN_ALL(ERR_SYS)
+    }
+
+    mfile->size = fst.st_size;
+    stats_count(STATS_FILES, 1);
+    stats_count(STATS_BYTES_READ, mfile->size);
+	ZIC_RESULT = OK;
+    CLEANUP_ALL(close(fd));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Readers map these files without locking, so the new contents go to a
+ * temporary file that replaces the old one in a single rename.
+ */
+static result
+write_atomic(const char *path, const void *data, size_t len, mode_t mode,
+             bool keep_mode) {
+    char tmppath[PATHBUF] = {0};
+    int fd;
+    ZIC_RESULT_INIT()
+
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", path, getpid());
+
+    UNWRAP_NEG (fd = open(tmppath, O_CREAT | O_TRUNC | O_WRONLY, mode))
+
+    if (keep_mode)
+        TRY_NEG (fchmod(fd, mode), close(fd); DO_CLEAN_ALL())
+
+    for (size_t written = 0; written < len;) {
+        ssize_t wres = write(fd, (const char *)data + written, len - written);
+        TRY_NEG (wres, close(fd); DO_CLEAN_ALL())
+        written += wres;
+    }
+
+    TRY_NEG (close(fd), DO_CLEAN_ALL())
+    TRY_NEG (rename(tmppath, path), DO_CLEAN_ALL())
+    RET_OK()
+
+    CLEANUP_ALL(unlink(tmppath));
+    ZIC_RETURN_RESULT()
+}
+
+result
+write_file_atomic(const char *path, const void *data, size_t len) {
+    return write_atomic(path, data, len, 0644, false);
+}
+
+/* the replacement keeps mode, regardless of the umask */
+result
+write_file_atomic_mode(const char *path, const void *data, size_t len,
+                       mode_t mode) {
+    return write_atomic(path, data, len, mode, true);
+}
+
+void
+unmap_file(struct mapped_file *mfile) {
+    if (mfile->data)
+        munmap(mfile->data, mfile->size);
+
+    memset(mfile, 0, sizeof(*mfile));
+}
+
+/*
+ * A method the file systems or the kernel cannot do is given up only
+ * while nothing has been copied yet, later on it is a real error.
+ */
+static bool
+copy_unsupported(size_t copied) {
+    return !copied && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                       errno == EOPNOTSUPP || errno == ENOTTY);
+}
+
+static result
+copy_in_kernel(int destfd, int srcfd, size_t *copied) {
+    bool use_sendfile = false;
+
+    for (;;) {
+        ssize_t cres;
+
+        if (use_sendfile)
+            cres = sendfile(destfd, srcfd, NULL, COPY_RANGE_MAX);
+        else
+            cres = copy_file_range(srcfd, NULL, destfd, NULL, COPY_RANGE_MAX, 0);
+
+        if (cres == 0)
+            RET_OK()
+
+        if (cres > 0) {
+            *copied += cres;
+            continue;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if (!copy_unsupported(*copied))
+            ERROR(ERR_SYS)
+
+        if (use_sendfile)
+            FAIL()
+
+        use_sendfile = true;
+    }
+}
+
+static result
+copy_buffered(int destfd, int srcfd, size_t *copied) {
+    char buf[COPY_CHUNK];
+    ssize_t rres;
+
+    while ((rres = read(srcfd, buf, sizeof(buf)))) {
+        if (rres < 0 && errno == EINTR)
+            continue;
+
+        UNWRAP_NEG (rres)
+
+        for (ssize_t written = 0; written < rres;) {
+            ssize_t wres = write(destfd, buf + written, rres - written);
+
+            if (wres < 0 && errno == EINTR)
+                continue;
+
+            UNWRAP_NEG (wres)
+            written += wres;
+        }
+
+        *copied += rres;
+    }
+    RET_OK()
+}
+
+/*
+ * Copies srcfd into the empty destfd: as a reflink where the file
+ * system can share extents, else in the kernel with copy_file_range or
+ * sendfile, and in bounded chunks through user space as a last resort.
+ */
+result
+copy_fd(int destfd, int srcfd, size_t *copied) {
+    struct stat srcst = {0};
+    result cres;
+
+    *copied = 0;
+    UNWRAP_NEG (fstat(srcfd, &srcst))
+
+    if (ioctl(destfd, FICLONE, srcfd) == 0) {
+        *copied = srcst.st_size;
+        RET_OK()
+    }
+
+    cres = copy_in_kernel(destfd, srcfd, copied);
+    if (cres != FAIL)
+        return cres;
+
+    return copy_buffered(destfd, srcfd, copied);
+}
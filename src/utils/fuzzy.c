@@ -0,0 +1,76 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include <string.h>
+#include "utils/fuzzy.h"
+
+void
+fuzzy_compile(struct fuzzy_pattern *pat, const char *word) {
+    const unsigned char *c = (const unsigned char *)word;
+
+    memset(pat->peq, 0, sizeof(pat->peq));
+    pat->word = word;
+    pat->len = strlen(word);
+
+    for (size_t i = 0; i < pat->len && i < FUZZY_MAX_PATTERN; i++)
+        pat->peq[c[i]] |= 1ULL << i;
+}
+
+/*
+ * Smallest edit distance between the pattern and any substring of text.
+ * Patterns longer than FUZZY_MAX_PATTERN only match exactly.
+ */
+size_t
+fuzzy_distance(const struct fuzzy_pattern *pat, const char *text, size_t len) {
+    const unsigned char *c = (const unsigned char *)text;
+    uint64_t pv = ~0ULL, mv = 0, last;
+    size_t score = pat->len, best = pat->len;
+
+    if (!pat->len)
+        return 0;
+
+    if (pat->len > FUZZY_MAX_PATTERN)
+        return memmem(text, len, pat->word, pat->len) ? 0 : pat->len;
+
+    last = 1ULL << (pat->len - 1);
+
+    for (size_t i = 0; i < len; i++) {
+        uint64_t eq = pat->peq[c[i]];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & last)
+            score++;
+        else if (mh & last)
+            score--;
+
+        /* the top row stays zero: a match may start anywhere in the text */
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+
+        if (score < best) {
+            best = score;
+            if (!best)
+                break;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,71 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "def.h"
+#include "utils/growbuf.h"
+
+result
+growbuf_reserve(struct growbuf *buf, size_t extra) {
+    size_t newcap;
+    char *newdata = NULL;
+
+    if (buf->len + extra <= buf->cap)
+        RET_OK()
+
+    for (newcap = buf->cap ? buf->cap : LINEBUF;
+         newcap < buf->len + extra;
+         newcap *= 2);
+
+    newdata = realloc(buf->data, newcap);
+    UNWRAP_PTR (newdata)
+
+    buf->data = newdata;
+    buf->cap = newcap;
+    RET_OK()
+}
+
+result
+growbuf_append(struct growbuf *buf, const void *data, size_t len,
+               uint32_t *off) {
+    UNWRAP (growbuf_reserve(buf, len))
+
+    if (buf->len + len > UINT32_MAX)
+        ERROR(ERR_LOCAL)
+
+    if (off)
+        *off = (uint32_t)buf->len;
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    RET_OK()
+}
+
+void
+growbuf_free(struct growbuf *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+result
+growbuf_append_string(struct growbuf *strings, const char *str, size_t len,
+                      uint32_t *off) {
+    UNWRAP (growbuf_append(strings, str, len, off))
+    return growbuf_append(strings, "", 1, NULL);
+}
@@ -29,8 +29,9 @@ static const char *usage_msg =
     "\t\tsearch <tool> [kewords] - search a patch for a <tool> with given [keywords] (default command).\n"
     "\t\tload   <tool> <patch>   - download <patch> for given <tool> with patch name.\n"
     "\t\topen   <tool> <patch>   - show full description for <patch> of specified <tool>.\n"
-    "\t\tapply  <tool> <patch>   - download and apply the <patch> for given <tool>.\n\n"
+    "\t\tapply  <tool> <patch>...- download and apply the patches in order for given <tool>.\n\n"
     "\t\tsync                    - synchonize local patches repository.\n"
+    "\t\tserve                   - keep patches in memory and answer search, open and load.\n"
 	
     "\t\thelp    (--help/-h)     - to see this page.\n"
     "\t\tversion (--version/-v)  - to get version info.\n"
@@ -40,11 +41,30 @@ static const char *usage_msg =
     "\t\t\t-b:  show the web page on suckless.org for given patch in "
     "browser.\n\n"
     "\t\tload: \n"
-    "\t\t\t-a:  load and apply patch at once (the same as spmn apply).\n\n"
+    "\t\t\t-a:  load and apply patch at once (the same as spmn apply).\n"
+    "\t\t\t-y:  take the best ranked diff without asking when it applies "
+    "cleanly.\n\n"
     "\t\tsearch: \n"
-    "\t\t\t-f:  show patch description for each patch found.\n\n"
+    "\t\t\t-f:  show patch description for each patch found.\n"
+    "\t\t\t-j N: scan patch directories with N threads (default: one per "
+    "40 patches, up to the CPU count).\n"
+    "\t\t\t-n K: show only the K most relevant patches, best first.\n"
+    "\t\t\t-~K: also match keywords within K typos, closest matches first.\n"
+    "\t\t\t--all: search every tool in the mirror, grouped by tool.\n"
+    "\t\t\t--batch: read '<tool> [keywords]' queries from stdin, one per line.\n\n"
+    "\t\tsync: \n"
+    "\t\t\t-r:  rebuild the registry, search indexes and patch catalogs "
+    "without fetching.\n\n"
+    "\t\tserve: \n"
+    "\t\t\t-f:  stay in the foreground instead of detaching.\n\n"
     "\t\tapply: \n"
-    "\t\t\t-f:  apply the patch directly from given file.\n";
+    "\t\t\t-f:  apply the patch directly from given file (repeatable).\n"
+    "\t\t\t--dry-run: report how every hunk would apply without "
+    "changing any file.\n"
+    "\t\t\t-y:  as for load.\n\n"
+    "\t\tany command: \n"
+    "\t\t\t--stats: print per-phase timings and I/O counters to stderr "
+    "(also SPMN_STATS=1).\n";
 
 void 
 error(const char* err_format, ...) {
@@ -0,0 +1,183 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "def.h"
+#include "utils/matcher.h"
+
+#define MASK_WORD_BITS 64
+
+static uint64_t *
+state_outputs(const struct ac_matcher *matcher, uint32_t state) {
+    return matcher->outputs + (size_t)state * matcher->mask_words;
+}
+
+static result
+insert_word(struct ac_matcher *matcher, const char *word, size_t wid) {
+    uint32_t state = MATCHER_ROOT;
+
+    for (const unsigned char *c = (const unsigned char *)word; *c; c++) {
+        if (!matcher->next[state][*c]) {
+            matcher->next[state][*c] = (uint32_t)matcher->state_cnt++;
+        }
+        state = matcher->next[state][*c];
+    }
+
+    state_outputs(matcher, state)[wid / MASK_WORD_BITS] |= 
+        1ULL << (wid % MASK_WORD_BITS);
+    matcher->has_output[state] = true;
+    RET_OK()
+}
+
+static result
+link_failures(struct ac_matcher *matcher) {
+    uint32_t *fail = NULL, *queue = NULL;
+    size_t qhead = 0, qtail = 0;
+
+    fail = calloc(matcher->state_cnt, sizeof(*fail));
+    UNWRAP_PTR (fail)
+
+    queue = calloc(matcher->state_cnt, sizeof(*queue));
+    if (!queue) {
+        free(fail);
+        ERROR(ERR_SYS)
+    }
+
+    for (size_t c = 0; c < MATCHER_ALPHABET; c++) {
+        uint32_t child = matcher->next[MATCHER_ROOT][c];
+
+        if (child)
+            queue[qtail++] = child;
+    }
+
+    /* BFS order guarantees fail[state] is complete before its children */
+    while (qhead < qtail) {
+        uint32_t state = queue[qhead++];
+        uint64_t *outputs = state_outputs(matcher, state);
+        const uint64_t *fail_outputs = state_outputs(matcher, fail[state]);
+
+        for (size_t w = 0; w < matcher->mask_words; w++)
+            outputs[w] |= fail_outputs[w];
+
+        matcher->has_output[state] |= matcher->has_output[fail[state]];
+
+        for (size_t c = 0; c < MATCHER_ALPHABET; c++) {
+            uint32_t child = matcher->next[state][c];
+
+            if (child) {
+                fail[child] = matcher->next[fail[state]][c];
+                queue[qtail++] = child;
+            } else {
+                matcher->next[state][c] = matcher->next[fail[state]][c];
+            }
+        }
+    }
+
+    free(queue);
+    free(fail);
+    RET_OK()
+}
+
+result
+matcher_build(struct ac_matcher *matcher, char *const *words,
+              size_t wordcount) {
+    size_t max_states = 1;
+    ZIC_RESULT_INIT()
+
+    memset(matcher, 0, sizeof(*matcher));
+
+    for (size_t i = 0; i < wordcount; i++)
+        max_states += strlen(words[i]);
+
+    matcher->word_cnt = wordcount;
+    matcher->mask_words = (wordcount + MASK_WORD_BITS - 1) / MASK_WORD_BITS + 1;
+    matcher->state_cnt = 1;
+
+    matcher->next = calloc(max_states, sizeof(*matcher->next));
+    UNWRAP_PTR (matcher->next)
+
+    matcher->outputs = calloc(max_states * matcher->mask_words,
+                              sizeof(*matcher->outputs));
+    TRY_PTR (matcher->outputs, DO_CLEAN_ALL())
+
+    matcher->has_output = calloc(max_states, sizeof(*matcher->has_output));
+    TRY_PTR (matcher->has_output, DO_CLEAN_ALL())
+
+    for (size_t i = 0; i < wordcount; i++)
+        UNWRAP_DO_CLEAN_ALL (insert_word(matcher, words[i], i))
+
+    UNWRAP_DO_CLEAN_ALL (link_failures(matcher))
+    RET_OK()
+
+    CLEANUP_ALL(matcher_free(matcher));
+    ZIC_RETURN_RESULT()
+}
+
+uint64_t *
+matcher_alloc_mask(const struct ac_matcher *matcher) {
+    return calloc(matcher->mask_words, sizeof(uint64_t));
+}
+
+bool
+matcher_all_matched(const struct ac_matcher *matcher, const uint64_t *matched) {
+    size_t full_words = matcher->word_cnt / MASK_WORD_BITS;
+    size_t rest_bits = matcher->word_cnt % MASK_WORD_BITS;
+
+    for (size_t w = 0; w < full_words; w++) {
+        if (matched[w] != UINT64_MAX)
+            return false;
+    }
+
+    return rest_bits == 0 || 
+        matched[full_words] == (1ULL << rest_bits) - 1;
+}
+
+bool
+matcher_scan(const struct ac_matcher *matcher, const char *text, size_t len,
+             uint64_t *matched) {
+    const unsigned char *c = (const unsigned char *)text;
+    uint32_t state = MATCHER_ROOT;
+
+    if (matcher_all_matched(matcher, matched))
+        return true;
+
+    for (size_t i = 0; i < len; i++) {
+        state = matcher->next[state][c[i]];
+
+        if (matcher->has_output[state]) {
+            const uint64_t *outputs = state_outputs(matcher, state);
+
+            for (size_t w = 0; w < matcher->mask_words; w++)
+                matched[w] |= outputs[w];
+
+            if (matcher_all_matched(matcher, matched))
+                return true;
+        }
+    }
+    return false;
+}
+
+void
+matcher_free(struct ac_matcher *matcher) {
+    free(matcher->next);
+    free(matcher->outputs);
+    free(matcher->has_output);
+    memset(matcher, 0, sizeof(*matcher));
+}
@@ -35,6 +35,9 @@ spmn. If not, see <https://www.gnu.org/licenses/>.
 #include <time.h>
 #include "def.h"
 #include "utils/logutils.h" 
+#include "utils/pathutils.h"
+#include "utils/registry.h"
+#include "utils/stats.h"
 
 result 
 check_isdir(const struct dirent *dir) {
@@ -143,6 +146,30 @@ append_tooldir(char **buf, const char *basecacherepo, const char *tooldir) {
     return spappend(buf, basecacherepo, tooldir);
 }
 
+/* a tool with a site of its own, <toolname>.suckless.org/patches/ */
+static result
+search_sitedir(char **buf, const char *basecacherepo, const char *toolname) {
+    char sitedir[PATHBUF] = {0};
+    char *patchdir = NULL;
+    struct stat pdst;
+    ZIC_RESULT_INIT()
+
+    if ((size_t)snprintf(sitedir, sizeof(sitedir), "%s%s",
+                         toolname, PATCHESDIR) >= sizeof(sitedir))
+        ERROR(ERR_ENTRY_NOT_FOUND)
+
+    UNWRAP (spappend(&patchdir, basecacherepo, sitedir))
+
+    if (stat(patchdir, &pdst) || !S_ISDIR(pdst.st_mode))
+        ERROR_DO_CLEAN_ALL(ERR_ENTRY_NOT_FOUND)
+
+    TRY_PTR (*buf = strdup(sitedir), DO_CLEAN_ALL())
+    ZIC_RESULT = OK;
+
+    CLEANUP_ALL(free(patchdir));
+    ZIC_RETURN_RESULT()
+}
+
 result
 search_tooldir(char **buf, const char *basecacherepo, const char *toolname) {
     char *toolsdir_path = NULL;
@@ -151,20 +178,30 @@ search_tooldir(char **buf, const char *basecacherepo, const char *toolname) {
     ZIC_RESULT_INIT()
 
     *buf = NULL;
+    if (IS_OK(search_sitedir(buf, basecacherepo, toolname)))
+        RET_OK()
+
     UNWRAP (spappend(&toolsdir_path, basecacherepo, TOOLSDIR));
 
-	TRY_PTR (toolsdir = opendir(toolsdir_path), DO_CLEAN(cl_pbuf_free);
+    if (!(toolsdir = opendir(toolsdir_path))) {
+        ZIC_RESULT = errno == ENOENT ? ERR_ENTRY_NOT_FOUND : ERR_SYS;
+        DO_CLEAN(cl_pbuf_free)
+    }
 
     while ((tool = readdir(toolsdir))) {
-        if (IS_OK(check_isdir(tool))) {
-            if (IS_OK(strncmp(toolname, tool->d_name, ENTRYLEN))) {
-                TRY (
-                    spappend(buf, TOOLSDIR, tool->d_name), DO_CLEAN_ALL()))
-            }
+        if (IS_OK(check_isdir(tool)) && 
+            IS_OK(strncmp(toolname, tool->d_name, ENTRYLEN))) {
+            char tooldir[PATHBUF] = {0};
+
+            snprintf(tooldir, sizeof(tooldir), "%s%s%s", 
+                     TOOLSDIR, tool->d_name, PATCHESP);
+
+            TRY_PTR (*buf = strdup(tooldir), DO_CLEAN_ALL())
+            break;
         } 
     }
 
-    ZIC_RESULT = !!*buf;
+    ZIC_RESULT = *buf ? OK : ERR_ENTRY_NOT_FOUND;
 
     CLEANUP_ALL (closedir(toolsdir));
 	CLEANUP(cl_pbuf_free, free(toolsdir_path));
@@ -180,8 +217,27 @@ str_append_patch_dir(char **patchdir, const char *append, size_t psize) {
     RET_OK()
 }
 
+static result
+get_registry_tool_path(char **patchdir, const struct tool_registry *reg, 
+                       const char *toolname) {
+    struct tool_entry tool;
+
+    UNWRAP (registry_lookup(reg, toolname, &tool))
+    return str_append_patch_dir(patchdir, tool.patchdir, strlen(tool.patchdir));
+}
+
 result
 get_tool_path(char **patchdir, const char *basecacherepo, const char *toolname) {
+    struct tool_registry reg;
+
+    if (IS_OK(open_tool_registry(&reg, basecacherepo))) {
+        result reg_res = get_registry_tool_path(patchdir, &reg, toolname);
+
+        close_tool_registry(&reg);
+        return reg_res;
+    }
+
+    /* without a registry from the last sync fall back to the directories */
     if (IS_OK(strncmp(toolname, DWM, ENTRYLEN))) {
         UNWRAP (
             str_append_patch_dir(patchdir, DWM_PATCHESDIR, sizeof(DWM_PATCHESDIR))
@@ -213,6 +269,201 @@ append_toolpath(char **buf, const char *basecacherepo, const char *toolname) {
 	ZIC_RETURN_RESULT()
 }
 
+static result
+append_cachefile(char **buf, const char *basecacherepo, const char *name) {
+    size_t cachedir_len;
+
+    cachedir_len = strnlen(basecacherepo, PATHBUF);
+    if (cachedir_len < 2)
+        ERROR(ERR_LOCAL);
+
+    for (cachedir_len -= 2; 
+         cachedir_len && basecacherepo[cachedir_len] != '/'; 
+         cachedir_len--);
+
+    return snpappend(buf, basecacherepo, name, cachedir_len + 1);
+}
+
+result
+append_cachedir(char **buf, const char *basecacherepo) {
+    return append_cachefile(buf, basecacherepo, "");
+}
+
+result
+append_indexdir(char **buf, const char *basecacherepo) {
+    return append_cachefile(buf, basecacherepo, INDEXDIR);
+}
+
+result
+append_socketpath(char **buf, const char *basecacherepo) {
+    return append_cachefile(buf, basecacherepo, SERVE_SOCKET);
+}
+
+result
+append_syncstatepath(char **buf, const char *basecacherepo) {
+    return append_cachefile(buf, basecacherepo, SYNC_STATE);
+}
+
+result
+append_indexpath(char **buf, const char *basecacherepo, const char *toolname) {
+    char *indexdir = NULL, *indexf = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+    TRY (spappend(&indexf, toolname, SEARCH_INDEX_EXT), DO_CLEAN(cl_indexdir))
+    TRY (spappend(buf, indexdir, indexf), DO_CLEAN_ALL())
+
+    CLEANUP_ALL(free(indexf));
+    CLEANUP(cl_indexdir, free(indexdir));
+    ZIC_RETURN_RESULT()
+}
+
+result
+append_catalogpath(char **buf, const char *basecacherepo, const char *toolname) {
+    char *indexdir = NULL, *catf = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+    TRY (spappend(&catf, toolname, PATCH_CATALOG_EXT), DO_CLEAN(cl_indexdir))
+    TRY (spappend(buf, indexdir, catf), DO_CLEAN_ALL())
+
+    CLEANUP_ALL(free(catf));
+    CLEANUP(cl_indexdir, free(indexdir));
+    ZIC_RETURN_RESULT()
+}
+
+result
+append_descstorepath(char **buf, const char *basecacherepo,
+                     const char *toolname) {
+    char *indexdir = NULL, *storef = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+    TRY (spappend(&storef, toolname, DESC_STORE_EXT), DO_CLEAN(cl_indexdir))
+    TRY (spappend(buf, indexdir, storef), DO_CLEAN_ALL())
+
+    CLEANUP_ALL(free(storef));
+    CLEANUP(cl_indexdir, free(indexdir));
+    ZIC_RETURN_RESULT()
+}
+
+result
+append_registrypath(char **buf, const char *basecacherepo) {
+    char *indexdir = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+    ZIC_RESULT = spappend(buf, indexdir, TOOL_REGISTRY);
+
+    free(indexdir);
+    ZIC_RETURN_RESULT()
+}
+
+static result
+iter_tool(const char *basecacherepo, const char *toolname, 
+          const char *tooldir, tool_iter_cb iter_cb, void *ctx) {
+    char *patchdir = NULL;
+    struct stat pdst;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (spappend(&patchdir, basecacherepo, tooldir))
+
+    if (stat(patchdir, &pdst) || !S_ISDIR(pdst.st_mode))
+        RET_OK_DO_CLEAN_ALL()
+
+    ZIC_RESULT = iter_cb(toolname, patchdir, ctx);
+
+    CLEANUP_ALL(free(patchdir));
+    ZIC_RETURN_RESULT()
+}
+
+static int
+site_dir_filter(const struct dirent *dir) {
+    return IS_OK(check_isdir(dir));
+}
+
+/*
+ * Every top-level <site>/patches/ of the mirror, in name order, is a
+ * tool named after <site> without its ".suckless.org" domain.
+ */
+static result
+iter_site_tools(const char *basecacherepo, tool_iter_cb iter_cb, void *ctx) {
+    const size_t domain_len = sizeof(SITE_DOMAIN) - 1;
+    struct dirent **sites = NULL;
+    int site_cnt;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_NEG (site_cnt = scandir(basecacherepo, &sites, &site_dir_filter,
+                                   &alphasort))
+    stats_count(STATS_DIRS, 1);
+
+    for (int i = 0; i < site_cnt; i++) {
+        const char *site = sites[i]->d_name;
+        size_t name_len = strlen(site);
+        char toolname[ENTRYLEN] = {0};
+        char tooldir[PATHBUF] = {0};
+
+        if (name_len > domain_len &&
+            IS_OK(strcmp(site + name_len - domain_len, SITE_DOMAIN)))
+            name_len -= domain_len;
+
+        if (name_len >= sizeof(toolname))
+            continue;
+
+        memcpy(toolname, site, name_len);
+        snprintf(tooldir, sizeof(tooldir), "%s%s", site, PATCHESP);
+
+        ZIC_RESULT = iter_tool(basecacherepo, toolname, tooldir, iter_cb, ctx);
+        if (ZIC_RESULT)
+            DO_CLEAN_ALL()
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(
+        for (int i = 0; i < site_cnt; i++)
+            free(sites[i]);
+        free(sites));
+    ZIC_RETURN_RESULT()
+}
+
+result
+iter_tools(const char *basecacherepo, tool_iter_cb iter_cb, void *ctx) {
+    char *toolsdir_path = NULL;
+    DIR *toolsdir = NULL;
+    struct dirent *tool = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (iter_site_tools(basecacherepo, iter_cb, ctx))
+
+    UNWRAP (spappend(&toolsdir_path, basecacherepo, TOOLSDIR));
+
+    /* a mirror without tools.suckless.org has only the site tools */
+    if (!(toolsdir = opendir(toolsdir_path))) {
+        ZIC_RESULT = errno == ENOENT ? OK : ERR_SYS;
+        DO_CLEAN(cl_pbuf_free)
+    }
+    stats_count(STATS_DIRS, 1);
+
+    while ((tool = readdir(toolsdir))) {
+        if (IS_OK(check_isdir(tool))) {
+            char tooldir[PATHBUF] = {0};
+
+            snprintf(tooldir, sizeof(tooldir), "%s%s%s", 
+                     TOOLSDIR, tool->d_name, PATCHESP);
+
+            ZIC_RESULT = iter_tool(basecacherepo, tool->d_name, 
+                                   tooldir, iter_cb, ctx);
+            if (ZIC_RESULT)
+                DO_CLEAN_ALL()
+        } 
+    }
+
+	ZIC_RESULT = OK;
+    CLEANUP_ALL (closedir(toolsdir));
+	CLEANUP(cl_pbuf_free, free(toolsdir_path));
+	ZIC_RETURN_RESULT()
+}
+
 result
 get_repocache(char **cachedirbuf) {
     char *homedir = NULL;
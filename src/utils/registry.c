@@ -0,0 +1,501 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "def.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+#include "utils/pathutils.h"
+#include "utils/registry.h"
+
+#define TREG_SEED_MIX 0x9e3779b97f4a7c15ULL
+
+struct registry_builder {
+    const char *basecacherepo;
+    struct growbuf tools;
+    struct growbuf keys;
+    struct growbuf strings;
+};
+
+static uint64_t
+treg_hash(const char *key, size_t len, uint32_t seed) {
+    const unsigned char *bytes = (const unsigned char *)key;
+    uint64_t hash = FNV_OFFSET_BASIS ^ (seed * TREG_SEED_MIX);
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t
+treg_checksum(const void *data, size_t len) {
+    return treg_hash(data, len, 0);
+}
+
+static size_t
+registry_size(uint32_t tool_cnt, uint32_t key_cnt, uint32_t strings_len) {
+    return sizeof(struct treg_header) + 
+        (size_t)key_cnt * (sizeof(int32_t) + sizeof(struct treg_key)) +
+        (size_t)tool_cnt * sizeof(struct treg_tool) + strings_len;
+}
+
+static result
+validate_tool_registry(const struct tool_registry *reg) {
+    const struct treg_header *hdr = reg->hdr;
+
+    if (reg->map.size < sizeof(*hdr) ||
+        memcmp(hdr->magic, TREG_MAGIC, TREG_MAGIC_LEN) ||
+        hdr->version != TREG_VERSION ||
+        reg->map.size != registry_size(hdr->tool_cnt, hdr->key_cnt,
+                                       hdr->strings_len) ||
+        hdr->checksum != treg_checksum(reg->map.data + sizeof(*hdr),
+                                       reg->map.size - sizeof(*hdr)))
+        ERROR(ERR_LOCAL)
+
+    for (uint32_t k = 0; k < hdr->key_cnt; k++) {
+        const struct treg_key *key = reg->keys + k;
+
+        if (key->tool >= hdr->tool_cnt ||
+            (uint64_t)key->str_off + key->str_len >= hdr->strings_len ||
+            reg->displacements[k] < -(int64_t)hdr->key_cnt)
+            ERROR(ERR_LOCAL)
+    }
+
+    for (uint32_t t = 0; t < hdr->tool_cnt; t++) {
+        const struct treg_tool *tool = reg->tools + t;
+
+        if ((uint64_t)tool->name_off + tool->name_len >= hdr->strings_len ||
+            (uint64_t)tool->dir_off + tool->dir_len >= hdr->strings_len)
+            ERROR(ERR_LOCAL)
+    }
+
+    if (hdr->strings_len && reg->strings[hdr->strings_len - 1] != ASCNULL)
+        ERROR(ERR_LOCAL)
+
+    RET_OK()
+}
+
+/*
+ * Kept mapped by spmn serve, every open hands out a view of it instead
+ * of mapping and validating the file again.
+ */
+static struct tool_registry resident_registry;
+
+result
+open_tool_registry(struct tool_registry *reg, const char *basecacherepo) {
+    char *regpath = NULL;
+    ZIC_RESULT_INIT()
+
+    if (resident_registry.retained) {
+        *reg = resident_registry;
+        RET_OK()
+    }
+
+    memset(reg, 0, sizeof(*reg));
+
+    UNWRAP (append_registrypath(&regpath, basecacherepo))
+    TRY (map_file(&reg->map, regpath), DO_CLEAN_ALL())
+
+    reg->hdr = (const struct treg_header *)reg->map.data;
+    if (reg->map.size >= sizeof(*reg->hdr)) {
+        reg->displacements = (const int32_t *)(reg->hdr + 1);
+        reg->keys = (const struct treg_key *)(reg->displacements + 
+                                              reg->hdr->key_cnt);
+        reg->tools = (const struct treg_tool *)(reg->keys + reg->hdr->key_cnt);
+        reg->strings = (const char *)(reg->tools + reg->hdr->tool_cnt);
+    }
+
+    ZIC_RESULT = validate_tool_registry(reg);
+    if (ZIC_RESULT)
+        close_tool_registry(reg);
+
+    CLEANUP_ALL(free(regpath));
+    ZIC_RETURN_RESULT()
+}
+
+void
+close_tool_registry(struct tool_registry *reg) {
+    if (!reg->retained)
+        unmap_file(&reg->map);
+
+    memset(reg, 0, sizeof(*reg));
+}
+
+result
+keep_tool_registry(const char *basecacherepo) {
+    struct tool_registry reg;
+
+    drop_tool_registry();
+    UNWRAP (open_tool_registry(&reg, basecacherepo))
+
+    resident_registry = reg;
+    resident_registry.retained = true;
+    RET_OK()
+}
+
+void
+drop_tool_registry(void) {
+    if (!resident_registry.retained)
+        return;
+
+    unmap_file(&resident_registry.map);
+    memset(&resident_registry, 0, sizeof(resident_registry));
+}
+
+result
+registry_lookup(const struct tool_registry *reg, const char *name,
+                struct tool_entry *entry) {
+    const struct treg_key *key = NULL;
+    const struct treg_tool *tool = NULL;
+    size_t namelen = strnlen(name, ENTRYLEN);
+    uint32_t key_cnt = reg->hdr->key_cnt;
+    int32_t disp;
+    uint64_t slot;
+
+    if (!key_cnt)
+        ERROR(ERR_ENTRY_NOT_FOUND)
+
+    disp = reg->displacements[treg_hash(name, namelen, 0) % key_cnt];
+    slot = disp < 0 ? (uint64_t)(-(int64_t)disp - 1) : 
+        treg_hash(name, namelen, (uint32_t)disp) % key_cnt;
+
+    /* any name lands in some slot, only the stored key tells a hit */
+    key = reg->keys + slot;
+    if (key->str_len != namelen || memcmp(reg->strings + key->str_off, name, namelen))
+        ERROR(ERR_ENTRY_NOT_FOUND)
+
+    tool = reg->tools + key->tool;
+    entry->name = reg->strings + tool->name_off;
+    entry->patchdir = reg->strings + tool->dir_off;
+    entry->patch_cnt = tool->patch_cnt;
+    RET_OK()
+}
+
+result
+iter_registry_tools(const struct tool_registry *reg, const char *basecacherepo,
+                    tool_iter_cb iter_cb, void *ctx) {
+    for (uint32_t t = 0; t < reg->hdr->tool_cnt; t++) {
+        const struct treg_tool *tool = reg->tools + t;
+        char *patchdir = NULL;
+        result iter_res;
+
+        UNWRAP (spappend(&patchdir, basecacherepo, reg->strings + tool->dir_off))
+        iter_res = iter_cb(reg->strings + tool->name_off, patchdir, ctx);
+        free(patchdir);
+
+        UNWRAP (iter_res)
+    }
+    RET_OK()
+}
+
+result
+iter_mirror_tools(const char *basecacherepo, tool_iter_cb iter_cb, void *ctx) {
+    struct tool_registry reg;
+    result iter_res;
+
+    if (open_tool_registry(&reg, basecacherepo))
+        return iter_tools(basecacherepo, iter_cb, ctx);
+
+    iter_res = iter_registry_tools(&reg, basecacherepo, iter_cb, ctx);
+    close_tool_registry(&reg);
+    return iter_res;
+}
+
+static uint32_t
+count_patches(const char *patchdir) {
+    DIR *pd = NULL;
+    struct dirent *pdir = NULL;
+    uint32_t patch_cnt = 0;
+
+    if (!(pd = opendir(patchdir)))
+        return 0;
+
+    while ((pdir = readdir(pd))) {
+        if (IS_OK(check_isdir(pdir)))
+            patch_cnt++;
+    }
+
+    closedir(pd);
+    return patch_cnt;
+}
+
+static bool
+has_key(const struct registry_builder *builder, const char *name, size_t len) {
+    const struct treg_key *keys = (const struct treg_key *)builder->keys.data;
+    size_t key_cnt = builder->keys.len / sizeof(*keys);
+
+    for (size_t k = 0; k < key_cnt; k++) {
+        if (keys[k].str_len == len && 
+            IS_OK(memcmp(builder->strings.data + keys[k].str_off, name, len)))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Keys point into strings already stored for the tool, an alias is a
+ * prefix of the tool's patches dir.
+ */
+static result
+add_key(struct registry_builder *builder, uint32_t str_off, uint32_t len,
+        uint32_t tool) {
+    struct treg_key key = { .str_off = str_off, .str_len = len, .tool = tool };
+
+    /* a name taken by an earlier tool keeps pointing there */
+    if (has_key(builder, builder->strings.data + str_off, len))
+        RET_OK()
+
+    return growbuf_append(&builder->keys, &key, sizeof(key), NULL);
+}
+
+/*
+ * Every tool is reachable by its name and by its site path without the
+ * patches suffix: "dwm.suckless.org" or "tools.suckless.org/dmenu".
+ */
+static result
+add_registry_tool(const char *toolname, const char *patchdir, void *ctx) {
+    struct registry_builder *builder = ctx;
+    const char *reldir = patchdir + strlen(builder->basecacherepo);
+    size_t reldir_len = strlen(reldir);
+    const size_t patchesp_len = sizeof(PATCHESP) - 1;
+    struct treg_tool tool = {0};
+    uint32_t toolid = (uint32_t)(builder->tools.len / sizeof(tool));
+
+    if (has_key(builder, toolname, strlen(toolname)))
+        RET_OK()
+
+    tool.name_len = (uint32_t)strlen(toolname);
+    tool.dir_len = (uint32_t)reldir_len;
+    tool.patch_cnt = count_patches(patchdir);
+
+    UNWRAP (growbuf_append_string(&builder->strings, toolname, tool.name_len,
+                                  &tool.name_off))
+    UNWRAP (growbuf_append_string(&builder->strings, reldir, tool.dir_len,
+                                  &tool.dir_off))
+    UNWRAP (growbuf_append(&builder->tools, &tool, sizeof(tool), NULL))
+
+    UNWRAP (add_key(builder, tool.name_off, tool.name_len, toolid))
+
+    if (reldir_len > patchesp_len && 
+        IS_OK(strcmp(reldir + reldir_len - patchesp_len, PATCHESP))) {
+        UNWRAP (add_key(builder, tool.dir_off, 
+                        (uint32_t)(reldir_len - patchesp_len), toolid))
+    }
+
+    RET_OK()
+}
+
+struct treg_bucket {
+    uint32_t *keys;
+    uint32_t key_cnt;
+    uint32_t id;
+};
+
+static int
+cmp_buckets(const void *a, const void *b) {
+    const struct treg_bucket *ba = a, *bb = b;
+
+    return (bb->key_cnt > ba->key_cnt) - (bb->key_cnt < ba->key_cnt);
+}
+
+static const char *
+key_str(const struct registry_builder *builder, const struct treg_key *key) {
+    return builder->strings.data + key->str_off;
+}
+
+/*
+ * Place the largest buckets first: find a displacement that sends every
+ * key of the bucket to a distinct free slot. Single-key buckets take the
+ * remaining free slots directly.
+ */
+static result
+place_bucket(const struct registry_builder *builder,
+             const struct treg_bucket *bucket, uint32_t key_cnt,
+             int32_t *displacements, uint32_t *slot_keys, uint32_t *slots) {
+    const struct treg_key *keys = (const struct treg_key *)builder->keys.data;
+
+    for (uint32_t disp = 1; disp < TREG_MAX_DISPLACEMENT; disp++) {
+        uint32_t placed = 0;
+
+        for (; placed < bucket->key_cnt; placed++) {
+            const struct treg_key *key = keys + bucket->keys[placed];
+            uint32_t slot = treg_hash(key_str(builder, key), key->str_len, disp) % 
+                key_cnt;
+            bool taken = slot_keys[slot] != UINT32_MAX;
+
+            for (uint32_t p = 0; p < placed && !taken; p++)
+                taken = slots[p] == slot;
+
+            if (taken)
+                break;
+
+            slots[placed] = slot;
+        }
+
+        if (placed == bucket->key_cnt) {
+            for (uint32_t p = 0; p < placed; p++)
+                slot_keys[slots[p]] = bucket->keys[p];
+
+            displacements[bucket->id] = (int32_t)disp;
+            RET_OK()
+        }
+    }
+    ERROR(ERR_LOCAL)
+}
+
+static result
+build_perfect_hash(const struct registry_builder *builder,
+                   int32_t *displacements, uint32_t *slot_keys) {
+    const struct treg_key *keys = (const struct treg_key *)builder->keys.data;
+    uint32_t key_cnt = (uint32_t)(builder->keys.len / sizeof(*keys));
+    struct treg_bucket *buckets = NULL;
+    uint32_t *key_buckets = NULL, *bucket_keys = NULL, *slots = NULL;
+    uint32_t free_slot = 0, bucket_off = 0;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_PTR (buckets = calloc(key_cnt + 1, sizeof(*buckets)))
+    TRY_PTR (key_buckets = calloc(key_cnt + 1, sizeof(*key_buckets)),
+        DO_CLEAN(cl_buckets))
+    TRY_PTR (bucket_keys = calloc(key_cnt + 1, sizeof(*bucket_keys)),
+        DO_CLEAN(cl_key_buckets))
+    TRY_PTR (slots = calloc(key_cnt + 1, sizeof(*slots)), DO_CLEAN(cl_bucket_keys))
+
+    for (uint32_t k = 0; k < key_cnt; k++) {
+        key_buckets[k] = treg_hash(key_str(builder, keys + k), keys[k].str_len, 0) % 
+            key_cnt;
+        buckets[key_buckets[k]].key_cnt++;
+    }
+
+    for (uint32_t b = 0; b < key_cnt; b++) {
+        buckets[b].id = b;
+        buckets[b].keys = bucket_keys + bucket_off;
+        bucket_off += buckets[b].key_cnt;
+        buckets[b].key_cnt = 0;
+        slot_keys[b] = UINT32_MAX;
+    }
+
+    for (uint32_t k = 0; k < key_cnt; k++) {
+        struct treg_bucket *bucket = buckets + key_buckets[k];
+
+        bucket->keys[bucket->key_cnt++] = k;
+    }
+
+    qsort(buckets, key_cnt, sizeof(*buckets), cmp_buckets);
+
+    for (uint32_t b = 0; b < key_cnt && buckets[b].key_cnt; b++) {
+        if (buckets[b].key_cnt > 1) {
+            UNWRAP_DO_CLEAN_ALL (place_bucket(builder, buckets + b, key_cnt,
+                                              displacements, slot_keys, slots))
+            continue;
+        }
+
+        while (slot_keys[free_slot] != UINT32_MAX)
+            free_slot++;
+
+        slot_keys[free_slot] = buckets[b].keys[0];
+        displacements[buckets[b].id] = -(int32_t)free_slot - 1;
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(free(slots));
+    CLEANUP(cl_bucket_keys, free(bucket_keys));
+    CLEANUP(cl_key_buckets, free(key_buckets));
+    CLEANUP(cl_buckets, free(buckets));
+    ZIC_RETURN_RESULT()
+}
+
+static result
+write_tool_registry(const struct registry_builder *builder, const char *regpath) {
+    const struct treg_key *keys = (const struct treg_key *)builder->keys.data;
+    struct treg_header hdr = {0};
+    int32_t *displacements = NULL;
+    uint32_t *slot_keys = NULL;
+    struct growbuf image = {0};
+    ZIC_RESULT_INIT()
+
+    memcpy(hdr.magic, TREG_MAGIC, TREG_MAGIC_LEN);
+    hdr.version = TREG_VERSION;
+    hdr.tool_cnt = (uint32_t)(builder->tools.len / sizeof(struct treg_tool));
+    hdr.key_cnt = (uint32_t)(builder->keys.len / sizeof(*keys));
+    hdr.strings_len = (uint32_t)builder->strings.len;
+
+    UNWRAP_PTR (displacements = calloc(hdr.key_cnt + 1, sizeof(*displacements)))
+    TRY_PTR (slot_keys = calloc(hdr.key_cnt + 1, sizeof(*slot_keys)),
+        DO_CLEAN(cl_displacements))
+
+    UNWRAP_DO_CLEAN_ALL (build_perfect_hash(builder, displacements, slot_keys))
+
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, &hdr, sizeof(hdr), NULL))
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, displacements, 
+                                        hdr.key_cnt * sizeof(*displacements),
+                                        NULL))
+
+    for (uint32_t s = 0; s < hdr.key_cnt; s++) {
+        UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, keys + slot_keys[s],
+                                            sizeof(*keys), NULL))
+    }
+
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, builder->tools.data,
+                                        builder->tools.len, NULL))
+    UNWRAP_DO_CLEAN_ALL (growbuf_append(&image, builder->strings.data,
+                                        builder->strings.len, NULL))
+
+    hdr.checksum = treg_checksum(image.data + sizeof(hdr), image.len - sizeof(hdr));
+    memcpy(image.data, &hdr, sizeof(hdr));
+
+    ZIC_RESULT = write_file_atomic(regpath, image.data, image.len);
+
+    CLEANUP_ALL(
+        growbuf_free(&image);
+        free(slot_keys));
+    CLEANUP(cl_displacements, free(displacements));
+    ZIC_RETURN_RESULT()
+}
+
+result
+build_tool_registry(const char *basecacherepo) {
+    struct registry_builder builder = { .basecacherepo = basecacherepo };
+    char *indexdir = NULL, *regpath = NULL;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (append_indexdir(&indexdir, basecacherepo))
+    TRY (append_registrypath(&regpath, basecacherepo), DO_CLEAN(cl_indexdir))
+
+    if (mkdir(indexdir, 0755) && errno != EEXIST)
+        ERROR_DO_CLEAN_ALL(ERR_SYS)
+
+    UNWRAP_DO_CLEAN_ALL (iter_tools(basecacherepo, &add_registry_tool, &builder))
+    ZIC_RESULT = write_tool_registry(&builder, regpath);
+
+    CLEANUP_ALL(
+        growbuf_free(&builder.tools);
+        growbuf_free(&builder.keys);
+        growbuf_free(&builder.strings);
+        free(regpath));
+    CLEANUP(cl_indexdir, free(indexdir));
+    ZIC_RETURN_RESULT()
+}
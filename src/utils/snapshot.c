@@ -0,0 +1,499 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include <bsd/string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "def.h"
+#include "utils/fileutils.h"
+#include "utils/pathutils.h"
+#include "utils/snapshot.h"
+
+#define SNAPSHOT_TEMPLATE "XXXXXX"
+#define SNAPSHOT_DIR_MODE 0755
+#define LOCK_MODE 0644
+#define PIN_TRIES 8
+#define GIT_NAME ".git"
+#define GIT_OBJECTS_NAME "objects"
+
+/*
+ * Links in the cache directory that go through 'current', for the paths
+ * used before snapshots.
+ */
+static const char *const compat_links[][2] = {
+    {"sites", CURRENT_SNAPSHOT "/sites"},
+    {"index", CURRENT_SNAPSHOT "/index"},
+};
+
+/*
+ * Git replaces worktree files instead of writing into them and indexes
+ * are replaced by rename, so their files are shared with the previous
+ * snapshot. Under .git only the
+ * objects are immutable; the refs, logs and the like are copied.
+ */
+enum stage_mode {
+    STAGE_LINK,
+    STAGE_COPY,
+};
+
+static result cache_path(char *buf, const char *basecacherepo,
+                         const char *name) {
+    char *cachedir = NULL;
+    int len;
+
+    UNWRAP(append_cachedir(&cachedir, basecacherepo))
+    len = snprintf(buf, PATHBUF, "%s%s", cachedir, name);
+    free(cachedir);
+
+    if (len < 0 || len >= PATHBUF)
+        ERROR(ERR_LOCAL)
+    RET_OK()
+}
+
+static result make_dirs(const char *path) {
+    char dir[PATHBUF] = {0};
+
+    if (strlcpy(dir, path, sizeof(dir)) >= sizeof(dir))
+        ERROR(ERR_LOCAL)
+
+    for (char *sep = strchr(dir + 1, '/'); sep; sep = strchr(sep + 1, '/')) {
+        *sep = ASCNULL;
+        if (mkdir(dir, SNAPSHOT_DIR_MODE) && errno != EEXIST)
+            ERROR(ERR_SYS)
+        *sep = '/';
+    }
+
+    if (mkdir(dir, SNAPSHOT_DIR_MODE) && errno != EEXIST)
+        ERROR(ERR_SYS)
+    RET_OK()
+}
+
+/*
+ * Pins the published snapshot for as long as the process runs or until
+ * unpin_snapshot. A mirror synced before snapshots existed is used as is.
+ */
+result pin_snapshot(struct snapshot *snap, const char *basecacherepo) {
+    char current[PATHBUF] = {0};
+    char snapdir[PATHBUF] = {0};
+    char lockpath[PATHBUF] = {0};
+    struct stat lockst;
+    int lockfd;
+
+    snap->basecacherepo = NULL;
+    snap->lockfd = -1;
+
+    UNWRAP(cache_path(current, basecacherepo, CURRENT_SNAPSHOT))
+
+    for (size_t try = 0; try < PIN_TRIES; try++) {
+        if (!realpath(current, snapdir)) {
+            if (errno != ENOENT)
+                ERROR(ERR_SYS)
+
+            UNWRAP_PTR(snap->basecacherepo = strdup(basecacherepo))
+            RET_OK()
+        }
+
+        if (snprintf(lockpath, sizeof(lockpath), "%s/%s", snapdir,
+                     READERS_LOCK) >= (int)sizeof(lockpath))
+            ERROR(ERR_LOCAL)
+
+        /* retired since 'current' was read: read it again */
+        if ((lockfd = open(lockpath, O_RDONLY | O_CLOEXEC)) < 0)
+            continue;
+
+        if (flock(lockfd, LOCK_SH) || fstat(lockfd, &lockst)) {
+            close(lockfd);
+            ERROR(ERR_SYS)
+        }
+
+        if (!lockst.st_nlink) {
+            close(lockfd);
+            continue;
+        }
+
+        snap->lockfd = lockfd;
+        if (IS_OK(spappend(&snap->basecacherepo, snapdir, "/" MIRRORDIR)))
+            RET_OK()
+
+        unpin_snapshot(snap);
+        FAIL()
+    }
+
+    ERROR(ERR_LOCAL)
+}
+
+void unpin_snapshot(struct snapshot *snap) {
+    if (snap->lockfd >= 0)
+        close(snap->lockfd);
+
+    free(snap->basecacherepo);
+    snap->basecacherepo = NULL;
+    snap->lockfd = -1;
+}
+
+/*
+ * Only one sync builds and publishes a snapshot at a time. Without wait,
+ * a sync already running is reported as ERR_SYNC_BUSY.
+ */
+result lock_snapshots(int *lockfd, const char *basecacherepo, bool wait) {
+    char path[PATHBUF] = {0};
+
+    UNWRAP(cache_path(path, basecacherepo, SNAPSHOTSDIR))
+    UNWRAP(make_dirs(path))
+    UNWRAP(cache_path(path, basecacherepo, SYNC_LOCK))
+
+    UNWRAP_NEG(*lockfd =
+                   open(path, O_CREAT | O_RDWR | O_CLOEXEC, LOCK_MODE))
+
+    if (flock(*lockfd, wait ? LOCK_EX : LOCK_EX | LOCK_NB)) {
+        int flock_err = errno;
+
+        close(*lockfd);
+        if (flock_err == EWOULDBLOCK)
+            ERROR(ERR_SYNC_BUSY)
+        ERROR(ERR_SYS)
+    }
+    RET_OK()
+}
+
+void unlock_snapshots(int lockfd) {
+    close(lockfd);
+}
+
+static result copy_file_at(int srcdirfd, int dstdirfd, const char *name) {
+    struct stat st;
+    size_t copied;
+    int srcfd, dstfd;
+    ZIC_RESULT_INIT()
+
+    UNWRAP_NEG(srcfd = openat(srcdirfd, name, O_RDONLY | O_CLOEXEC))
+    TRY_NEG(fstat(srcfd, &st), DO_CLEAN_ALL())
+    TRY_NEG(dstfd = openat(dstdirfd, name,
+                           O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC,
+                           st.st_mode & ~S_IFMT),
+            DO_CLEAN_ALL())
+
+    ZIC_RESULT = copy_fd(dstfd, srcfd, &copied);
+    close(dstfd);
+
+    CLEANUP_ALL(close(srcfd));
+    ZIC_RETURN_RESULT()
+}
+
+static result link_tree(int srcfd, int dstfd, enum stage_mode mode);
+
+static result link_subdir(int srcdirfd, int dstdirfd, const char *name,
+                          mode_t dirmode, enum stage_mode mode) {
+    int srcfd, dstfd;
+    ZIC_RESULT_INIT()
+
+    if (mode == STAGE_LINK && IS_OK(strcmp(name, GIT_NAME)))
+        mode = STAGE_COPY;
+    else if (mode == STAGE_COPY && IS_OK(strcmp(name, GIT_OBJECTS_NAME)))
+        mode = STAGE_LINK;
+
+    UNWRAP_NEG(mkdirat(dstdirfd, name, dirmode & ~S_IFMT))
+    UNWRAP_NEG(dstfd = openat(dstdirfd, name,
+                              O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+    TRY_NEG(srcfd = openat(srcdirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+            DO_CLEAN_ALL())
+
+    /* link_tree closes srcfd along with its directory stream */
+    ZIC_RESULT = link_tree(srcfd, dstfd, mode);
+
+    CLEANUP_ALL(close(dstfd));
+    ZIC_RETURN_RESULT()
+}
+
+static result link_entry(int srcfd, int dstfd, const char *name,
+                         enum stage_mode mode) {
+    char target[PATHBUF] = {0};
+    struct stat st;
+    ssize_t target_len;
+
+    UNWRAP_NEG(fstatat(srcfd, name, &st, AT_SYMLINK_NOFOLLOW))
+
+    if (S_ISDIR(st.st_mode))
+        return link_subdir(srcfd, dstfd, name, st.st_mode, mode);
+
+    if (S_ISLNK(st.st_mode)) {
+        UNWRAP_NEG(target_len =
+                       readlinkat(srcfd, name, target, sizeof(target) - 1))
+        target[target_len] = ASCNULL;
+        UNWRAP_NEG(symlinkat(target, dstfd, name))
+        RET_OK()
+    }
+
+    if (!S_ISREG(st.st_mode))
+        RET_OK()
+
+    if (mode == STAGE_COPY)
+        return copy_file_at(srcfd, dstfd, name);
+
+    UNWRAP_NEG(linkat(srcfd, name, dstfd, name, 0))
+    RET_OK()
+}
+
+static result link_tree(int srcfd, int dstfd, enum stage_mode mode) {
+    struct dirent *ent;
+    DIR *dir = NULL;
+    ZIC_RESULT_INIT()
+
+    if (!(dir = fdopendir(srcfd))) {
+        close(srcfd);
+        ERROR(ERR_SYS)
+    }
+
+    while ((ent = readdir(dir))) {
+        if (IS_OK(strcmp(ent->d_name, ".")) ||
+            IS_OK(strcmp(ent->d_name, "..")))
+            continue;
+
+        UNWRAP_DO_CLEAN_ALL(link_entry(dirfd(dir), dstfd, ent->d_name, mode))
+    }
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(closedir(dir));
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * The directory a new snapshot starts from: the published snapshot, or
+ * the cache directory itself for a mirror synced before snapshots.
+ */
+static result published_dir(char *buf, const char *basecacherepo) {
+    char current[PATHBUF] = {0};
+
+    UNWRAP(cache_path(current, basecacherepo, CURRENT_SNAPSHOT))
+
+    if (!realpath(current, buf)) {
+        if (errno != ENOENT)
+            ERROR(ERR_SYS)
+
+        return cache_path(buf, basecacherepo, "");
+    }
+
+    if (strlcat(buf, "/", PATHBUF) >= PATHBUF)
+        ERROR(ERR_LOCAL)
+    RET_OK()
+}
+
+static result stage_dir(const char *srcroot, int stagefd, const char *name) {
+    char srcpath[PATHBUF] = {0};
+    struct stat st;
+    int srcfd;
+    ZIC_RESULT_INIT()
+
+    snprintf(srcpath, sizeof(srcpath), "%s%s", srcroot, name);
+    if (stat(srcpath, &st)) {
+        if (errno == ENOENT)
+            RET_OK()
+        ERROR(ERR_SYS)
+    }
+
+    UNWRAP_NEG(srcfd = open(srcroot, O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+    ZIC_RESULT = link_subdir(srcfd, stagefd, name, st.st_mode, STAGE_LINK);
+    close(srcfd);
+    ZIC_RETURN_RESULT()
+}
+
+/*
+ * Makes a new snapshot out of hard links to the published one, for sync
+ * to update in place of the mirror.
+ */
+result stage_snapshot(struct snapshot_stage *stage, const char *basecacherepo) {
+    char srcroot[PATHBUF] = {0};
+    char lockpath[PATHBUF] = {0};
+    int stagefd, lockfd;
+    ZIC_RESULT_INIT()
+
+    memset(stage, 0, sizeof(*stage));
+
+    UNWRAP(published_dir(srcroot, basecacherepo))
+    UNWRAP(cache_path(stage->dir, basecacherepo,
+                      SNAPSHOTSDIR SNAPSHOT_TEMPLATE))
+    UNWRAP_PTR(mkdtemp(stage->dir))
+
+    if (snprintf(lockpath, sizeof(lockpath), "%s/%s", stage->dir,
+                 READERS_LOCK) >= (int)sizeof(lockpath))
+        ERROR_DO_CLEAN(ERR_LOCAL, DO_CLEAN(cl_dir))
+    TRY_NEG(lockfd = open(lockpath, O_CREAT | O_WRONLY | O_CLOEXEC, LOCK_MODE),
+            DO_CLEAN(cl_dir))
+    close(lockfd);
+
+    TRY_NEG(stagefd = open(stage->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+            DO_CLEAN(cl_dir))
+
+    for (size_t i = 0; i < sizeof(compat_links) / sizeof(*compat_links); i++) {
+        UNWRAP_DO_CLEAN_ALL(stage_dir(srcroot, stagefd, compat_links[i][0]))
+    }
+
+    ZIC_RESULT = spappend(&stage->basecacherepo, stage->dir, "/" MIRRORDIR);
+
+    CLEANUP_ALL(close(stagefd));
+    CLEANUP(cl_dir, if (ZIC_RESULT) remove_tree(stage->dir));
+    ZIC_RETURN_RESULT()
+}
+
+static result replace_link(const char *target, const char *linkpath) {
+    char tmppath[PATHBUF] = {0};
+
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", linkpath, (int)getpid());
+    unlink(tmppath);
+
+    UNWRAP_NEG(symlink(target, tmppath))
+    if (rename(tmppath, linkpath)) {
+        unlink(tmppath);
+        ERROR(ERR_SYS)
+    }
+    RET_OK()
+}
+
+/*
+ * Turns a directory left from before snapshots into a link through
+ * 'current'. The directory is moved into a snapshot of its own to be
+ * retired.
+ */
+static result link_compat(const char *basecacherepo, const char *name,
+                          const char *target) {
+    char linkpath[PATHBUF] = {0};
+    char retired[PATHBUF] = {0};
+    struct stat st;
+
+    UNWRAP(cache_path(linkpath, basecacherepo, name))
+
+    if (IS_OK(lstat(linkpath, &st)) && S_ISLNK(st.st_mode))
+        RET_OK()
+
+    if (IS_OK(lstat(linkpath, &st))) {
+        UNWRAP(cache_path(retired, basecacherepo,
+                          SNAPSHOTSDIR SNAPSHOT_TEMPLATE))
+        UNWRAP_PTR(mkdtemp(retired))
+        UNWRAP(bufpappend(retired, "/"))
+        UNWRAP(bufpappend(retired, name))
+        UNWRAP_NEG(rename(linkpath, retired))
+    } else if (errno != ENOENT) {
+        ERROR(ERR_SYS)
+    }
+
+    return replace_link(target, linkpath);
+}
+
+/*
+ * Publishes the staged snapshot with a single rename of 'current'.
+ * Processes that pinned the previous one keep reading it.
+ */
+result publish_snapshot(struct snapshot_stage *stage,
+                        const char *basecacherepo) {
+    char current[PATHBUF] = {0};
+    char target[PATHBUF] = {0};
+
+    UNWRAP(cache_path(current, basecacherepo, CURRENT_SNAPSHOT))
+    snprintf(target, sizeof(target), "%s%s", SNAPSHOTSDIR,
+             basename(stage->dir));
+
+    UNWRAP(replace_link(target, current))
+    stage->published = true;
+
+    for (size_t i = 0; i < sizeof(compat_links) / sizeof(*compat_links); i++) {
+        UNWRAP(link_compat(basecacherepo, compat_links[i][0],
+                           compat_links[i][1]))
+    }
+    RET_OK()
+}
+
+void drop_snapshot_stage(struct snapshot_stage *stage) {
+    if (!stage->published && *stage->dir)
+        remove_tree(stage->dir);
+
+    free(stage->basecacherepo);
+    stage->basecacherepo = NULL;
+}
+
+/*
+ * Deletes the snapshots no process has pinned, but the published one.
+ * The readers lock is unlinked under the exclusive lock, so a process
+ * that pins the snapshot meanwhile finds it retired and pins again.
+ */
+void retire_snapshots(const char *basecacherepo) {
+    char current[PATHBUF] = {0};
+    char snapsdir[PATHBUF] = {0};
+    char path[PATHBUF] = {0};
+    const char *published = "";
+    struct dirent *ent;
+    DIR *dir;
+
+    if (cache_path(snapsdir, basecacherepo, SNAPSHOTSDIR) ||
+        cache_path(path, basecacherepo, CURRENT_SNAPSHOT))
+        return;
+
+    if (realpath(path, current))
+        published = basename(current);
+
+    if (!(dir = opendir(snapsdir)))
+        return;
+
+    while ((ent = readdir(dir))) {
+        int lockfd;
+
+        if (IS_OK(strcmp(ent->d_name, ".")) ||
+            IS_OK(strcmp(ent->d_name, "..")) ||
+            IS_OK(strcmp(ent->d_name, published)))
+            continue;
+
+        if (snprintf(path, sizeof(path), "%s%s/%s", snapsdir, ent->d_name,
+                     READERS_LOCK) >= (int)sizeof(path))
+            continue;
+
+        if ((lockfd = open(path, O_RDONLY | O_CLOEXEC)) >= 0) {
+            if (flock(lockfd, LOCK_EX | LOCK_NB)) {
+                close(lockfd);
+                continue;
+            }
+            unlink(path);
+            close(lockfd);
+        }
+
+        if (snprintf(path, sizeof(path), "%s%s", snapsdir, ent->d_name) <
+            (int)sizeof(path))
+            remove_tree(path);
+    }
+
+    closedir(dir);
+}
+
+static int remove_cb(const char *fpath, const struct stat *sb, int typeflag,
+                     struct FTW *ftwbuf) {
+    if (remove(fpath))
+        perror(fpath);
+
+    return OK;
+}
+
+int remove_tree(const char *path) {
+    return nftw(path, remove_cb, 64, FTW_DEPTH | FTW_PHYS);
+}
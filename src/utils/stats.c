@@ -0,0 +1,162 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "def.h"
+#include "utils/stats.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000.0
+
+bool stats_enabled;
+
+struct phase_stats {
+    uint64_t calls;
+    uint64_t elapsed;
+};
+
+struct busy_stats {
+    uint64_t threads;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+static struct phase_stats phases[STATS_PHASE_CNT];
+static uint64_t counters[STATS_COUNTER_CNT];
+static struct busy_stats busy;
+static pthread_mutex_t busy_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t started;
+
+static const char *const phase_names[STATS_PHASE_CNT] = {
+    "resolve", "parse", "index open", "index lookup",
+    "readdir", "read", "match", "output"};
+
+static const char *const counter_names[STATS_COUNTER_CNT] = {
+    "dirs visited", "files opened", "bytes read", "bytes written",
+    "matches", "allocations"};
+
+uint64_t
+stats_clock(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+static bool
+stats_env_enabled(void) {
+    const char *env = getenv(STATS_ENV);
+
+    return env && *env && strcmp(env, "0");
+}
+
+/*
+ * --stats is accepted anywhere on the command line, so it is taken out
+ * of argv before the commands parse their own options.
+ */
+void
+stats_init(int *argc, char **argv) {
+    int kept = 0;
+
+    stats_enabled = stats_env_enabled();
+
+    for (int i = 0; i < *argc; i++) {
+        if (i && IS_OK(strcmp(argv[i], STATS_ARG))) {
+            stats_enabled = true;
+            continue;
+        }
+        argv[kept++] = argv[i];
+    }
+
+    argv[kept] = NULL;
+    *argc = kept;
+
+    if (stats_enabled)
+        started = stats_clock();
+}
+
+void
+stats_add_time(enum stats_phase phase, uint64_t elapsed) {
+    __atomic_fetch_add(&phases[phase].calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&phases[phase].elapsed, elapsed, __ATOMIC_RELAXED);
+}
+
+void
+stats_add(enum stats_counter counter, uint64_t n) {
+    __atomic_fetch_add(counters + counter, n, __ATOMIC_RELAXED);
+}
+
+void
+stats_add_busy(uint64_t elapsed) {
+    if (!stats_enabled)
+        return;
+
+    pthread_mutex_lock(&busy_lock);
+    if (!busy.threads || elapsed < busy.min)
+        busy.min = elapsed;
+    if (elapsed > busy.max)
+        busy.max = elapsed;
+
+    busy.total += elapsed;
+    busy.threads++;
+    pthread_mutex_unlock(&busy_lock);
+}
+
+static double
+msec(uint64_t nsec) {
+    return nsec / NSEC_PER_MSEC;
+}
+
+void
+stats_report(void) {
+    struct rusage usage = {0};
+
+    if (!stats_enabled)
+        return;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "spmn stats: %.3f ms wall, %ld KiB max rss\n",
+            msec(stats_clock() - started), usage.ru_maxrss);
+
+    for (size_t p = 0; p < STATS_PHASE_CNT; p++) {
+        if (!phases[p].calls)
+            continue;
+
+        fprintf(stderr, "  %-14s %10.3f ms %10lu calls\n", phase_names[p],
+                msec(phases[p].elapsed), (unsigned long)phases[p].calls);
+    }
+
+    for (size_t c = 0; c < STATS_COUNTER_CNT; c++) {
+        fprintf(stderr, "  %-14s %10lu\n", counter_names[c],
+                (unsigned long)counters[c]);
+    }
+
+    if (busy.threads) {
+        fprintf(stderr, "  %-14s %10.3f ms %10lu threads, "
+                "min %.3f ms, max %.3f ms\n", "worker busy",
+                msec(busy.total), (unsigned long)busy.threads,
+                msec(busy.min), msec(busy.max));
+    }
+}
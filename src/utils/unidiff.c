@@ -0,0 +1,652 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "def.h"
+#include "utils/fileutils.h"
+#include "utils/growbuf.h"
+#include "utils/unidiff.h"
+
+#define OLD_HEADER "--- "
+#define NEW_HEADER "+++ "
+#define HUNK_HEADER "@@ -"
+#define NO_NEWLINE_MARKER '\\'
+#define ITEMS_INIT_CAP 16
+#define OCTAL_ESCAPE_LEN 3
+
+struct text_span {
+    const char *text;
+    size_t len;
+};
+
+/*
+ * The lines of the text being patched and the side of a hunk that has
+ * to be found in them.
+ */
+struct hunk_search {
+    const struct text_span *lines;
+    size_t line_cnt;
+    const struct text_span *pattern;
+    size_t pat_cnt;
+    size_t prefix_ctx;
+    size_t suffix_ctx;
+};
+
+static const char *
+line_end(const char *line, const char *end) {
+    const char *eol = memchr(line, '\n', end - line);
+    return eol ? eol + 1 : end;
+}
+
+static bool
+starts_with(const char *line, const char *end, const char *prefix) {
+    size_t len = strlen(prefix);
+
+    return (size_t)(end - line) >= len && IS_OK(memcmp(line, prefix, len));
+}
+
+static result
+reserve_items(void **items, size_t *cap, size_t cnt, size_t size) {
+    size_t newcap;
+    void *newitems = NULL;
+
+    if (cnt < *cap)
+        RET_OK()
+
+    newcap = *cap ? *cap * 2 : ITEMS_INIT_CAP;
+    UNWRAP_PTR (newitems = realloc(*items, newcap * size))
+
+    *items = newitems;
+    *cap = newcap;
+    RET_OK()
+}
+
+static size_t
+unquote_char(const char **pos, const char *end) {
+    const char *c = *pos;
+    size_t val = 0, digits = 0;
+
+    switch (*c) {
+    case 'n':
+        val = '\n';
+        break;
+    case 't':
+        val = '\t';
+        break;
+    default:
+        for (; digits < OCTAL_ESCAPE_LEN && c + digits < end &&
+               c[digits] >= '0' && c[digits] <= '7'; digits++) {
+            val = val * 8 + (c[digits] - '0');
+        }
+
+        if (!digits)
+            val = (unsigned char)*c;
+        else
+            c += digits - 1;
+    }
+
+    *pos = c;
+    return val;
+}
+
+/*
+ * A name runs up to the tab before a timestamp, or to the end of the
+ * line. Git quotes names with unusual characters in them C style.
+ */
+static result
+parse_name(const char *name, const char *end, char **parsed) {
+    const char *stop = memchr(name, '\t', end - name);
+    char *out = NULL;
+    size_t len = 0;
+
+    if (!stop)
+        stop = end;
+
+    while (stop > name && (stop[-1] == '\n' || stop[-1] == '\r' ||
+                           stop[-1] == ' '))
+        stop--;
+
+    UNWRAP_PTR (out = malloc(stop - name + 1))
+
+    if (name < stop && *name == '"') {
+        for (const char *c = name + 1; c < stop && *c != '"'; c++) {
+            if (*c == '\\' && c + 1 < stop) {
+                c++;
+                out[len++] = (char)unquote_char(&c, stop);
+            } else {
+                out[len++] = *c;
+            }
+        }
+    } else {
+        len = stop - name;
+        memcpy(out, name, len);
+    }
+
+    out[len] = ASCNULL;
+
+    if (IS_OK(strcmp(out, DEVNULL_NAME))) {
+        free(out);
+        out = NULL;
+    }
+
+    *parsed = out;
+    RET_OK()
+}
+
+static bool
+parse_number(const char **pos, const char *end, size_t *num) {
+    const char *c = *pos;
+
+    for (*num = 0; c < end && *c >= '0' && *c <= '9'; c++)
+        *num = *num * 10 + (*c - '0');
+
+    if (c == *pos)
+        return false;
+
+    *pos = c;
+    return true;
+}
+
+static bool
+parse_range(const char **pos, const char *end, char sign, size_t *start,
+            size_t *cnt) {
+    const char *c = *pos;
+
+    if (c >= end || *c++ != sign || !parse_number(&c, end, start))
+        return false;
+
+    *cnt = 1;
+    if (c < end && *c == ',') {
+        c++;
+        if (!parse_number(&c, end, cnt))
+            return false;
+    }
+
+    *pos = c;
+    return true;
+}
+
+static void
+count_context(const struct unidiff *diff, struct diff_hunk *hunk) {
+    const struct diff_line *lines = diff->lines + hunk->first_line;
+
+    while (hunk->prefix_ctx < hunk->line_cnt &&
+           lines[hunk->prefix_ctx].op == ' ')
+        hunk->prefix_ctx++;
+
+    while (hunk->suffix_ctx < hunk->line_cnt - hunk->prefix_ctx &&
+           lines[hunk->line_cnt - hunk->suffix_ctx - 1].op == ' ')
+        hunk->suffix_ctx++;
+}
+
+static result
+parse_hunk(struct unidiff *diff, const char **pos, const char *end) {
+    const char *line = *pos + strlen(HUNK_HEADER) - 1;
+    const char *next = line_end(*pos, end);
+    struct diff_hunk *hunk = NULL;
+    size_t old_left, new_left;
+    void *items = diff->hunks;
+
+    UNWRAP (reserve_items(&items, &diff->hunk_cap, diff->hunk_cnt,
+                          sizeof(*diff->hunks)))
+    diff->hunks = items;
+
+    hunk = diff->hunks + diff->hunk_cnt;
+    memset(hunk, 0, sizeof(*hunk));
+
+    if (!parse_range(&line, next, '-', &hunk->old_start, &hunk->old_cnt) ||
+        line >= next || *line++ != ' ' ||
+        !parse_range(&line, next, '+', &hunk->new_start, &hunk->new_cnt))
+        ERROR(ERR_BAD_DIFF)
+
+    hunk->first_line = diff->line_cnt;
+    old_left = hunk->old_cnt;
+    new_left = hunk->new_cnt;
+
+    for (line = next; line < end && (old_left || new_left ||
+                                     *line == NO_NEWLINE_MARKER); line = next) {
+        struct diff_line *dline = NULL;
+
+        next = line_end(line, end);
+
+        if (*line == NO_NEWLINE_MARKER) {
+            if (diff->line_cnt > hunk->first_line) {
+                dline = diff->lines + diff->line_cnt - 1;
+
+                if (dline->len && dline->text[dline->len - 1] == '\n')
+                    dline->len--;
+            }
+            continue;
+        }
+
+        items = diff->lines;
+        UNWRAP (reserve_items(&items, &diff->line_cap, diff->line_cnt,
+                              sizeof(*diff->lines)))
+        diff->lines = items;
+
+        dline = diff->lines + diff->line_cnt;
+        dline->op = *line;
+        dline->text = line + 1;
+        dline->len = next - line - 1;
+
+        /* editors strip the space off empty context lines */
+        if (*line == '\n') {
+            dline->op = ' ';
+            dline->text = line;
+            dline->len = next - line;
+        }
+
+        switch (dline->op) {
+        case ' ':
+            if (!old_left || !new_left)
+                ERROR(ERR_BAD_DIFF)
+            old_left--;
+            new_left--;
+            break;
+        case '-':
+            if (!old_left)
+                ERROR(ERR_BAD_DIFF)
+            old_left--;
+            break;
+        case '+':
+            if (!new_left)
+                ERROR(ERR_BAD_DIFF)
+            new_left--;
+            break;
+        default:
+            ERROR(ERR_BAD_DIFF)
+        }
+
+        diff->line_cnt++;
+    }
+
+    if (old_left || new_left)
+        ERROR(ERR_BAD_DIFF)
+
+    hunk->line_cnt = diff->line_cnt - hunk->first_line;
+    count_context(diff, hunk);
+
+    diff->hunk_cnt++;
+    *pos = line;
+    RET_OK()
+}
+
+static result
+parse_file(struct unidiff *diff, const char **pos, const char *end) {
+    const char *line = *pos, *next = line_end(line, end);
+    struct diff_file *file = NULL;
+    void *items = diff->files;
+
+    UNWRAP (reserve_items(&items, &diff->file_cap, diff->file_cnt,
+                          sizeof(*diff->files)))
+    diff->files = items;
+
+    file = diff->files + diff->file_cnt++;
+    memset(file, 0, sizeof(*file));
+
+    UNWRAP (parse_name(line + strlen(OLD_HEADER), next, &file->old_name))
+
+    line = next;
+    next = line_end(line, end);
+    UNWRAP (parse_name(line + strlen(NEW_HEADER), next, &file->new_name))
+
+    if (!file->old_name && !file->new_name)
+        ERROR(ERR_BAD_DIFF)
+
+    file->first_hunk = diff->hunk_cnt;
+    for (line = next; starts_with(line, end, HUNK_HEADER);)
+        UNWRAP (parse_hunk(diff, &line, end))
+
+    file->hunk_cnt = diff->hunk_cnt - file->first_hunk;
+    *pos = line;
+    RET_OK()
+}
+
+/*
+ * Anything outside of a '---'/'+++' section and its hunks, like the
+ * commit message and 'diff --git' or 'index' lines, is skipped.
+ */
+static result
+parse_sections(struct unidiff *diff, const char *text, size_t len) {
+    const char *line = text, *end = text + len;
+
+    while (line < end) {
+        const char *next = line_end(line, end);
+
+        if (starts_with(line, end, OLD_HEADER) &&
+            starts_with(next, end, NEW_HEADER)) {
+            UNWRAP (parse_file(diff, &line, end))
+            continue;
+        }
+
+        line = next;
+    }
+
+    if (!diff->hunk_cnt)
+        ERROR(ERR_BAD_DIFF)
+
+    RET_OK()
+}
+
+result
+parse_unidiff(struct unidiff *diff, const char *text, size_t len) {
+    ZIC_RESULT_INIT()
+
+    memset(diff, 0, sizeof(*diff));
+    TRY (parse_sections(diff, text, len), free_unidiff(diff))
+    RET_OK()
+}
+
+result
+load_unidiff(struct unidiff *diff, const char *path) {
+    ZIC_RESULT_INIT()
+
+    memset(diff, 0, sizeof(*diff));
+    UNWRAP (map_file(&diff->map, path))
+    TRY (parse_sections(diff, diff->map.data, diff->map.size),
+         free_unidiff(diff))
+    RET_OK()
+}
+
+void
+free_unidiff(struct unidiff *diff) {
+    for (size_t i = 0; i < diff->file_cnt; i++) {
+        free(diff->files[i].old_name);
+        free(diff->files[i].new_name);
+    }
+
+    free(diff->files);
+    free(diff->hunks);
+    free(diff->lines);
+    unmap_file(&diff->map);
+    memset(diff, 0, sizeof(*diff));
+}
+
+static result
+split_lines(const char *text, size_t len, struct text_span **lines,
+            size_t *line_cnt) {
+    const char *line, *end = text + len;
+    size_t cnt = 0;
+
+    for (line = text; line < end; line = line_end(line, end))
+        cnt++;
+
+    UNWRAP_PTR (*lines = calloc(cnt + 1, sizeof(**lines)))
+
+    for (cnt = 0, line = text; line < end; cnt++) {
+        const char *next = line_end(line, end);
+
+        (*lines)[cnt].text = line;
+        (*lines)[cnt].len = next - line;
+        line = next;
+    }
+
+    *line_cnt = cnt;
+    RET_OK()
+}
+
+static size_t
+hunk_side(const struct unidiff *diff, const struct diff_hunk *hunk,
+          char other_op, struct text_span *side) {
+    size_t cnt = 0;
+
+    for (size_t i = 0; i < hunk->line_cnt; i++) {
+        const struct diff_line *dline = diff->lines + hunk->first_line + i;
+
+        if (dline->op == other_op)
+            continue;
+
+        side[cnt].text = dline->text;
+        side[cnt].len = dline->len;
+        cnt++;
+    }
+    return cnt;
+}
+
+/* like GNU patch, a line without a newline differs from one with */
+static bool
+same_line(const struct text_span *a, const struct text_span *b) {
+    return a->len == b->len && IS_OK(memcmp(a->text, b->text, a->len));
+}
+
+static bool
+pattern_matches(const struct hunk_search *search, long at, long prefix_fuzz,
+                long suffix_fuzz) {
+    if (at < 1 || (size_t)at - 1 + search->pat_cnt > search->line_cnt)
+        return false;
+
+    for (long i = prefix_fuzz; i < (long)search->pat_cnt - suffix_fuzz; i++) {
+        if (!same_line(search->lines + at - 1 + i, search->pattern + i))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Finds the 1-based line the hunk goes to, or 0, the way GNU patch does:
+ * the expected line first, then ever further below and above it, but
+ * never above a hunk applied before. A hunk with less context on one
+ * side than on the other is anchored to that end of the file.
+ */
+static long
+locate_hunk(const struct hunk_search *search, long p_first, long first_guess,
+            long last_frozen, size_t fuzz) {
+    long prefix_ctx = search->prefix_ctx, suffix_ctx = search->suffix_ctx;
+    long context = prefix_ctx > suffix_ctx ? prefix_ctx : suffix_ctx;
+    long prefix_fuzz = (long)fuzz + prefix_ctx - context;
+    long suffix_fuzz = (long)fuzz + suffix_ctx - context;
+    long pat_cnt = search->pat_cnt, line_cnt = search->line_cnt;
+    long max_neg = first_guess - last_frozen - 1;
+    long max_pos = line_cnt - first_guess - pat_cnt + 1;
+    long max_offset = max_pos > max_neg ? max_pos : max_neg;
+
+    if (prefix_fuzz < 0 && p_first <= 1) {
+        if (suffix_fuzz < 0 && pat_cnt != line_cnt)
+            return 0;
+
+        if (last_frozen <= 1 && 1 - first_guess <= max_pos &&
+            pattern_matches(search, 1, 0, suffix_fuzz < 0 ? 0 : suffix_fuzz))
+            return 1;
+
+        return 0;
+    }
+
+    if (prefix_fuzz < 0)
+        prefix_fuzz = 0;
+
+    if (suffix_fuzz < 0) {
+        long offset = first_guess - (line_cnt - pat_cnt + 1);
+
+        if (offset <= max_neg &&
+            pattern_matches(search, first_guess - offset, prefix_fuzz, 0))
+            return first_guess - offset;
+
+        return 0;
+    }
+
+    for (long offset = 0; offset <= max_offset; offset++) {
+        if (offset <= max_pos &&
+            pattern_matches(search, first_guess + offset, prefix_fuzz,
+                            suffix_fuzz))
+            return first_guess + offset;
+
+        if (offset && offset <= max_neg &&
+            pattern_matches(search, first_guess - offset, prefix_fuzz,
+                            suffix_fuzz))
+            return first_guess - offset;
+    }
+    return 0;
+}
+
+/* whatever follows a last line without a newline starts a line of its own */
+static result
+emit(struct growbuf *out, const char *text, size_t len) {
+    if (!len)
+        RET_OK()
+
+    if (out->len && out->data[out->len - 1] != '\n')
+        UNWRAP (growbuf_append(out, "\n", 1, NULL))
+
+    return growbuf_append(out, text, len, NULL);
+}
+
+static result
+emit_lines(struct growbuf *out, const struct text_span *lines, size_t from,
+           size_t to) {
+    if (from >= to)
+        RET_OK()
+
+    return emit(out, lines[from].text,
+                lines[to - 1].text + lines[to - 1].len - lines[from].text);
+}
+
+static result
+apply_hunk(const struct unidiff *diff, const struct diff_hunk *hunk,
+           const struct text_span *lines, size_t *cursor,
+           struct growbuf *out) {
+    for (size_t i = 0; i < hunk->line_cnt; i++) {
+        const struct diff_line *dline = diff->lines + hunk->first_line + i;
+
+        switch (dline->op) {
+        case ' ':
+            UNWRAP (emit_lines(out, lines, *cursor, *cursor + 1))
+            (*cursor)++;
+            break;
+        case '-':
+            (*cursor)++;
+            break;
+        default:
+            UNWRAP (emit(out, dline->text, dline->len))
+        }
+    }
+    RET_OK()
+}
+
+static size_t
+max_fuzz(const struct diff_hunk *hunk) {
+    size_t context = hunk->prefix_ctx > hunk->suffix_ctx ?
+        hunk->prefix_ctx : hunk->suffix_ctx;
+
+    return context < MAX_FUZZ ? context : MAX_FUZZ;
+}
+
+static bool
+find_reversed(const struct unidiff *diff, const struct diff_hunk *hunk,
+              const struct hunk_search *search, struct text_span *newside,
+              long in_offset, long last_frozen, size_t fuzz) {
+    struct hunk_search reversed = *search;
+    long n_first;
+
+    reversed.pattern = newside;
+    reversed.pat_cnt = hunk_side(diff, hunk, '-', newside);
+    n_first = hunk->new_start + !reversed.pat_cnt;
+
+    return locate_hunk(&reversed, n_first, n_first + in_offset,
+                       last_frozen, fuzz) != 0;
+}
+
+/*
+ * Applies the hunks of file to text into out. Hunks that cannot be
+ * placed are left out and counted in failed; the result says where
+ * every hunk went.
+ */
+result
+patch_text(const struct unidiff *diff, const struct diff_file *file,
+           const char *text, size_t len, struct growbuf *out,
+           struct hunk_result *results, size_t *failed) {
+    struct text_span *lines = NULL, *oldside = NULL, *newside = NULL;
+    size_t line_cnt = 0, cursor = 0, maxlines = 0;
+    long in_offset = 0, last_frozen = 0, out_delta = 0;
+    ZIC_RESULT_INIT()
+
+    *failed = 0;
+    UNWRAP (split_lines(text, len, &lines, &line_cnt))
+
+    for (size_t h = 0; h < file->hunk_cnt; h++) {
+        if (diff->hunks[file->first_hunk + h].line_cnt > maxlines)
+            maxlines = diff->hunks[file->first_hunk + h].line_cnt;
+    }
+
+    TRY_PTR (oldside = calloc(maxlines + 1, sizeof(*oldside)), DO_CLEAN(cl_lines))
+    TRY_PTR (newside = calloc(maxlines + 1, sizeof(*newside)), DO_CLEAN_ALL())
+
+    for (size_t h = 0; h < file->hunk_cnt; h++) {
+        const struct diff_hunk *hunk = diff->hunks + file->first_hunk + h;
+        struct hunk_result *res = results + h;
+        struct hunk_search search = {
+            .lines = lines, .line_cnt = line_cnt, .pattern = oldside,
+            .prefix_ctx = hunk->prefix_ctx, .suffix_ctx = hunk->suffix_ctx,
+        };
+        long p_first, where = 0;
+        bool reversed = false;
+
+        search.pat_cnt = hunk_side(diff, hunk, '+', oldside);
+        p_first = hunk->old_start + !search.pat_cnt;
+        memset(res, 0, sizeof(*res));
+
+        /*
+         * Like patch(1), a first hunk that fits the file better backwards
+         * than with more fuzz means the diff is already applied.
+         */
+        for (; res->fuzz <= max_fuzz(hunk) && !where && !reversed;
+             res->fuzz++) {
+            where = locate_hunk(&search, p_first, p_first + in_offset,
+                                last_frozen, res->fuzz);
+            if (!where && h == 0)
+                reversed = find_reversed(diff, hunk, &search, newside,
+                                         in_offset, last_frozen, res->fuzz);
+        }
+
+        if (!where && h > 0)
+            reversed = find_reversed(diff, hunk, &search, newside,
+                                     in_offset, last_frozen, 0);
+
+        if (!where) {
+            res->status = reversed ? HUNK_REVERSED : HUNK_FAILED;
+            res->fuzz = 0;
+            res->line = p_first + out_delta;
+            (*failed)++;
+            continue;
+        }
+
+        res->fuzz--;
+        TRY (emit_lines(out, lines, cursor, where - 1), DO_CLEAN_ALL())
+        cursor = where - 1;
+
+        res->status = HUNK_APPLIED;
+        res->line = where + out_delta;
+        res->offset = where - p_first;
+
+        TRY (apply_hunk(diff, hunk, lines, &cursor, out), DO_CLEAN_ALL())
+
+        in_offset = where - p_first;
+        last_frozen = where + search.pat_cnt - 1;
+        out_delta += (long)hunk->new_cnt - (long)hunk->old_cnt;
+    }
+
+    TRY (emit_lines(out, lines, cursor, line_cnt), DO_CLEAN_ALL())
+
+    ZIC_RESULT = OK;
+    CLEANUP_ALL(
+        free(newside);
+        free(oldside));
+    CLEANUP(cl_lines, free(lines));
+    ZIC_RETURN_RESULT()
+}
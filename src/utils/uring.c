@@ -0,0 +1,464 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "def.h"
+#include "utils/growbuf.h"
+#include "utils/stats.h"
+#include "utils/uring.h"
+
+enum file_op {
+    FILE_OPEN,
+    FILE_READ,
+    FILE_CLOSE,
+};
+
+#define FILE_OP_BITS 2
+#define FILE_OP_MASK ((1U << FILE_OP_BITS) - 1)
+#define BATCH_SHIFT 32
+
+/* the ring's user data of a request: batch, slot and operation */
+#define FILE_TAG(batch, slot, op) \
+    ((uint64_t)(batch) << BATCH_SHIFT | (uint64_t)(slot) << FILE_OP_BITS | (op))
+
+static const unsigned char file_ops[] = {
+    IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE,
+};
+
+struct file_slot {
+    size_t file;
+    int fd;
+    int err;
+    size_t len;
+};
+
+/*
+ * Every slot reads into its own URING_READ_SIZE part of buf. A file
+ * that fills it is read to the end into big when it is delivered.
+ */
+struct file_batch {
+    struct file_slot slots[URING_BATCH];
+    size_t cnt;
+    char *buf;
+    struct growbuf big;
+};
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void *
+map_ring(int fd, size_t len, off_t off) {
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, off);
+
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/* kernels before 5.6 have a ring but none of the file operations */
+static bool
+uring_supports_files(const struct uring *ring) {
+    const size_t op_cnt = IORING_OP_LAST;
+    struct io_uring_probe *probe = NULL;
+    bool supported = true;
+
+    probe = calloc(1, sizeof(*probe) + op_cnt * sizeof(*probe->ops));
+    if (!probe)
+        return false;
+
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe,
+                              op_cnt) < 0) {
+        free(probe);
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(file_ops) / sizeof(*file_ops); i++) {
+        if (file_ops[i] > probe->last_op ||
+            !(probe->ops[file_ops[i]].flags & IO_URING_OP_SUPPORTED))
+            supported = false;
+    }
+
+    free(probe);
+    return supported;
+}
+
+/*
+ * ERR_NO_URING when the kernel has no io_uring, or it is disabled, or
+ * it cannot open, read and close files.
+ */
+result
+uring_init(struct uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    char *sq = NULL, *cq = NULL;
+    ZIC_RESULT_INIT()
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0)
+        ERROR(ERR_NO_URING)
+
+    ring->sq_map_len = params.sq_off.array +
+        params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_len > ring->sq_map_len)
+            ring->sq_map_len = ring->cq_map_len;
+        ring->cq_map_len = 0;
+    }
+
+    ring->sq_map = map_ring(ring->fd, ring->sq_map_len, IORING_OFF_SQ_RING);
+    if (!ring->sq_map)
+        ERROR_DO_CLEAN_ALL(ERR_NO_URING)
+
+    ring->cq_map = ring->sq_map;
+    if (ring->cq_map_len) {
+        ring->cq_map = map_ring(ring->fd, ring->cq_map_len,
+                                IORING_OFF_CQ_RING);
+        if (!ring->cq_map)
+            ERROR_DO_CLEAN_ALL(ERR_NO_URING)
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = map_ring(ring->fd, ring->sqes_len, IORING_OFF_SQES);
+    if (!ring->sqes)
+        ERROR_DO_CLEAN_ALL(ERR_NO_URING)
+
+    sq = ring->sq_map;
+    cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    if (!uring_supports_files(ring))
+        ERROR_DO_CLEAN_ALL(ERR_NO_URING)
+
+    RET_OK()
+
+    CLEANUP_ALL(uring_exit(ring));
+    ZIC_RETURN_RESULT()
+}
+
+void
+uring_exit(struct uring *ring) {
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map)
+        munmap(ring->sq_map, ring->sq_map_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static struct io_uring_sqe *
+uring_sqe(struct uring *ring, unsigned char opcode, uint64_t tag) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned idx = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = ring->sqes + idx;
+
+    /* the batches are sized so the ring never fills up */
+    if (ring->sqe_tail - head >= ring->sq_entries)
+        return NULL;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = tag;
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/* submits everything queued and waits for all of the completions */
+static result
+uring_wait(struct uring *ring, unsigned queued,
+           void (*complete)(const struct io_uring_cqe *, void *), void *ctx) {
+    unsigned tail = *ring->sq_tail;
+    unsigned to_submit = ring->sqe_tail - tail;
+    int entered;
+
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    while (queued) {
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != cq_tail && queued; head++, queued--)
+            complete(ring->cqes + (head & *ring->cq_mask), ctx);
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (!queued)
+            break;
+
+        entered = sys_io_uring_enter(ring->fd, to_submit, 1,
+                                     IORING_ENTER_GETEVENTS);
+        if (entered < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                ERROR(ERR_SYS)
+            continue;
+        }
+        to_submit -= (unsigned)entered;
+    }
+
+    RET_OK()
+}
+
+static void
+complete_file_op(const struct io_uring_cqe *cqe, void *ctx) {
+    struct file_batch *batches = ctx;
+    struct file_batch *batch = batches + (cqe->user_data >> BATCH_SHIFT);
+    struct file_slot *slot =
+        batch->slots + ((uint32_t)cqe->user_data >> FILE_OP_BITS);
+
+    switch (cqe->user_data & FILE_OP_MASK) {
+    case FILE_OPEN:
+        if (cqe->res >= 0)
+            slot->fd = cqe->res;
+        else
+            slot->err = -cqe->res;
+        break;
+    case FILE_READ:
+        if (cqe->res >= 0)
+            slot->len = cqe->res;
+        else
+            slot->err = -cqe->res;
+        break;
+    }
+}
+
+/* the slot is free for the next file as soon as its close is queued */
+static unsigned
+queue_closes(struct uring *ring, struct file_batch *batch, unsigned id) {
+    unsigned queued = 0;
+
+    for (size_t s = 0; s < batch->cnt; s++) {
+        struct file_slot *slot = batch->slots + s;
+        struct io_uring_sqe *sqe = NULL;
+
+        if (slot->fd < 0)
+            continue;
+
+        sqe = uring_sqe(ring, IORING_OP_CLOSE, FILE_TAG(id, s, FILE_CLOSE));
+        sqe->fd = slot->fd;
+        slot->fd = -1;
+        queued++;
+    }
+
+    batch->cnt = 0;
+    return queued;
+}
+
+static unsigned
+queue_opens(struct uring *ring, struct file_batch *batch, unsigned id,
+            int dirfd, const char *const *paths, size_t *next, size_t cnt) {
+    for (batch->cnt = 0; batch->cnt < URING_BATCH && *next < cnt;
+         batch->cnt++, (*next)++) {
+        struct file_slot *slot = batch->slots + batch->cnt;
+        struct io_uring_sqe *sqe = NULL;
+
+        memset(slot, 0, sizeof(*slot));
+        slot->file = *next;
+        slot->fd = -1;
+
+        sqe = uring_sqe(ring, IORING_OP_OPENAT,
+                        FILE_TAG(id, batch->cnt, FILE_OPEN));
+        sqe->fd = dirfd;
+        sqe->addr = (uintptr_t)paths[*next];
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+
+    return (unsigned)batch->cnt;
+}
+
+static unsigned
+queue_reads(struct uring *ring, struct file_batch *batch, unsigned id) {
+    unsigned queued = 0;
+
+    for (size_t s = 0; s < batch->cnt; s++) {
+        struct file_slot *slot = batch->slots + s;
+        struct io_uring_sqe *sqe = NULL;
+
+        if (slot->fd < 0)
+            continue;
+
+        sqe = uring_sqe(ring, IORING_OP_READ, FILE_TAG(id, s, FILE_READ));
+        sqe->fd = slot->fd;
+        sqe->addr = (uintptr_t)(batch->buf + s * URING_READ_SIZE);
+        sqe->len = URING_READ_SIZE;
+        queued++;
+    }
+
+    return queued;
+}
+
+/* the slot's part of buf is the head of the file, the rest follows */
+static result
+read_rest(struct file_batch *batch, struct file_slot *slot, const char *head,
+          const char **data) {
+    struct stat st;
+
+    UNWRAP_NEG (fstat(slot->fd, &st))
+
+    batch->big.len = 0;
+    UNWRAP (growbuf_append(&batch->big, head, slot->len, NULL))
+
+    if ((size_t)st.st_size > slot->len)
+        UNWRAP (growbuf_reserve(&batch->big, st.st_size - slot->len))
+
+    while (batch->big.len < (size_t)st.st_size) {
+        ssize_t rres = pread(slot->fd, batch->big.data + batch->big.len,
+                             st.st_size - batch->big.len, batch->big.len);
+
+        UNWRAP_NEG (rres)
+        if (!rres)
+            break;
+
+        batch->big.len += rres;
+    }
+
+    slot->len = batch->big.len;
+    *data = batch->big.data;
+    RET_OK()
+}
+
+static result
+deliver_batch(struct file_batch *batch, file_read_cb cb, void *ctx) {
+    for (size_t s = 0; s < batch->cnt; s++) {
+        struct file_slot *slot = batch->slots + s;
+        const char *data = batch->buf + s * URING_READ_SIZE;
+
+        /* a file that could not be read is skipped, as by map_file */
+        if (slot->err || slot->fd < 0)
+            continue;
+
+        if (slot->len == URING_READ_SIZE)
+            UNWRAP (read_rest(batch, slot, data, &data))
+
+        stats_count(STATS_FILES, 1);
+        stats_count(STATS_BYTES_READ, slot->len);
+        UNWRAP (cb(slot->file, data, slot->len, ctx))
+    }
+
+    RET_OK()
+}
+
+/*
+ * Reads the files at paths, relative to dirfd, and hands each one to cb
+ * in the order of paths. Every round submits in one call the opens of a
+ * batch, the reads of the batch opened the round before and the closes
+ * of the one read before that, so on a cold cache the device has a
+ * batch of requests to order as it likes, and the scan waits on its
+ * throughput rather than on one round trip per file.
+ * Files that cannot be read are skipped. ERR_NO_URING before anything
+ * is read if the ring is not available.
+ */
+result
+uring_read_files(int dirfd, const char *const *paths, size_t cnt,
+                 file_read_cb cb, void *ctx) {
+    struct file_batch *batches = NULL;
+    struct uring ring;
+    result failed = OK;
+    unsigned id = 0, queued;
+    size_t next = 0;
+    ZIC_RESULT_INIT()
+
+    UNWRAP (uring_init(&ring, URING_ENTRIES))
+
+    batches = calloc(2, sizeof(*batches));
+    TRY_PTR (batches, DO_CLEAN(cl_ring))
+
+    for (unsigned b = 0; b < 2; b++) {
+        batches[b].buf = malloc(URING_BATCH * URING_READ_SIZE);
+        TRY_PTR (batches[b].buf, DO_CLEAN_ALL())
+    }
+
+    while (next < cnt || batches[!id].cnt) {
+        struct file_batch *fill = batches + id, *drain = batches + !id;
+        uint64_t start = stats_begin();
+
+        /* once cb failed only the files already open are seen through */
+        if (failed)
+            next = cnt;
+
+        queued = queue_closes(&ring, fill, id);
+        queued += queue_opens(&ring, fill, id, dirfd, paths, &next, cnt);
+        queued += queue_reads(&ring, drain, !id);
+
+        TRY (uring_wait(&ring, queued, &complete_file_op, batches),
+             DO_CLEAN_ALL())
+        stats_end(STATS_READ, start);
+
+        if (!failed)
+            failed = deliver_batch(drain, cb, ctx);
+
+        id = !id;
+    }
+
+    queued = queue_closes(&ring, batches, 0);
+    queued += queue_closes(&ring, batches + 1, 1);
+    TRY (uring_wait(&ring, queued, &complete_file_op, batches),
+         DO_CLEAN_ALL())
+
+    ZIC_RESULT = failed;
+
+    CLEANUP_ALL(
+        for (unsigned b = 0; b < 2; b++) {
+            free(batches[b].buf);
+            growbuf_free(&batches[b].big);
+        }
+        free(batches));
+    CLEANUP(cl_ring, uring_exit(&ring));
+    ZIC_RETURN_RESULT()
+}
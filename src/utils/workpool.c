@@ -0,0 +1,291 @@
+/*
+Copyright 2022 Viacheslav Chepelyk-Kozhin.
+
+This file is part of Suckless Patch Manager (spmn).
+Spmn is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+Spmn is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+spmn. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "def.h"
+#include "utils/stats.h"
+#include "utils/workpool.h"
+
+#define DEQUE_INIT_CAP 64
+
+struct worker {
+    struct workpool *pool;
+    size_t id;
+};
+
+size_t
+online_cpus(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus > 0 ? (size_t)cpus : 1;
+}
+
+result
+workpool_init(struct workpool *pool, size_t worker_cnt) {
+    memset(pool, 0, sizeof(*pool));
+
+    if (worker_cnt == 0)
+        ERROR(ERR_LOCAL)
+
+    pool->deques = calloc(worker_cnt, sizeof(*pool->deques));
+    UNWRAP_PTR (pool->deques)
+
+    for (size_t i = 0; i < worker_cnt; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->fed_cond, NULL);
+    pool->worker_cnt = worker_cnt;
+    RET_OK()
+}
+
+static result
+push_item(struct work_deque *deque, void *item) {
+    if (deque->tail == deque->cap) {
+        size_t newcap = deque->cap ? deque->cap * 2 : DEQUE_INIT_CAP;
+        void **newitems = realloc(deque->items, newcap * sizeof(*newitems));
+
+        UNWRAP_PTR (newitems)
+        deque->items = newitems;
+        deque->cap = newcap;
+    }
+
+    deque->items[deque->tail++] = item;
+    RET_OK()
+}
+
+result
+workpool_push(struct workpool *pool, void *item) {
+    UNWRAP (push_item(pool->deques + (pool->next_push % pool->worker_cnt),
+                      item))
+
+    pool->next_push++;
+    RET_OK()
+}
+
+static bool
+pop_own(struct work_deque *deque, void **item) {
+    bool popped = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        *item = deque->items[--deque->tail];
+        popped = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return popped;
+}
+
+static bool
+steal(struct work_deque *deque, void **item) {
+    bool stolen = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        *item = deque->items[deque->head++];
+        stolen = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return stolen;
+}
+
+static bool
+next_item(struct workpool *pool, size_t id, void **item) {
+    if (pop_own(pool->deques + id, item))
+        return true;
+
+    for (size_t victim = 1; victim < pool->worker_cnt; victim++) {
+        if (steal(pool->deques + ((id + victim) % pool->worker_cnt), item))
+            return true;
+    }
+    return false;
+}
+
+static uint64_t
+run_items(struct workpool *pool, size_t id) {
+    void *item = NULL;
+    uint64_t busy = 0;
+
+    while (next_item(pool, id, &item)) {
+        uint64_t start = stats_begin();
+
+        pool->fn(item, pool->ctx, id);
+        busy += stats_since(start);
+    }
+
+    return busy;
+}
+
+static void *
+run_worker(void *worker_args) {
+    struct worker *worker = worker_args;
+
+    stats_add_busy(run_items(worker->pool, worker->id));
+    return NULL;
+}
+
+/*
+ * Runs the items fed so far, then sleeps until more are fed. The last
+ * pass starts after workpool_finish, when nothing can be fed anymore.
+ */
+static void *
+run_fed_worker(void *worker_args) {
+    struct worker *worker = worker_args;
+    struct workpool *pool = worker->pool;
+    uint64_t busy = 0;
+    size_t seen;
+    bool feeding;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        seen = pool->fed;
+        feeding = pool->feeding;
+        pthread_mutex_unlock(&pool->lock);
+
+        busy += run_items(pool, worker->id);
+        if (!feeding)
+            break;
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->feeding && pool->fed == seen) {
+            pthread_cond_wait(&pool->fed_cond, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    stats_add_busy(busy);
+    return NULL;
+}
+
+static result
+alloc_workers(struct workpool *pool, work_fn fn, void *ctx) {
+    pool->fn = fn;
+    pool->ctx = ctx;
+
+    pool->workers = calloc(pool->worker_cnt, sizeof(*pool->workers));
+    UNWRAP_PTR (pool->workers)
+
+    pool->threads = calloc(pool->worker_cnt, sizeof(*pool->threads));
+    if (!pool->threads) {
+        free(pool->workers);
+        pool->workers = NULL;
+        ERROR(ERR_SYS)
+    }
+
+    for (size_t i = 0; i < pool->worker_cnt; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+    }
+    RET_OK()
+}
+
+static void
+start_workers(struct workpool *pool, size_t first, void *(*run)(void *)) {
+    for (pool->started = first; pool->started < pool->worker_cnt;
+         pool->started++) {
+        if (pthread_create(pool->threads + pool->started, NULL, run,
+                           pool->workers + pool->started))
+            break;
+    }
+}
+
+static void
+join_workers(struct workpool *pool, size_t first) {
+    for (size_t i = first; i < pool->started; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    free(pool->threads);
+    free(pool->workers);
+    pool->threads = NULL;
+    pool->workers = NULL;
+    pool->started = 0;
+}
+
+result
+workpool_run(struct workpool *pool, work_fn fn, void *ctx) {
+    UNWRAP (alloc_workers(pool, fn, ctx))
+
+    start_workers(pool, 1, &run_worker);
+    run_worker(pool->workers);
+    join_workers(pool, 1);
+    RET_OK()
+}
+
+result
+workpool_start(struct workpool *pool, work_fn fn, void *ctx) {
+    UNWRAP (alloc_workers(pool, fn, ctx))
+
+    pool->feeding = true;
+    start_workers(pool, 0, &run_fed_worker);
+
+    if (pool->started == 0) {
+        pool->feeding = false;
+        join_workers(pool, 0);
+        ERROR(ERR_SYS)
+    }
+    RET_OK()
+}
+
+/* the deques of workers that failed to start are stolen from */
+result
+workpool_feed(struct workpool *pool, void *item) {
+    struct work_deque *deque = pool->deques +
+        (pool->next_push % pool->worker_cnt);
+    result pushed;
+
+    pthread_mutex_lock(&deque->lock);
+    pushed = push_item(deque, item);
+    pthread_mutex_unlock(&deque->lock);
+    UNWRAP (pushed)
+
+    pool->next_push++;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fed++;
+    pthread_cond_signal(&pool->fed_cond);
+    pthread_mutex_unlock(&pool->lock);
+    RET_OK()
+}
+
+void
+workpool_finish(struct workpool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->feeding = false;
+    pthread_cond_broadcast(&pool->fed_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    join_workers(pool, 0);
+}
+
+void
+workpool_destroy(struct workpool *pool) {
+    for (size_t i = 0; i < pool->worker_cnt; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->fed_cond);
+    free(pool->deques);
+    memset(pool, 0, sizeof(*pool));
+}